@@ -0,0 +1,57 @@
+/*
+ * bench.hpp
+ * Header file for seer_bench, the statistics and distance kernel benchmarks
+ *
+ * Each benchmark is set up once, with synthetic data, then its run function
+ * is timed over enough iterations to take at least the minimum time. The
+ * iterations are doubled until then, as in Google Benchmark. Results can be
+ * written as a tab separated baseline, and compared against one
+ *
+ */
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Constants
+const double bench_min_time_default = 0.5; // seconds
+const uint64_t bench_max_iterations = 1000000000;
+const unsigned int bench_seed = 1;
+const std::vector<size_t> bench_sample_sizes = {500, 2000, 10000};
+const std::vector<size_t> bench_covariate_widths = {0, 3, 10};
+const std::vector<size_t> bench_distance_sizes = {500, 2000}; // n x n distances at 10k samples is too large
+const size_t bench_distance_kmers = 10000;
+
+// A benchmark. setup makes the data and returns the function to time
+struct benchCase
+{
+   std::string name;
+   std::function<std::function<void()>()> setup;
+};
+
+struct benchResult
+{
+   std::string name;
+   uint64_t iterations;
+   double real_ns; // per iteration
+   double cpu_ns;
+};
+
+// benchMain headers
+benchResult runBenchmark(const benchCase& bench, const double min_time);
+std::vector<benchResult> readBaseline(const std::string& file_name);
+void writeBaseline(const std::string& file_name, const std::vector<benchResult>& results);
+
+// seerBench headers
+void seerBenchmarks(std::vector<benchCase>& benchmarks);
+// kmdsBench headers
+void kmdsBenchmarks(std::vector<benchCase>& benchmarks);
+
+// Stops the compiler optimising away a benchmark's result
+template <class T>
+inline void keepResult(const T& value)
+{
+   asm volatile("" : : "g"(&value) : "memory");
+}
+
@@ -0,0 +1,201 @@
+/*
+ * File: benchMain.cpp
+ *
+ * Times the seer and kmds kernels on synthetic data, optionally comparing
+ * against a baseline from a previous run
+ *
+ */
+
+#include "bench.hpp"
+
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+double cpuSeconds()
+{
+   timespec cpu_time;
+   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_time);
+   return cpu_time.tv_sec + cpu_time.tv_nsec * 1e-9;
+}
+
+// Doubles the iterations until the run takes at least min_time
+benchResult runBenchmark(const benchCase& bench, const double min_time)
+{
+   std::function<void()> run = bench.setup();
+
+   benchResult result;
+   result.name = bench.name;
+   for (uint64_t iterations = 1; ; iterations *= 2)
+   {
+      auto start = std::chrono::steady_clock::now();
+      double start_cpu = cpuSeconds();
+      for (uint64_t i = 0; i < iterations; ++i)
+      {
+         run();
+      }
+      double real = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      double cpu = cpuSeconds() - start_cpu;
+
+      if (real >= min_time || iterations >= bench_max_iterations)
+      {
+         result.iterations = iterations;
+         result.real_ns = real * 1e9 / iterations;
+         result.cpu_ns = cpu * 1e9 / iterations;
+         break;
+      }
+   }
+
+   return result;
+}
+
+// Format is that written by writeBaseline: name, iterations, real and cpu ns
+std::vector<benchResult> readBaseline(const std::string& file_name)
+{
+   std::ifstream baseline_file(file_name.c_str());
+   if (!baseline_file)
+   {
+      throw std::runtime_error("Could not open baseline " + file_name);
+   }
+
+   std::vector<benchResult> baseline;
+   std::string line;
+   while (std::getline(baseline_file, line))
+   {
+      if (line.empty() || line[0] == '#')
+      {
+         continue;
+      }
+
+      std::istringstream fields(line);
+      benchResult result;
+      if (!(fields >> result.name >> result.iterations >> result.real_ns >> result.cpu_ns))
+      {
+         throw std::runtime_error("Could not parse baseline line: " + line);
+      }
+      baseline.push_back(result);
+   }
+
+   return baseline;
+}
+
+void writeBaseline(const std::string& file_name, const std::vector<benchResult>& results)
+{
+   std::ofstream baseline_file(file_name.c_str());
+   if (!baseline_file)
+   {
+      throw std::runtime_error("Could not open " + file_name + " for writing");
+   }
+
+   baseline_file << "#name\titerations\treal_ns\tcpu_ns\n" << std::fixed << std::setprecision(1);
+   for (auto it = results.begin(); it != results.end(); ++it)
+   {
+      baseline_file << it->name << "\t" << it->iterations << "\t" << it->real_ns << "\t" << it->cpu_ns << "\n";
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   po::options_description options("seer_bench options");
+   options.add_options()
+    ("filter", po::value<std::string>()->default_value(".*"), "regex of benchmark names to run")
+    ("min_time", po::value<double>()->default_value(bench_min_time_default), "minimum seconds to run each benchmark for")
+    ("out", po::value<std::string>(), "write results to this file, to use as a baseline")
+    ("baseline", po::value<std::string>(), "compare against results written by a previous --out")
+    ("list", "list the benchmarks and exit")
+    ("help,h", "full help message");
+
+   po::variables_map vm;
+   try
+   {
+      po::store(po::command_line_parser(argc, argv).options(options).run(), vm);
+      po::notify(vm);
+   }
+   catch (po::error& e)
+   {
+      std::cerr << "Error: " << e.what() << "\n\n" << options << std::endl;
+      return 1;
+   }
+   if (vm.count("help"))
+   {
+      std::cerr << options << std::endl;
+      return 0;
+   }
+
+   std::vector<benchCase> benchmarks;
+   seerBenchmarks(benchmarks);
+   kmdsBenchmarks(benchmarks);
+
+   std::map<std::string, benchResult> baseline;
+   if (vm.count("baseline"))
+   {
+      std::vector<benchResult> baseline_results = readBaseline(vm["baseline"].as<std::string>());
+      for (auto it = baseline_results.begin(); it != baseline_results.end(); ++it)
+      {
+         baseline[it->name] = *it;
+      }
+   }
+
+   // Run, printing each result as it finishes
+   std::regex filter(vm["filter"].as<std::string>());
+   const double min_time = vm["min_time"].as<double>();
+   std::vector<benchResult> results;
+
+   std::cout << std::left << std::setw(56) << "benchmark" << std::right << std::setw(16) << "real_ns"
+             << std::setw(16) << "cpu_ns" << std::setw(12) << "iterations";
+   if (!baseline.empty())
+   {
+      std::cout << std::setw(12) << "vs_base";
+   }
+   std::cout << std::endl;
+
+   for (auto it = benchmarks.begin(); it != benchmarks.end(); ++it)
+   {
+      if (!std::regex_search(it->name, filter))
+      {
+         continue;
+      }
+      if (vm.count("list"))
+      {
+         std::cout << it->name << std::endl;
+         continue;
+      }
+
+      benchResult result = runBenchmark(*it, min_time);
+      results.push_back(result);
+
+      std::cout << std::left << std::setw(56) << result.name << std::right << std::fixed << std::setprecision(1)
+                << std::setw(16) << result.real_ns << std::setw(16) << result.cpu_ns
+                << std::setw(12) << result.iterations;
+
+      // Ratio of the time to the baseline's. Above one is slower
+      auto base_it = baseline.find(result.name);
+      if (base_it != baseline.end())
+      {
+         std::cout << std::setw(12) << std::setprecision(3) << result.real_ns / base_it->second.real_ns;
+      }
+      else if (!baseline.empty())
+      {
+         std::cout << std::setw(12) << "new";
+      }
+      std::cout << std::endl;
+   }
+
+   if (vm.count("out"))
+   {
+      writeBaseline(vm["out"].as<std::string>(), results);
+   }
+
+   return 0;
+}
+
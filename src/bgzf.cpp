@@ -0,0 +1,666 @@
+/*
+ * File: bgzf.cpp
+ *
+ * Reads and writes BGZF files, decompressing blocks in parallel
+ *
+ */
+
+#include "bgzf.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+const size_t bgzf_header_size = 18;
+const size_t bgzf_footer_size = 8;
+
+// An empty block marks the end of the file
+const unsigned char bgzf_eof[28] = {
+   0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+   0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+uint16_t readLE16(const char* buf)
+{
+   return (uint16_t)(unsigned char)buf[0] | (uint16_t)(unsigned char)buf[1] << 8;
+}
+
+uint32_t readLE32(const char* buf)
+{
+   return (uint32_t)readLE16(buf) | (uint32_t)readLE16(buf + 2) << 16;
+}
+
+void writeLE(char* buf, uint64_t value, const size_t bytes)
+{
+   for (size_t i = 0; i < bytes; ++i)
+   {
+      buf[i] = (char)(value & 0xff);
+      value >>= 8;
+   }
+}
+
+// Finds the BSIZE field (total block size - 1) in a gzip extra field.
+// Returns -1 if this isn't a BGZF block
+long int bgzfBlockSize(const char* header, const size_t header_length)
+{
+   long int block_size = -1;
+
+   if (header_length >= 12 && (unsigned char)header[0] == 31 && (unsigned char)header[1] == 139
+         && header[2] == 8 && (header[3] & 4))
+   {
+      size_t extra_length = readLE16(header + 10);
+      size_t pos = 12;
+      while (pos + 4 <= 12 + extra_length && pos + 4 <= header_length)
+      {
+         size_t subfield_length = readLE16(header + pos + 2);
+         if (header[pos] == 'B' && header[pos + 1] == 'C' && subfield_length == 2 && pos + 6 <= header_length)
+         {
+            block_size = readLE16(header + pos + 4);
+            break;
+         }
+         pos += 4 + subfield_length;
+      }
+   }
+
+   return block_size;
+}
+
+// Reads the next whole compressed block. Returns 0 at the end of the file
+int readRawBlock(std::istream& file, std::vector<char>& raw)
+{
+   raw.resize(12);
+   file.read(&raw[0], 12);
+   if (file.gcount() == 0)
+   {
+      return 0;
+   }
+   else if (file.gcount() < 12)
+   {
+      throw std::runtime_error("Truncated BGZF block header");
+   }
+
+   size_t extra_length = readLE16(&raw[10]);
+   raw.resize(12 + extra_length);
+   if (!file.read(&raw[12], extra_length))
+   {
+      throw std::runtime_error("Truncated BGZF block header");
+   }
+
+   long int block_size = bgzfBlockSize(&raw[0], raw.size());
+   if (block_size < 0 || (size_t)block_size + 1 < raw.size() + bgzf_footer_size)
+   {
+      throw std::runtime_error("Input is not BGZF compressed");
+   }
+
+   size_t header_length = raw.size();
+   raw.resize(block_size + 1);
+   if (!file.read(&raw[header_length], raw.size() - header_length))
+   {
+      throw std::runtime_error("Truncated BGZF block");
+   }
+
+   return 1;
+}
+
+std::string decompressBlock(const std::vector<char>& raw)
+{
+   size_t header_length = 12 + readLE16(&raw[10]);
+   uint32_t crc = readLE32(&raw[raw.size() - 8]);
+   uint32_t data_length = readLE32(&raw[raw.size() - 4]);
+
+   std::string data(data_length, '\0');
+   if (data_length > 0)
+   {
+      z_stream zs;
+      memset(&zs, 0, sizeof(zs));
+      zs.next_in = (Bytef*)&raw[header_length];
+      zs.avail_in = raw.size() - header_length - bgzf_footer_size;
+      zs.next_out = (Bytef*)&data[0];
+      zs.avail_out = data_length;
+
+      if (inflateInit2(&zs, -15) != Z_OK)
+      {
+         throw std::runtime_error("Could not initialise zlib");
+      }
+      int status = inflate(&zs, Z_FINISH);
+      inflateEnd(&zs);
+
+      if (status != Z_STREAM_END || zs.avail_out != 0
+            || crc32(crc32(0L, Z_NULL, 0), (const Bytef*)data.data(), data_length) != crc)
+      {
+         throw std::runtime_error("Corrupt BGZF block");
+      }
+   }
+
+   return data;
+}
+
+// Block i is decompressed by thread i % threads
+std::vector<std::string> decompressBatch(const std::vector<std::vector<char>> raw_blocks, const unsigned int threads)
+{
+   std::vector<std::string> blocks(raw_blocks.size());
+
+   auto decompressShare = [&](const unsigned int thread_index)
+   {
+      for (size_t i = thread_index; i < raw_blocks.size(); i += threads)
+      {
+         blocks[i] = decompressBlock(raw_blocks[i]);
+      }
+   };
+
+   std::vector<std::future<void>> helpers;
+   for (unsigned int i = 1; i < threads && i < raw_blocks.size(); ++i)
+   {
+      helpers.push_back(std::async(std::launch::async, decompressShare, i));
+   }
+   decompressShare(0);
+
+   for (auto it = helpers.begin(); it != helpers.end(); ++it)
+   {
+      it->get(); // rethrows
+   }
+
+   return blocks;
+}
+
+/*
+ * BgzfReadBuf
+ */
+BgzfReadBuf::BgzfReadBuf()
+   :_threads(1), _offset(0), _block_offset(0), _end_offset(UINT64_MAX), _batch_pos(0), _skip_line(0), _done(1), _last_char('\n')
+{
+}
+
+BgzfReadBuf::~BgzfReadBuf()
+{
+   close();
+}
+
+BgzfReadBuf* BgzfReadBuf::open(const std::string& file_name, const unsigned int threads, const uint64_t start_offset, const uint64_t end_offset)
+{
+   _file.open(file_name.c_str(), std::ios::in | std::ios::binary);
+   if (!_file)
+   {
+      return NULL;
+   }
+
+   _threads = std::max(threads, 1U);
+   _offset = start_offset;
+   _block_offset = start_offset;
+   _end_offset = end_offset;
+   _batch.clear();
+   _batch_offsets.clear();
+   _batch_pos = 0;
+   _done = 0;
+   _last_char = '\n'; // The start of the file is the start of a line
+
+   // Starting part way through, the first line belongs to the previous range
+   // unless the previous block ended a line
+   if (start_offset > 0)
+   {
+      std::vector<uint64_t> offsets = bgzfBlockOffsets(file_name);
+      auto start_block = std::lower_bound(offsets.begin(), offsets.end(), start_offset);
+      if (start_block == offsets.end() || *start_block != start_offset)
+      {
+         throw std::runtime_error("BGZF range does not start on a block in " + file_name);
+      }
+
+      std::vector<char> raw;
+      _file.seekg(*(start_block - 1));
+      readRawBlock(_file, raw);
+
+      std::string previous_block = decompressBlock(raw);
+      if (!previous_block.empty())
+      {
+         _last_char = previous_block.back();
+      }
+
+      _file.seekg(start_offset);
+   }
+   _skip_line = (_last_char != '\n');
+
+   setg(NULL, NULL, NULL);
+   readBatch();
+
+   return this;
+}
+
+void BgzfReadBuf::close()
+{
+   if (_next_batch.valid())
+   {
+      _next_batch.wait();
+   }
+   _batch.clear();
+   _done = 1;
+
+   if (_file.is_open())
+   {
+      _file.close();
+   }
+}
+
+// Reads the next set of blocks, and starts decompressing them in the
+// background. Past the end of the range, blocks are read one at a time until
+// the last line is finished
+void BgzfReadBuf::readBatch()
+{
+   std::vector<std::vector<char>> raw_blocks;
+   _next_offsets.clear();
+
+   size_t batch_size = _offset < _end_offset ? _threads * bgzf_blocks_per_thread : 1;
+   while (raw_blocks.size() < batch_size && (_offset < _end_offset || raw_blocks.empty()))
+   {
+      std::vector<char> raw;
+      if (!readRawBlock(_file, raw))
+      {
+         break;
+      }
+
+      _next_offsets.push_back(_offset);
+      _offset += raw.size();
+      raw_blocks.push_back(std::move(raw));
+   }
+
+   _next_batch = std::async(std::launch::async, decompressBatch, std::move(raw_blocks), _threads);
+}
+
+// Moves the get area on to the next block with any data in the range.
+// Returns 0 when there is none
+int BgzfReadBuf::nextBlock()
+{
+   while (!_done)
+   {
+      if (_batch_pos >= _batch.size())
+      {
+         _batch = _next_batch.get();
+         _batch_offsets = _next_offsets;
+         _batch_pos = 0;
+
+         if (_batch.empty())
+         {
+            _done = 1;
+            break;
+         }
+         readBatch();
+      }
+
+      std::string& block = _batch[_batch_pos];
+      uint64_t block_offset = _batch_offsets[_batch_pos];
+      _batch_pos++;
+
+      if (block.empty())
+      {
+         continue;
+      }
+
+      char* begin = &block[0];
+      char* end = begin + block.size();
+      if (block_offset >= _end_offset)
+      {
+         // Blocks after the range only finish the line which started in it
+         if (_skip_line || _last_char == '\n')
+         {
+            _done = 1;
+            break;
+         }
+
+         char* line_end = (char*)memchr(begin, '\n', end - begin);
+         if (line_end != NULL)
+         {
+            end = line_end + 1;
+            _done = 1;
+         }
+      }
+      else if (_skip_line)
+      {
+         char* line_end = (char*)memchr(begin, '\n', end - begin);
+         if (line_end != NULL)
+         {
+            begin = line_end + 1;
+            _skip_line = 0;
+         }
+         else
+         {
+            begin = end;
+         }
+      }
+      _last_char = block.back();
+
+      if (begin < end)
+      {
+         setg(begin, begin, end);
+         _block_offset = block_offset;
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+int BgzfReadBuf::underflow()
+{
+   if (gptr() < egptr())
+   {
+      return traits_type::to_int_type(*gptr());
+   }
+
+   if (!nextBlock())
+   {
+      return traits_type::eof();
+   }
+
+   return traits_type::to_int_type(*gptr());
+}
+
+/*
+ * BgzfWriteBuf
+ */
+BgzfWriteBuf::BgzfWriteBuf()
+   :_buffer(bgzf_block_size), _compressed(bgzf_max_block), _write_index(0), _compressed_offset(0), _uncompressed_offset(0)
+{
+}
+
+BgzfWriteBuf::~BgzfWriteBuf()
+{
+   close();
+}
+
+BgzfWriteBuf* BgzfWriteBuf::open(const std::string& file_name, const int write_index, const uint64_t append_offset)
+{
+   if (append_offset > 0)
+   {
+      if (write_index)
+      {
+         throw std::runtime_error("Can't continue the .gzi index of " + file_name);
+      }
+      if (truncate(file_name.c_str(), append_offset) != 0)
+      {
+         throw std::runtime_error("Could not cut " + file_name + " back to its checkpointed length");
+      }
+      _file.open(file_name.c_str(), std::ios::out | std::ios::binary | std::ios::app);
+   }
+   else
+   {
+      _file.open(file_name.c_str(), std::ios::out | std::ios::binary);
+   }
+   if (!_file)
+   {
+      return NULL;
+   }
+
+   _file_name = file_name;
+   _write_index = write_index;
+   _compressed_offset = append_offset;
+   _uncompressed_offset = 0;
+   _index.clear();
+   setp(&_buffer[0], &_buffer[0] + _buffer.size());
+
+   return this;
+}
+
+void BgzfWriteBuf::close()
+{
+   if (!_file.is_open())
+   {
+      return;
+   }
+
+   if (pptr() > pbase())
+   {
+      writeBlock(pbase(), pptr() - pbase());
+   }
+   _file.write((const char*)bgzf_eof, sizeof(bgzf_eof));
+   _file.close();
+   setp(NULL, NULL);
+
+   if (_write_index)
+   {
+      std::ofstream index_file((_file_name + bgzf_index_suffix).c_str(), std::ios::out | std::ios::binary);
+
+      char entry[8];
+      writeLE(entry, _index.size() / 2, 8);
+      index_file.write(entry, 8);
+      for (auto it = _index.begin(); it != _index.end(); ++it)
+      {
+         writeLE(entry, *it, 8);
+         index_file.write(entry, 8);
+      }
+   }
+}
+
+int BgzfWriteBuf::overflow(int c)
+{
+   if (!_file.is_open())
+   {
+      return traits_type::eof();
+   }
+
+   writeBlock(pbase(), pptr() - pbase());
+   setp(&_buffer[0], &_buffer[0] + _buffer.size());
+
+   if (!traits_type::eq_int_type(c, traits_type::eof()))
+   {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+   }
+
+   return traits_type::not_eof(c);
+}
+
+uint64_t BgzfWriteBuf::flush_block()
+{
+   if (pptr() > pbase())
+   {
+      writeBlock(pbase(), pptr() - pbase());
+      setp(&_buffer[0], &_buffer[0] + _buffer.size());
+   }
+   _file.flush();
+
+   return _compressed_offset;
+}
+
+int BgzfWriteBuf::sync()
+{
+   return _file.good() ? 0 : -1;
+}
+
+void BgzfWriteBuf::writeBlock(const char* data, const size_t length)
+{
+   if (length == 0)
+   {
+      return;
+   }
+
+   // Index the start of every block but the first
+   if (_compressed_offset > 0)
+   {
+      _index.push_back(_compressed_offset);
+      _index.push_back(_uncompressed_offset);
+   }
+
+   // Compress. If the data doesn't shrink enough to fit, store it
+   size_t compressed_length = 0;
+   int levels[2] = {Z_DEFAULT_COMPRESSION, Z_NO_COMPRESSION};
+   for (unsigned int i = 0; i < 2 && compressed_length == 0; ++i)
+   {
+      z_stream zs;
+      memset(&zs, 0, sizeof(zs));
+      zs.next_in = (Bytef*)data;
+      zs.avail_in = length;
+      zs.next_out = (Bytef*)&_compressed[bgzf_header_size];
+      zs.avail_out = _compressed.size() - bgzf_header_size - bgzf_footer_size;
+
+      if (deflateInit2(&zs, levels[i], Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      {
+         throw std::runtime_error("Could not initialise zlib");
+      }
+      if (deflate(&zs, Z_FINISH) == Z_STREAM_END)
+      {
+         compressed_length = zs.total_out;
+      }
+      deflateEnd(&zs);
+   }
+   if (compressed_length == 0)
+   {
+      throw std::runtime_error("Could not compress BGZF block");
+   }
+
+   size_t block_length = bgzf_header_size + compressed_length + bgzf_footer_size;
+   const unsigned char header[16] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0};
+   memcpy(&_compressed[0], header, sizeof(header));
+   writeLE(&_compressed[16], block_length - 1, 2);
+
+   char* footer = &_compressed[bgzf_header_size + compressed_length];
+   writeLE(footer, crc32(crc32(0L, Z_NULL, 0), (const Bytef*)data, length), 4);
+   writeLE(footer + 4, length, 4);
+
+   _file.write(&_compressed[0], block_length);
+   _compressed_offset += block_length;
+   _uncompressed_offset += length;
+}
+
+/*
+ * Streams
+ */
+DsmStream::DsmStream()
+   :std::istream(&_gz_buf), _use_bgzf(0)
+{
+}
+
+void DsmStream::open(const std::string& file_name, const unsigned int threads, const uint64_t start_offset, const uint64_t end_offset)
+{
+   _use_bgzf = isBgzf(file_name);
+   if (_use_bgzf)
+   {
+      rdbuf(&_bgzf_buf);
+      if (!_bgzf_buf.open(file_name, threads, start_offset, end_offset))
+      {
+         setstate(std::ios::badbit);
+      }
+   }
+   else if (start_offset > 0 || end_offset != UINT64_MAX)
+   {
+      throw std::runtime_error("Can only read part of BGZF compressed files, which " + file_name + " is not");
+   }
+   else
+   {
+      rdbuf(&_gz_buf);
+      if (!_gz_buf.open(file_name.c_str(), std::ios::in))
+      {
+         setstate(std::ios::badbit);
+      }
+   }
+}
+
+void DsmStream::close()
+{
+   if (_use_bgzf)
+   {
+      _bgzf_buf.close();
+   }
+   else
+   {
+      _gz_buf.close();
+   }
+}
+
+BgzfOutStream::BgzfOutStream()
+   :std::ostream(&_buf)
+{
+}
+
+BgzfOutStream::BgzfOutStream(const std::string& file_name, const int write_index)
+   :std::ostream(&_buf)
+{
+   open(file_name, write_index);
+}
+
+void BgzfOutStream::open(const std::string& file_name, const int write_index, const uint64_t append_offset)
+{
+   if (!_buf.open(file_name, write_index, append_offset))
+   {
+      setstate(std::ios::badbit);
+   }
+}
+
+void BgzfOutStream::close()
+{
+   flush();
+   _buf.close();
+}
+
+/*
+ * Functions
+ */
+int isBgzf(const std::string& file_name)
+{
+   std::ifstream file(file_name.c_str(), std::ios::in | std::ios::binary);
+
+   char header[bgzf_header_size];
+   file.read(header, bgzf_header_size);
+
+   return (file.gcount() == (std::streamsize)bgzf_header_size && bgzfBlockSize(header, bgzf_header_size) >= 0);
+}
+
+// Compressed offsets of the start of every block
+std::vector<uint64_t> bgzfBlockOffsets(const std::string& file_name)
+{
+   std::vector<uint64_t> offsets(1, 0);
+
+   struct stat buffer;
+   std::string index_name = file_name + bgzf_index_suffix;
+   if (stat(index_name.c_str(), &buffer) == 0)
+   {
+      std::ifstream index_file(index_name.c_str(), std::ios::in | std::ios::binary);
+
+      char entry[16];
+      index_file.read(entry, 8);
+      uint64_t num_entries = (uint64_t)readLE32(entry) | (uint64_t)readLE32(entry + 4) << 32;
+      for (uint64_t i = 0; i < num_entries && index_file.read(entry, 16); ++i)
+      {
+         offsets.push_back((uint64_t)readLE32(entry) | (uint64_t)readLE32(entry + 4) << 32);
+      }
+   }
+   else
+   {
+      // No index, so step through the block headers
+      std::ifstream file(file_name.c_str(), std::ios::in | std::ios::binary);
+
+      char header[bgzf_header_size];
+      uint64_t offset = 0;
+      while (file.read(header, bgzf_header_size))
+      {
+         long int block_size = bgzfBlockSize(header, bgzf_header_size);
+         if (block_size < 0)
+         {
+            throw std::runtime_error(file_name + " is not BGZF compressed");
+         }
+
+         offset += block_size + 1;
+         file.seekg(offset);
+         offsets.push_back(offset);
+      }
+      if (offsets.size() > 1)
+      {
+         offsets.pop_back(); // End of file
+      }
+   }
+
+   return offsets;
+}
+
+// Splits a file into num_parts ranges, with roughly the same number of blocks
+// in each
+void bgzfRange(const std::string& file_name, const unsigned int part, const unsigned int num_parts, uint64_t& start_offset, uint64_t& end_offset)
+{
+   std::vector<uint64_t> offsets = bgzfBlockOffsets(file_name);
+
+   start_offset = (part == 0) ? 0 : offsets[part * offsets.size() / num_parts];
+   end_offset = (part + 1 >= num_parts) ? UINT64_MAX : offsets[(part + 1) * offsets.size() / num_parts];
+}
+
@@ -0,0 +1,142 @@
+/*
+ * bgzf.hpp
+ * Header file for BGZF (blocked gzip) input and output
+ *
+ * BGZF files are a series of independent gzip members (blocks) of at most
+ * 64Kb, each recording its own compressed size. They are valid gzip, so can
+ * still be read with zcat or gzstream, but blocks can be found without
+ * decompressing and so decompressed in parallel or from any block start.
+ * The .gzi index is as written by bgzip -i: a count, then the compressed and
+ * uncompressed offsets of each block after the first, all little endian
+ * uint64
+ *
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <future>
+
+#include <gzstream.h>
+
+// Constants
+const size_t bgzf_block_size = 0xff00; // Maximum uncompressed data per block
+const size_t bgzf_max_block = 0x10000; // Maximum compressed block, including header
+const unsigned int bgzf_blocks_per_thread = 16; // Read ahead, per decompression thread
+const std::string bgzf_index_suffix = ".gzi";
+
+// Decompresses a BGZF file, optionally only the lines starting in the blocks
+// from start_offset up to (not including) end_offset. Lines are assigned to
+// the range their first character is in, so splitting a file on any block
+// offsets gives each line to exactly one range
+class BgzfReadBuf : public std::streambuf
+{
+   public:
+      BgzfReadBuf();
+      ~BgzfReadBuf();
+
+      BgzfReadBuf* open(const std::string& file_name, const unsigned int threads = 1, const uint64_t start_offset = 0, const uint64_t end_offset = UINT64_MAX);
+      void close();
+      int is_open() const { return _file.is_open(); }
+      uint64_t block_offset() const { return _block_offset; } // of the block being read
+
+   protected:
+      int underflow();
+
+   private:
+      void readBatch();
+      int nextBlock();
+
+      std::ifstream _file;
+      unsigned int _threads;
+      uint64_t _offset; // of the next block to read
+      uint64_t _block_offset;
+      uint64_t _end_offset;
+
+      // Decompressed blocks, and their compressed offsets
+      std::vector<std::string> _batch;
+      std::vector<uint64_t> _batch_offsets;
+      size_t _batch_pos;
+      std::future<std::vector<std::string>> _next_batch;
+      std::vector<uint64_t> _next_offsets;
+
+      int _skip_line; // First line belongs to the previous range
+      int _done;
+      char _last_char;
+};
+
+// Compresses to BGZF, one block at a time. The EOF block, and the .gzi index
+// if requested, are written on close. Opening with an append_offset cuts the
+// file back to that length, which must be the end of a block, and carries on
+// after it (without an index)
+class BgzfWriteBuf : public std::streambuf
+{
+   public:
+      BgzfWriteBuf();
+      ~BgzfWriteBuf();
+
+      BgzfWriteBuf* open(const std::string& file_name, const int write_index = 0, const uint64_t append_offset = 0);
+      void close();
+      int is_open() const { return _file.is_open(); }
+
+      // Ends the current block early and flushes the file. Returns its length,
+      // which can be appended to
+      uint64_t flush_block();
+
+   protected:
+      int overflow(int c);
+      int sync(); // Doesn't split blocks, so there's nothing to do until close
+
+   private:
+      void writeBlock(const char* data, const size_t length);
+
+      std::ofstream _file;
+      std::string _file_name;
+      std::vector<char> _buffer;
+      std::vector<char> _compressed;
+
+      int _write_index;
+      uint64_t _compressed_offset;
+      uint64_t _uncompressed_offset;
+      std::vector<uint64_t> _index;
+};
+
+// Input stream for dsm files. BGZF files are decompressed with a pool of
+// threads; other files (gzipped or not) are read with gzstream
+class DsmStream : public std::istream
+{
+   public:
+      DsmStream();
+
+      void open(const std::string& file_name, const unsigned int threads = 1, const uint64_t start_offset = 0, const uint64_t end_offset = UINT64_MAX);
+      void close();
+      int is_bgzf() const { return _use_bgzf; }
+      uint64_t block_offset() const { return _bgzf_buf.block_offset(); } // BGZF files only
+
+   private:
+      gzstreambuf _gz_buf;
+      BgzfReadBuf _bgzf_buf;
+      int _use_bgzf;
+};
+
+class BgzfOutStream : public std::ostream
+{
+   public:
+      BgzfOutStream();
+      BgzfOutStream(const std::string& file_name, const int write_index = 0);
+
+      void open(const std::string& file_name, const int write_index = 0, const uint64_t append_offset = 0);
+      void close();
+      uint64_t flush_block() { flush(); return _buf.flush_block(); }
+
+   private:
+      BgzfWriteBuf _buf;
+};
+
+// Functions
+int isBgzf(const std::string& file_name);
+std::vector<uint64_t> bgzfBlockOffsets(const std::string& file_name); // Uses the .gzi index if present
+void bgzfRange(const std::string& file_name, const unsigned int part, const unsigned int num_parts, uint64_t& start_offset, uint64_t& end_offset);
+
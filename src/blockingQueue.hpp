@@ -0,0 +1,192 @@
+/*
+ * blockingQueue.hpp
+ * Thread safe queues used to pass k-mers between the reader, worker and
+ * writer threads
+ *
+ */
+
+#include <queue>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+// Bounded FIFO. push blocks while full, pop blocks while empty. Once closed
+// pop drains what is left then returns false. try_pop never blocks
+template <class T>
+class BlockingQueue
+{
+   public:
+      BlockingQueue(const size_t max_size)
+         : _max_size(max_size), _closed(0)
+      {
+      }
+
+      void push(T item)
+      {
+         std::unique_lock<std::mutex> lock(_mtx);
+         _not_full.wait(lock, [this]{ return _queue.size() < _max_size; });
+
+         _queue.push(std::move(item));
+         _not_empty.notify_one();
+      }
+
+      bool pop(T& item)
+      {
+         std::unique_lock<std::mutex> lock(_mtx);
+         _not_empty.wait(lock, [this]{ return !_queue.empty() || _closed; });
+
+         if (_queue.empty())
+         {
+            return false;
+         }
+
+         item = std::move(_queue.front());
+         _queue.pop();
+         _not_full.notify_one();
+
+         return true;
+      }
+
+      // As pop, but returns false rather than waiting if empty
+      bool try_pop(T& item)
+      {
+         std::lock_guard<std::mutex> lock(_mtx);
+         if (_queue.empty())
+         {
+            return false;
+         }
+
+         item = std::move(_queue.front());
+         _queue.pop();
+         _not_full.notify_one();
+
+         return true;
+      }
+
+      void close()
+      {
+         std::lock_guard<std::mutex> lock(_mtx);
+         _closed = 1;
+         _not_empty.notify_all();
+      }
+
+   private:
+      std::queue<T> _queue;
+      size_t _max_size;
+      int _closed;
+
+      std::mutex _mtx;
+      std::condition_variable _not_empty;
+      std::condition_variable _not_full;
+};
+
+// Accepts items tagged with their position in the input (0, 1, 2...) in any
+// order, and gives them back in input order.
+// push blocks while the item is more than window places ahead of the next
+// one due out, which bounds memory use with a slow item at the head. The
+// head item is always accepted, so as long as items are handed to producers
+// in order this cannot deadlock.
+// Each producer calls done() when it has no more items; pop returns false
+// once all producers are done and everything has been given back
+template <class T>
+class ReorderBuffer
+{
+   public:
+      ReorderBuffer(const size_t window, const unsigned int num_producers)
+         : _window(window), _producers(num_producers), _next(0)
+      {
+      }
+
+      void push(const long int order, T item)
+      {
+         std::unique_lock<std::mutex> lock(_mtx);
+         _space.wait(lock, [this, order]{ return order < _next + (long int)_window; });
+
+         _buffer.insert(std::make_pair(order, std::move(item)));
+         if (order == _next)
+         {
+            _ready.notify_one();
+         }
+      }
+
+      bool pop(T& item)
+      {
+         std::unique_lock<std::mutex> lock(_mtx);
+         _ready.wait(lock, [this]{ return _buffer.count(_next) || _producers == 0; });
+
+         auto head = _buffer.find(_next);
+         if (head == _buffer.end())
+         {
+            return false;
+         }
+
+         item = std::move(head->second);
+         _buffer.erase(head);
+         ++_next;
+         _space.notify_all();
+
+         return true;
+      }
+
+      void done()
+      {
+         std::lock_guard<std::mutex> lock(_mtx);
+         --_producers;
+         _ready.notify_one();
+      }
+
+   private:
+      std::map<long int, T> _buffer;
+      size_t _window;
+      unsigned int _producers;
+      long int _next;
+
+      std::mutex _mtx;
+      std::condition_variable _ready;
+      std::condition_variable _space;
+};
+
+
+// Items finished with, kept to be used again so the storage they own (their
+// strings and vectors) isn't freed then allocated again. Never blocks: get
+// returns false if there is nothing to reuse, and the pool holds at most
+// max_size items
+template <class T>
+class RecyclePool
+{
+   public:
+      RecyclePool(const size_t max_size)
+         : _max_size(max_size)
+      {
+      }
+
+      void put(T& item)
+      {
+         std::lock_guard<std::mutex> lock(_mtx);
+         if (_items.size() < _max_size)
+         {
+            _items.push_back(std::move(item));
+         }
+      }
+
+      bool get(T& item)
+      {
+         std::lock_guard<std::mutex> lock(_mtx);
+         if (_items.empty())
+         {
+            return false;
+         }
+
+         item = std::move(_items.back());
+         _items.pop_back();
+
+         return true;
+      }
+
+   private:
+      std::vector<T> _items;
+      size_t _max_size;
+
+      std::mutex _mtx;
+};
@@ -0,0 +1,197 @@
+/*
+ * File: checkpoint.cpp
+ *
+ * Saves and loads the progress of seer and kmds runs
+ *
+ */
+
+#include "checkpoint.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Fields are in host (little endian) byte order, strings and vectors with
+// their length first
+void writeValue(std::ostream& os, const uint64_t value)
+{
+   os.write((const char*)&value, sizeof(uint64_t));
+}
+
+uint64_t readValue(std::istream& is)
+{
+   uint64_t value = 0;
+   is.read((char*)&value, sizeof(uint64_t));
+   return value;
+}
+
+void writeString(std::ostream& os, const std::string& value)
+{
+   writeValue(os, value.length());
+   os.write(value.data(), value.length());
+}
+
+std::string readString(std::istream& is)
+{
+   std::string value(readValue(is), '\0');
+   is.read(&value[0], value.length());
+   return value;
+}
+
+Checkpoint::Checkpoint()
+   :shard(0), num_shards(1), line_nr(0), block_offset(UINT64_MAX), block_line(-1)
+{
+}
+
+int Checkpoint::load(const std::string& file_name, const std::function<void(std::istream&)>& read_state)
+{
+   std::ifstream file(file_name.c_str(), std::ios::in | std::ios::binary);
+   if (!file)
+   {
+      return 0;
+   }
+
+   std::string magic(checkpoint_magic.length(), '\0');
+   file.read(&magic[0], magic.length());
+   if (!file || magic != checkpoint_magic)
+   {
+      throw std::runtime_error(file_name + " is not a checkpoint file");
+   }
+
+   program = readString(file);
+   kmers = readString(file);
+   shard = readValue(file);
+   num_shards = readValue(file);
+   settings = readString(file);
+
+   line_nr = readValue(file);
+   block_offset = readValue(file);
+   block_line = readValue(file);
+
+   counters.resize(readValue(file));
+   for (auto it = counters.begin(); it != counters.end(); ++it)
+   {
+      *it = readValue(file);
+   }
+   output_offsets.resize(readValue(file));
+   for (auto it = output_offsets.begin(); it != output_offsets.end(); ++it)
+   {
+      *it = readValue(file);
+   }
+
+   if (read_state)
+   {
+      read_state(file);
+   }
+
+   if (!file)
+   {
+      throw std::runtime_error("Truncated checkpoint file " + file_name);
+   }
+
+   return 1;
+}
+
+void Checkpoint::save(const std::string& file_name, const std::function<void(std::ostream&)>& write_state) const
+{
+   const std::string tmp_file_name = file_name + checkpoint_tmp_suffix;
+   {
+      std::ofstream file(tmp_file_name.c_str(), std::ios::out | std::ios::binary);
+
+      file.write(checkpoint_magic.data(), checkpoint_magic.length());
+      writeString(file, program);
+      writeString(file, kmers);
+      writeValue(file, shard);
+      writeValue(file, num_shards);
+      writeString(file, settings);
+
+      writeValue(file, line_nr);
+      writeValue(file, block_offset);
+      writeValue(file, block_line);
+
+      writeValue(file, counters.size());
+      for (auto it = counters.begin(); it != counters.end(); ++it)
+      {
+         writeValue(file, *it);
+      }
+      writeValue(file, output_offsets.size());
+      for (auto it = output_offsets.begin(); it != output_offsets.end(); ++it)
+      {
+         writeValue(file, *it);
+      }
+
+      if (write_state)
+      {
+         write_state(file);
+      }
+
+      file.close();
+      if (!file)
+      {
+         throw std::runtime_error("Could not write checkpoint to " + tmp_file_name);
+      }
+   }
+
+   syncFile(tmp_file_name);
+   if (rename(tmp_file_name.c_str(), file_name.c_str()) != 0)
+   {
+      throw std::runtime_error("Could not rename " + tmp_file_name + " to " + file_name);
+   }
+
+   // The rename is durable once the directory is synced
+   size_t slash = file_name.rfind('/');
+   syncFile(slash == std::string::npos ? "." : file_name.substr(0, slash + 1));
+}
+
+void Checkpoint::check(const std::string& program_name, const std::string& kmers_file, const unsigned int shard_index, const unsigned int shards, const std::string& run_settings) const
+{
+   if (program != program_name || kmers != kmers_file || shard != shard_index || num_shards != shards)
+   {
+      throw std::runtime_error("Checkpoint is from " + program + " reading " + kmers
+            + " (shard " + std::to_string(shard + 1) + "/" + std::to_string(num_shards) + "), so can't be resumed by this run");
+   }
+
+   // Reports the first setting which differs
+   if (settings != run_settings)
+   {
+      std::istringstream saved(settings), run(run_settings);
+      std::string saved_line, run_line;
+      do
+      {
+         saved_line.clear();
+         run_line.clear();
+         std::getline(saved, saved_line);
+         std::getline(run, run_line);
+      }
+      while (saved_line == run_line);
+
+      throw std::runtime_error("Checkpoint is from a run with " + (saved_line.empty() ? "fewer options" : saved_line)
+            + ", not " + (run_line.empty() ? "fewer options" : run_line) + ", so can't be resumed by this run");
+   }
+}
+
+void syncFile(const std::string& file_name)
+{
+   int fd = open(file_name.c_str(), O_RDONLY);
+   if (fd < 0 || fsync(fd) != 0)
+   {
+      if (fd >= 0)
+      {
+         close(fd);
+      }
+      throw std::runtime_error("Could not sync " + file_name + " to disk");
+   }
+   close(fd);
+}
+
+void truncateFile(const std::string& file_name, const uint64_t length)
+{
+   if (truncate(file_name.c_str(), length) != 0)
+   {
+      throw std::runtime_error("Could not truncate " + file_name + " to its checkpointed length");
+   }
+}
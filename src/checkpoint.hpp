@@ -0,0 +1,69 @@
+/*
+ * checkpoint.hpp
+ * Header file for resumable runs
+ *
+ * With --checkpoint, seer and kmds periodically save how far through the
+ * k-mer file they are, their counters and how much output they have written
+ * (which is synced to disk first). If the checkpoint file exists when they
+ * start, the output is cut back to its saved length and reading restarts
+ * after the last line covered. In BGZF files this is from the start of the
+ * block the line was in, so only that block is read again.
+ * Checkpoints are written to a temporary file which is synced then renamed
+ * over the last one, so there is always a complete checkpoint. A checkpoint
+ * records the options which change the output (the phenotypes, covariates
+ * and filter thresholds), and is only resumed by a run with the same ones
+ *
+ */
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Constants
+const std::string checkpoint_magic = "SEERCKP2";
+const std::string checkpoint_tmp_suffix = ".tmp";
+const unsigned int checkpoint_interval_default = 600; // seconds
+
+class Checkpoint
+{
+   public:
+      // Initialisation. At the start of the k-mer file
+      Checkpoint();
+
+      // Returns 0 if there is no checkpoint file. Anything after the fields
+      // is read by read_state
+      int load(const std::string& file_name, const std::function<void(std::istream&)>& read_state = nullptr);
+      void save(const std::string& file_name, const std::function<void(std::ostream&)>& write_state = nullptr) const;
+
+      // Throws if the checkpoint is from a different run
+      void check(const std::string& program, const std::string& kmers, const unsigned int shard, const unsigned int num_shards, const std::string& settings) const;
+
+      // What the checkpoint is of
+      std::string program;
+      std::string kmers;
+      unsigned int shard;
+      unsigned int num_shards;
+      std::string settings; // Options which change the output, as name=value lines
+
+      // Position in the k-mer file, after the last line covered: lines read
+      // (line_nr), and for BGZF files the block that line started in and
+      // the lines which started in it before, from 0 (block_line)
+      long int line_nr;
+      uint64_t block_offset; // UINT64_MAX if the file isn't BGZF
+      long int block_line;
+
+      std::vector<long int> counters; // Program's own progress counts
+      std::vector<uint64_t> output_offsets; // Bytes of each output file
+};
+
+// Functions
+void syncFile(const std::string& file_name); // Flushes to disk
+void truncateFile(const std::string& file_name, const uint64_t length);
+
+// Fields of checkpoint files, for programs' own state
+void writeValue(std::ostream& os, const uint64_t value);
+uint64_t readValue(std::istream& is);
+void writeString(std::ostream& os, const std::string& value);
+std::string readString(std::istream& is);
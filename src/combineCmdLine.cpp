@@ -16,12 +16,19 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
    //Required options
    po::options_description required("Required options");
    required.add_options()
-    ("samples,r", po::value<std::string>()->required(), "file with tab separated sample name and kmer file")
+    ("samples,r", po::value<std::string>()->required(), "file with tab separated sample name and kmer file. kmer files are text kmer counts, or dsk .h5 output")
     ("output,o", po::value<std::string>()->required(), "output file prefix");
 
    po::options_description other("Other options");
    other.add_options()
     ("min_samples", po::value<int>()->default_value(1), "minimum number of samples kmer must occur in to be printed")
+    ("threads", po::value<int>()->default_value(1), ("number of threads reading count files. Suggested: " + std::to_string(std::thread::hardware_concurrency())).c_str())
+    ("partitions", po::value<int>(), "number of partitions kmers are split into by hash, each built by its own thread. Default: --threads")
+    ("max_memory", po::value<size_t>()->default_value(0), "memory budget in MB, shared between the partitions. Partitions over budget spill sorted runs to disk next to the output. 0 for no limit")
+    ("shards", "write each partition to its own file, output.1 to output.N, rather than one file. Each holds different kmers, so can be tested by a separate seer run")
+    ("sorted", "each sample's kmer counts are text (not dsk), sorted by kmer (LC_ALL=C sort). Merges them in a single pass, in memory proportional to the number of samples, and prints kmers in order")
+    ("bgzf", "write BGZF (blocked gzip) output with a .gzi index, which seer and kmds can decompress with multiple threads")
+    ("binary", "write a binary k-mer matrix (.kmx) instead, which seer and kmds read faster. Abundances are not kept")
     ("help,h", "full help message");
 
    po::options_description all;
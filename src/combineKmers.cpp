@@ -4,14 +4,6 @@
  *
  */
 
-
-//
-// Consider transforming bases to a more compact representation
-//
-// Just use sample index vs. use full sample name
-//
-// TODO read dsk output directly
-
 #include "combineKmers.hpp"
 
 int main (int argc, char *argv[])
@@ -35,67 +27,101 @@ int main (int argc, char *argv[])
 
    // Read in list of sample kmer files and their names
    std::vector<std::tuple<std::string, std::string> > samples = readSamples(vm["samples"].as<std::string>());
-   std::unordered_map<int, std::string> sample_names;
+   std::vector<std::string> sample_names;
+   for (auto sample_it = samples.cbegin(); sample_it != samples.cend(); ++sample_it)
+   {
+      sample_names.push_back(std::get<0>(*sample_it));
+   }
    size_t min_samples = checkMin(samples.size(), vm["min_samples"].as<int>());
 
-   // Open the output file before counting kmers
-   ogzstream out_file((vm["output"].as<std::string>() + ".gz").c_str());
-
-   // Map to store kmers
-   // TODO this would be neater if written with objects
-   std::unordered_map<std::string, std::vector<std::tuple<int, int>>> kmer_union;
-
-   // Add kmers to map
-   std::cerr << "Reading and mapping kmers..." << std::endl;
-   for (unsigned int i = 0; i < samples.size(); ++i)
+   std::vector<std::string> count_files;
+   for (auto sample_it = samples.cbegin(); sample_it != samples.cend(); ++sample_it)
    {
-      std::string sample_name, filename;
-      std::tie(sample_name, filename) = samples[i];
-
-      // Rather than storing lots of copies of sample names as strings, just
-      // store hash keys
-      sample_names[i] = sample_name;
+      count_files.push_back(std::get<1>(*sample_it));
+   }
 
-      std::ifstream kmer_counts(filename.c_str());
+   try
+   {
+      std::string out_prefix = vm["output"].as<std::string>();
+      int binary = vm.count("binary"), bgzf = vm.count("bgzf");
+      unsigned int num_threads = std::max(vm["threads"].as<int>(), 1);
+      unsigned int num_partitions = vm.count("partitions") ? std::max(vm["partitions"].as<int>(), 1) : num_threads;
 
-      if (kmer_counts)
+      if (vm.count("sorted"))
       {
-         std::cerr << "File " << i + 1 << "/" << samples.size() << "\r";
-         std::cerr.flush();
-
-         std::string kmer, abundance;
-         while (kmer_counts >> kmer >> abundance)
+         // Stream all the files at once, printing kmers in order
+         UnionWriter out_file(out_prefix, sample_names, binary, bgzf);
+         std::cerr << "Merging sorted kmer counts..." << std::endl;
+         mergeSortedCounts(count_files, min_samples, [&out_file](const std::string& kmer, const std::vector<kmerPosting>& postings)
          {
-            kmer_union[kmer].push_back(std::make_tuple(i, stoi(abundance)));
-         }
+            out_file.write(kmer, postings);
+         });
       }
       else
       {
-         std::cerr << "Could not open " + filename << std::endl;
-         std::cerr << "Skipping..." << std::endl;
-      }
-   }
-   std::cerr << std::endl;
+         // Route kmers to partitions by hash, each with an equal share of the
+         // memory budget, above which it spills sorted runs to disk
+         size_t max_memory = vm["max_memory"].as<size_t>() * 1024 * 1024;
+         std::vector<std::unique_ptr<KmerPartition>> partitions;
+         for (unsigned int i = 0; i < num_partitions; ++i)
+         {
+            partitions.emplace_back(new KmerPartition(out_prefix + ".run" + std::to_string(i + 1), max_memory / num_partitions));
+         }
 
-   // Print results
-   std::cerr << "Printing union of kmers" << std::endl;
-   for(auto kmer_it = kmer_union.cbegin(); kmer_it != kmer_union.cend(); ++kmer_it)
-   {
-      if (kmer_it->second.size() >= min_samples)
-      {
-         out_file << kmer_it->first;
-         for (auto sample_it = kmer_it->second.cbegin(); sample_it != kmer_it->second.cend(); ++sample_it)
+         std::cerr << "Reading and mapping kmers..." << std::endl;
+         buildPartitions(count_files, partitions, num_threads);
+         std::cerr << std::endl;
+
+         size_t in_memory = 0, memory = 0, runs = 0;
+         for (auto it = partitions.begin(); it != partitions.end(); ++it)
          {
-            int sample, abundance;
-            std::tie (sample, abundance) = *sample_it;
+            in_memory += (*it)->size();
+            memory += (*it)->memory();
+            runs += (*it)->num_runs();
+         }
+         std::cerr << "Printing union of kmers: " << in_memory << " in memory, using " << memory / (1024 * 1024) << " MB";
+         if (runs > 0)
+         {
+            std::cerr << ", and " << runs << " runs on disk";
+         }
+         std::cerr << std::endl;
 
-            out_file << " " << sample_names[sample] + ":" + std::to_string(abundance);
+         if (vm.count("shards"))
+         {
+            // Each partition to its own file, in parallel
+            std::atomic<size_t> next_partition(0);
+            std::vector<std::future<void>> writers;
+            for (unsigned int i = 0; i < std::min(num_threads, num_partitions); ++i)
+            {
+               writers.push_back(std::async(std::launch::async, writePartitions, std::ref(partitions), std::ref(next_partition), std::cref(out_prefix),
+                        std::cref(sample_names), min_samples, binary, bgzf));
+            }
+            for (auto it = writers.begin(); it != writers.end(); ++it)
+            {
+               it->get(); // rethrows
+            }
+         }
+         else
+         {
+            // Partitions one after another
+            UnionWriter out_file(out_prefix, sample_names, binary, bgzf);
+            for (auto it = partitions.begin(); it != partitions.end(); ++it)
+            {
+               (*it)->for_each(min_samples, [&out_file](const std::string& kmer, const std::vector<kmerPosting>& postings)
+               {
+                  out_file.write(kmer, postings);
+               });
+            }
          }
-         out_file << std::endl;
       }
-   }
 
-   std::cerr << "Done." << std::endl;
+      std::cerr << "Done." << std::endl;
+   }
+   catch (std::exception& e)
+   {
+      std::cerr << "Error: " << e.what() << std::endl;
+      return 1;
+   }
 
    return(0);
 }
@@ -9,13 +9,47 @@
 #include <fstream>
 #include <vector>
 #include <tuple>
-#include <unordered_map>
 #include <iterator>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <exception>
+#include <memory>
 
 // Library includes
 #include <boost/program_options.hpp>
 #include <gzstream.h>
 
+#include "bgzf.hpp"
+#include "kmerMatrix.hpp"
+#include "kmerUnion.hpp"
+#include "blockingQueue.hpp"
+
+// Constants
+const unsigned int partition_queue_depth = 4; // batches waiting for each partition
+
+// Writes the union in one of the output formats: gzipped text, BGZF text,
+// or a k-mer matrix
+class UnionWriter
+{
+   public:
+      UnionWriter(const std::string& file_prefix, const std::vector<std::string>& sample_names, const int binary, const int bgzf);
+      ~UnionWriter();
+
+      void write(const std::string& kmer, const std::vector<kmerPosting>& postings);
+      void close();
+
+   private:
+      const std::vector<std::string>& _sample_names;
+      int _binary;
+      int _bgzf;
+
+      ogzstream _gz_out_file;
+      BgzfOutStream _bgzf_out_file;
+      KmerMatrixWriter _matrix_out_file;
+      std::vector<uint32_t> _present;
+};
+
 // Function prototypes
 int parseCommandLine (int argc, char *argv[], boost::program_options::variables_map& vm);
 void printHelp(boost::program_options::options_description& help);
@@ -23,3 +57,9 @@ void printHelp(boost::program_options::options_description& help);
 std::vector<std::tuple<std::string, std::string> > readSamples(const std::string& sample_file);
 size_t checkMin(const size_t num_samples, const int input_min_samples);
 
+void buildPartitions(const std::vector<std::string>& count_files, std::vector<std::unique_ptr<KmerPartition>>& partitions, const unsigned int num_threads);
+void readCounts(const std::vector<std::string>& count_files, std::atomic<size_t>& next_file, std::vector<std::unique_ptr<BlockingQueue<kmerBatch>>>& partition_queues);
+void readCountFiles(const std::vector<std::string>& count_files, std::atomic<size_t>& next_file, std::vector<std::unique_ptr<BlockingQueue<kmerBatch>>>& partition_queues);
+void addCounts(BlockingQueue<kmerBatch>& partition_queue, KmerPartition& partition);
+void writePartitions(std::vector<std::unique_ptr<KmerPartition>>& partitions, std::atomic<size_t>& next_partition, const std::string& file_prefix, const std::vector<std::string>& sample_names, const size_t min_samples, const int binary, const int bgzf);
+
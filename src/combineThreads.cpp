@@ -0,0 +1,219 @@
+/*
+ * combineThreads.cpp
+ * Partitioned union of k-mer counts for combineKmers. Reader threads parse
+ * the count files, routing each k-mer by its hash to one of the partitions,
+ * each of which is built by its own thread
+ *
+ */
+
+#include "combineKmers.hpp"
+
+// Reads all the count files into the partitions, num_threads files at a time.
+// An error in any of the threads is rethrown once they have all finished
+void buildPartitions(const std::vector<std::string>& count_files, std::vector<std::unique_ptr<KmerPartition>>& partitions, const unsigned int num_threads)
+{
+   std::vector<std::unique_ptr<BlockingQueue<kmerBatch>>> partition_queues;
+   std::vector<std::future<void>> builders;
+   for (auto it = partitions.begin(); it != partitions.end(); ++it)
+   {
+      partition_queues.emplace_back(new BlockingQueue<kmerBatch>(partition_queue_depth));
+      builders.push_back(std::async(std::launch::async, addCounts, std::ref(*partition_queues.back()), std::ref(**it)));
+   }
+
+   std::atomic<size_t> next_file(0);
+   std::vector<std::future<void>> readers;
+   for (unsigned int i = 0; i < num_threads; ++i)
+   {
+      readers.push_back(std::async(std::launch::async, readCounts, std::cref(count_files), std::ref(next_file), std::ref(partition_queues)));
+   }
+
+   for (auto it = readers.begin(); it != readers.end(); ++it)
+   {
+      it->wait();
+   }
+   for (auto it = partition_queues.begin(); it != partition_queues.end(); ++it)
+   {
+      (*it)->close();
+   }
+   for (auto it = builders.begin(); it != builders.end(); ++it)
+   {
+      it->wait();
+   }
+
+   for (auto it = readers.begin(); it != readers.end(); ++it)
+   {
+      it->get(); // rethrows
+   }
+   for (auto it = builders.begin(); it != builders.end(); ++it)
+   {
+      it->get();
+   }
+}
+
+// Reader thread. Takes the next count file until there are none left,
+// passing its k-mers to their partitions in batches. On an error the other
+// readers are stopped from taking more files
+void readCounts(const std::vector<std::string>& count_files, std::atomic<size_t>& next_file, std::vector<std::unique_ptr<BlockingQueue<kmerBatch>>>& partition_queues)
+{
+   try
+   {
+      readCountFiles(count_files, next_file, partition_queues);
+   }
+   catch (...)
+   {
+      next_file = count_files.size();
+      throw;
+   }
+}
+
+void readCountFiles(const std::vector<std::string>& count_files, std::atomic<size_t>& next_file, std::vector<std::unique_ptr<BlockingQueue<kmerBatch>>>& partition_queues)
+{
+   const unsigned int num_partitions = partition_queues.size();
+   std::vector<kmerBatch> batches(num_partitions);
+
+   uint32_t abundance;
+   std::vector<uint64_t> key;
+   for (size_t i = next_file++; i < count_files.size(); i = next_file++)
+   {
+      KmerCountReader kmer_counts;
+      if (!kmer_counts.open(count_files[i]))
+      {
+         std::cerr << "Could not open " + count_files[i] + "\nSkipping...\n";
+         continue;
+      }
+      std::cerr << "File " + std::to_string(i + 1) + "/" + std::to_string(count_files.size()) + "\r";
+      std::cerr.flush();
+
+      while (kmer_counts.next(key, abundance))
+      {
+         unsigned int partition = kmerPartition(key.data(), key.size(), num_partitions);
+         kmerBatch& batch = batches[partition];
+         if (batch.samples.empty())
+         {
+            batch.kmer_length = kmer_counts.kmer_length();
+         }
+         else if (batch.kmer_length != kmer_counts.kmer_length())
+         {
+            throw std::runtime_error("k-mers of different lengths (" + std::to_string(batch.kmer_length) + " and " + std::to_string(kmer_counts.kmer_length()) + ") can't be combined\n");
+         }
+         batch.keys.insert(batch.keys.end(), key.begin(), key.end());
+         batch.samples.push_back(i);
+         batch.abundances.push_back(abundance);
+
+         if (batch.samples.size() == count_batch_size)
+         {
+            partition_queues[partition]->push(std::move(batch));
+            batch = kmerBatch();
+         }
+      }
+   }
+
+   for (unsigned int partition = 0; partition < num_partitions; ++partition)
+   {
+      if (!batches[partition].samples.empty())
+      {
+         partition_queues[partition]->push(std::move(batches[partition]));
+      }
+   }
+}
+
+// Builder thread for one partition. After an error the queue is still
+// emptied, so the readers don't block on it, and the error is rethrown at
+// the end
+void addCounts(BlockingQueue<kmerBatch>& partition_queue, KmerPartition& partition)
+{
+   std::exception_ptr error;
+   kmerBatch batch;
+   while (partition_queue.pop(batch))
+   {
+      if (!error)
+      {
+         try
+         {
+            partition.add(batch);
+         }
+         catch (...)
+         {
+            error = std::current_exception();
+         }
+      }
+   }
+
+   if (error)
+   {
+      std::rethrow_exception(error);
+   }
+}
+
+// Writer thread for --shards. Takes the next partition until there are none
+// left, writing each to its own file
+void writePartitions(std::vector<std::unique_ptr<KmerPartition>>& partitions, std::atomic<size_t>& next_partition, const std::string& file_prefix, const std::vector<std::string>& sample_names, const size_t min_samples, const int binary, const int bgzf)
+{
+   for (size_t i = next_partition++; i < partitions.size(); i = next_partition++)
+   {
+      UnionWriter out(file_prefix + "." + std::to_string(i + 1), sample_names, binary, bgzf);
+      partitions[i]->for_each(min_samples, [&out](const std::string& kmer, const std::vector<kmerPosting>& postings)
+      {
+         out.write(kmer, postings);
+      });
+      out.close();
+   }
+}
+
+/*
+ * UnionWriter
+ */
+UnionWriter::UnionWriter(const std::string& file_prefix, const std::vector<std::string>& sample_names, const int binary, const int bgzf)
+   :_sample_names(sample_names), _binary(binary), _bgzf(bgzf)
+{
+   std::string out_file_name = file_prefix + ".gz";
+   if (_binary)
+   {
+      _matrix_out_file.open(file_prefix + kmx_suffix, sample_names);
+   }
+   else if (_bgzf)
+   {
+      _bgzf_out_file.open(out_file_name, 1);
+   }
+   else
+   {
+      _gz_out_file.open(out_file_name.c_str());
+   }
+}
+
+UnionWriter::~UnionWriter()
+{
+   close();
+}
+
+void UnionWriter::write(const std::string& kmer, const std::vector<kmerPosting>& postings)
+{
+   if (_binary)
+   {
+      _present.clear();
+      for (auto sample_it = postings.cbegin(); sample_it != postings.cend(); ++sample_it)
+      {
+         _present.push_back(sample_it->sample);
+      }
+
+      _matrix_out_file.write(kmer, _present);
+   }
+   else
+   {
+      std::ostream& out_file = _bgzf ? (std::ostream&)_bgzf_out_file : (std::ostream&)_gz_out_file;
+
+      out_file << kmer;
+      for (auto sample_it = postings.cbegin(); sample_it != postings.cend(); ++sample_it)
+      {
+         out_file << " " << _sample_names[sample_it->sample] + ":" + std::to_string(sample_it->abundance);
+      }
+      out_file << "\n";
+   }
+}
+
+void UnionWriter::close()
+{
+   _bgzf_out_file.close();
+   _matrix_out_file.close();
+   _gz_out_file.close();
+}
@@ -0,0 +1,210 @@
+/*
+ * File: dsmReader.cpp
+ *
+ * Parses dsm lines into kmer objects
+ *
+ */
+
+#include "seercommon.hpp"
+
+#include <cstring>
+
+DsmReader::DsmReader(const std::vector<Sample>& samples, const int keep_names)
+   :_dictionary(samples), _keep_names(keep_names), _binary(0), _block_offset(UINT64_MAX), _block_line(-1)
+{
+}
+
+void DsmReader::open(const std::string& file_name, const unsigned int threads, const uint64_t start_offset, const uint64_t end_offset)
+{
+   _binary = isKmerMatrix(file_name);
+   _block_offset = UINT64_MAX;
+   _block_line = -1;
+   if (_binary)
+   {
+      _matrix.open(file_name);
+
+      // Sample indices in the file are fixed, so look them up now. Names are
+      // only added to the dictionary if they are kept
+      const std::vector<std::string>& matrix_samples = _matrix.samples();
+      _matrix_ids.resize(matrix_samples.size());
+      for (unsigned int i = 0; i < matrix_samples.size(); ++i)
+      {
+         _matrix_ids[i] = _keep_names ? _dictionary.intern(matrix_samples[i].data(), matrix_samples[i].length())
+            : _dictionary.find(matrix_samples[i].data(), matrix_samples[i].length());
+      }
+   }
+   else
+   {
+      openDsmFile(_stream, file_name, threads, start_offset, end_offset);
+   }
+}
+
+// BGZF files are opened from the block the checkpoint's last line started
+// in, so only the lines before it in that block are read again
+void DsmReader::resume(const std::string& file_name, const Checkpoint& checkpoint, const unsigned int threads, const uint64_t start_offset, const uint64_t end_offset)
+{
+   if (checkpoint.block_offset != UINT64_MAX)
+   {
+      open(file_name, threads, checkpoint.block_offset, end_offset);
+      skip(checkpoint.block_line + 1);
+   }
+   else
+   {
+      open(file_name, threads, start_offset, end_offset);
+      skip(checkpoint.line_nr);
+   }
+}
+
+void DsmReader::close()
+{
+   if (_binary)
+   {
+      _matrix.close();
+   }
+   else
+   {
+      _stream.close();
+   }
+}
+
+int DsmReader::next(Kmer& k)
+{
+   if (_binary)
+   {
+      if (!_matrix.next())
+      {
+         return 0;
+      }
+      parseRecord(_matrix.sequence(), _matrix.present(), k);
+   }
+   else
+   {
+      if (!readLine(_line))
+      {
+         return 0;
+      }
+      parseLine(_line, k, _keep_names ? &_dictionary : NULL);
+   }
+
+   return 1;
+}
+
+// Reads the next line, or .kmx record, without parsing it
+int DsmReader::nextRaw(std::string& raw)
+{
+   if (_binary)
+   {
+      if (!_matrix.next())
+      {
+         return 0;
+      }
+      raw.assign(_matrix.record(), _matrix.record_length());
+   }
+   else if (!readLine(raw))
+   {
+      return 0;
+   }
+
+   return 1;
+}
+
+// Moves past lines without parsing them, to resume from a checkpoint
+void DsmReader::skip(const long int lines)
+{
+   std::string raw;
+   for (long int i = 0; i < lines && nextRaw(raw); ++i)
+   {
+   }
+}
+
+// For BGZF files, keeps track of the block the line started in, and how
+// many lines started in it before
+int DsmReader::readLine(std::string& line)
+{
+   if (_stream.is_bgzf() && _stream.rdbuf()->sgetc() != std::char_traits<char>::eof())
+   {
+      uint64_t block_offset = _stream.block_offset();
+      _block_line = block_offset == _block_offset ? _block_line + 1 : 0;
+      _block_offset = block_offset;
+   }
+
+   return std::getline(_stream, line) ? 1 : 0;
+}
+
+// Parses a line or record from nextRaw. Doesn't change the reader, so can be
+// called from other threads. sequence and present are storage for decoding
+// .kmx records
+void DsmReader::parse(const std::string& raw, Kmer& k, std::string& sequence, std::vector<uint32_t>& present) const
+{
+   if (_binary)
+   {
+      decodeKmxRecord(raw.data(), raw.length(), _matrix.samples().size(), sequence, present);
+      parseRecord(sequence, present, k);
+   }
+   else
+   {
+      parseLine(raw, k, NULL);
+   }
+}
+
+/*
+ * Example dsm file line AAAAAAAAAAAAAAAAAATGCATATTTATCTTAG 5.172314 0.175087 100 0 100
+ * 0.164875 100 | 6925_3#7:9 6823_4#17:26 6871_2#9:8
+ *
+ * OR
+ *
+ * AAAAAAAAAAAAAAAAAATGCATATTTATCTTAG 5.172314 6925_3#7:9 6823_4#17:26 6871_2#9:8
+ *
+ * Samples are the part of each field before the ':'. Entropy fields and the
+ * separator have no ':', so are skipped. Names are interned into names, and
+ * their ids added to k, if it is given
+ */
+void DsmReader::parseLine(const std::string& line, Kmer& k, SampleDictionary* names) const
+{
+   size_t pos = 0, start, length;
+
+   // First field is the kmer
+   nextField(line, pos, start, length);
+   k.reset(line.data() + start, length, _dictionary.num_pheno());
+
+   while (nextField(line, pos, start, length))
+   {
+      const char* field = line.data() + start;
+      const char* colon = (const char*)memchr(field, ':', length);
+
+      if (colon != NULL)
+      {
+         long int sample_id = names != NULL ? names->intern(field, colon - field) : _dictionary.find(field, colon - field);
+         if (sample_id >= 0 && (size_t)sample_id < _dictionary.num_pheno())
+         {
+            k.add_sample(sample_id);
+         }
+
+         if (names != NULL)
+         {
+            k.add_sample_id(sample_id);
+         }
+      }
+   }
+   k.set_maf((double)k.num_occurrences() / _dictionary.num_pheno());
+}
+
+void DsmReader::parseRecord(const std::string& sequence, const std::vector<uint32_t>& present, Kmer& k) const
+{
+   k.reset(sequence.data(), sequence.length(), _dictionary.num_pheno());
+
+   for (auto it = present.begin(); it != present.end(); ++it)
+   {
+      long int sample_id = _matrix_ids[*it];
+      if (sample_id >= 0 && (size_t)sample_id < _dictionary.num_pheno())
+      {
+         k.add_sample(sample_id);
+      }
+
+      if (_keep_names)
+      {
+         k.add_sample_id(sample_id);
+      }
+   }
+   k.set_maf((double)k.num_occurrences() / _dictionary.num_pheno());
+}
@@ -0,0 +1,69 @@
+/*
+ * dsmReader.hpp
+ * Header file for dsm reader class
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Reads k-mers from dsm files, or binary k-mer matrix (.kmx) files. Each line
+// is read into the same buffer and split in place, and sample names are looked
+// up straight to their id in the sample dictionary, so nothing is allocated
+// per sample. For .kmx files the sample names are looked up once, when the
+// file is opened.
+// Sample ids are only added to the k-mer if keep_names is set, for
+// --print_samples
+class DsmReader
+{
+   public:
+      // Initialisation
+      DsmReader(const std::vector<Sample>& samples, const int keep_names = 0);
+
+      // For BGZF files, only lines starting in the blocks from start_offset
+      // up to end_offset are read
+      void open(const std::string& file_name, const unsigned int threads = 1, const uint64_t start_offset = 0, const uint64_t end_offset = UINT64_MAX);
+      // Opens the file after the last line covered by the checkpoint
+      void resume(const std::string& file_name, const Checkpoint& checkpoint, const unsigned int threads = 1, const uint64_t start_offset = 0, const uint64_t end_offset = UINT64_MAX);
+      void close();
+
+      // Reads the next k-mer into k. Returns 0 at the end of input
+      int next(Kmer& k);
+
+      // Reading and parsing separately, so lines can be parsed by other
+      // threads. Sample names aren't kept when parsing dsm lines this way
+      int nextRaw(std::string& raw);
+      void parse(const std::string& raw, Kmer& k, std::string& sequence, std::vector<uint32_t>& present) const;
+
+      // nonmodifying operations
+      int is_binary() const { return _binary; }
+      const std::string& line() const { return _line; } // last line read by next, dsm files only
+      const KmerMatrixReader& matrix() const { return _matrix; } // .kmx files only
+      const SampleDictionary& dictionary() const { return _dictionary; } // names of the ids in each k-mer
+
+      // Position of the last line read in BGZF files: the block it started
+      // in, and the lines which started in the block before it. The block
+      // is UINT64_MAX for other files
+      uint64_t block_offset() const { return _block_offset; }
+      long int block_line() const { return _block_line; }
+
+   private:
+      int readLine(std::string& line);
+      void skip(const long int lines);
+      void parseLine(const std::string& line, Kmer& k, SampleDictionary* names) const;
+      void parseRecord(const std::string& sequence, const std::vector<uint32_t>& present, Kmer& k) const;
+
+      SampleDictionary _dictionary;
+      int _keep_names;
+
+      int _binary;
+      DsmStream _stream;
+      std::string _line;
+      uint64_t _block_offset;
+      long int _block_line;
+
+      KmerMatrixReader _matrix;
+      std::vector<long int> _matrix_ids; // -1 if not kept
+};
+
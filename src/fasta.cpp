@@ -7,10 +7,67 @@
 
 #include "fasta.hpp"
 
-// Read in sequences to memory from file
+// Read in sequences from file, and index them
 Fasta::Fasta(const std::string& obj_name, const std::string& filename)
    :name(obj_name)
 {
+   std::vector<uint8_t> text;
+   readFasta(filename, sequence_names, sequence_starts, text);
+
+   index = std::make_shared<const FmIndex>(text);
+}
+
+// An assembly already read and indexed
+Fasta::Fasta(const std::string& obj_name, const std::vector<std::string>& names, const std::vector<uint64_t>& starts, const std::shared_ptr<const FmIndex>& fm_index)
+   :sequence_names(names), sequence_starts(starts), index(fm_index), name(obj_name)
+{
+}
+
+// All exact matches to search sequence in all sequences in fasta, in order
+// of sequence then position
+std::vector<Mapping> Fasta::hasSeq(const std::string& search) const
+{
+   std::vector<Mapping> results;
+   Mapping hit;
+
+   std::vector<uint64_t> hit_positions = index->locate(search);
+   std::sort(hit_positions.begin(), hit_positions.end());
+
+   // Find which sequence each hit is in
+   for (std::vector<uint64_t>::iterator it = hit_positions.begin(); it != hit_positions.end(); ++it)
+   {
+      size_t sequence_idx = std::upper_bound(sequence_starts.begin(), sequence_starts.end(), *it) - sequence_starts.begin() - 1;
+
+      hit.sequence_name = sequence_names[sequence_idx];
+      hit.position = *it - sequence_starts[sequence_idx];
+      results.push_back(hit);
+   }
+
+   return results;
+}
+
+// Prints results to hasSeq
+// a nicer output than hasSeq: use this function
+void Fasta::printMappings(std::ostream &os, const std::string& search) const
+{
+   std::vector<Mapping> hits = hasSeq(search);
+   for (std::vector<Mapping>::iterator it = hits.begin(); it != hits.end(); ++it)
+   {
+      os << "\t" << Fasta::name << ":" << it->sequence_name << ":" << it->position << "-" << it->position + search.length() - 1;
+   }
+}
+
+/*
+ * Functions
+ */
+// Reads the contigs of a fasta file as FM-index symbols, concatenated, each
+// followed by a separator, which no search can match
+void readFasta(const std::string& filename, std::vector<std::string>& sequence_names, std::vector<uint64_t>& sequence_starts, std::vector<uint8_t>& text)
+{
+   sequence_names.clear();
+   sequence_starts.clear();
+   text.clear();
+
    std::ifstream ist(filename.c_str());
 
    if (!ist)
@@ -19,7 +76,7 @@ Fasta::Fasta(const std::string& obj_name, const std::string& filename)
    }
 
    std::string line_in;
-   std::string seq, contig_name = "";
+   std::string contig_name = "";
 
    std::getline(ist, line_in);
 
@@ -31,6 +88,7 @@ Fasta::Fasta(const std::string& obj_name, const std::string& filename)
    else if (line_in[0] == '>')
    {
       contig_name = line_in.substr(1);
+      sequence_starts.push_back(0);
    }
    else
    {
@@ -38,76 +96,26 @@ Fasta::Fasta(const std::string& obj_name, const std::string& filename)
          "Header should start with '>', but has:\n" + line_in + "\n");
    }
 
-   while (!ist.eof())
+   while (std::getline(ist, line_in))
    {
       // New contig, new sequence
-      if (ist.peek() == '>')
+      if (line_in[0] == '>')
       {
          sequence_names.push_back(contig_name);
-         sequences.push_back(seq);
+         text.push_back(fm_separator);
+         sequence_starts.push_back(text.size());
 
-         seq = "";
-         std::getline(ist, line_in);
          contig_name = line_in.substr(1);
       }
       else
       {
          // Concatenate sequence lines
-         std::getline(ist, line_in);
-         seq += line_in;
+         std::transform(line_in.begin(), line_in.end(), std::back_inserter(text), fmSymbol);
       }
    }
 
    // Add in final contig
    sequence_names.push_back(contig_name);
-   sequences.push_back(seq);
-
-}
-
-// All exact matches to search sequence in all sequences in fasta
-std::vector<Mapping> Fasta::hasSeq(const std::string& search)
-{
-   std::vector<Mapping> results;
-   Mapping hit;
-
-   // Search each sequence in fasta
-   std::vector<std::string>::iterator name_it = Fasta::sequence_names.begin();
-   for (std::vector<std::string>::iterator it = Fasta::sequences.begin(); it != Fasta::sequences.end(); ++it)
-   {
-      size_t hit_position = it->find(search);
-
-      // Search allowing for multiple hits
-      while (hit_position != std::string::npos)
-      {
-         hit.sequence_name = *name_it;
-         hit.position = hit_position;
-         results.push_back(hit);
-
-         hit_position = it->find(search, hit_position + 1);
-      }
-
-      // Move forward in name vector
-      ++name_it;
-   }
-
-   return results;
-}
-
-// Prints results to hasSeq
-// a nicer output than hasSeq: use this function
-void Fasta::printMappings(std::ostream &os, const std::string search, std::mutex& mtx)
-{
-   std::vector<Mapping> hits = hasSeq(search);
-
-   if (hits.size() > 0)
-   {
-      // Lock use of std::out to make sure output isn't mangled
-      mtx.lock();
-      for (std::vector<Mapping>::iterator it = hits.begin(); it != hits.end(); ++it)
-      {
-         os << "\t" << Fasta::name << ":" << it->sequence_name << ":" << it->position << "-" << it->position + search.length() - 1;
-      }
-      mtx.unlock();
-   }
+   text.push_back(fm_separator);
 }
 
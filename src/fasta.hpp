@@ -10,6 +10,10 @@
 #include <vector>
 #include <iterator>
 #include <mutex>
+#include <memory>
+#include <algorithm>
+
+#include "fmIndex.hpp"
 
 // Container for a successful mapping result
 struct Mapping
@@ -18,25 +22,35 @@ struct Mapping
    long int position;
 };
 
-// Contains sequences and contig names
+// Contig names, and an index of the sequences. The index is shared between
+// copies
 class Fasta
 {
    public:
       // Initialisation
       Fasta(const std::string& obj_name, const std::string& file);
+      Fasta(const std::string& obj_name, const std::vector<std::string>& names, const std::vector<uint64_t>& starts, const std::shared_ptr<const FmIndex>& fm_index);
 
       // Complex operations
-      std::vector<Mapping> hasSeq(const std::string& search);
-      void printMappings(std::ostream &os, const std::string search, std::mutex& mtx);
+      std::vector<Mapping> hasSeq(const std::string& search) const;
+      void printMappings(std::ostream &os, const std::string& search) const;
 
       // nonmodifying operations
       std::string get_name() const { return name; }
-      static bool compareFasta(Fasta lhs, Fasta rhs) { return (lhs.name < rhs.name); }
+      const std::vector<std::string>& get_sequence_names() const { return sequence_names; }
+      const std::vector<uint64_t>& get_sequence_starts() const { return sequence_starts; }
+      const FmIndex& get_index() const { return *index; }
+      static bool compareFasta(const Fasta& lhs, const Fasta& rhs) { return (lhs.name < rhs.name); }
 
    private:
-      // Sequences and sequence names necessarily in same order as read in
-      std::vector<std::string> sequences;
+      // Sequence names necessarily in same order as read in, and the start of
+      // each sequence in the index
       std::vector<std::string> sequence_names;
+      std::vector<uint64_t> sequence_starts;
+      std::shared_ptr<const FmIndex> index;
 
       std::string name;
 };
+
+// Functions
+void readFasta(const std::string& filename, std::vector<std::string>& sequence_names, std::vector<uint64_t>& sequence_starts, std::vector<uint8_t>& text);
@@ -30,6 +30,9 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
    po::options_description other("Other options");
    other.add_options()
     ("sort,s", po::value<std::string>(), "field to sort on: chisq, pval, maf or beta")
+    ("top", po::value<size_t>(), "print only the first N kmers in --sort order, held in memory. Default sort: pval")
+    ("max_memory", po::value<size_t>()->default_value(0), "memory in MB used to sort. Over this, sorted runs are written to temporary files and merged. 0 for no limit")
+    ("threads", po::value<size_t>()->default_value(1), ("number of threads used by --substr. Suggested: " + std::to_string(std::thread::hardware_concurrency())).c_str())
     ("version", "prints version and exits")
     ("help,h", "full help message");
 
@@ -135,15 +138,31 @@ cmdOptions processCmdLine(po::variables_map& vm)
       processed_options.substr_kmers = 1;
    }
 
+   processed_options.num_threads = std::max(vm["threads"].as<size_t>(), (size_t)1);
+
    if (vm.count("sort"))
    {
       processed_options.sort_field = vm["sort"].as<std::string>();
    }
+   else if (vm.count("top"))
+   {
+      processed_options.sort_field = "pval";
+   }
    else
    {
       processed_options.sort_field = "";
    }
 
+   if (vm.count("top"))
+   {
+      processed_options.top = std::max(vm["top"].as<size_t>(), (size_t)1);
+   }
+   else
+   {
+      processed_options.top = 0;
+   }
+   processed_options.max_memory = vm["max_memory"].as<size_t>() * 1024 * 1024;
+
    return processed_options;
 }
 
@@ -0,0 +1,189 @@
+/*
+ * File: filterSort.cpp
+ *
+ * Sorted output for filter_seer --sort and --top. Each k-mer is kept as its
+ * sort value and printed line, the lines packed together in one buffer. With
+ * --top only the first N are held, in a heap; otherwise sorted runs are
+ * written to temporary files when over --max_memory, and merged at the end
+ *
+ */
+
+#include "filter_seer.hpp"
+
+SortedKmers::SortedKmers(const sortSigKmer& sort_order, const size_t top, const size_t max_memory)
+   :_sort_order(sort_order), _top(top), _max_memory(max_memory), _num_added(0), _unused(0)
+{
+}
+
+SortedKmers::~SortedKmers()
+{
+   for (auto it = _runs.begin(); it != _runs.end(); ++it)
+   {
+      std::fclose(*it);
+   }
+}
+
+void SortedKmers::add(const Significant_kmer& kmer)
+{
+   sortRecord record{_sort_order.value(kmer), _num_added++, _lines.size(), 0};
+
+   // Once full, a k-mer after the last of the top N can be skipped without
+   // printing it
+   if (_top && _records.size() == _top && !recordOrder(record, _records.front()))
+   {
+      return;
+   }
+
+   _line.str("");
+   _line << kmer;
+   const std::string line = _line.str();
+   record.length = line.length();
+   _lines.insert(_lines.end(), line.begin(), line.end());
+   _records.push_back(record);
+
+   if (_top)
+   {
+      std::push_heap(_records.begin(), _records.end(), recordOrder);
+      if (_records.size() > _top)
+      {
+         std::pop_heap(_records.begin(), _records.end(), recordOrder);
+         _unused += _records.back().length;
+         _records.pop_back();
+
+         // Lines dropped from the heap are reclaimed once they are most of
+         // the buffer
+         if (_unused > _lines.size() / 2)
+         {
+            compact();
+         }
+      }
+   }
+   else if (_max_memory && memory() > _max_memory)
+   {
+      spill();
+   }
+}
+
+// Prints the k-mers in order, followed by newlines
+void SortedKmers::print(std::ostream& os)
+{
+   if (_runs.empty())
+   {
+      std::sort(_records.begin(), _records.end(), recordOrder);
+      for (auto it = _records.begin(); it != _records.end(); ++it)
+      {
+         os.write(&_lines[it->offset], it->length);
+         os << "\n";
+      }
+   }
+   else
+   {
+      spill();
+      mergeRuns(os);
+   }
+}
+
+size_t SortedKmers::memory() const
+{
+   return _lines.size() + _records.size() * sizeof(sortRecord);
+}
+
+// Copies the lines still in the heap to a new buffer
+void SortedKmers::compact()
+{
+   std::vector<char> kept_lines;
+   kept_lines.reserve(_lines.size() - _unused);
+   for (auto it = _records.begin(); it != _records.end(); ++it)
+   {
+      size_t offset = kept_lines.size();
+      kept_lines.insert(kept_lines.end(), _lines.begin() + it->offset, _lines.begin() + it->offset + it->length);
+      it->offset = offset;
+   }
+   _lines.swap(kept_lines);
+   _unused = 0;
+}
+
+// Writes the k-mers held to a temporary file in order, and empties the buffer.
+// A run is, for each k-mer
+//    value    double
+//    order    uint64
+//    length   uint64
+//    line     length bytes
+void SortedKmers::spill()
+{
+   std::FILE* run = std::tmpfile();
+   if (run == NULL)
+   {
+      throw std::runtime_error("Could not open a temporary file to sort k-mers");
+   }
+   _runs.push_back(run);
+
+   std::sort(_records.begin(), _records.end(), recordOrder);
+   for (auto it = _records.begin(); it != _records.end(); ++it)
+   {
+      uint64_t length = it->length;
+      if (std::fwrite(&it->value, sizeof(double), 1, run) != 1 || std::fwrite(&it->order, sizeof(uint64_t), 1, run) != 1
+            || std::fwrite(&length, sizeof(uint64_t), 1, run) != 1 || std::fwrite(&_lines[it->offset], 1, length, run) != length)
+      {
+         throw std::runtime_error("Could not write k-mers to a temporary file");
+      }
+   }
+   std::rewind(run);
+
+   _records.clear();
+   _lines.clear();
+}
+
+// k-way merge of the runs, keeping the next k-mer of each
+void SortedKmers::mergeRuns(std::ostream& os)
+{
+   std::vector<sortRecord> next(_runs.size());
+   std::vector<std::string> lines(_runs.size());
+   auto read_record = [&](const size_t run)
+   {
+      uint64_t length;
+      if (std::fread(&next[run].value, sizeof(double), 1, _runs[run]) != 1)
+      {
+         return false;
+      }
+      if (std::fread(&next[run].order, sizeof(uint64_t), 1, _runs[run]) != 1 || std::fread(&length, sizeof(uint64_t), 1, _runs[run]) != 1)
+      {
+         throw std::runtime_error("Could not read k-mers from a temporary file");
+      }
+      lines[run].resize(length);
+      if (length && std::fread(&lines[run][0], 1, length, _runs[run]) != length)
+      {
+         throw std::runtime_error("Could not read k-mers from a temporary file");
+      }
+      return true;
+   };
+
+   // Heap of runs, by their next k-mer
+   auto later = [&next](const size_t a, const size_t b) { return recordOrder(next[b], next[a]); };
+   std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+   for (size_t i = 0; i < _runs.size(); ++i)
+   {
+      if (read_record(i))
+      {
+         heap.push(i);
+      }
+   }
+
+   while (!heap.empty())
+   {
+      size_t run = heap.top();
+      heap.pop();
+      os << lines[run] << "\n";
+      if (read_record(run))
+      {
+         heap.push(run);
+      }
+   }
+}
+
+// By sort value, then in the order added, as a stable sort
+bool recordOrder(const sortRecord& a, const sortRecord& b)
+{
+   return a.value < b.value || (a.value == b.value && a.order < b.order);
+}
+
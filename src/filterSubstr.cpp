@@ -0,0 +1,118 @@
+/*
+ * File: filterSubstr.cpp
+ *
+ * Removes k-mers which are substrings of others for filter_seer --substr.
+ * Every distinct sequence is added to one Aho-Corasick automaton, then each
+ * is scanned through it; any other k-mer matched inside a scan is a
+ * substring of that sequence. Scans are split between threads. Sequences
+ * with bases other than ACGT, which the automaton can't hold, are searched
+ * for in every other sequence directly
+ *
+ */
+
+#include "filter_seer.hpp"
+
+// Removes k-mers contained in a longer k-mer, and repeats of the same
+// sequence. Leaves the rest sorted from longest to shortest, otherwise in
+// their input order
+void removeSubstrings(std::vector<Significant_kmer>& kmers, const size_t num_threads)
+{
+   sortSigKmer length_sort("sequence");
+   std::stable_sort(kmers.begin(), kmers.end(), [&length_sort](const Significant_kmer& a, const Significant_kmer& b) { return length_sort(b, a); });
+
+   // Only the first of repeated sequences is kept
+   std::unordered_map<std::string, uint32_t> sequence_ids;
+   std::vector<std::string> sequences;
+   std::vector<int> repeated(kmers.size(), 0);
+   std::vector<uint32_t> others; // Not ACGT only
+   KmerAutomaton automaton;
+   for (size_t i = 0; i < kmers.size(); ++i)
+   {
+      if (sequence_ids.insert(std::make_pair(kmers[i].sequence(), sequences.size())).second)
+      {
+         if (acgtOnly(kmers[i].sequence()))
+         {
+            automaton.add(kmers[i].sequence(), sequences.size());
+         }
+         else
+         {
+            others.push_back(sequences.size());
+         }
+         sequences.push_back(kmers[i].sequence());
+      }
+      else
+      {
+         repeated[i] = 1;
+      }
+   }
+   automaton.build();
+
+   std::unique_ptr<std::atomic<char>[]> contained(new std::atomic<char>[sequences.size()]);
+   for (size_t i = 0; i < sequences.size(); ++i)
+   {
+      contained[i] = 0;
+   }
+
+   std::vector<std::thread> scan_threads;
+   for (size_t i = 0; i < num_threads; ++i)
+   {
+      scan_threads.push_back(std::thread(markSubstrings, std::cref(automaton), std::cref(sequences), i, num_threads, contained.get()));
+   }
+   for (auto it = scan_threads.begin(); it != scan_threads.end(); ++it)
+   {
+      it->join();
+   }
+
+   // Sequences are distinct and longest first, so only those longer than it,
+   // before it in the list, can contain it
+   for (auto it = others.begin(); it != others.end(); ++it)
+   {
+      for (size_t i = 0; i < sequences.size() && sequences[i].length() > sequences[*it].length() && !contained[*it]; ++i)
+      {
+         if (sequences[i].find(sequences[*it]) != std::string::npos)
+         {
+            contained[*it] = 1;
+         }
+      }
+   }
+
+   size_t kept = 0;
+   uint32_t id = 0;
+   for (size_t i = 0; i < kmers.size(); ++i)
+   {
+      if (!repeated[i] && !contained[id++])
+      {
+         if (kept != i)
+         {
+            kmers[kept] = std::move(kmers[i]);
+         }
+         kept++;
+      }
+   }
+   kmers.resize(kept);
+}
+
+// Scan thread. Marks the k-mers found in every thread_stride-th sequence,
+// other than the sequence itself. Once a k-mer is marked so are all the
+// shorter k-mers on its chain of matches, so a walk along the chain stops at
+// the first marked one
+void markSubstrings(const KmerAutomaton& automaton, const std::vector<std::string>& sequences, const size_t first, const size_t thread_stride, std::atomic<char>* contained)
+{
+   for (size_t i = first; i < sequences.size(); i += thread_stride)
+   {
+      int32_t state = automaton.root();
+      for (auto base = sequences[i].begin(); base != sequences[i].end(); ++base)
+      {
+         state = automaton.next(state, *base);
+         automaton.matches_while(state, [i, contained](const uint32_t id)
+         {
+            if (id == i)
+            {
+               return true;
+            }
+            return !contained[id].exchange(1);
+         });
+      }
+   }
+}
+
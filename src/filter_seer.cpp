@@ -40,105 +40,85 @@ int main (int argc, char *argv[])
       substr_sort.addSortField("sequence");
    }
 
-   std::list<Significant_kmer> filtered_kmers;
+   // k-mers are held for --substr, and to sort. Sorted output is bounded
+   // by --top or --max_memory
+   std::vector<Significant_kmer> filtered_kmers;
+   SortedKmers sorted_kmers(sort_kmers, options.top, options.max_memory);
 
    // Open input file, check opened ok
    try
    {
-      std::ifstream kmers_in(options.input_file.c_str());
-      if (!kmers_in)
+      SignificantKmerReader kmers_in;
+      if (!kmers_in.open(options.input_file))
       {
          throw std::runtime_error("Could not open input file " + options.input_file);
       }
       else
       {
-         // Read the header
-         std::string header;
-         std::getline(kmers_in, header);
-         int num_covar_fields = parseHeader(header);
-
-         while (kmers_in)
+         // Read each kmer, as text or binary results
+         Significant_kmer kmer(kmers_in.num_covars());
+         while (kmers_in.next(kmer))
          {
-            // Read in each kmer
-            Significant_kmer kmer(num_covar_fields);
-            kmers_in >> kmer;
-
-            if (kmers_in)
+            // Filter fields. MAF needs to include max, beta needs modulus
+            if (options.maf_filter && (kmer.maf() < options.maf_filter || 1-kmer.maf() < options.maf_filter))
             {
-               // Filter fields. MAF needs to include max, beta needs modulus
-               if (options.maf_filter && (kmer.maf() < options.maf_filter || 1-kmer.maf() < options.maf_filter))
-               {
-                  continue;
-               }
-               else if (!options.neg_beta && kmer.beta() < 0)
-               {
-                  continue;
-               }
-               else if (options.beta_filter && fabs(kmer.beta()) < options.beta_filter)
-               {
-                  continue;
-               }
-               else if (options.chi_filter && kmer.unadj() > options.chi_filter)
-               {
-                  continue;
-               }
-               else if (options.p_filter && kmer.p_val() > options.p_filter)
-               {
-                  continue;
-               }
-               // If sorted, store in mem. Otherwise print immediately
-               else if (!sort_kmers && !substr_sort)
-               {
-                  std::cout << kmer << std::endl;
-               }
-               else
-               {
-                  filtered_kmers.push_back(kmer);
-               }
+               continue;
+            }
+            else if (!options.neg_beta && kmer.beta() < 0)
+            {
+               continue;
+            }
+            else if (options.beta_filter && fabs(kmer.beta()) < options.beta_filter)
+            {
+               continue;
+            }
+            else if (options.chi_filter && kmer.unadj() > options.chi_filter)
+            {
+               continue;
+            }
+            else if (options.p_filter && kmer.p_val() > options.p_filter)
+            {
+               continue;
+            }
+            // If sorted, store in mem. Otherwise print immediately
+            else if (substr_sort)
+            {
+               filtered_kmers.push_back(kmer);
+            }
+            else if (sort_kmers)
+            {
+               sorted_kmers.add(kmer);
+            }
+            else
+            {
+               std::cout << kmer << "\n";
             }
          }
+
          // Remove substr if necessary
          if (substr_sort)
          {
-            // Sort largest to smallest
-            filtered_kmers.sort(substr_sort);
+            removeSubstrings(filtered_kmers, options.num_threads);
 
-            auto list_it = filtered_kmers.begin();
-            while (list_it != filtered_kmers.end())
+            for (auto out_it = filtered_kmers.begin(); out_it != filtered_kmers.end(); ++out_it)
             {
-               // Check in all the larger kmers that this one isn't
-               // a substring
-               bool found = 0;
-               for (auto sub_it = filtered_kmers.begin(); sub_it != list_it; ++sub_it)
+               if (sort_kmers)
                {
-                  if (sub_it->sequence().find(list_it->sequence()) != std::string::npos)
-                  {
-                     list_it = filtered_kmers.erase(list_it);
-                     found = 1;
-                     break;
-                  }
+                  sorted_kmers.add(*out_it);
                }
-
-               if (!found)
+               else
                {
-                  ++list_it;
+                  std::cout << *out_it << "\n";
                }
             }
          }
 
-         // If sorting, sort, then print
+         // If sorting, print in order
          if (sort_kmers)
          {
-            filtered_kmers.sort(sort_kmers);
-         }
-
-         if (sort_kmers || substr_sort)
-         {
-            for (auto out_it = filtered_kmers.begin(); out_it != filtered_kmers.end(); ++out_it)
-            {
-               std::cout << *out_it << std::endl;
-            }
+            sorted_kmers.print(std::cout);
          }
+         std::cout.flush();
 
          std::cerr << "Done." << std::endl;
       }
@@ -146,6 +126,7 @@ int main (int argc, char *argv[])
    catch (std::exception& e)
    {
       std::cerr << "Error: " << e.what() << std::endl;
+      return(1);
    }
 
    return(0);
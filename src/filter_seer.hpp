@@ -8,8 +8,14 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
-#include <list>
+#include <vector>
+#include <queue>
+#include <cstdio>
+#include <unordered_map>
 #include <iterator>
+#include <memory>
+#include <thread>
+#include <atomic>
 #include <stdexcept>
 #include <math.h>
 
@@ -17,6 +23,7 @@
 #include <boost/program_options.hpp>
 
 #include "significant_kmer.hpp"
+#include "kmerAutomaton.hpp"
 
 // Constants
 const std::string VERSION = "1.1.2";
@@ -27,6 +34,51 @@ struct cmdOptions
    std::string input_file, output_file, sort_field;
    double maf_filter, chi_filter, p_filter, beta_filter;
    bool neg_beta, substr_kmers;
+   size_t num_threads, top, max_memory;
+};
+
+// A k-mer to be printed in order. Its line is length bytes from offset
+struct sortRecord
+{
+   double value;
+   uint64_t order;
+   size_t offset;
+   size_t length;
+};
+
+// Classes
+class SortedKmers
+{
+   public:
+      // Keeps only the first top k-mers, or all if top is 0. Otherwise
+      // spills to temporary files over max_memory bytes, if it is not 0
+      SortedKmers(const sortSigKmer& sort_order, const size_t top, const size_t max_memory);
+      ~SortedKmers();
+
+      SortedKmers(const SortedKmers&) = delete;
+      SortedKmers& operator=(const SortedKmers&) = delete;
+
+      void add(const Significant_kmer& kmer);
+      void print(std::ostream& os);
+
+      // nonmodifying operations
+      size_t memory() const; // bytes
+
+   private:
+      void compact();
+      void spill();
+      void mergeRuns(std::ostream& os);
+
+      sortSigKmer _sort_order;
+      size_t _top;
+      size_t _max_memory;
+      uint64_t _num_added;
+
+      std::ostringstream _line;
+      std::vector<char> _lines;
+      size_t _unused; // bytes of _lines no longer in _records
+      std::vector<sortRecord> _records; // a heap with --top
+      std::vector<std::FILE*> _runs;
 };
 
 // Function prototypes
@@ -35,3 +87,8 @@ cmdOptions processCmdLine(boost::program_options::variables_map& vm);
 double fractionFilter(const std::string& filter_input);
 void printHelp(boost::program_options::options_description& help);
 
+void removeSubstrings(std::vector<Significant_kmer>& kmers, const size_t num_threads);
+void markSubstrings(const KmerAutomaton& automaton, const std::vector<std::string>& sequences, const size_t first, const size_t thread_stride, std::atomic<char>* contained);
+
+bool recordOrder(const sortRecord& a, const sortRecord& b);
+
@@ -0,0 +1,320 @@
+/*
+ * File: fixedCovariates.cpp
+ *
+ * Null model quantities shared by every k-mer's regression
+ *
+ */
+
+#include "seer.hpp"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const std::string context_magic = "SEERCTX1";
+
+FixedCovariates::FixedCovariates(const arma::vec& y, const arma::mat& covariates, const int continuous)
+   :_y(y), _x(y.n_rows, 1, arma::fill::ones), _null_sse(0), _dispersion(1)
+{
+   if (covariates.n_cols > 0)
+   {
+      _x = arma::join_rows(_x, covariates);
+   }
+   _x_t = _x.t();
+   _xtx_inv = inv_covar(_x.t() * _x);
+
+   _null_ll = nullLogLikelihood(_x, _y, continuous);
+   fitNull(continuous);
+   weightCovariates();
+}
+
+FixedCovariates::FixedCovariates(const arma::vec& y, const std::string& context_file, const std::vector<Sample>& samples, const int continuous)
+   :_y(y), _null_sse(0), _dispersion(1)
+{
+   int fd = ::open(context_file.c_str(), O_RDONLY);
+   struct stat file_info;
+   if (fd < 0 || fstat(fd, &file_info) != 0)
+   {
+      throw std::runtime_error("Could not open context file " + context_file + "\n");
+   }
+
+   const size_t map_length = file_info.st_size;
+   void* map = map_length > 0 ? mmap(NULL, map_length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+   ::close(fd);
+   if (map == MAP_FAILED)
+   {
+      throw std::runtime_error("Could not map context file " + context_file + "\n");
+   }
+   const char* context = (const char*)map;
+
+   // Reads the next field, checking it is in the file
+   size_t pos = 0;
+   auto read = [&](void* field, const size_t length)
+   {
+      if (pos + length > map_length)
+      {
+         munmap(map, map_length);
+         throw std::runtime_error("Truncated context file " + context_file + "\n");
+      }
+      memcpy(field, context + pos, length);
+      pos += length;
+   };
+   auto read_mat = [&](arma::mat& field, const size_t rows, const size_t cols)
+   {
+      field.set_size(rows, cols);
+      read(field.memptr(), rows * cols * sizeof(double));
+   };
+
+   std::string magic(context_magic.length(), '\0');
+   read(&magic[0], magic.length());
+   if (magic != context_magic)
+   {
+      munmap(map, map_length);
+      throw std::runtime_error(context_file + " is not a seer context file\n");
+   }
+
+   uint32_t num_samples, num_fixed, saved_continuous;
+   uint64_t y_hash;
+   read(&num_samples, sizeof(uint32_t));
+   read(&num_fixed, sizeof(uint32_t));
+   read(&saved_continuous, sizeof(uint32_t));
+   read(&y_hash, sizeof(uint64_t));
+
+   if (num_samples != samples.size() || num_samples != y.n_elem)
+   {
+      munmap(map, map_length);
+      throw std::runtime_error("Number of samples in context file " + context_file + " does not match the .pheno file\n");
+   }
+   for (auto it = samples.begin(); it != samples.end(); ++it)
+   {
+      uint32_t name_length;
+      read(&name_length, sizeof(uint32_t));
+
+      std::string name(name_length, '\0');
+      read(&name[0], name_length);
+      if (name != it->iid())
+      {
+         munmap(map, map_length);
+         throw std::runtime_error("Samples in context file " + context_file + " do not match the .pheno file\n");
+      }
+   }
+
+   read_mat(_x, num_samples, num_fixed);
+   read_mat(_xtx_inv, num_fixed, num_fixed);
+   _x_t = _x.t();
+
+   // Null model, only kept if it was fitted to this phenotype
+   arma::vec null_b, null_residuals, null_weights;
+   arma::mat xtwx_inv;
+   double null_sse, null_ll, dispersion;
+   read_mat(null_b, num_fixed, 1);
+   read_mat(null_residuals, num_samples, 1);
+   read_mat(null_weights, num_samples, 1);
+   read_mat(xtwx_inv, num_fixed, num_fixed);
+   read(&null_sse, sizeof(double));
+   read(&null_ll, sizeof(double));
+   read(&dispersion, sizeof(double));
+   munmap(map, map_length);
+
+   if ((int)saved_continuous == continuous && y_hash == hashPhenotype(y))
+   {
+      _null_b = null_b;
+      _null_residuals = null_residuals;
+      _null_weights = null_weights;
+      _xtwx_inv = xtwx_inv;
+      _null_sse = null_sse;
+      _null_ll = null_ll;
+      _dispersion = dispersion;
+
+      _wx_t = _x_t % repmat(_null_weights.t(), _x.n_cols, 1);
+   }
+   else
+   {
+      _null_ll = nullLogLikelihood(_x, _y, continuous);
+      fitNull(continuous);
+      weightCovariates();
+   }
+}
+
+void FixedCovariates::save(const std::string& context_file, const std::vector<Sample>& samples, const int continuous) const
+{
+   std::ofstream context(context_file.c_str(), std::ios::out | std::ios::binary);
+   if (!context)
+   {
+      throw std::runtime_error("Could not open " + context_file + " for writing\n");
+   }
+
+   auto write = [&](const void* field, const size_t length)
+   {
+      context.write((const char*)field, length);
+   };
+   auto write_mat = [&](const arma::mat& field)
+   {
+      write(field.memptr(), field.n_elem * sizeof(double));
+   };
+
+   uint32_t num_samples = _x.n_rows, num_fixed = _x.n_cols, saved_continuous = continuous;
+   uint64_t y_hash = hashPhenotype(_y);
+   write(context_magic.data(), context_magic.length());
+   write(&num_samples, sizeof(uint32_t));
+   write(&num_fixed, sizeof(uint32_t));
+   write(&saved_continuous, sizeof(uint32_t));
+   write(&y_hash, sizeof(uint64_t));
+
+   for (auto it = samples.begin(); it != samples.end(); ++it)
+   {
+      uint32_t name_length = it->iid().length();
+      write(&name_length, sizeof(uint32_t));
+      write(it->iid().data(), name_length);
+   }
+
+   write_mat(_x);
+   write_mat(_xtx_inv);
+   write_mat(_null_b);
+   write_mat(_null_residuals);
+   write_mat(_null_weights);
+   write_mat(_xtwx_inv);
+   write(&_null_sse, sizeof(double));
+   write(&_null_ll, sizeof(double));
+   write(&_dispersion, sizeof(double));
+
+   if (!context)
+   {
+      throw std::runtime_error("Could not write context file " + context_file + "\n");
+   }
+}
+
+// For score tests
+void FixedCovariates::weightCovariates()
+{
+   _wx_t = _x_t % repmat(_null_weights.t(), _x.n_cols, 1);
+   _xtwx_inv = inv_covar(_wx_t * _x);
+}
+
+// Betas of the null model, used as the starting point of each k-mer's fit,
+// and its residuals and weights
+void FixedCovariates::fitNull(const int continuous)
+{
+   if (continuous)
+   {
+      // OLS, which the linear fits are updated from
+      _null_b = _xtx_inv * (_x.t() * _y);
+      _null_residuals = _y - _x * _null_b;
+      _null_sse = accu(square(_null_residuals));
+
+      _null_weights = arma::ones(_y.n_elem);
+      _dispersion = _null_sse / (_x.n_rows - _x.n_cols);
+   }
+   else
+   {
+      // Newton-Raphson. Without the k-mer there is unlikely to be separation
+      _null_b = arma::zeros(_x.n_cols);
+      _null_b(0) = log(mean(_y)/(1 - mean(_y)));
+
+      for (unsigned int i = 0; i < max_nr_iterations; ++i)
+      {
+         arma::vec y_pred = predictLogitProbs(_x, _null_b);
+         arma::mat W = repmat(y_pred % (arma::ones(y_pred.n_rows) - y_pred), 1, _x.n_cols);
+
+         arma::mat var_covar_mat = inv_covar(_x.t() * (W % _x));
+         if (var_covar_mat.n_elem == 0)
+         {
+            break;
+         }
+
+         arma::vec step = var_covar_mat * (_x.t() * (_y - y_pred));
+         _null_b += step;
+
+         if (arma::abs(step).max() < convergence_limit)
+         {
+            break;
+         }
+      }
+
+      arma::vec y_pred = predictLogitProbs(_x, _null_b);
+      _null_residuals = _y - y_pred;
+      _null_weights = y_pred % (arma::ones(y_pred.n_rows) - y_pred);
+   }
+}
+
+arma::vec FixedCovariates::cross_product(const Presence& x) const
+{
+   return sumRows(_x_t, x);
+}
+
+arma::vec FixedCovariates::weighted_cross_product(const Presence& x) const
+{
+   return sumRows(_wx_t, x);
+}
+
+// Sum of the columns of x_t (rows of the design) for samples present
+arma::vec FixedCovariates::sumRows(const arma::mat& x_t, const Presence& x) const
+{
+   arma::vec xz = arma::zeros(x_t.n_rows);
+
+   const std::vector<uint64_t>& words = x.words();
+   for (size_t i = 0; i < words.size(); ++i)
+   {
+      uint64_t word = words[i];
+      while (word)
+      {
+         xz += x_t.col(i * presence_word_bits + __builtin_ctzll(word));
+         word &= word - 1;
+      }
+   }
+
+   return xz;
+}
+
+arma::mat FixedCovariates::design(const Presence& x) const
+{
+   arma::mat x_design;
+   design(x, x_design);
+
+   return x_design;
+}
+
+// Only the k-mer column is rewritten if x_design is already the right size,
+// so the other columns must be from an earlier call
+void FixedCovariates::design(const Presence& x, arma::mat& x_design) const
+{
+   if (x_design.n_rows != _x.n_rows || x_design.n_cols != _x.n_cols + 1)
+   {
+      x_design.set_size(_x.n_rows, _x.n_cols + 1);
+      x_design.col(0) = _x.col(0);
+      if (_x.n_cols > 1)
+      {
+         x_design.cols(2, _x.n_cols) = _x.cols(1, _x.n_cols - 1);
+      }
+   }
+   x_design.col(1).zeros();
+
+   const std::vector<uint64_t>& words = x.words();
+   for (size_t i = 0; i < words.size(); ++i)
+   {
+      uint64_t word = words[i];
+      while (word)
+      {
+         x_design(i * presence_word_bits + __builtin_ctzll(word), 1) = 1;
+         word &= word - 1;
+      }
+   }
+}
+
+// FNV-1a of the phenotype values, to check a saved null model was fitted to
+// the same phenotype
+uint64_t hashPhenotype(const arma::vec& y)
+{
+   uint64_t hash = 14695981039346656037ULL;
+   const unsigned char* bytes = (const unsigned char*)y.memptr();
+   for (size_t i = 0; i < y.n_elem * sizeof(double); ++i)
+   {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+   }
+
+   return hash;
+}
@@ -0,0 +1,82 @@
+/*
+ * fixedCovariates.hpp
+ * Header file for the fixed covariates class
+ *
+ * These can be saved as an analysis context file (--save_context), so later
+ * runs with the same samples and covariates can skip reading and fitting
+ * them. Integers and doubles are in host byte order.
+ *
+ *    magic        8 bytes, "SEERCTX1"
+ *    num_samples  uint32
+ *    num_fixed    uint32, columns of X including the intercept
+ *    continuous   uint32
+ *    y_hash       uint64, of the phenotype the null model was fitted to
+ *    samples      num_samples x (uint32 length, name), in pheno file order
+ *    X, (X'X)^-1, null betas, null residuals, null weights, (X'WX)^-1
+ *                 doubles, column major
+ *    null SSE, null log-likelihood, dispersion
+ *                 doubles
+ *
+ */
+
+// The part of each k-mer's regression that is the same for every k-mer: the
+// intercept and any MDS components or covariates, and the null model fitted
+// to them. Built once per run, so each k-mer fit only has to add its own
+// column
+class FixedCovariates
+{
+   public:
+      // Initialisation. covariates may have no columns
+      FixedCovariates(const arma::vec& y, const arma::mat& covariates, const int continuous);
+      // From a saved context. The samples must be the same, and in the same
+      // order. The null model is only refitted if y is not the phenotype it
+      // was saved with
+      FixedCovariates(const arma::vec& y, const std::string& context_file, const std::vector<Sample>& samples, const int continuous);
+
+      void save(const std::string& context_file, const std::vector<Sample>& samples, const int continuous) const;
+
+      // nonmodifying operations
+      const arma::vec& y() const { return _y; }
+      size_t num_samples() const { return _y.n_elem; }
+      size_t num_fixed() const { return _x.n_cols; } // including the intercept
+      const arma::mat& x_t() const { return _x_t; } // [1, covariates]', one column per sample
+      double null_ll() const { return _null_ll; }
+
+      const arma::mat& xtx_inv() const { return _xtx_inv; } // (X'X)^-1
+      const arma::vec& null_b() const { return _null_b; }
+      const arma::vec& null_residuals() const { return _null_residuals; } // y - fitted values
+      double null_sse() const { return _null_sse; } // continuous only
+
+      // IRLS weights W of the null fit (all one for linear), and dispersion
+      const arma::vec& null_weights() const { return _null_weights; }
+      double dispersion() const { return _dispersion; }
+      const arma::mat& xtwx_inv() const { return _xtwx_inv; } // (X'WX)^-1
+
+      arma::vec cross_product(const Presence& x) const; // X'z for the k-mer column z
+      arma::vec weighted_cross_product(const Presence& x) const; // X'Wz
+      arma::mat design(const Presence& x) const; // [1, z, covariates]
+      void design(const Presence& x, arma::mat& x_design) const; // Reusing x_design, if made by this
+
+   private:
+      void fitNull(const int continuous);
+      void weightCovariates();
+      arma::vec sumRows(const arma::mat& x_t, const Presence& x) const;
+
+      arma::vec _y;
+      arma::mat _x; // [1, covariates]
+      arma::mat _x_t; // rows of _x contiguous, for cross_product
+      arma::mat _xtx_inv;
+
+      arma::vec _null_b;
+      arma::vec _null_residuals;
+      double _null_sse;
+      double _null_ll;
+
+      arma::vec _null_weights;
+      double _dispersion;
+      arma::mat _wx_t; // as _x_t, with rows weighted by W
+      arma::mat _xtwx_inv;
+};
+
+uint64_t hashPhenotype(const arma::vec& y);
+
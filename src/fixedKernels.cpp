@@ -0,0 +1,176 @@
+/*
+ * File: fixedKernels.cpp
+ *
+ * Cholesky inversion and information matrix accumulation for designs of up
+ * to max_fixed_cols columns, with the width as a template parameter
+ *
+ */
+
+#include "seercommon.hpp"
+
+// Inverse of the symmetric P x P matrix A, by Cholesky factorisation A = LL'
+// then A^-1 = L^-T L^-1. Returns false, leaving inverse unchanged, if A is
+// not positive definite
+template <unsigned int P>
+bool invSympdFixed(arma::mat& inverse, const arma::mat& A)
+{
+   arma::mat::fixed<P, P> L;
+   for (unsigned int j = 0; j < P; ++j)
+   {
+      double pivot = A.at(j, j);
+      for (unsigned int k = 0; k < j; ++k)
+      {
+         pivot -= L.at(j, k) * L.at(j, k);
+      }
+      if (!(pivot > 0) || !std::isfinite(pivot))
+      {
+         return false;
+      }
+      L.at(j, j) = sqrt(pivot);
+
+      for (unsigned int i = j + 1; i < P; ++i)
+      {
+         double sum = A.at(i, j);
+         for (unsigned int k = 0; k < j; ++k)
+         {
+            sum -= L.at(i, k) * L.at(j, k);
+         }
+         L.at(i, j) = sum / L.at(j, j);
+      }
+   }
+
+   // L^-1, which is also lower triangular
+   arma::mat::fixed<P, P> L_inv;
+   for (unsigned int j = 0; j < P; ++j)
+   {
+      L_inv.at(j, j) = 1 / L.at(j, j);
+      for (unsigned int i = j + 1; i < P; ++i)
+      {
+         double sum = 0;
+         for (unsigned int k = j; k < i; ++k)
+         {
+            sum -= L.at(i, k) * L_inv.at(k, j);
+         }
+         L_inv.at(i, j) = sum / L.at(i, i);
+      }
+   }
+
+   inverse.set_size(P, P);
+   for (unsigned int j = 0; j < P; ++j)
+   {
+      for (unsigned int i = j; i < P; ++i)
+      {
+         double sum = 0;
+         for (unsigned int k = i; k < P; ++k)
+         {
+            sum += L_inv.at(k, i) * L_inv.at(k, j);
+         }
+         inverse.at(i, j) = sum;
+         inverse.at(j, i) = sum;
+      }
+   }
+
+   return true;
+}
+
+// X'WX for the n x P matrix x, in one pass over its rows. The upper triangle
+// is summed in registers. w may be NULL, for X'X
+template <unsigned int P>
+void crossProductFixed(const arma::mat& x, const double* w, arma::mat& xtwx)
+{
+   double sums[P * (P + 1) / 2] = {};
+   const double* cols[P];
+   for (unsigned int j = 0; j < P; ++j)
+   {
+      cols[j] = x.colptr(j);
+   }
+
+   for (size_t i = 0; i < x.n_rows; ++i)
+   {
+      double x_i[P];
+      for (unsigned int j = 0; j < P; ++j)
+      {
+         x_i[j] = cols[j][i];
+      }
+
+      const double weight = w == NULL ? 1 : w[i];
+      unsigned int pair = 0;
+      for (unsigned int j = 0; j < P; ++j)
+      {
+         const double wx_j = weight * x_i[j];
+         for (unsigned int l = j; l < P; ++l)
+         {
+            sums[pair++] += wx_j * x_i[l];
+         }
+      }
+   }
+
+   xtwx.set_size(P, P);
+   unsigned int pair = 0;
+   for (unsigned int j = 0; j < P; ++j)
+   {
+      for (unsigned int l = j; l < P; ++l)
+      {
+         xtwx.at(j, l) = sums[pair];
+         xtwx.at(l, j) = sums[pair++];
+      }
+   }
+}
+
+// Kernels by number of columns
+typedef bool (*invKernel)(arma::mat&, const arma::mat&);
+const invKernel inv_kernels[max_fixed_cols + 1] = {NULL,
+   invSympdFixed<1>, invSympdFixed<2>, invSympdFixed<3>, invSympdFixed<4>,
+   invSympdFixed<5>, invSympdFixed<6>, invSympdFixed<7>, invSympdFixed<8>,
+   invSympdFixed<9>, invSympdFixed<10>, invSympdFixed<11>, invSympdFixed<12>,
+   invSympdFixed<13>, invSympdFixed<14>, invSympdFixed<15>, invSympdFixed<16>};
+
+typedef void (*crossKernel)(const arma::mat&, const double*, arma::mat&);
+const crossKernel cross_kernels[max_fixed_cols + 1] = {NULL,
+   crossProductFixed<1>, crossProductFixed<2>, crossProductFixed<3>, crossProductFixed<4>,
+   crossProductFixed<5>, crossProductFixed<6>, crossProductFixed<7>, crossProductFixed<8>,
+   crossProductFixed<9>, crossProductFixed<10>, crossProductFixed<11>, crossProductFixed<12>,
+   crossProductFixed<13>, crossProductFixed<14>, crossProductFixed<15>, crossProductFixed<16>};
+
+// Returns false if A can't be inverted by Cholesky decomposition
+bool invSympd(arma::mat& inverse, const arma::mat& A)
+{
+   if (A.n_rows == A.n_cols && A.n_rows > 0 && A.n_rows <= max_fixed_cols)
+   {
+      return inv_kernels[A.n_rows](inverse, A);
+   }
+   else
+   {
+      return arma::inv_sympd(inverse, A);
+   }
+}
+
+void crossProduct(const arma::mat& x, arma::mat& xtx)
+{
+   if (x.n_cols > 0 && x.n_cols <= max_fixed_cols)
+   {
+      cross_kernels[x.n_cols](x, NULL, xtx);
+   }
+   else
+   {
+      xtx = x.t() * x;
+   }
+}
+
+void weightedCrossProduct(const arma::mat& x, const arma::vec& w, arma::mat& xtwx)
+{
+   if (x.n_cols > 0 && x.n_cols <= max_fixed_cols)
+   {
+      cross_kernels[x.n_cols](x, w.memptr(), xtwx);
+   }
+   else
+   {
+      // WX, as W is diagonal
+      arma::mat w_x(x.n_rows, x.n_cols);
+      for (unsigned int j = 0; j < x.n_cols; ++j)
+      {
+         w_x.col(j) = w % x.col(j);
+      }
+      xtwx = x.t() * w_x;
+   }
+}
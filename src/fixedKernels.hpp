@@ -0,0 +1,19 @@
+/*
+ * fixedKernels.hpp
+ * Header file for the regression kernels specialised on design width
+ *
+ * seer's designs are the intercept, the k-mer and usually a few MDS
+ * components or covariates. Up to max_fixed_cols columns, information
+ * matrices and their inverses are computed in fixed size storage, with loops
+ * the compiler can unroll for that width. The kernel is picked at runtime by
+ * the number of columns, and wider designs use armadillo's dynamic path
+ *
+ */
+
+// Constants
+const unsigned int max_fixed_cols = 16;
+
+// Functions
+bool invSympd(arma::mat& inverse, const arma::mat& A); // As arma::inv_sympd
+void crossProduct(const arma::mat& x, arma::mat& xtx); // X'X
+void weightedCrossProduct(const arma::mat& x, const arma::vec& w, arma::mat& xtwx); // X'WX, for diagonal W
@@ -0,0 +1,461 @@
+/*
+ * File: fmIndex.cpp
+ *
+ * Builds and searches the FM-index of an assembly
+ *
+ */
+
+#include "fmIndex.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+/*
+ * FmIndex
+ */
+FmIndex::FmIndex()
+   :_data(NULL), _data_length(0), _size(0), _bwt(NULL), _first(NULL), _occ(NULL), _sampled_rows(NULL), _sampled_rank(NULL), _samples(NULL),
+   _exception_rows(NULL), _exception_rank(NULL), _exceptions(NULL)
+{
+}
+
+FmIndex::FmIndex(const std::vector<uint8_t>& text)
+{
+   if (text.size() + 1 > INT_MAX)
+   {
+      throw std::runtime_error("Assembly too large to index");
+   }
+   const int n = text.size() + 1;
+
+   // Suffix array, with the sentinel last
+   std::vector<int> symbols(text.begin(), text.end());
+   symbols.push_back(fm_sentinel);
+   std::vector<int> sa(n);
+   suffixArray(symbols.data(), sa.data(), n, fm_alphabet);
+
+   // BWT, occurrence counts and samples in one pass
+   std::vector<uint64_t> bwt(n / 32 + 1, 0);
+   std::vector<uint32_t> occ((n / fm_occ_block + 1) * fm_alphabet, 0);
+   std::vector<uint64_t> sampled_rows(n / 64 + 1, 0);
+   std::vector<uint32_t> samples;
+   samples.reserve(n / fm_sample_rate + 1);
+   std::vector<uint64_t> exception_rows(n / 64 + 1, 0);
+   std::vector<uint8_t> exceptions;
+
+   std::vector<uint32_t> counts(fm_alphabet, 0);
+   for (int i = 0; i < n; ++i)
+   {
+      if (i % fm_occ_block == 0)
+      {
+         std::copy(counts.begin(), counts.end(), occ.begin() + (i / fm_occ_block) * fm_alphabet);
+      }
+
+      uint8_t c = sa[i] == 0 ? fm_sentinel : symbols[sa[i] - 1];
+      if (fmBase(c))
+      {
+         bwt[i / 32] |= (uint64_t)(c - fmSymbol('A')) << (2 * (i % 32));
+      }
+      else
+      {
+         exception_rows[i / 64] |= (uint64_t)1 << (i % 64);
+         exceptions.push_back(c);
+      }
+      counts[c]++;
+
+      if (sa[i] % fm_sample_rate == 0)
+      {
+         sampled_rows[i / 64] |= (uint64_t)1 << (i % 64);
+         samples.push_back(sa[i]);
+      }
+   }
+   if (n % fm_occ_block == 0)
+   {
+      std::copy(counts.begin(), counts.end(), occ.begin() + (n / fm_occ_block) * fm_alphabet);
+   }
+
+   std::vector<uint64_t> first(fm_alphabet, 0);
+   for (unsigned int c = 1; c < fm_alphabet; ++c)
+   {
+      first[c] = first[c - 1] + counts[c - 1];
+   }
+
+   std::vector<uint32_t> sampled_rank = rowRanks(sampled_rows);
+   std::vector<uint32_t> exception_rank = rowRanks(exception_rows);
+
+   // Lay out the block
+   const size_t length = fmBlockLength(n, samples.size(), exceptions.size());
+   _storage.assign(length / sizeof(uint64_t), 0);
+   char* block = (char*)_storage.data();
+
+   uint64_t header[3] = {(uint64_t)n, samples.size(), exceptions.size()};
+   size_t pos = 0;
+   auto append = [&block, &pos](const void* section, const size_t section_length)
+   {
+      memcpy(block + pos, section, section_length);
+      pos += section_length;
+   };
+   append(header, sizeof(header));
+   append(first.data(), first.size() * sizeof(uint64_t));
+   append(sampled_rows.data(), sampled_rows.size() * sizeof(uint64_t));
+   append(exception_rows.data(), exception_rows.size() * sizeof(uint64_t));
+   append(bwt.data(), bwt.size() * sizeof(uint64_t));
+   append(occ.data(), occ.size() * sizeof(uint32_t));
+   append(sampled_rank.data(), sampled_rank.size() * sizeof(uint32_t));
+   append(exception_rank.data(), exception_rank.size() * sizeof(uint32_t));
+   append(samples.data(), samples.size() * sizeof(uint32_t));
+   append(exceptions.data(), exceptions.size());
+
+   map(block, length);
+}
+
+FmIndex::FmIndex(const char* data, const size_t length)
+{
+   map(data, length);
+}
+
+// Points the sections at a block laid out as in fmIndex.hpp
+void FmIndex::map(const char* data, const size_t length)
+{
+   uint64_t header[3];
+   if (length < sizeof(header))
+   {
+      throw std::runtime_error("Truncated FM-index");
+   }
+   memcpy(header, data, sizeof(header));
+   if (fmBlockLength(header[0], header[1], header[2]) != length)
+   {
+      throw std::runtime_error("Truncated FM-index");
+   }
+
+   _data = data;
+   _data_length = length;
+   _size = header[0];
+
+   const uint64_t rows_words = _size / 64 + 1;
+   const char* pos = data + sizeof(header);
+   _first = (const uint64_t*)pos;
+   pos += fm_alphabet * sizeof(uint64_t);
+   _sampled_rows = (const uint64_t*)pos;
+   pos += rows_words * sizeof(uint64_t);
+   _exception_rows = (const uint64_t*)pos;
+   pos += rows_words * sizeof(uint64_t);
+   _bwt = (const uint64_t*)pos;
+   pos += (_size / 32 + 1) * sizeof(uint64_t);
+   _occ = (const uint32_t*)pos;
+   pos += (_size / fm_occ_block + 1) * fm_alphabet * sizeof(uint32_t);
+   _sampled_rank = (const uint32_t*)pos;
+   pos += rows_words * sizeof(uint32_t);
+   _exception_rank = (const uint32_t*)pos;
+   pos += rows_words * sizeof(uint32_t);
+   _samples = (const uint32_t*)pos;
+   pos += header[1] * sizeof(uint32_t);
+   _exceptions = (const uint8_t*)pos;
+}
+
+// Backward search for the rows of the suffixes starting with pattern, then
+// walks each back to a sampled row to find its position
+std::vector<uint64_t> FmIndex::locate(const std::string& pattern) const
+{
+   std::vector<uint64_t> positions;
+   if (pattern.empty() || _size == 0)
+   {
+      return positions;
+   }
+
+   uint64_t start = 0, end = _size;
+   for (auto it = pattern.rbegin(); it != pattern.rend() && start < end; ++it)
+   {
+      uint8_t c = fmSymbol(*it);
+      start = _first[c] + rank(c, start);
+      end = _first[c] + rank(c, end);
+   }
+
+   for (uint64_t row = start; row < end; ++row)
+   {
+      uint64_t sa_row = row, steps = 0;
+      while (!sampled(sa_row))
+      {
+         sa_row = lf(sa_row);
+         steps++;
+      }
+      positions.push_back(_samples[sample_rank(sa_row)] + steps);
+   }
+
+   return positions;
+}
+
+// From the count at the start of the block. Bases are counted 32 rows at a
+// time in the packed BWT; exception rows are stored as A, so are taken off
+// its count. Other symbols are only in the exception rows
+uint64_t FmIndex::rank(const uint8_t c, const uint64_t row) const
+{
+   const uint64_t block_start = row / fm_occ_block * fm_occ_block;
+   uint64_t occurrences = _occ[row / fm_occ_block * fm_alphabet + c];
+
+   if (fmBase(c))
+   {
+      const uint64_t pattern = (c - fmSymbol('A')) * 0x5555555555555555ULL;
+      for (uint64_t word = block_start / 32; word * 32 < row; ++word)
+      {
+         uint64_t diff = _bwt[word] ^ pattern;
+         uint64_t matches = ~(diff | (diff >> 1)) & 0x5555555555555555ULL; // low bit of each equal row
+         if (row - word * 32 < 32)
+         {
+            matches &= ((uint64_t)1 << (2 * (row - word * 32))) - 1;
+         }
+         occurrences += __builtin_popcountll(matches);
+      }
+      if (c == fmSymbol('A'))
+      {
+         occurrences -= exception_rank(row) - exception_rank(block_start);
+      }
+   }
+   else
+   {
+      for (uint64_t i = exception_rank(block_start), end = exception_rank(row); i < end; ++i)
+      {
+         occurrences += _exceptions[i] == c;
+      }
+   }
+
+   return occurrences;
+}
+
+// Row of the suffix one position earlier in the text
+uint64_t FmIndex::lf(const uint64_t row) const
+{
+   uint8_t c = symbol(row);
+   return _first[c] + rank(c, row);
+}
+
+uint8_t FmIndex::symbol(const uint64_t row) const
+{
+   if ((_exception_rows[row / 64] >> (row % 64)) & 1)
+   {
+      return _exceptions[exception_rank(row)];
+   }
+   return fmSymbol('A') + ((_bwt[row / 32] >> (2 * (row % 32))) & 3);
+}
+
+int FmIndex::sampled(const uint64_t row) const
+{
+   return (_sampled_rows[row / 64] >> (row % 64)) & 1;
+}
+
+uint64_t FmIndex::sample_rank(const uint64_t row) const
+{
+   uint64_t below = ((uint64_t)1 << (row % 64)) - 1;
+   return _sampled_rank[row / 64] + __builtin_popcountll(_sampled_rows[row / 64] & below);
+}
+
+uint64_t FmIndex::exception_rank(const uint64_t row) const
+{
+   uint64_t below = ((uint64_t)1 << (row % 64)) - 1;
+   return _exception_rank[row / 64] + __builtin_popcountll(_exception_rows[row / 64] & below);
+}
+
+/*
+ * Functions
+ */
+// Bytes in the block of an index of n rows, rounded up to whole uint64
+size_t fmBlockLength(const uint64_t n, const uint64_t num_samples, const uint64_t num_exceptions)
+{
+   const uint64_t rows_words = n / 64 + 1;
+   size_t length = (3 + fm_alphabet + 2 * rows_words + n / 32 + 1) * sizeof(uint64_t)
+      + ((n / fm_occ_block + 1) * fm_alphabet + 2 * rows_words + num_samples) * sizeof(uint32_t)
+      + num_exceptions;
+
+   return (length + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+}
+
+// Rank of the set bits before each word, for a bit per row
+std::vector<uint32_t> rowRanks(const std::vector<uint64_t>& rows)
+{
+   std::vector<uint32_t> ranks(rows.size());
+   uint32_t before = 0;
+   for (size_t i = 0; i < rows.size(); ++i)
+   {
+      ranks[i] = before;
+      before += __builtin_popcountll(rows[i]);
+   }
+   return ranks;
+}
+
+uint8_t fmSymbol(const char base)
+{
+   switch (base)
+   {
+      case 'A':
+         return 2;
+      case 'C':
+         return 3;
+      case 'G':
+         return 4;
+      case 'T':
+         return 5;
+      default:
+         return fm_other;
+   }
+}
+
+int fmBase(const uint8_t symbol)
+{
+   return symbol >= fmSymbol('A') && symbol <= fmSymbol('T');
+}
+
+// Start (or end) of each symbol's bucket in the suffix array
+void saBuckets(const int* text, std::vector<int>& buckets, const int n, const int end)
+{
+   std::fill(buckets.begin(), buckets.end(), 0);
+   for (int i = 0; i < n; ++i)
+   {
+      buckets[text[i]]++;
+   }
+
+   int sum = 0;
+   for (size_t c = 0; c < buckets.size(); ++c)
+   {
+      sum += buckets[c];
+      buckets[c] = end ? sum : sum - buckets[c];
+   }
+}
+
+// Sorts the L-type suffixes, then the S-type, from those already in sa
+void saInduce(const int* text, int* sa, const std::vector<char>& s_type, std::vector<int>& buckets, const int n)
+{
+   saBuckets(text, buckets, n, 0);
+   for (int i = 0; i < n; ++i)
+   {
+      int j = sa[i] - 1;
+      if (j >= 0 && !s_type[j])
+      {
+         sa[buckets[text[j]]++] = j;
+      }
+   }
+
+   saBuckets(text, buckets, n, 1);
+   for (int i = n - 1; i >= 0; --i)
+   {
+      int j = sa[i] - 1;
+      if (j >= 0 && s_type[j])
+      {
+         sa[--buckets[text[j]]] = j;
+      }
+   }
+}
+
+// SA-IS (Nong, Zhang & Chan 2009). text[n - 1] must be a unique smallest
+// symbol, and all symbols are less than alphabet
+void suffixArray(const int* text, int* sa, const int n, const int alphabet)
+{
+   if (n == 1)
+   {
+      sa[0] = 0;
+      return;
+   }
+
+   // S-type suffixes are smaller than the next suffix
+   std::vector<char> s_type(n, 0);
+   s_type[n - 1] = 1;
+   for (int i = n - 2; i >= 0; --i)
+   {
+      s_type[i] = text[i] < text[i + 1] || (text[i] == text[i + 1] && s_type[i + 1]);
+   }
+   auto leftmost_s = [&s_type](const int i) { return i > 0 && s_type[i] && !s_type[i - 1]; };
+
+   // Sort the LMS substrings, by inducing from the LMS suffixes in any order
+   std::vector<int> buckets(alphabet);
+   std::fill(sa, sa + n, -1);
+   saBuckets(text, buckets, n, 1);
+   for (int i = 1; i < n; ++i)
+   {
+      if (leftmost_s(i))
+      {
+         sa[--buckets[text[i]]] = i;
+      }
+   }
+   saInduce(text, sa, s_type, buckets, n);
+
+   // Name the sorted LMS substrings, equal substrings getting the same name
+   int n1 = 0;
+   for (int i = 0; i < n; ++i)
+   {
+      if (leftmost_s(sa[i]))
+      {
+         sa[n1++] = sa[i];
+      }
+   }
+   std::fill(sa + n1, sa + n, -1);
+
+   int name = 0, prev = -1;
+   for (int i = 0; i < n1; ++i)
+   {
+      int pos = sa[i];
+      int diff = 0;
+      for (int d = 0; d < n; ++d)
+      {
+         if (prev == -1 || text[pos + d] != text[prev + d] || s_type[pos + d] != s_type[prev + d])
+         {
+            diff = 1;
+            break;
+         }
+         else if (d > 0 && (leftmost_s(pos + d) || leftmost_s(prev + d)))
+         {
+            break;
+         }
+      }
+      if (diff)
+      {
+         name++;
+         prev = pos;
+      }
+      sa[n1 + pos / 2] = name - 1;
+   }
+   for (int i = n - 1, j = n - 1; i >= n1; --i)
+   {
+      if (sa[i] >= 0)
+      {
+         sa[j--] = sa[i];
+      }
+   }
+
+   // Sort the LMS suffixes, recursing if any names are repeated
+   int* sa1 = sa;
+   int* text1 = sa + n - n1;
+   if (name < n1)
+   {
+      suffixArray(text1, sa1, n1, name);
+   }
+   else
+   {
+      for (int i = 0; i < n1; ++i)
+      {
+         sa1[text1[i]] = i;
+      }
+   }
+
+   // Induce the full suffix array from the sorted LMS suffixes
+   saBuckets(text, buckets, n, 1);
+   for (int i = 1, j = 0; i < n; ++i)
+   {
+      if (leftmost_s(i))
+      {
+         text1[j++] = i;
+      }
+   }
+   for (int i = 0; i < n1; ++i)
+   {
+      sa1[i] = text1[sa1[i]];
+   }
+   std::fill(sa + n1, sa + n, -1);
+   for (int i = n1 - 1; i >= 0; --i)
+   {
+      int j = sa[i];
+      sa[i] = -1;
+      sa[--buckets[text[j]]] = j;
+   }
+   saInduce(text, sa, s_type, buckets, n);
+}
+
@@ -0,0 +1,107 @@
+/*
+ * fmIndex.hpp
+ * Header file for the FM-index used by map_back
+ *
+ * A compressed full-text index of an assembly's contigs, concatenated with
+ * separators. Counting the matches of a pattern takes O(pattern length), and
+ * each match is then located in at most fm_sample_rate steps. The text
+ * itself isn't kept
+ *
+ * The suffix array is built with SA-IS, in linear time, then only every
+ * fm_sample_rate'th text position of it is kept. The BWT is packed 2 bits per
+ * row (A=0 C=1 G=2 T=3). Rows of any other symbol (the
+ * sentinel, separators and bases other than ACGT) are stored as A and marked
+ * in an exception mask, with their symbols kept separately in row order.
+ * Symbol counts are every fm_occ_block rows. All told this is about 7 bits
+ * per base, less than the text at one byte per base
+ *
+ * All of the index is held in one block, which can be written out and used
+ * in place from a memory map (see referenceCache.hpp). Sections are
+ * uint64 then uint32 arrays then bytes, so stay 8 byte aligned
+ *    size            uint64, n (text and the sentinel)
+ *    num_samples     uint64
+ *    num_exceptions  uint64
+ *    first           fm_alphabet uint64
+ *    sampled rows    n / 64 + 1 uint64
+ *    exception rows  n / 64 + 1 uint64
+ *    BWT             n / 32 + 1 uint64, row i in bits 2 * (i % 32) of word i / 32
+ *    occ             (n / fm_occ_block + 1) * fm_alphabet uint32
+ *    sampled rank    n / 64 + 1 uint32
+ *    exception rank  n / 64 + 1 uint32
+ *    samples         num_samples uint32
+ *    exceptions      num_exceptions bytes, symbols of the exception rows,
+ *                    padded to 8
+ *
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Constants
+const unsigned int fm_sample_rate = 32; // text positions between suffix array samples
+const unsigned int fm_occ_block = 256; // BWT rows between occurrence counts. A multiple of 64
+// Symbols. Bases other than ACGT (N, IUPAC codes, lower case) are all
+// fm_other, and contigs are separated by fm_separator
+const uint8_t fm_sentinel = 0;
+const uint8_t fm_separator = 1;
+const uint8_t fm_other = 6;
+const unsigned int fm_alphabet = 7;
+
+class FmIndex
+{
+   public:
+      // Initialisation. text is the contigs as symbols (from fmSymbol), each
+      // followed by fm_separator
+      FmIndex();
+      FmIndex(const std::vector<uint8_t>& text);
+      // An index already built, as given by data(). Not copied, so must
+      // outlive this
+      FmIndex(const char* data, const size_t length);
+
+      FmIndex(const FmIndex&) = delete;
+      FmIndex& operator=(const FmIndex&) = delete;
+
+      // Start positions in text of every match to pattern, in no particular
+      // order
+      std::vector<uint64_t> locate(const std::string& pattern) const;
+
+      // nonmodifying operations
+      size_t size() const { return _size; } // text, and the sentinel
+      const char* data() const { return _data; }
+      size_t data_length() const { return _data_length; }
+
+   private:
+      void map(const char* data, const size_t length);
+
+      uint64_t rank(const uint8_t c, const uint64_t row) const; // occurrences of c in BWT rows [0, row)
+      uint64_t lf(const uint64_t row) const;
+      uint8_t symbol(const uint64_t row) const;
+      int sampled(const uint64_t row) const;
+      uint64_t sample_rank(const uint64_t row) const; // sampled rows before row
+      uint64_t exception_rank(const uint64_t row) const; // exception rows before row
+
+      std::vector<uint64_t> _storage; // the block, if built rather than mapped
+      const char* _data;
+      size_t _data_length;
+
+      uint64_t _size;
+      const uint64_t* _bwt; // 2 bits per row
+      const uint64_t* _first; // first row of each symbol's suffixes
+      const uint32_t* _occ; // fm_alphabet counts per block
+      const uint64_t* _sampled_rows; // bit per row
+      const uint32_t* _sampled_rank; // per 64 rows
+      const uint32_t* _samples; // suffix array, at the sampled rows
+      const uint64_t* _exception_rows; // bit per row, of symbols other than ACGT
+      const uint32_t* _exception_rank; // per 64 rows
+      const uint8_t* _exceptions; // symbols of the exception rows
+};
+
+// Functions
+size_t fmBlockLength(const uint64_t n, const uint64_t num_samples, const uint64_t num_exceptions);
+std::vector<uint32_t> rowRanks(const std::vector<uint64_t>& rows);
+uint8_t fmSymbol(const char base);
+int fmBase(const uint8_t symbol); // ACGT, rather than an exception
+void suffixArray(const int* text, int* sa, const int n, const int alphabet);
+
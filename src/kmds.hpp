@@ -7,33 +7,113 @@
 
 // Common headers
 #include "seercommon.hpp"
+#include "blockingQueue.hpp"
 
 // C/C++ std headers
 #include <random>
-#include <queue>
 #include <future>
+#include <atomic>
+#include <memory>
 
 // Constants
 //    Default options
 const int pc_default = 10;
 const long int size_default = 1000000;
+//    Distance matrix blocking
+const unsigned int distance_tile_size = 64; // Samples per side of a tile
+const size_t distance_block_words = 256; // 64-bit words of k-mers per pass over a tile
+//    Eigensolver
+const double lanczos_tolerance = 1e-10; // Ritz residuals, relative to the largest eigenvalue
+const unsigned int lanczos_check_steps = 10; // Lanczos steps between convergence checks
+const unsigned int lanczos_seed = 1;
+//    Kinship
+const double kinship_tolerance = 1e-10; // Smallest eigenvalue kept, relative to the largest
+const std::string kinship_suffix = ".kinship";
+//    Streaming distances
+const size_t distance_stream_words = 64; // k-mers buffered per sample before adding to distances, in 64-bit words
+//    Filtering pass
+const size_t kmds_batch_size = 1024; // lines read and filtered together
+const unsigned int kmds_queue_depth = 4; // batches waiting to be filtered, per worker
+const unsigned int kmds_reorder_depth = 8; // batches filtered ahead of the next one to write, per worker
 
 // Structs
-struct DistanceElement
+// Lines (or .kmx records) read together, and what the workers found in them.
+// The first num_raw of raw are used, so that the strings after them keep
+// their storage when batches are recycled
+struct kmdsBatch
 {
-   unsigned int row;
-   unsigned int col;
-   double distance;
+   long int order;
+   std::vector<std::string> raw;
+   size_t num_raw;
+
+   std::string filtered; // raw lines or records passing the filters, to be written
+   size_t num_filtered;
+   std::vector<Presence> sampled; // k-mers for the MDS, in input order
+   size_t num_sampled;
+
+   // Position after the batch's last line, for checkpoints
+   long int input_line;
+   uint64_t block_offset;
+   long int block_line;
+};
+
+// Classes
+// Sums Hamming distances between samples over a stream of k-mers, so only the
+// n x n distance matrix is held however many k-mers are used. k-mers are
+// buffered as per-sample bitsets and added to the counts in blocks
+class DistanceAccumulator
+{
+   public:
+      DistanceAccumulator(const size_t num_samples, const unsigned int threads);
+
+      void add(const Presence& x);
+
+      // nonmodifying operations
+      long int num_kmers() const { return _num_kmers; }
+
+      // Distances normalised by the number of k-mers added, as from
+      // dissimiliarityMatrix, or the raw counts (as from hammingCounts).
+      // Only one of these can be taken, once
+      arma::mat distances();
+      arma::mat counts();
+
+      // The counts so far, for checkpoints
+      void save(std::ostream& os);
+      void load(std::istream& is);
+
+   private:
+      void flush();
+
+      size_t _num_samples;
+      unsigned int _threads;
+      std::vector<uint64_t> _bits;
+      size_t _buffered;
+      long int _num_kmers;
+      arma::mat _counts;
 };
 
 // kmdsCmdLine headers
 int parseCommandLine (int argc, char *argv[], boost::program_options::variables_map& vm);
 void printHelp(boost::program_options::options_description& help);
 
+// kmdsThreads headers
+void readBatches(DsmReader& dsm_reader, BlockingQueue<kmdsBatch>& work_queue, RecyclePool<kmdsBatch>& recycled, long int input_line);
+void filterBatches(BlockingQueue<kmdsBatch>& work_queue, ReorderBuffer<kmdsBatch>& results, const DsmReader& dsm_reader, const cmdOptions& parameters, const int stream_distances);
+
 // kmdsStruct headers
 arma::mat metricMDS(const arma::mat& populationMatrix, const int dimensions, const unsigned int threads, const std::string& distances_file = "");
+arma::mat distanceMDS(arma::mat B, const int dimensions, const std::string& distances_file = "");
+void writeStructure(arma::mat P, const std::vector<Sample>& samples, const cmdOptions& options, const std::string& dsm_file, const std::string& distances_file, const std::string& kinship_file);
+void centreDistances(arma::mat& B, const std::string& distances_file = "");
+arma::mat centredMDS(const arma::mat& B, const int dimensions);
+arma::mat kinshipFactor(const arma::mat& B, const unsigned int rank = 0);
+void doubleCentre(arma::mat& P);
+void lanczosEigs(const arma::mat& A, const unsigned int k, arma::vec& eigval, arma::mat& eigvec);
 arma::mat dissimiliarityMatrix(const arma::mat& inMat, const unsigned int threads);
+arma::mat hammingCounts(const arma::mat& inMat, const unsigned int threads);
 
-std::vector<DistanceElement> threadDistance(std::vector<DistanceElement> element_list, const arma::mat& rectangular_matrix);
-double distanceFunction(const arma::rowvec& vec_1, const arma::rowvec& vec_2);
+void addDistances(const std::vector<uint64_t>& bits, const size_t words, const unsigned int matSize, arma::mat& dist, const unsigned int threads);
+void threadDistance(const std::vector<std::pair<unsigned int, unsigned int>>& tiles, std::atomic<size_t>& next_tile, const std::vector<uint64_t>& bits, const size_t words, const unsigned int matSize, arma::mat& dist);
 
+uint64_t kmerHash(const std::string& sequence);
+int hashSampled(const std::string& sequence, const double fraction);
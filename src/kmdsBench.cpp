@@ -0,0 +1,76 @@
+/*
+ * File: kmdsBench.cpp
+ *
+ * Benchmarks of kmds' distance matrix and MDS, on random k-mer presence
+ *
+ */
+
+#include "kmds.hpp"
+#include "bench.hpp"
+
+// Samples by k-mers, each present with probability 0.3
+arma::mat benchPopulation(const size_t num_samples, const size_t num_kmers)
+{
+   std::mt19937 generator(bench_seed);
+   std::bernoulli_distribution present(0.3);
+
+   arma::mat population(num_samples, num_kmers);
+   for (size_t j = 0; j < num_kmers; ++j)
+   {
+      for (size_t i = 0; i < num_samples; ++i)
+      {
+         population(i, j) = present(generator);
+      }
+   }
+
+   return population;
+}
+
+// Runs f with the timing messages on stderr discarded
+template <class T>
+T quietly(std::function<T()> f)
+{
+   std::streambuf* cerr_buf = std::cerr.rdbuf(NULL);
+   T result = f();
+   std::cerr.rdbuf(cerr_buf);
+
+   return result;
+}
+
+void kmdsBenchmarks(std::vector<benchCase>& benchmarks)
+{
+   const unsigned int max_threads = std::max(1u, std::thread::hardware_concurrency());
+   for (auto n_it = bench_distance_sizes.begin(); n_it != bench_distance_sizes.end(); ++n_it)
+   {
+      const size_t n = *n_it;
+      const std::string size_name = "/n:" + std::to_string(n) + "/kmers:" + std::to_string(bench_distance_kmers);
+
+      std::vector<unsigned int> thread_counts = {1};
+      if (max_threads > 1)
+      {
+         thread_counts.push_back(max_threads);
+      }
+      for (auto t_it = thread_counts.begin(); t_it != thread_counts.end(); ++t_it)
+      {
+         const unsigned int threads = *t_it;
+         benchmarks.push_back(benchCase{"dissimiliarityMatrix" + size_name + "/threads:" + std::to_string(threads), [n, threads]()
+         {
+            std::shared_ptr<arma::mat> population(new arma::mat(benchPopulation(n, bench_distance_kmers)));
+            return std::function<void()>([population, threads]()
+            {
+               keepResult(quietly<arma::mat>([&]() { return dissimiliarityMatrix(*population, threads); }));
+            });
+         }});
+      }
+
+      benchmarks.push_back(benchCase{"metricMDS" + size_name + "/dims:" + std::to_string(pc_default), [n, max_threads]()
+      {
+         std::shared_ptr<arma::mat> population(new arma::mat(benchPopulation(n, bench_distance_kmers)));
+         return std::function<void()>([population, max_threads]()
+         {
+            keepResult(quietly<arma::mat>([&]() { return metricMDS(*population, pc_default, max_threads); }));
+         });
+      }});
+   }
+}
+
@@ -18,7 +18,7 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
    //Required options
    po::options_description required("Required options");
    required.add_options()
-    ("kmers,k", po::value<std::string>(), "dsm kmer output file (not needed if using --mds_concat)")
+    ("kmers,k", po::value<std::string>(), "dsm kmer output file (not needed if using --mds_concat or --merge_partial)")
     ("pheno,p", po::value<std::string>(), ".pheno metadata");
 
    po::options_description mds("MDS options");
@@ -26,10 +26,17 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
     ("output,o", po::value<std::string>(), "output prefix for new dsm file")
     ("no_mds", "do not perform MDS; output subsampled matrix instead")
     ("write_distances",  "write csv of distance matrix")
+    ("write_partial", "do not perform MDS; output summed distances to merge with other runs instead")
     ("mds_concat", po::value<std::string>(), "list of subsampled matrices to use in MDS. Performs only MDS; implies --no_filtering")
+    ("merge_partial", po::value<std::string>(), "list of summed distances from --write_partial to add and use in MDS. Performs only MDS")
     ("pc", po::value<int>()->default_value(pc_default), "number of principal coordinates to output")
+    ("kinship", "also save the eigendecomposition of a kinship matrix from the distances, for seer --lmm")
+    ("kinship_rank", po::value<int>(), "with --kinship, only keep this many of the largest eigenvalues")
     ("size", po::value<long int>()->default_value(size_default), "number of kmers to use in MDS")
-    ("threads", po::value<int>()->default_value(1), ("number of threads. Suggested: " + std::to_string(std::thread::hardware_concurrency())).c_str());
+    ("sample_fraction", po::value<double>(), "instead of --size, use this fraction of kmers (chosen by hash) and stream them into the distance matrix. Not compatible with --no_mds")
+    ("threads", po::value<int>()->default_value(1), ("number of threads. Suggested: " + std::to_string(std::thread::hardware_concurrency())).c_str())
+    ("checkpoint", po::value<std::string>(), "save progress through the kmers to this file, and resume from it if it exists")
+    ("checkpoint_interval", po::value<int>(), ("seconds between checkpoints. Default: " + std::to_string(checkpoint_interval_default)).c_str());
 
    //Optional filtering parameters
    //NB pval cutoffs are strings for display, and are converted to floats later
@@ -94,6 +101,9 @@ void printHelp(po::options_description& help)
    std::cerr << "kmds" << "\n";
    std::cerr << "\t1) filter and subsample with --no_mds and --size\n";
    std::cerr << "\t2) combine, and do metric multidimensional scaling with --mds_concat\n";
+   std::cerr << "or\n";
+   std::cerr << "\t1) filter and sum distances over part of the kmers with --write_partial\n";
+   std::cerr << "\t2) add these, and do metric multidimensional scaling with --merge_partial\n";
 
    std::cerr << help << "\n";
 }
@@ -7,6 +7,9 @@
 
 #include "kmds.hpp"
 
+#include <iomanip>
+#include <sstream>
+
 // globals
 std::default_random_engine rand_gen;
 
@@ -24,8 +27,8 @@ int main (int argc, char *argv[])
    //    Have a no_filter option
    //    Output prefix, with default (same as input)
    //
-   // Read a dsm line, convert to stringstream
-   //    Parse as kmer
+   // Read dsm lines in batches
+   //    Parse as kmers, on a pool of threads
    //    Write out if passes filters
    //
    // Build large matrix using reservoir sampler
@@ -71,47 +74,113 @@ int main (int argc, char *argv[])
    arma::vec y = constructVecY(samples);
 
    // Normal operation
-   if (!vm.count("mds_concat"))
+   if (!vm.count("mds_concat") && !vm.count("merge_partial"))
    {
       // Check compulsory paramters provided
       if (!vm.count("kmers") || !vm.count("pheno"))
       {
-         std::cerr << "Either -k and -p must be provided, or --mds_concat\n";
+         std::cerr << "Either -k and -p must be provided, or one of --mds_concat or --merge_partial\n";
          return 1;
       }
 
       cmdOptions parameters = verifyCommandLine(vm, samples);
+      if (parameters.sample_fraction > 0 && vm.count("no_mds"))
+      {
+         std::cerr << "--sample_fraction streams k-mers into distances, so cannot be used with --no_mds\n";
+         return 1;
+      }
+      if (vm.count("write_partial") && vm.count("no_mds"))
+      {
+         std::cerr << "Only one of --write_partial and --no_mds can be used\n";
+         return 1;
+      }
+      if (parameters.kinship && (vm.count("write_partial") || vm.count("no_mds")))
+      {
+         std::cerr << "--kinship is made with the MDS, so cannot be used with --write_partial or --no_mds\n";
+         return 1;
+      }
 
-      // Open the dsm kmer ifstream, and read through the whole thing
-      igzstream kmer_file;
-      openDsmFile(kmer_file, parameters.kmers.c_str());
+      // Resume from the checkpoint, if there is one. The rest of its state,
+      // the k-mers sampled so far, is read once they are set up
+      Checkpoint checkpoint;
+      std::string checkpoint_state;
+      int resuming = 0;
+      if (!parameters.checkpoint.empty())
+      {
+         // Options which change the k-mers kept, which a resumed run must share
+         std::ostringstream settings;
+         settings << std::setprecision(17)
+                  << "pheno=" << vm["pheno"].as<std::string>() << "\n"
+                  << "filter=" << parameters.filter << "\n"
+                  << "min_words=" << parameters.min_words << "\n"
+                  << "max_words=" << parameters.max_words << "\n"
+                  << "max_length=" << parameters.max_length << "\n"
+                  << "size=" << parameters.size << "\n"
+                  << "sample_fraction=" << parameters.sample_fraction << "\n";
+
+         resuming = checkpoint.load(parameters.checkpoint, [&checkpoint_state](std::istream& is)
+               { checkpoint_state.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()); });
+         if (resuming)
+         {
+            checkpoint.check("kmds", parameters.kmers, 0, 1, settings.str());
+            std::cerr << "Resuming from " << parameters.checkpoint << " after " << checkpoint.line_nr << " k-mers\n";
+         }
+         checkpoint.program = "kmds";
+         checkpoint.kmers = parameters.kmers;
+         checkpoint.settings = settings.str();
+      }
 
-      // Set up output files
-      ogzstream filtered_file;
-      std::string output_file_name, dsm_file_name, distances_file_name;
+      // Open the dsm or .kmx kmer file, and read through the whole thing
+      DsmReader dsm_reader(samples);
+      dsm_reader.resume(parameters.kmers, checkpoint, parameters.num_threads);
+
+      // Set up output files. Filtered k-mers are written in the same format
+      // as the input. Filtered dsm files are BGZF, so they can be cut back
+      // to a checkpoint (and are still gzip)
+      BgzfOutStream filtered_file;
+      KmerMatrixWriter filtered_matrix;
+      std::string output_file_name, dsm_file_name, distances_file_name, partial_file_name, kinship_file_name;
       if (parameters.filter)
       {
+         std::string filtered_suffix = dsm_reader.is_binary() ? kmx_suffix : ".gz";
          if (vm.count("output"))
          {
-            output_file_name = parameters.output + ".kmers.gz";
+            output_file_name = parameters.output + ".kmers" + filtered_suffix;
          }
          else
          {
-            output_file_name = std::regex_replace(parameters.kmers, file_format_e, std::string("$1/filtered.$2.gz"));
+            output_file_name = std::regex_replace(parameters.kmers, file_format_e, std::string("$1/filtered.$2") + filtered_suffix);
             if (output_file_name == parameters.kmers) // If first match fails
             {
-               output_file_name = std::regex_replace(parameters.kmers, file_format_within_e, std::string("filtered.$1.gz"));
+               output_file_name = std::regex_replace(parameters.kmers, file_format_within_e, std::string("filtered.$1") + filtered_suffix);
             }
 
          }
 
-         filtered_file.open(output_file_name.c_str());
+         if (resuming && checkpoint.output_offsets.size() != 1)
+         {
+            throw std::runtime_error("Checkpoint " + parameters.checkpoint + " is from a run without filtering");
+         }
+
+         if (dsm_reader.is_binary() && resuming)
+         {
+            filtered_matrix.resume(output_file_name, dsm_reader.matrix().samples(), checkpoint.output_offsets[0], checkpoint.counters.at(0));
+         }
+         else if (dsm_reader.is_binary())
+         {
+            filtered_matrix.open(output_file_name, dsm_reader.matrix().samples());
+         }
+         else
+         {
+            filtered_file.open(output_file_name, 0, resuming ? checkpoint.output_offsets[0] : 0);
+         }
       }
 
       if (vm.count("output"))
       {
          dsm_file_name = parameters.output + ".dsm";
          distances_file_name = parameters.output + "distances.csv";
+         partial_file_name = parameters.output + ".partial";
       }
       else
       {
@@ -126,47 +195,151 @@ int main (int argc, char *argv[])
          {
             distances_file_name  = std::regex_replace(parameters.kmers, file_format_within_e, std::string("$1.distances.csv"));
          }
+
+         partial_file_name = std::regex_replace(parameters.kmers, file_format_e, std::string("$1/$2.partial"));
+         if (partial_file_name == parameters.kmers) // If first match fails
+         {
+            partial_file_name = std::regex_replace(parameters.kmers, file_format_within_e, std::string("$1.partial"));
+         }
       }
+      kinship_file_name = dsm_file_name + kinship_suffix;
 
-      // vector of subsampled kmers
-      std::vector<arma::vec> dsm_kmers;
-      dsm_kmers.reserve(parameters.size);
+      // vector of subsampled kmers, or with --sample_fraction the distances
+      // between samples so far
+      std::vector<Presence> dsm_kmers;
+      std::unique_ptr<DistanceAccumulator> distances;
+      if (parameters.sample_fraction > 0)
+      {
+         distances.reset(new DistanceAccumulator(samples.size(), parameters.num_threads));
+      }
+      else
+      {
+         dsm_kmers.reserve(parameters.size);
+      }
 
+      // The sampled k-mers so far, and the state of the reservoir sampler
       long int kmer_index = 0;
-      while (kmer_file)
+      auto save_sampled = [&](std::ostream& os)
+      {
+         writeValue(os, distances ? 1 : 0);
+         if (distances)
+         {
+            distances->save(os);
+         }
+         else
+         {
+            std::ostringstream rand_state;
+            rand_state << rand_gen;
+            writeString(os, rand_state.str());
+
+            writeValue(os, parameters.size);
+            writeValue(os, kmer_index);
+            writeValue(os, dsm_kmers.size());
+            for (auto it = dsm_kmers.begin(); it != dsm_kmers.end(); ++it)
+            {
+               const std::vector<uint64_t>& words = it->words();
+               for (auto word_it = words.begin(); word_it != words.end(); ++word_it)
+               {
+                  writeValue(os, *word_it);
+               }
+            }
+         }
+      };
+
+      if (resuming)
       {
-         // Allow output of entire dsm line
-         std::string dsm_line;
-         std::getline(kmer_file, dsm_line);
-         std::stringstream dsm_stream(dsm_line);
+         std::istringstream is(checkpoint_state);
+         if ((readValue(is) != 0) != (distances != nullptr))
+         {
+            throw std::runtime_error("Checkpoint " + parameters.checkpoint + " is from a run with different --size or --sample_fraction");
+         }
+
+         if (distances)
+         {
+            distances->load(is);
+         }
+         else
+         {
+            std::istringstream rand_state(readString(is));
+            rand_state >> rand_gen;
+
+            if ((long int)readValue(is) != parameters.size)
+            {
+               throw std::runtime_error("Checkpoint " + parameters.checkpoint + " is from a run with a different --size");
+            }
+            kmer_index = readValue(is);
+            dsm_kmers.resize(readValue(is), Presence(samples.size()));
+            for (auto it = dsm_kmers.begin(); it != dsm_kmers.end(); ++it)
+            {
+               for (size_t i = 0; i < it->words().size(); ++i)
+               {
+                  uint64_t word = readValue(is);
+                  while (word)
+                  {
+                     it->set(i * presence_word_bits + __builtin_ctzll(word));
+                     word &= word - 1;
+                  }
+               }
+            }
+         }
 
-         Kmer k;
-         if (kmer_file)
+         if (!is)
          {
-            dsm_stream >> k;
-            k.add_x(sample_map, samples.size());
+            throw std::runtime_error("Truncated checkpoint file " + parameters.checkpoint);
+         }
+      }
 
-            // apply filters here
-            int passed_filters = 0;
-            if (parameters.filter && passBasicFilters(parameters, k))
+      // Read and filter the k-mers on a pool of threads. Batches come back
+      // in input order, so are written here and the sampled k-mers added in
+      // the same order whatever the number of threads
+      BlockingQueue<kmdsBatch> work_queue(kmds_queue_depth * parameters.num_threads);
+      ReorderBuffer<kmdsBatch> results(kmds_reorder_depth * parameters.num_threads, parameters.num_threads);
+      RecyclePool<kmdsBatch> recycled((kmds_queue_depth + kmds_reorder_depth) * parameters.num_threads);
+
+      std::thread reader(readBatches, std::ref(dsm_reader), std::ref(work_queue), std::ref(recycled), checkpoint.line_nr);
+      std::vector<std::thread> workers;
+      workers.reserve(parameters.num_threads);
+      for (unsigned int i = 0; i < parameters.num_threads; ++i)
+      {
+         workers.push_back(std::thread(filterBatches, std::ref(work_queue), std::ref(results), std::cref(dsm_reader),
+                  std::cref(parameters), distances ? 1 : 0));
+      }
+
+      // Checkpoints are taken between batches, once the filtered k-mers so
+      // far are on disk
+      auto last_checkpoint = std::chrono::steady_clock::now();
+      const auto checkpoint_interval = std::chrono::seconds(parameters.checkpoint_interval);
+
+      kmdsBatch batch;
+      while (results.pop(batch))
+      {
+         if (batch.num_filtered > 0)
+         {
+            if (dsm_reader.is_binary())
             {
-               passed_filters = 1;
-               filtered_file << dsm_line << "\n";
+               filtered_matrix.write_records(batch.filtered.data(), batch.filtered.length(), batch.num_filtered);
             }
-            else if (!parameters.filter)
+            else
             {
-               passed_filters = 1;
+               filtered_file.write(batch.filtered.data(), batch.filtered.length());
             }
+         }
 
-            // kmer has passed basic filters, so is a candidate for mds
-            // subsampling
-            if (passed_filters)
+         // k-mers have passed basic filters, so are candidates for mds
+         // subsampling
+         for (size_t i = 0; i < batch.num_sampled; ++i)
+         {
+            if (distances)
+            {
+               distances->add(batch.sampled[i]);
+            }
+            else
             {
                // Resevoir sampler for parameters.size kmers
                kmer_index++;
                if (dsm_kmers.size() < dsm_kmers.capacity())
                {
-                  dsm_kmers.push_back(k.get_x());
+                  dsm_kmers.push_back(batch.sampled[i]);
                }
                else
                {
@@ -174,42 +347,106 @@ int main (int argc, char *argv[])
                   int r = dist(rand_gen);
                   if (r < parameters.size)
                   {
-                     dsm_kmers[r] = k.get_x();
+                     dsm_kmers[r] = batch.sampled[i];
                   }
                }
             }
          }
+
+         if (!parameters.checkpoint.empty() && std::chrono::steady_clock::now() - last_checkpoint >= checkpoint_interval)
+         {
+            checkpoint.line_nr = batch.input_line;
+            checkpoint.block_offset = batch.block_offset;
+            checkpoint.block_line = batch.block_line;
+
+            checkpoint.counters.clear();
+            checkpoint.output_offsets.clear();
+            if (parameters.filter)
+            {
+               if (dsm_reader.is_binary())
+               {
+                  checkpoint.counters.push_back(filtered_matrix.num_kmers());
+                  checkpoint.output_offsets.push_back(filtered_matrix.flush());
+               }
+               else
+               {
+                  checkpoint.output_offsets.push_back(filtered_file.flush_block());
+               }
+               syncFile(output_file_name);
+            }
+            checkpoint.save(parameters.checkpoint, save_sampled);
+            last_checkpoint = std::chrono::steady_clock::now();
+         }
+
+         recycled.put(batch);
       }
 
-      // Convert into arma::mat before MDS
-      arma::mat subsampledMatrix(samples.size(), dsm_kmers.size());
-      for (unsigned int i = 0; i < dsm_kmers.size(); ++i)
+      reader.join();
+      for (auto it = workers.begin(); it != workers.end(); ++it)
       {
-         subsampledMatrix.col(i) = dsm_kmers[i];
+         it->join();
       }
+      filtered_matrix.close();
+      filtered_file.close();
 
-      // Write output
-      if (vm.count("no_mds"))
+      if (distances)
       {
-         writeMDS(dsm_file_name, samples, subsampledMatrix);
+         std::cerr << "Using " << distances->num_kmers() << " sampled k-mers in MDS\n";
+         if (vm.count("write_partial"))
+         {
+            long int num_kmers = distances->num_kmers();
+            writePartialDistances(partial_file_name, samples, distances->counts(), num_kmers);
+         }
+         else
+         {
+            writeStructure(distances->distances(), samples, parameters, dsm_file_name, distances_file_name, kinship_file_name);
+         }
       }
       else
       {
+         // Convert into arma::mat before MDS
+         arma::mat subsampledMatrix(samples.size(), dsm_kmers.size());
+         subsampledMatrix.zeros();
+         for (unsigned int i = 0; i < dsm_kmers.size(); ++i)
+         {
+            for (unsigned int j = 0; j < samples.size(); ++j)
+            {
+               if (dsm_kmers[i].test(j))
+               {
+                  subsampledMatrix(j, i) = 1;
+               }
+            }
+         }
 
-         // Run metric MDS, then output to file
-         if (parameters.write_distances)
+         // Write output
+         if (vm.count("no_mds"))
+         {
+            writeMDS(dsm_file_name, samples, subsampledMatrix);
+         }
+         else if (vm.count("write_partial"))
          {
-            writeMDS(dsm_file_name, samples, metricMDS(subsampledMatrix, parameters.pc, parameters.num_threads, distances_file_name));
+            writePartialDistances(partial_file_name, samples, hammingCounts(subsampledMatrix, parameters.num_threads), dsm_kmers.size());
          }
          else
          {
-            writeMDS(dsm_file_name, samples, metricMDS(subsampledMatrix, parameters.pc, parameters.num_threads));
+            // Run metric MDS, then output to file
+            writeStructure(dissimiliarityMatrix(subsampledMatrix, parameters.num_threads), samples, parameters, dsm_file_name, distances_file_name, kinship_file_name);
          }
+      }
 
+      // A finished run starts again from the beginning
+      if (!parameters.checkpoint.empty())
+      {
+         std::remove(parameters.checkpoint.c_str());
       }
 
       std::cerr << "Done.\n";
-      if (!vm.count("no_mds"))
+      if (vm.count("write_partial"))
+      {
+         std::cerr << "Partial distances written to " << partial_file_name << "\n"
+            << "Add a list of these to run MDS with kmds --merge_partial\n";
+      }
+      else if (!vm.count("no_mds"))
       {
          if (parameters.filter)
          {
@@ -223,6 +460,59 @@ int main (int argc, char *argv[])
                << " -p " << vm["pheno"].as<std::string>() << " --struct " << dsm_file_name
                << " > significant_kmers.txt\n";
          }
+         if (parameters.kinship)
+         {
+            std::cerr << "Kinship written to " << kinship_file_name << ". Use this as the --lmm option of seer\n";
+         }
+      }
+   }
+   // Distances already summed over parts of the k-mers. Add these and
+   // perform MDS
+   else if (vm.count("merge_partial"))
+   {
+      std::string partial_input = vm["merge_partial"].as<std::string>();
+
+      cmdOptions mdsOptions;
+      verifyMDSOptions(mdsOptions, vm);
+
+      std::string dsm_file_name, distances_file_name;
+      if (fileStat(partial_input))
+      {
+         if (vm.count("output"))
+         {
+            dsm_file_name = vm["output"].as<std::string>();
+            distances_file_name = vm["output"].as<std::string>() + ".distances.csv";
+         }
+         else
+         {
+            dsm_file_name = partial_input + ".dsm";
+            distances_file_name = partial_input + ".distances.csv";
+         }
+
+         long int num_kmers;
+         arma::mat distances = readPartialList(partial_input, samples, num_kmers);
+         if (num_kmers == 0)
+         {
+            throw std::runtime_error("No k-mers were sampled for MDS");
+         }
+         distances /= num_kmers;
+         std::cerr << "Using " << num_kmers << " sampled k-mers in MDS\n";
+
+         // Run metric MDS, then output to file
+         writeStructure(std::move(distances), samples, mdsOptions, dsm_file_name, distances_file_name, dsm_file_name + kinship_suffix);
+      }
+      else
+      {
+         throw std::runtime_error("Couldn't open list of partial distances " + partial_input);
+      }
+
+      std::cerr << "Done.\n";
+
+      std::cerr << "Output written to " << dsm_file_name << "\n"
+         << "Use this as the --struct option of seer\n";
+      if (mdsOptions.kinship)
+      {
+         std::cerr << "Kinship written to " << dsm_file_name + kinship_suffix << ". Use this as the --lmm option of seer\n";
       }
    }
    // Matrices already subsampled. Concatenate and perform MDS
@@ -249,14 +539,7 @@ int main (int argc, char *argv[])
          }
 
          // Run metric MDS, then output to file
-         if (mdsOptions.write_distances)
-         {
-            writeMDS(dsm_file_name, samples, metricMDS(readMDSList(matrix_input), mdsOptions.pc, mdsOptions.num_threads, distances_file_name));
-         }
-         else
-         {
-            writeMDS(dsm_file_name, samples, metricMDS(readMDSList(matrix_input), mdsOptions.pc, mdsOptions.num_threads));
-         }
+         writeStructure(dissimiliarityMatrix(readMDSList(matrix_input), mdsOptions.num_threads), samples, mdsOptions, dsm_file_name, distances_file_name, dsm_file_name + kinship_suffix);
       }
       else
       {
@@ -267,6 +550,10 @@ int main (int argc, char *argv[])
 
       std::cerr << "Output written to " << dsm_file_name << "\n"
          << "Use this as the --struct option of seer\n";
+      if (mdsOptions.kinship)
+      {
+         std::cerr << "Kinship written to " << dsm_file_name + kinship_suffix << ". Use this as the --lmm option of seer\n";
+      }
    }
 }
 
@@ -9,46 +9,68 @@
 
 arma::mat metricMDS(const arma::mat& populationMatrix, const int dimensions, const unsigned int threads, const std::string& distances_file)
 {
-   /*
-    * Metric MDS
-    *
-    * 1) P^2 -> matrix with elements which are distances squared
-    * 2) J = I - n^-1(II') - II' is a square matrix of ones
-    * 3) B = -0.5JP^2J
-    * 4) Decompose B into eigenvalues
-    * 5) MDS components = eigenvectors * eigenvalues
-    * 6) Normalise components
-    */
-   const unsigned int matSize = populationMatrix.n_rows;
+   return distanceMDS(dissimiliarityMatrix(populationMatrix, threads), dimensions, distances_file);
+}
 
+/*
+ * Metric MDS
+ *
+ * 1) P^2 -> matrix with elements which are distances squared
+ * 2) J = I - n^-1(II') - II' is a square matrix of ones
+ * 3) B = -0.5JP^2J
+ * 4) Find the top eigenvalues of B
+ * 5) MDS components = eigenvectors * eigenvalues
+ * 6) Normalise components
+ *
+ * Only one n x n matrix is kept: P^2 is squared and then centred in place
+ */
+arma::mat distanceMDS(arma::mat B, const int dimensions, const std::string& distances_file)
+{
+   centreDistances(B, distances_file);
+   return centredMDS(B, dimensions);
+}
+
+// Writes the MDS components of the distances P to dsm_file, and with
+// --kinship a factor of the kinship matrix to kinship_file
+void writeStructure(arma::mat P, const std::vector<Sample>& samples, const cmdOptions& options, const std::string& dsm_file, const std::string& distances_file, const std::string& kinship_file)
+{
+   centreDistances(P, options.write_distances ? distances_file : "");
+   if (options.kinship)
+   {
+      writeMDS(kinship_file, samples, kinshipFactor(P, options.kinship_rank));
+   }
+   writeMDS(dsm_file, samples, centredMDS(P, options.pc));
+}
+
+// Steps 1) to 3), in place
+void centreDistances(arma::mat& B, const std::string& distances_file)
+{
    // Step 1)
-   arma::mat P = arma::square(dissimiliarityMatrix(populationMatrix, threads));
+   B %= B;
 
    // If supplied as an optional parameter, write distance matrix to file
    if (!distances_file.empty())
    {
-      writeDistances(distances_file, P);
+      writeDistances(distances_file, B);
    }
 
-   // Step 2)
-   arma::mat J = arma::eye<arma::mat>(matSize, matSize)
-      - 1/double(matSize)*arma::ones<arma::mat>(matSize, matSize);
+   // Steps 2) and 3)
+   doubleCentre(B);
+}
 
-   // Step 3)
-   arma::mat B = -0.5 * J * P * J;
+// Steps 4) to 6), from B
+arma::mat centredMDS(const arma::mat& B, const int dimensions)
+{
+   const unsigned int matSize = B.n_rows;
 
    // Step 4)
    arma::vec eigval;
    arma::mat eigvec;
-
-   if (!arma::eig_sym(eigval, eigvec, B))
-   {
-      throw std::runtime_error("Could not calculate eigenvalues of B matrix in metric MDS");
-   }
+   lanczosEigs(B, dimensions, eigval, eigvec);
 
    // Step 5)
-   // Eigenvalues returned are sorted ascending, so want to reverse order
-   arma::mat mds = fliplr(eigvec * diagmat(sqrt(eigval)));
+   // Eigenvalues are returned largest first
+   arma::mat mds = eigvec * diagmat(sqrt(eigval));
 
    // Step 6)
    // All values will lie in the interval [-1,1]
@@ -68,78 +90,242 @@ arma::mat metricMDS(const arma::mat& populationMatrix, const int dimensions, con
    return norm_mds;
 }
 
-// Distance between all rows. 0/1 elements only
-arma::mat dissimiliarityMatrix(const arma::mat& inMat, const unsigned int threads)
+// The kinship matrix is B scaled to a mean diagonal of one, K = GG'. G is
+// returned, which is the eigenvectors of K scaled by the square roots of
+// their eigenvalues, largest first. Those which are (numerically) zero or
+// negative are dropped. This has the samples as rows, so is saved and read
+// like the MDS components. With rank > 0 only that many of the largest are
+// found, by Lanczos iteration, giving a low rank kinship
+arma::mat kinshipFactor(const arma::mat& B, const unsigned int rank)
 {
-   const unsigned int matSize = inMat.n_rows;
-   arma::mat dist = arma::zeros<arma::mat>(matSize, matSize);
+   const unsigned int matSize = B.n_rows;
+   const double scale = arma::trace(B) / matSize;
+   if (!(scale > 0))
+   {
+      throw std::runtime_error("Kinship matrix is zero. Are all samples identical?");
+   }
 
-   // Time parallelisation
-   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   arma::vec eigval;
+   arma::mat eigvec;
+   if (rank > 0 && rank < matSize)
+   {
+      lanczosEigs(B, rank, eigval, eigvec);
+   }
+   else
+   {
+      // Ascending order
+      arma::eig_sym(eigval, eigvec, B);
+      eigval = arma::flipud(eigval);
+      eigvec = arma::fliplr(eigvec);
+   }
 
-   // Create queue for distance calculations
-   std::queue<std::future<std::vector<DistanceElement>>> distance_calculations;
+   arma::uvec keep = arma::find(eigval > kinship_tolerance * eigval(0));
+   arma::mat factor = eigvec.cols(keep);
+   for (unsigned int i = 0; i < keep.n_elem; ++i)
+   {
+      factor.col(i) *= sqrt(eigval(keep(i)) / scale);
+   }
+
+   return factor;
+}
 
-   // Set up number of jobs per thread
-   const unsigned long int num_calculations = 0.5*matSize*(matSize - 1);
-   const unsigned long int calc_per_thread = (unsigned long int)num_calculations / threads;
-   const unsigned int num_big_threads = num_calculations % threads;
+// B = -0.5JPJ in place. JPJ subtracts the row and column means of P and adds
+// back its grand mean. P is symmetric, so row and column means are the same
+void doubleCentre(arma::mat& P)
+{
+   const unsigned int matSize = P.n_rows;
 
-   // Keep track of row and column outside of outer loop
-   unsigned int row = 0;
-   unsigned int col = 0;
-   for (unsigned int thread_idx = 0; thread_idx < threads; ++thread_idx) // Loop over threads
+   std::vector<double> means(matSize, 0);
+   double grand_mean = 0;
+   for (unsigned int j = 0; j < matSize; ++j)
    {
-      // First 'big' threads have an extra job
-      unsigned long int thread_jobs;
-      if (distance_calculations.size() < num_big_threads)
+      const double* col = P.colptr(j);
+      for (unsigned int i = 0; i < matSize; ++i)
       {
-         thread_jobs = calc_per_thread + 1;
+         means[j] += col[i];
       }
-      else
+      means[j] /= matSize;
+      grand_mean += means[j];
+   }
+   grand_mean /= matSize;
+
+   for (unsigned int j = 0; j < matSize; ++j)
+   {
+      double* col = P.colptr(j);
+      for (unsigned int i = 0; i < matSize; ++i)
       {
-         thread_jobs = calc_per_thread;
+         col[i] = -0.5 * (col[i] - means[i] - means[j] + grand_mean);
       }
+   }
+}
+
+// Top (largest) k eigenpairs of the symmetric matrix A by Lanczos iteration
+// with full reorthogonalisation. The Krylov basis is extended until the
+// residuals of the top k Ritz pairs are small, so A is only ever used in
+// matrix-vector products. Each eigenvector's largest element is made
+// positive, so results don't depend on the random start
+void lanczosEigs(const arma::mat& A, const unsigned int k, arma::vec& eigval, arma::mat& eigvec)
+{
+   const unsigned int n = A.n_rows;
+   if (k > n)
+   {
+      throw std::runtime_error("Cannot find more MDS components than there are samples");
+   }
+
+   std::mt19937 rand_gen(lanczos_seed);
+   std::normal_distribution<double> normal(0, 1);
+
+   std::vector<arma::vec> basis;
+   std::vector<double> alpha, beta;
+   basis.reserve(std::min(n, 4 * k + lanczos_check_steps));
 
-      // Each thread is assigned elements to calculated scanning left to right,
-      // top to bottom on the upper triangle of the matrix
-      std::vector<DistanceElement> thread_elements;
-      thread_elements.reserve(thread_jobs);
-      for (unsigned int element = 0; element < calc_per_thread; ++element)
+   arma::vec q(n);
+   arma::vec theta;
+   arma::mat S;
+   double scale = 0;
+   int converged = 0;
+   while (!converged)
+   {
+      // Start or restart (after finding an invariant subspace) from a random
+      // vector orthogonal to the basis so far
+      if (basis.size() == 0 || beta.back() == 0)
       {
-         DistanceElement d;
-         d.row = row;
-         d.col = ++col;
+         for (unsigned int i = 0; i < n; ++i)
+         {
+            q[i] = normal(rand_gen);
+         }
+         for (auto it = basis.begin(); it != basis.end(); ++it)
+         {
+            q -= dot(q, *it) * *it;
+         }
+         q /= norm(q);
+      }
+      basis.push_back(q);
 
-         thread_elements.push_back(d);
+      // Lanczos step
+      const unsigned int m = basis.size() - 1;
+      arma::vec w = A * basis[m];
+      alpha.push_back(dot(w, basis[m]));
+      scale = std::max(scale, fabs(alpha.back()));
 
-         if (col + 1 == matSize)
+      // Twice is enough to keep the basis orthogonal to working precision
+      for (int pass = 0; pass < 2; ++pass)
+      {
+         for (auto it = basis.begin(); it != basis.end(); ++it)
          {
-            ++row;
-            col = row;
+            w -= dot(w, *it) * *it;
          }
       }
+      double w_norm = norm(w);
+      if (w_norm <= lanczos_tolerance * scale)
+      {
+         w_norm = 0;
+      }
+      beta.push_back(w_norm);
+      if (w_norm > 0)
+      {
+         q = w / w_norm;
+      }
+
+      // Check Ritz pairs of the tridiagonal matrix
+      const unsigned int steps = basis.size();
+      if (steps == n || (steps >= k && (steps - k) % lanczos_check_steps == 0))
+      {
+         arma::mat T = arma::zeros<arma::mat>(steps, steps);
+         for (unsigned int i = 0; i < steps; ++i)
+         {
+            T(i, i) = alpha[i];
+            if (i + 1 < steps)
+            {
+               T(i, i + 1) = beta[i];
+               T(i + 1, i) = beta[i];
+            }
+         }
+
+         if (!arma::eig_sym(theta, S, T))
+         {
+            throw std::runtime_error("Could not calculate eigenvalues of B matrix in metric MDS");
+         }
 
-      // Set the thread off
-      distance_calculations.push(std::async(std::launch::async, threadDistance, thread_elements, std::cref(inMat)));
+         // Ritz values ascending. The residual of each pair is the last
+         // element of its eigenvector of T times the next off-diagonal
+         converged = steps == n;
+         if (!converged && w_norm > 0)
+         {
+            converged = 1;
+            for (unsigned int i = steps - k; i < steps; ++i)
+            {
+               if (w_norm * fabs(S(steps - 1, i)) > lanczos_tolerance * std::max(scale, fabs(theta[steps - 1])))
+               {
+                  converged = 0;
+                  break;
+               }
+            }
+         }
+      }
    }
 
-   // Wait for thread results to return, and put the results in the distance
-   // matrix
-   while(!distance_calculations.empty())
+   // Ritz vectors, largest eigenvalue first
+   const unsigned int steps = basis.size();
+   eigval.set_size(k);
+   eigvec = arma::zeros<arma::mat>(n, k);
+   for (unsigned int i = 0; i < k; ++i)
    {
-      std::vector<DistanceElement> distance_elements = distance_calculations.front().get();
-      distance_calculations.pop();
+      const unsigned int ritz_idx = steps - 1 - i;
+      eigval[i] = theta[ritz_idx];
+      for (unsigned int j = 0; j < steps; ++j)
+      {
+         eigvec.col(i) += S(j, ritz_idx) * basis[j];
+      }
 
-      for(std::vector<DistanceElement>::iterator it = distance_elements.begin() ; it < distance_elements.end(); ++it)
+      const double* v = eigvec.colptr(i);
+      unsigned int largest = 0;
+      for (unsigned int j = 1; j < n; ++j)
+      {
+         if (fabs(v[j]) > fabs(v[largest]))
+         {
+            largest = j;
+         }
+      }
+      if (v[largest] < 0)
       {
-         dist(it->row, it->col) = it->distance;
-         dist(it->col, it->row) = it->distance;
+         eigvec.col(i) *= -1;
       }
    }
+}
 
-   // Normalise by total k-mers
-   dist = dist / inMat.n_cols;
+// Distance between all rows. 0/1 elements only, so the squared euclidean
+// distance is the Hamming distance, normalised by the number of k-mers
+arma::mat dissimiliarityMatrix(const arma::mat& inMat, const unsigned int threads)
+{
+   arma::mat dist = hammingCounts(inMat, threads);
+   dist /= inMat.n_cols;
+
+   return dist;
+}
+
+// Number of columns in which each pair of rows differ
+arma::mat hammingCounts(const arma::mat& inMat, const unsigned int threads)
+{
+   const unsigned int matSize = inMat.n_rows;
+   arma::mat dist = arma::zeros<arma::mat>(matSize, matSize);
+
+   // Time parallelisation
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   const size_t words = (inMat.n_cols + 63) / 64;
+   std::vector<uint64_t> bits(matSize * words, 0);
+   for (unsigned int j = 0; j < inMat.n_cols; ++j)
+   {
+      for (unsigned int i = 0; i < matSize; ++i)
+      {
+         if (inMat(i, j) != 0)
+         {
+            bits[i * words + j / 64] |= (uint64_t)1 << (j % 64);
+         }
+      }
+   }
+   addDistances(bits, words, matSize, dist, threads);
 
    // Print time taken
    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
@@ -149,19 +335,178 @@ arma::mat dissimiliarityMatrix(const arma::mat& inMat, const unsigned int thread
    return dist;
 }
 
-std::vector<DistanceElement> threadDistance(std::vector<DistanceElement> element_list, const arma::mat& rectangular_matrix)
+// Adds the Hamming distances between rows of a packed bit matrix (words
+// 64-bit words per row) to dist. Square tiles of the upper triangle are
+// handed out to threads, which popcount the XOR of each pair a block of words
+// at a time
+void addDistances(const std::vector<uint64_t>& bits, const size_t words, const unsigned int matSize, arma::mat& dist, const unsigned int threads)
+{
+   // Tiles on or above the diagonal, numbered left to right, top to bottom
+   const unsigned int num_tiles = (matSize + distance_tile_size - 1) / distance_tile_size;
+   std::vector<std::pair<unsigned int, unsigned int>> tiles;
+   tiles.reserve(num_tiles * (num_tiles + 1) / 2);
+   for (unsigned int tile_row = 0; tile_row < num_tiles; ++tile_row)
+   {
+      for (unsigned int tile_col = tile_row; tile_col < num_tiles; ++tile_col)
+      {
+         tiles.push_back(std::make_pair(tile_row, tile_col));
+      }
+   }
+
+   std::atomic<size_t> next_tile(0);
+   std::vector<std::future<void>> distance_calculations;
+   for (unsigned int thread_idx = 0; thread_idx < threads; ++thread_idx)
+   {
+      distance_calculations.push_back(std::async(std::launch::async, threadDistance, std::cref(tiles), std::ref(next_tile), std::cref(bits), words, matSize, std::ref(dist)));
+   }
+   for (auto it = distance_calculations.begin(); it != distance_calculations.end(); ++it)
+   {
+      it->get();
+   }
+}
+
+// Takes tiles from the list until none are left. Each tile's counts are
+// accumulated over blocks of words, so both sets of rows stay in cache. Tiles
+// don't overlap, so no locking is needed to add the results
+void threadDistance(const std::vector<std::pair<unsigned int, unsigned int>>& tiles, std::atomic<size_t>& next_tile, const std::vector<uint64_t>& bits, const size_t words, const unsigned int matSize, arma::mat& dist)
+{
+   std::vector<uint64_t> counts(distance_tile_size * distance_tile_size);
+
+   size_t tile_idx;
+   while ((tile_idx = next_tile++) < tiles.size())
+   {
+      const unsigned int row_start = tiles[tile_idx].first * distance_tile_size;
+      const unsigned int row_end = std::min(row_start + distance_tile_size, matSize);
+      const unsigned int col_start = tiles[tile_idx].second * distance_tile_size;
+      const unsigned int col_end = std::min(col_start + distance_tile_size, matSize);
+      const int diagonal = row_start == col_start;
+
+      std::fill(counts.begin(), counts.end(), 0);
+      for (size_t block_start = 0; block_start < words; block_start += distance_block_words)
+      {
+         const size_t block_end = std::min(block_start + distance_block_words, words);
+         for (unsigned int row = row_start; row < row_end; ++row)
+         {
+            const uint64_t* row_bits = &bits[row * words];
+            for (unsigned int col = diagonal ? row + 1 : col_start; col < col_end; ++col)
+            {
+               const uint64_t* col_bits = &bits[col * words];
+               uint64_t count = 0;
+               for (size_t w = block_start; w < block_end; ++w)
+               {
+                  count += __builtin_popcountll(row_bits[w] ^ col_bits[w]);
+               }
+               counts[(row - row_start) * distance_tile_size + col - col_start] += count;
+            }
+         }
+      }
+
+      for (unsigned int row = row_start; row < row_end; ++row)
+      {
+         for (unsigned int col = diagonal ? row + 1 : col_start; col < col_end; ++col)
+         {
+            double distance = counts[(row - row_start) * distance_tile_size + col - col_start];
+            dist(row, col) += distance;
+            dist(col, row) += distance;
+         }
+      }
+   }
+}
+
+/*
+ * DistanceAccumulator
+ */
+DistanceAccumulator::DistanceAccumulator(const size_t num_samples, const unsigned int threads)
+   :_num_samples(num_samples), _threads(threads), _bits(num_samples * distance_stream_words, 0), _buffered(0), _num_kmers(0)
+{
+   _counts = arma::zeros<arma::mat>(num_samples, num_samples);
+}
+
+void DistanceAccumulator::add(const Presence& x)
+{
+   const std::vector<uint64_t>& words = x.words();
+   for (size_t i = 0; i < words.size(); ++i)
+   {
+      uint64_t word = words[i];
+      while (word)
+      {
+         size_t sample = i * presence_word_bits + __builtin_ctzll(word);
+         _bits[sample * distance_stream_words + _buffered / 64] |= (uint64_t)1 << (_buffered % 64);
+         word &= word - 1;
+      }
+   }
+
+   ++_num_kmers;
+   if (++_buffered == distance_stream_words * 64)
+   {
+      flush();
+   }
+}
+
+arma::mat DistanceAccumulator::distances()
+{
+   if (_num_kmers == 0)
+   {
+      throw std::runtime_error("No k-mers were sampled for MDS");
+   }
+
+   arma::mat dist = counts();
+   dist /= _num_kmers;
+   return dist;
+}
+
+arma::mat DistanceAccumulator::counts()
+{
+   flush();
+   return std::move(_counts);
+}
+
+void DistanceAccumulator::save(std::ostream& os)
+{
+   flush();
+   writeValue(os, _num_kmers);
+   os.write((const char*)_counts.memptr(), _counts.n_elem * sizeof(double));
+}
+
+void DistanceAccumulator::load(std::istream& is)
+{
+   _num_kmers = readValue(is);
+   is.read((char*)_counts.memptr(), _counts.n_elem * sizeof(double));
+}
+
+void DistanceAccumulator::flush()
+{
+   if (_buffered > 0)
+   {
+      addDistances(_bits, distance_stream_words, _num_samples, _counts, _threads);
+      std::fill(_bits.begin(), _bits.end(), 0);
+      _buffered = 0;
+   }
+}
+
+// Fixed 64-bit hash of a k-mer sequence (FNV-1a with a final avalanche), so
+// that hash subsampling picks the same k-mers on every run and platform
+uint64_t kmerHash(const std::string& sequence)
 {
-   for(std::vector<DistanceElement>::iterator it = element_list.begin() ; it != element_list.end(); ++it)
+   uint64_t hash = 14695981039346656037ULL;
+   for (auto it = sequence.begin(); it != sequence.end(); ++it)
    {
-      it->distance = distanceFunction(rectangular_matrix.row(it->row), rectangular_matrix.row(it->col));
+      hash ^= (unsigned char)*it;
+      hash *= 1099511628211ULL;
    }
 
-   return element_list;
+   hash ^= hash >> 33;
+   hash *= 0xff51afd7ed558ccdULL;
+   hash ^= hash >> 33;
+   hash *= 0xc4ceb9fe1a85ec53ULL;
+   hash ^= hash >> 33;
+
+   return hash;
 }
 
-double distanceFunction(const arma::rowvec& vec_1, const arma::rowvec& vec_2)
+// k-mers are kept if their hash, as a fraction of the largest, is below
+// fraction
+int hashSampled(const std::string& sequence, const double fraction)
 {
-   // Slow
-   // return accu(abs(vec_1 - vec_2));
-   return dot(vec_1 - vec_2, vec_1 - vec_2);
+   return (kmerHash(sequence) >> 11) * (1.0 / 9007199254740992.0) < fraction;
 }
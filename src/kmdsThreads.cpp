@@ -0,0 +1,106 @@
+/*
+ * File: kmdsThreads.cpp
+ *
+ * Reader and worker threads for kmds's pass over the k-mers. The reader
+ * reads lines in batches, without parsing them, and a pool of workers parses
+ * and filters them. Batches come back to the main thread in input order,
+ * which writes the filtered k-mers and samples those for the MDS
+ *
+ */
+
+#include "kmds.hpp"
+
+// Reads the dsm or .kmx file into batches of kmds_batch_size lines, reusing
+// batches which have been written. The queue is closed at the end of the
+// file. input_line counts the lines read, from a checkpoint if resuming
+void readBatches(DsmReader& dsm_reader, BlockingQueue<kmdsBatch>& work_queue, RecyclePool<kmdsBatch>& recycled, long int input_line)
+{
+   long int order = 0;
+   int more_kmers = 1;
+   while (more_kmers)
+   {
+      kmdsBatch batch;
+      recycled.get(batch);
+      if (batch.raw.size() < kmds_batch_size)
+      {
+         batch.raw.resize(kmds_batch_size);
+      }
+
+      batch.num_raw = 0;
+      while (batch.num_raw < kmds_batch_size && (more_kmers = dsm_reader.nextRaw(batch.raw[batch.num_raw])))
+      {
+         ++batch.num_raw;
+      }
+
+      if (batch.num_raw > 0)
+      {
+         input_line += batch.num_raw;
+         batch.input_line = input_line;
+         batch.block_offset = dsm_reader.block_offset();
+         batch.block_line = dsm_reader.block_line();
+
+         batch.order = order++;
+         work_queue.push(std::move(batch));
+      }
+   }
+
+   work_queue.close();
+}
+
+// Worker thread. Parses each line of a batch and applies the basic filters.
+// Lines passing are kept to be written, if filtering, and the k-mers passing
+// are candidates for the MDS. When streaming distances only those in the
+// hash sample are kept
+void filterBatches(BlockingQueue<kmdsBatch>& work_queue, ReorderBuffer<kmdsBatch>& results, const DsmReader& dsm_reader, const cmdOptions& parameters, const int stream_distances)
+{
+   Kmer k;
+   std::string sequence;
+   std::vector<uint32_t> present;
+
+   kmdsBatch batch;
+   while (work_queue.pop(batch))
+   {
+      batch.filtered.clear();
+      batch.num_filtered = 0;
+      batch.num_sampled = 0;
+
+      for (size_t i = 0; i < batch.num_raw; ++i)
+      {
+         dsm_reader.parse(batch.raw[i], k, sequence, present);
+
+         // apply filters here
+         int passed_filters = 0;
+         if (parameters.filter && passBasicFilters(parameters, k))
+         {
+            passed_filters = 1;
+            batch.filtered.append(batch.raw[i]);
+            if (!dsm_reader.is_binary())
+            {
+               batch.filtered.push_back('\n'); // Allow output of entire dsm line
+            }
+            ++batch.num_filtered;
+         }
+         else if (!parameters.filter)
+         {
+            passed_filters = 1;
+         }
+
+         if (passed_filters && (!stream_distances || hashSampled(k.sequence(), parameters.sample_fraction)))
+         {
+            if (batch.num_sampled == batch.sampled.size())
+            {
+               batch.sampled.push_back(k.presence());
+            }
+            else
+            {
+               batch.sampled[batch.num_sampled] = k.presence();
+            }
+            ++batch.num_sampled;
+         }
+      }
+
+      results.push(batch.order, std::move(batch));
+   }
+
+   results.done();
+}
@@ -7,21 +7,9 @@
 
 #include "kmer.hpp"
 
-// Initialisation
-Kmer::Kmer(const std::string& sequence, const std::vector<std::string>& occurrences, const double pvalue, const double lrt_pvalue, const double beta, const double se, const double maf, const double log_likelihood)
-   : Significant_kmer(sequence, occurrences, maf, kmer_chi_pvalue_default, pvalue, lrt_pvalue, beta, se, kmer_comment_default), _x_set(0), _log_likelihood(log_likelihood), _use_firth(0)
-{
-}
-
-// Initialise without calculated information
-Kmer::Kmer(const std::string& sequence, const std::vector<std::string>& occurrences)
-   : Significant_kmer(sequence, occurrences, kmer_maf_default, kmer_chi_pvalue_default, kmer_pvalue_default, kmer_pvalue_default, kmer_beta_default, kmer_se_default, kmer_comment_default), _x_set(0), _log_likelihood(0), _use_firth(0)
-{
-}
-
 // Initialise with default info only
 Kmer::Kmer()
-    : Significant_kmer(kmer_seq_default, kmer_occ_default, kmer_maf_default, kmer_chi_pvalue_default, kmer_pvalue_default, kmer_pvalue_default, kmer_beta_default, kmer_se_default, kmer_comment_default), _x_set(0), _log_likelihood(0), _use_firth(0)
+    : Significant_kmer(kmer_seq_default, std::vector<std::string>(), kmer_maf_default, kmer_chi_pvalue_default, kmer_pvalue_default, kmer_pvalue_default, kmer_beta_default, kmer_se_default, kmer_comment_default), _x_set(0), _comment_flags(0), _log_likelihood(0), _use_firth(0)
 {
 }
 
@@ -32,7 +20,7 @@ std::ostream& operator<<(std::ostream &os, const Kmer& k)
       << "\t" << std::scientific << k.unadj() << "\t" << k.p_val() << "\t" << k.lrt_p_val()
       << "\t" << k.beta() << "\t" << k.se();
 
-   std::vector<double> covariates = k.covar_p();
+   const std::vector<double>& covariates = k.covar_p();
    for (auto it = covariates.begin(); it != covariates.end(); ++it)
    {
       os << "\t" << *it;
@@ -43,117 +31,120 @@ std::ostream& operator<<(std::ostream &os, const Kmer& k)
    return os;
 }
 
-// Input
-std::istream& operator>>(std::istream &is, Kmer& k)
+// Reset to defaults with a new sequence, found in no samples. Samples are
+// then added by index. The storage of the last k-mer is reused, so nothing is
+// allocated once it is large enough
+void Kmer::reset(const char* sequence, const size_t length, const size_t num_samples)
 {
-   std::vector<std::string> samples;
-   std::string word, s_buffer, kmer_line;
-   char c_buffer;
-
-   /*
-    * Example dsm file line AAAAAAAAAAAAAAAAAATGCATATTTATCTTAG 5.172314 0.175087 100 0 100
-    * 0.164875 100 | 6925_3#7:9 6823_4#17:26 6871_2#9:8
-    *
-    * OR
-    *
-    * AAAAAAAAAAAAAAAAAATGCATATTTATCTTAG 5.172314 6925_3#7:9 6823_4#17:26 6871_2#9:8
-    *
-    */
-   if (is)
-   {
-      std::getline(is, kmer_line);
-      std::stringstream line(kmer_line);
-
-      // First field is the kmer
-      line >> word;
+   _line_nr = 0;
+   _word.assign(sequence, length);
+   _sample_ids.clear();
+
+   _maf = kmer_maf_default;
+   _unadj_p = kmer_chi_pvalue_default;
+   _adj_p = kmer_pvalue_default;
+   _adj_lrt_p = kmer_pvalue_default;
+   _beta = kmer_beta_default;
+   _se = kmer_se_default;
+   _covar_p.clear();
+   _comment_flags = 0;
+
+   _x.clear(num_samples);
+   _x_set = 1;
+   _log_likelihood = 0;
+   _use_firth = 0;
+}
 
-      // Skip entropy fields
-      while (line >> s_buffer)
+// Comma separated, or NA if there are none
+void Kmer::append_comments(std::string& buffer) const
+{
+   if (_comment_flags == 0)
+   {
+      buffer.append(kmer_comment_default);
+   }
+   else
+   {
+      int first = 1;
+      for (unsigned int i = 0; i < num_kmer_comments; ++i)
       {
-         if (s_buffer == "|")
-         {
-            break;
-         }
-         // Gone one too far in a string w/out | separator
-         else
+         if (_comment_flags & (1u << i))
          {
-            size_t occurence_pos = s_buffer.find(":");
-            if (s_buffer.find(":") != std::string::npos)
+            if (!first)
             {
-               samples.push_back(s_buffer.substr(0, occurence_pos));
-               break;
+               buffer.push_back(',');
             }
-         }
-      }
-      s_buffer = "";
-
-      while (line >> c_buffer)
-      {
-         // Found end of sample. Read forward to next one
-         if (c_buffer == ':')
-         {
-            samples.push_back(s_buffer);
-            line >> s_buffer;
-
-            s_buffer = "";
-         }
-         else
-         {
-            s_buffer += c_buffer;
+            buffer.append(kmer_comment_names[i]);
+            first = 0;
          }
       }
    }
-
-   k = Kmer(word, samples);
-
-   return is;
 }
 
-// Set the x and maf of the kmer
-void Kmer::add_x(const std::unordered_map<std::string,int>& sample_map, const int num_samples)
+std::string Kmer::comments() const
 {
-   _x.zeros(num_samples);
+   std::string comments;
+   append_comments(comments);
 
-   for (auto it = _samples.begin(); it != _samples.end(); ++it)
-   {
-      auto sample_index_it = sample_map.find(*it);
-
-      if (sample_index_it != sample_map.end())
-      {
-         _x[sample_index_it->second] = 1;
-      }
-   }
-
-   // Set object values
-   _x_set = 1;
-   _maf = (double)num_occurrences()/num_samples;
+   return comments;
 }
 
-// Add a new comment in
-void Kmer::add_comment(const std::string& new_comment)
+size_t Kmer::num_occurrences() const
 {
-   if (_comment == kmer_comment_default)
+   size_t total_occurrences;
+   if (_x_set)
    {
-      _comment = new_comment;
+      total_occurrences = _x.count();
    }
    else
    {
-      _comment += "," + new_comment;
+      total_occurrences = _sample_ids.size();
    }
+
+   return total_occurrences;
 }
 
-size_t Kmer::num_occurrences() const
+// The fields set by the association test
+kmerResult Kmer::result() const
 {
-   size_t total_occurrences;
-   if (_x_set)
-   {
-      total_occurrences = (int) accu(_x);
-   }
-   else
+   kmerResult result;
+   result.unadj_p = _unadj_p;
+   result.p_val = _adj_p;
+   result.lrt_p_val = _adj_lrt_p;
+   result.beta = _beta;
+   result.se = _se;
+   result.covar_p = _covar_p;
+   result.comments = _comment_flags;
+   result.log_likelihood = _log_likelihood;
+   result.firth = _use_firth;
+
+   return result;
+}
+
+void Kmer::set_result(const kmerResult& result)
+{
+   _unadj_p = result.unadj_p;
+   _adj_p = result.p_val;
+   _adj_lrt_p = result.lrt_p_val;
+   _beta = result.beta;
+   _se = result.se;
+   _covar_p = result.covar_p;
+   _comment_flags = result.comments;
+   _log_likelihood = result.log_likelihood;
+   _use_firth = result.firth;
+}
+
+// Expand presence into a vector of 0s and 1s
+arma::vec Kmer::get_x() const
+{
+   arma::vec x(_x.size(), arma::fill::zeros);
+   for (size_t i = 0; i < _x.size(); ++i)
    {
-      total_occurrences = _samples.size();
+      if (_x.test(i))
+      {
+         x[i] = 1;
+      }
    }
 
-   return total_occurrences;
+   return x;
 }
 
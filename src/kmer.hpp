@@ -9,9 +9,9 @@
 #include <armadillo>
 
 #include "significant_kmer.hpp"
+#include "presence.hpp"
 
 const std::string kmer_seq_default = "";
-const std::vector<std::string> kmer_occ_default;
 const double kmer_pvalue_default = 1;
 const double kmer_chi_pvalue_default = 1;
 const double kmer_beta_default = 0;
@@ -19,39 +19,74 @@ const double kmer_maf_default = 0;
 const double kmer_se_default = 0;
 const std::string kmer_comment_default = "NA";
 
+// Comments on how a k-mer's test went, as flags. They are written in this
+// order, which is the order they can be added in, separated by commas
+enum kmerComment
+{
+   comment_bad_chisq = 1 << 0,
+   comment_bfgs_fail = 1 << 1,
+   comment_nr_fail = 1 << 2,
+   comment_large_se = 1 << 3,
+   comment_inv_fail = 1 << 4,
+   comment_firth_fail = 1 << 5,
+   comment_collinear = 1 << 6,
+   comment_zero_ll = 1 << 7
+};
+const unsigned int num_kmer_comments = 8;
+const char* const kmer_comment_names[num_kmer_comments] = {"bad-chisq", "bfgs-fail", "nr-fail", "large-se", "inv-fail", "firth-fail", "collinear", "zero-ll"};
+
+// Everything the association test sets on a k-mer
+struct kmerResult
+{
+   double unadj_p;
+   double p_val;
+   double lrt_p_val;
+   double beta;
+   double se;
+   std::vector<double> covar_p;
+   unsigned int comments;
+   double log_likelihood;
+   int firth;
+};
+
 class Kmer: public Significant_kmer
 {
    public:
       // Initialisation
-      Kmer(const std::string& sequence, const std::vector<std::string>& occurrences, const double pvalue, const double lrt_pvalue, const double beta, const double se, const double maf, const double log_likelihood);
-      Kmer(const std::string& sequence, const std::vector<std::string>& occurrences); // Initialise without calculated information
       Kmer(); // defaults
 
       // nonmodifying operations
       int length() const { return _word.length(); }
       size_t num_occurrences() const;
-      std::string occurrence(int i) const { return _samples[i]; }
-      std::vector<std::string> occurrence_vector() const { return _samples; }
-      arma::vec get_x() const { return _x; }
+      const std::vector<uint32_t>& sample_ids() const { return _sample_ids; } // In the SampleDictionary, with --print_samples
+      unsigned int comment_flags() const { return _comment_flags; }
+      std::string comments() const; // Rendered from the flags
+      void append_comments(std::string& buffer) const;
+      const Presence& presence() const { return _x; }
+      arma::vec get_x() const; // Dense 0/1 column, for the design matrix
       int has_x() const { return _x_set; }
       double log_likelihood() const { return _log_likelihood; }
       int firth() const { return _use_firth; }
+      kmerResult result() const;
 
       // Modifying operations
-      void add_comment(const std::string& new_comment); // this is defined in kmer.cpp
-      void add_x(const std::unordered_map<std::string,int>& sample_map, const int num_samples); // this is defined in kmer.cpp
+      void add_comment(const kmerComment comment) { _comment_flags |= comment; }
+      void reset(const char* sequence, const size_t length, const size_t num_samples); // this is defined in kmer.cpp
+      void add_sample(const size_t sample_index) { _x.set(sample_index); }
+      void add_sample_id(const uint32_t sample_id) { _sample_ids.push_back(sample_id); }
       void log_likelihood(const double ll) { _log_likelihood = ll; }
       void firth(const int use_firth) { _use_firth = use_firth; }
+      void set_result(const kmerResult& result); // From a k-mer with the same presence pattern
 
    private:
-      arma::vec _x;
+      Presence _x;
       int _x_set;
+      std::vector<uint32_t> _sample_ids;
+      unsigned int _comment_flags;
       double _log_likelihood;
       int _use_firth;
 
 };
 
-// Overload output and input operators
+// Overload output operator. Input is by DsmReader
 std::ostream& operator<<(std::ostream &os, const Kmer& k);
-
-std::istream& operator>>(std::istream &is, Kmer& k);
@@ -0,0 +1,123 @@
+/*
+ * File: kmerAutomaton.cpp
+ *
+ * Builds the Aho-Corasick automaton for map_back --batch and filter_seer
+ * --substr
+ *
+ */
+
+#include "kmerAutomaton.hpp"
+
+#include <queue>
+#include <stdexcept>
+
+KmerAutomaton::KmerAutomaton()
+   :_nodes(1, automatonNode{{-1, -1, -1, -1}, 0, -1, -1})
+{
+}
+
+void KmerAutomaton::add(const std::string& pattern, const uint32_t id)
+{
+   int32_t state = root();
+   for (auto it = pattern.begin(); it != pattern.end(); ++it)
+   {
+      int base = baseIndex(*it);
+      if (base < 0)
+      {
+         throw std::runtime_error("Invalid nucleotide");
+      }
+
+      if (_nodes[state].next[base] < 0)
+      {
+         _nodes[state].next[base] = _nodes.size();
+         _nodes.push_back(automatonNode{{-1, -1, -1, -1}, 0, -1, -1});
+      }
+      state = _nodes[state].next[base];
+   }
+
+   _matches.push_back(automatonMatch{id, _nodes[state].first_match});
+   _nodes[state].first_match = _matches.size() - 1;
+
+   if (_lengths.size() <= id)
+   {
+      _lengths.resize(id + 1, 0);
+   }
+   _lengths[id] = pattern.length();
+}
+
+// Breadth first, so each state's failure state is finished before it
+void KmerAutomaton::build()
+{
+   std::queue<int32_t> to_visit;
+   for (int base = 0; base < 4; ++base)
+   {
+      int32_t& child = _nodes[root()].next[base];
+      if (child < 0)
+      {
+         child = root();
+      }
+      else
+      {
+         _nodes[child].fail = root();
+         to_visit.push(child);
+      }
+   }
+
+   while (!to_visit.empty())
+   {
+      int32_t state = to_visit.front();
+      to_visit.pop();
+
+      for (int base = 0; base < 4; ++base)
+      {
+         int32_t child = _nodes[state].next[base];
+         int32_t fail_next = _nodes[_nodes[state].fail].next[base];
+         if (child < 0)
+         {
+            _nodes[state].next[base] = fail_next;
+         }
+         else
+         {
+            _nodes[child].fail = fail_next;
+            _nodes[child].dictionary = _nodes[fail_next].first_match >= 0 ? fail_next : _nodes[fail_next].dictionary;
+            to_visit.push(child);
+         }
+      }
+   }
+}
+
+int32_t KmerAutomaton::next(const int32_t state, const char base) const
+{
+   int index = baseIndex(base);
+   return index < 0 ? root() : _nodes[state].next[index];
+}
+
+int baseIndex(const char base)
+{
+   switch (base)
+   {
+      case 'A':
+         return 0;
+      case 'C':
+         return 1;
+      case 'G':
+         return 2;
+      case 'T':
+         return 3;
+      default:
+         return -1;
+   }
+}
+
+
+int acgtOnly(const std::string& sequence)
+{
+   for (auto it = sequence.begin(); it != sequence.end(); ++it)
+   {
+      if (baseIndex(*it) < 0)
+      {
+         return 0;
+      }
+   }
+   return 1;
+}
@@ -0,0 +1,96 @@
+/*
+ * kmerAutomaton.hpp
+ * Header file for the Aho-Corasick automaton used by map_back --batch and
+ * filter_seer --substr
+ *
+ * Matches every k-mer in a single pass over a sequence. Patterns are ACGT
+ * only (see acgtOnly; callers compare any others themselves), and any other
+ * base returns the automaton to its root. The goto
+ * function is complete after build(), so each base is one lookup; matches
+ * ending at a state are found by following dictionary suffix links
+ *
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class KmerAutomaton
+{
+   public:
+      KmerAutomaton();
+
+      // Adds a pattern, reported as id. Call build() once all are added.
+      // Throws if the pattern isn't acgtOnly
+      void add(const std::string& pattern, const uint32_t id);
+      void build();
+
+      // nonmodifying operations
+      int32_t root() const { return 0; }
+      int32_t next(const int32_t state, const char base) const;
+      size_t length(const uint32_t id) const { return _lengths[id]; }
+      size_t num_states() const { return _nodes.size(); }
+
+      // Calls f(id) for each pattern ending at state
+      template <class F>
+      void matches(int32_t state, F f) const
+      {
+         if (_nodes[state].first_match < 0)
+         {
+            state = _nodes[state].dictionary;
+         }
+         while (state >= 0)
+         {
+            for (int32_t m = _nodes[state].first_match; m >= 0; m = _matches[m].next)
+            {
+               f(_matches[m].id);
+            }
+            state = _nodes[state].dictionary;
+         }
+      }
+
+      // As matches, longest first, stopping once f(id) returns false
+      template <class F>
+      void matches_while(int32_t state, F f) const
+      {
+         if (_nodes[state].first_match < 0)
+         {
+            state = _nodes[state].dictionary;
+         }
+         while (state >= 0)
+         {
+            for (int32_t m = _nodes[state].first_match; m >= 0; m = _matches[m].next)
+            {
+               if (!f(_matches[m].id))
+               {
+                  return;
+               }
+            }
+            state = _nodes[state].dictionary;
+         }
+      }
+
+   private:
+      struct automatonNode
+      {
+         int32_t next[4];
+         int32_t fail;
+         int32_t dictionary; // nearest state on the failure chain with matches, or -1
+         int32_t first_match; // into _matches, or -1
+      };
+
+      struct automatonMatch
+      {
+         uint32_t id;
+         int32_t next; // next match at the same state, or -1
+      };
+
+      std::vector<automatonNode> _nodes;
+      std::vector<automatonMatch> _matches;
+      std::vector<size_t> _lengths; // by id
+};
+
+// Functions
+int baseIndex(const char base); // 0-3 for ACGT, -1 otherwise
+int acgtOnly(const std::string& sequence); // Whether it can be added to the automaton
+
@@ -0,0 +1,408 @@
+/*
+ * File: kmerMatrix.cpp
+ *
+ * Reads and writes binary k-mer matrix files
+ *
+ */
+
+#include "kmerMatrix.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const size_t kmx_header_size = 20; // magic, num_samples, num_kmers
+const size_t kmx_words = 64;
+const char kmx_bases[4] = {'A', 'C', 'G', 'T'};
+
+size_t kmxSampleWords(const size_t num_samples)
+{
+   return (num_samples + kmx_words - 1) / kmx_words;
+}
+
+/*
+ * KmerMatrixReader
+ */
+KmerMatrixReader::KmerMatrixReader()
+   :_fd(-1), _map(NULL), _map_length(0), _pos(0), _num_kmers(0), _record(NULL), _record_length(0)
+{
+}
+
+KmerMatrixReader::~KmerMatrixReader()
+{
+   close();
+}
+
+void KmerMatrixReader::open(const std::string& file_name)
+{
+   close();
+
+   _fd = ::open(file_name.c_str(), O_RDONLY);
+   struct stat file_info;
+   if (_fd < 0 || fstat(_fd, &file_info) != 0)
+   {
+      throw std::runtime_error("Could not open kmer file " + file_name + "\n");
+   }
+
+   _map_length = file_info.st_size;
+   if (_map_length < kmx_header_size)
+   {
+      throw std::runtime_error(file_name + " is not a k-mer matrix file\n");
+   }
+
+   void* map = mmap(NULL, _map_length, PROT_READ, MAP_PRIVATE, _fd, 0);
+   if (map == MAP_FAILED)
+   {
+      throw std::runtime_error("Could not map kmer file " + file_name + "\n");
+   }
+   madvise(map, _map_length, MADV_SEQUENTIAL);
+   _map = (const char*)map;
+
+   if (memcmp(_map, kmx_magic.data(), kmx_magic.length()) != 0)
+   {
+      throw std::runtime_error(file_name + " is not a k-mer matrix file\n");
+   }
+
+   uint32_t num_samples;
+   memcpy(&num_samples, _map + 8, sizeof(uint32_t));
+   memcpy(&_num_kmers, _map + 12, sizeof(uint64_t));
+
+   // Sample dictionary
+   _pos = kmx_header_size;
+   _samples.clear();
+   _samples.reserve(num_samples);
+   for (uint32_t i = 0; i < num_samples; ++i)
+   {
+      uint32_t name_length;
+      if (_pos + sizeof(uint32_t) > _map_length)
+      {
+         throw std::runtime_error("Truncated sample list in " + file_name + "\n");
+      }
+      memcpy(&name_length, _map + _pos, sizeof(uint32_t));
+      _pos += sizeof(uint32_t);
+
+      if (_pos + name_length > _map_length)
+      {
+         throw std::runtime_error("Truncated sample list in " + file_name + "\n");
+      }
+      _samples.emplace_back(_map + _pos, name_length);
+      _pos += name_length;
+   }
+}
+
+void KmerMatrixReader::close()
+{
+   if (_map != NULL)
+   {
+      munmap((void*)_map, _map_length);
+      _map = NULL;
+   }
+   if (_fd >= 0)
+   {
+      ::close(_fd);
+      _fd = -1;
+   }
+}
+
+int KmerMatrixReader::next()
+{
+   if (_map == NULL || _pos >= _map_length)
+   {
+      return 0;
+   }
+
+   _record = _map + _pos;
+   _record_length = decodeKmxRecord(_record, _map_length - _pos, _samples.size(), _sequence, _present);
+   _pos += _record_length;
+
+   return 1;
+}
+
+/*
+ * KmerMatrixWriter
+ */
+KmerMatrixWriter::KmerMatrixWriter()
+   :_file(NULL), _num_samples(0), _num_kmers(0)
+{
+}
+
+KmerMatrixWriter::~KmerMatrixWriter()
+{
+   try
+   {
+      close();
+   }
+   catch (std::exception& e)
+   {
+      std::cerr << e.what() << std::endl;
+   }
+}
+
+void KmerMatrixWriter::open(const std::string& file_name, const std::vector<std::string>& samples)
+{
+   _file = fopen(file_name.c_str(), "wb");
+   if (_file == NULL)
+   {
+      throw std::runtime_error("Could not open " + file_name + " for writing\n");
+   }
+
+   _file_name = file_name;
+   _num_samples = samples.size();
+   _num_kmers = 0;
+
+   uint32_t num_samples = samples.size();
+   put(kmx_magic.data(), 1, kmx_magic.length());
+   put(&num_samples, sizeof(uint32_t), 1);
+   put(&_num_kmers, sizeof(uint64_t), 1); // Filled in on close
+
+   for (auto it = samples.begin(); it != samples.end(); ++it)
+   {
+      uint32_t name_length = it->length();
+      put(&name_length, sizeof(uint32_t), 1);
+      put(it->data(), 1, name_length);
+   }
+}
+
+void KmerMatrixWriter::resume(const std::string& file_name, const std::vector<std::string>& samples, const uint64_t length, const uint64_t num_kmers)
+{
+   if (truncate(file_name.c_str(), length) != 0)
+   {
+      throw std::runtime_error("Could not cut " + file_name + " back to its checkpointed length");
+   }
+
+   _file = fopen(file_name.c_str(), "r+b");
+   if (_file == NULL || fseek(_file, 0, SEEK_END) != 0)
+   {
+      throw std::runtime_error("Could not open " + file_name + " for writing\n");
+   }
+
+   _file_name = file_name;
+   _num_samples = samples.size();
+   _num_kmers = num_kmers;
+}
+
+uint64_t KmerMatrixWriter::flush()
+{
+   if (fflush(_file) != 0)
+   {
+      throw std::runtime_error("Could not write k-mers to " + _file_name + "\n");
+   }
+   return ftell(_file);
+}
+
+void KmerMatrixWriter::close()
+{
+   if (_file != NULL)
+   {
+      // Closed even if the count can't be written, so this isn't tried again
+      // from the destructor
+      int failed = fseek(_file, kmx_magic.length() + sizeof(uint32_t), SEEK_SET) != 0;
+      failed |= fwrite(&_num_kmers, sizeof(uint64_t), 1, _file) != 1;
+      failed |= fclose(_file) != 0;
+      _file = NULL;
+
+      if (failed)
+      {
+         throw std::runtime_error("Could not write k-mers to " + _file_name + "\n");
+      }
+   }
+}
+
+void KmerMatrixWriter::write(const std::string& sequence, const std::vector<uint32_t>& present)
+{
+   if (sequence.length() > UINT16_MAX)
+   {
+      throw std::runtime_error("k-mer too long for k-mer matrix format");
+   }
+
+   uint16_t length = sequence.length();
+   size_t words = kmxSampleWords(_num_samples);
+   uint8_t row_type = (1 + present.size()) * sizeof(uint32_t) < words * sizeof(uint64_t) ? kmx_sparse : kmx_dense;
+
+   _buffer.assign(3 + (length + 3) / 4, 0);
+   memcpy(&_buffer[0], &length, sizeof(uint16_t));
+   _buffer[2] = row_type;
+
+   for (size_t i = 0; i < length; ++i)
+   {
+      unsigned char code;
+      switch (sequence[i])
+      {
+         case 'A':
+            code = 0;
+            break;
+         case 'C':
+            code = 1;
+            break;
+         case 'G':
+            code = 2;
+            break;
+         case 'T':
+            code = 3;
+            break;
+         default:
+            throw std::runtime_error("Invalid nucleotide");
+      }
+      _buffer[3 + i / 4] |= code << (2 * (i % 4));
+   }
+
+   if (row_type == kmx_dense)
+   {
+      std::vector<uint64_t> row(words, 0);
+      for (auto it = present.begin(); it != present.end(); ++it)
+      {
+         row[*it / kmx_words] |= (uint64_t)1 << (*it % kmx_words);
+      }
+
+      size_t row_start = _buffer.size();
+      _buffer.resize(row_start + words * sizeof(uint64_t));
+      memcpy(&_buffer[row_start], row.data(), words * sizeof(uint64_t));
+   }
+   else
+   {
+      uint32_t count = present.size();
+      size_t row_start = _buffer.size();
+      _buffer.resize(row_start + (1 + count) * sizeof(uint32_t));
+      memcpy(&_buffer[row_start], &count, sizeof(uint32_t));
+      if (count > 0)
+      {
+         memcpy(&_buffer[row_start + sizeof(uint32_t)], present.data(), count * sizeof(uint32_t));
+      }
+   }
+
+   write_record(_buffer.data(), _buffer.size());
+}
+
+void KmerMatrixWriter::write_record(const char* record, const size_t length)
+{
+   put(record, 1, length);
+   _num_kmers++;
+}
+
+void KmerMatrixWriter::write_records(const char* records, const size_t length, const size_t count)
+{
+   put(records, 1, length);
+   _num_kmers += count;
+}
+
+// fwrite, throwing on a short write (e.g. a full disk)
+void KmerMatrixWriter::put(const void* data, const size_t size, const size_t count)
+{
+   if (fwrite(data, size, count, _file) != count)
+   {
+      throw std::runtime_error("Could not write k-mers to " + _file_name + "\n");
+   }
+}
+
+/*
+ * Functions
+ */
+// Decodes the record at the start of the remaining bytes of a file with
+// num_samples samples. Returns its length
+size_t decodeKmxRecord(const char* record, const size_t remaining, const size_t num_samples, std::string& sequence, std::vector<uint32_t>& present)
+{
+   if (remaining < 3)
+   {
+      throw std::runtime_error("Truncated k-mer record");
+   }
+
+   uint16_t length;
+   memcpy(&length, record, sizeof(uint16_t));
+   uint8_t row_type = record[2];
+   size_t pos = 3;
+
+   // Sequence
+   size_t sequence_bytes = (length + 3) / 4;
+   if (pos + sequence_bytes > remaining)
+   {
+      throw std::runtime_error("Truncated k-mer record");
+   }
+   sequence.resize(length);
+   for (size_t i = 0; i < length; ++i)
+   {
+      sequence[i] = kmx_bases[((unsigned char)record[pos + i / 4] >> (2 * (i % 4))) & 3];
+   }
+   pos += sequence_bytes;
+
+   // Samples present
+   present.clear();
+   if (row_type == kmx_dense)
+   {
+      size_t words = kmxSampleWords(num_samples);
+      if (pos + words * sizeof(uint64_t) > remaining)
+      {
+         throw std::runtime_error("Truncated k-mer record");
+      }
+
+      for (size_t i = 0; i < words; ++i)
+      {
+         uint64_t word;
+         memcpy(&word, record + pos, sizeof(uint64_t));
+         pos += sizeof(uint64_t);
+
+         // Bits past the last sample are padding
+         if (i == words - 1 && num_samples % kmx_words)
+         {
+            word &= ((uint64_t)1 << (num_samples % kmx_words)) - 1;
+         }
+
+         while (word)
+         {
+            present.push_back(i * kmx_words + __builtin_ctzll(word));
+            word &= word - 1;
+         }
+      }
+   }
+   else if (row_type == kmx_sparse)
+   {
+      uint32_t count;
+      if (pos + sizeof(uint32_t) > remaining)
+      {
+         throw std::runtime_error("Truncated k-mer record");
+      }
+      memcpy(&count, record + pos, sizeof(uint32_t));
+      pos += sizeof(uint32_t);
+
+      if (pos + count * sizeof(uint32_t) > remaining)
+      {
+         throw std::runtime_error("Truncated k-mer record");
+      }
+      present.resize(count);
+      if (count > 0)
+      {
+         memcpy(&present[0], record + pos, count * sizeof(uint32_t));
+      }
+      pos += count * sizeof(uint32_t);
+
+      for (auto it = present.begin(); it != present.end(); ++it)
+      {
+         if (*it >= num_samples)
+         {
+            throw std::runtime_error("Corrupt k-mer record");
+         }
+      }
+   }
+   else
+   {
+      throw std::runtime_error("Unknown k-mer record type");
+   }
+
+   return pos;
+}
+
+int isKmerMatrix(const std::string& file_name)
+{
+   std::ifstream file(file_name.c_str(), std::ios::in | std::ios::binary);
+
+   std::string magic(kmx_magic.length(), '\0');
+   file.read(&magic[0], magic.length());
+
+   return (file.gcount() == (std::streamsize)kmx_magic.length() && magic == kmx_magic);
+}
+
@@ -0,0 +1,109 @@
+/*
+ * kmerMatrix.hpp
+ * Header file for the binary k-mer matrix (.kmx) format
+ *
+ * An alternative to text dsm files, written by combineKmers --binary and
+ * read by seer and kmds. Integers are in host (little endian) byte order.
+ *
+ * Header
+ *    magic        8 bytes, "SEERKMX1"
+ *    num_samples  uint32
+ *    num_kmers    uint64
+ *    samples      num_samples x (uint32 length, name)
+ * Then one record per k-mer
+ *    length       uint16, bases in the k-mer
+ *    row type     uint8, kmx_dense or kmx_sparse
+ *    sequence     (length + 3) / 4 bytes, 2 bits per base (A=0 C=1 G=2 T=3),
+ *                 first base in the lowest bits
+ *    dense row    (num_samples + 63) / 64 uint64, bit i set if in sample i
+ *    sparse row   uint32 count, then count uint32 sample indices, ascending
+ * The writer uses whichever row type is smaller. Abundances are not stored
+ *
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Constants
+const std::string kmx_magic = "SEERKMX1";
+const std::string kmx_suffix = ".kmx";
+const uint8_t kmx_dense = 0;
+const uint8_t kmx_sparse = 1;
+
+// Reads a .kmx file through a read-only memory map
+class KmerMatrixReader
+{
+   public:
+      KmerMatrixReader();
+      ~KmerMatrixReader();
+
+      void open(const std::string& file_name);
+      void close();
+
+      // Moves to the next record. Returns 0 at the end of the file
+      int next();
+
+      // nonmodifying operations
+      const std::vector<std::string>& samples() const { return _samples; }
+      uint64_t num_kmers() const { return _num_kmers; }
+
+      // Current record
+      const std::string& sequence() const { return _sequence; }
+      const std::vector<uint32_t>& present() const { return _present; } // Indices into samples()
+      const char* record() const { return _record; }
+      size_t record_length() const { return _record_length; }
+
+   private:
+      int _fd;
+      const char* _map;
+      size_t _map_length;
+      size_t _pos;
+
+      std::vector<std::string> _samples;
+      uint64_t _num_kmers;
+
+      std::string _sequence;
+      std::vector<uint32_t> _present;
+      const char* _record;
+      size_t _record_length;
+};
+
+class KmerMatrixWriter
+{
+   public:
+      KmerMatrixWriter();
+      ~KmerMatrixWriter();
+
+      void open(const std::string& file_name, const std::vector<std::string>& samples);
+      // Cuts a file being written back to length, when it had num_kmers,
+      // and carries on writing after them
+      void resume(const std::string& file_name, const std::vector<std::string>& samples, const uint64_t length, const uint64_t num_kmers);
+      void close(); // Fills in the number of k-mers written. Throws if any write failed
+
+      // Flushes the records so far. Returns the length of the file
+      uint64_t flush();
+      uint64_t num_kmers() const { return _num_kmers; }
+
+      // present is sample indices, ascending
+      void write(const std::string& sequence, const std::vector<uint32_t>& present);
+      // A record as given by KmerMatrixReader::record, from a file with the
+      // same samples, or count of them one after another
+      void write_record(const char* record, const size_t length);
+      void write_records(const char* records, const size_t length, const size_t count);
+
+   private:
+      void put(const void* data, const size_t size, const size_t count);
+
+      std::FILE* _file;
+      std::string _file_name;
+      size_t _num_samples;
+      uint64_t _num_kmers;
+      std::vector<char> _buffer;
+};
+
+// Functions
+int isKmerMatrix(const std::string& file_name);
+size_t decodeKmxRecord(const char* record, const size_t remaining, const size_t num_samples, std::string& sequence, std::vector<uint32_t>& present);
+
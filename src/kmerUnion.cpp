@@ -0,0 +1,843 @@
+/*
+ * File: kmerUnion.cpp
+ *
+ * Hash table and k-way merge engines for the union of k-mer counts
+ *
+ */
+
+#include "kmerUnion.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+
+#ifndef NO_HDF5
+#include <hdf5.h>
+
+// The HDF5 library is not thread safe unless built to be, and readers of
+// different dsk files run on their own threads, so all calls go through this
+std::mutex hdf5_mtx;
+#endif
+
+/*
+ * KmerCountReader
+ */
+KmerCountReader::KmerCountReader()
+   :_kmer_length(0), _dsk(0), _h5_file(-1), _h5_solid(-1), _h5_partition(-1), _h5_type(-1), _num_partitions(0),
+   _partition(0), _partition_size(0), _partition_pos(0), _value_words(0), _record_size(0), _block_count(0), _block_pos(0)
+{
+}
+
+KmerCountReader::~KmerCountReader()
+{
+   close();
+}
+
+int KmerCountReader::open(const std::string& file_name)
+{
+   close();
+   _file_name = file_name;
+
+   // dsk output is recognised by the HDF5 signature
+   std::string signature(hdf5_signature.length(), '\0');
+   _file.open(file_name.c_str(), std::ios::in | std::ios::binary);
+   if (!_file)
+   {
+      return 0;
+   }
+   _file.read(&signature[0], signature.length());
+   _dsk = _file.gcount() == (std::streamsize)signature.length() && signature == hdf5_signature;
+
+   _file.close();
+   if (_dsk)
+   {
+      open_dsk();
+   }
+   else
+   {
+      _file.open(file_name.c_str());
+   }
+
+   return 1;
+}
+
+void KmerCountReader::close()
+{
+   _file.close();
+   _file.clear();
+   _dsk = 0;
+
+#ifndef NO_HDF5
+   std::lock_guard<std::mutex> lock(hdf5_mtx);
+   if (_h5_partition >= 0)
+   {
+      H5Dclose(_h5_partition);
+   }
+   if (_h5_type >= 0)
+   {
+      H5Tclose(_h5_type);
+   }
+   if (_h5_solid >= 0)
+   {
+      H5Gclose(_h5_solid);
+   }
+   if (_h5_file >= 0)
+   {
+      H5Fclose(_h5_file);
+   }
+#endif
+   _h5_file = _h5_solid = _h5_partition = _h5_type = -1;
+   _num_partitions = _partition = _partition_size = _partition_pos = 0;
+   _block_count = _block_pos = 0;
+}
+
+int KmerCountReader::next(std::vector<uint64_t>& key, uint32_t& abundance)
+{
+   return _dsk ? next_dsk(key, abundance) : next_text(key, abundance);
+}
+
+int KmerCountReader::next_text(std::vector<uint64_t>& key, uint32_t& abundance)
+{
+   if (!(_file >> _kmer >> _abundance))
+   {
+      return 0;
+   }
+
+   try
+   {
+      abundance = std::stoul(_abundance);
+   }
+   catch (std::logic_error& e)
+   {
+      throw std::runtime_error("Bad abundance '" + _abundance + "' for " + _kmer + " in " + _file_name + "\n");
+   }
+
+   if (!packKmer(_kmer, key))
+   {
+      throw std::runtime_error("Invalid kmer " + _kmer + " in " + _file_name + "\n");
+   }
+   _kmer_length = _kmer.length();
+
+   return 1;
+}
+
+int KmerCountReader::next_dsk(std::vector<uint64_t>& key, uint32_t& abundance)
+{
+   if (_block_pos == _block_count && !read_dsk_block())
+   {
+      return 0;
+   }
+
+   const char* record = &_block[_block_pos * _record_size];
+   dskToKey((const uint64_t*)record, _value_words, _kmer_length, key);
+   memcpy(&abundance, record + _value_words * sizeof(uint64_t), sizeof(uint32_t));
+   _block_pos++;
+
+   return 1;
+}
+
+#ifdef NO_HDF5
+void KmerCountReader::open_dsk()
+{
+   throw std::runtime_error(_file_name + " is dsk output, but combineKmers was built without HDF5. Dump it with dsk2ascii\n");
+}
+
+int KmerCountReader::read_dsk_block()
+{
+   return 0;
+}
+#else
+void KmerCountReader::open_dsk()
+{
+   std::lock_guard<std::mutex> lock(hdf5_mtx);
+   H5Eset_auto2(H5E_DEFAULT, NULL, NULL); // Errors are reported here instead
+
+   _h5_file = H5Fopen(_file_name.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+   if (_h5_file < 0)
+   {
+      throw std::runtime_error("Could not open dsk output " + _file_name + "\n");
+   }
+
+   // k, stored as a string
+   hid_t attribute = H5Aopen_by_name(_h5_file, "dsk", "kmer_size", H5P_DEFAULT, H5P_DEFAULT);
+   if (attribute < 0)
+   {
+      throw std::runtime_error(_file_name + " has no dsk/kmer_size, so is not dsk output\n");
+   }
+   hid_t attribute_type = H5Aget_type(attribute);
+   long int kmer_size = 0;
+   if (H5Tget_class(attribute_type) == H5T_STRING)
+   {
+      std::string kmer_size_string;
+      if (H5Tis_variable_str(attribute_type) > 0)
+      {
+         char* value = NULL;
+         hid_t string_type = H5Tget_native_type(attribute_type, H5T_DIR_ASCEND);
+         if (H5Aread(attribute, string_type, &value) >= 0 && value != NULL)
+         {
+            kmer_size_string = value;
+            H5free_memory(value);
+         }
+         H5Tclose(string_type);
+      }
+      else
+      {
+         kmer_size_string.assign(H5Tget_size(attribute_type), '\0');
+         H5Aread(attribute, attribute_type, &kmer_size_string[0]);
+      }
+      kmer_size = atol(kmer_size_string.c_str());
+   }
+   else if (H5Tget_class(attribute_type) == H5T_INTEGER)
+   {
+      H5Aread(attribute, H5T_NATIVE_LONG, &kmer_size);
+   }
+   H5Tclose(attribute_type);
+   H5Aclose(attribute);
+   if (kmer_size <= 0)
+   {
+      throw std::runtime_error("Could not read dsk/kmer_size from " + _file_name + "\n");
+   }
+   _kmer_length = kmer_size;
+
+   // One dataset per partition
+   _h5_solid = H5Gopen2(_h5_file, "dsk/solid", H5P_DEFAULT);
+   H5G_info_t solid_info;
+   if (_h5_solid < 0 || H5Gget_info(_h5_solid, &solid_info) < 0)
+   {
+      throw std::runtime_error(_file_name + " has no dsk/solid k-mers\n");
+   }
+   _num_partitions = solid_info.nlinks;
+}
+
+// Reads the next block of records, from the next partition if this one has
+// been read. Returns 0 after the last partition
+int KmerCountReader::read_dsk_block()
+{
+   std::lock_guard<std::mutex> lock(hdf5_mtx);
+   while (_partition_pos == _partition_size)
+   {
+      if (_h5_partition >= 0)
+      {
+         H5Dclose(_h5_partition);
+         _h5_partition = -1;
+      }
+      if (_partition == _num_partitions)
+      {
+         return 0;
+      }
+
+      std::string partition_name = std::to_string(_partition++);
+      _h5_partition = H5Dopen2(_h5_solid, partition_name.c_str(), H5P_DEFAULT);
+      if (_h5_partition < 0)
+      {
+         throw std::runtime_error("Could not open dsk/solid/" + partition_name + " in " + _file_name + "\n");
+      }
+
+      hid_t space = H5Dget_space(_h5_partition);
+      hsize_t size = 0;
+      H5Sget_simple_extent_dims(space, &size, NULL);
+      H5Sclose(space);
+      _partition_size = size;
+      _partition_pos = 0;
+
+      // The record type in memory, from the k-mer's type in the file. Fields
+      // are matched by name, and abundances converted to uint32
+      if (_h5_type < 0)
+      {
+         hid_t file_type = H5Dget_type(_h5_partition);
+         int value_idx = H5Tget_member_index(file_type, "value");
+         if (H5Tget_class(file_type) != H5T_COMPOUND || value_idx < 0 || H5Tget_member_index(file_type, "abundance") < 0)
+         {
+            H5Tclose(file_type);
+            throw std::runtime_error("dsk/solid/" + partition_name + " in " + _file_name + " is not (value, abundance) counts\n");
+         }
+
+         hid_t value_type = H5Tget_member_type(file_type, value_idx);
+         hid_t memory_value_type;
+         if (H5Tget_class(value_type) == H5T_INTEGER)
+         {
+            _value_words = 1;
+            memory_value_type = H5Tcopy(H5T_NATIVE_UINT64);
+         }
+         else if (H5Tget_class(value_type) == H5T_ARRAY && H5Tget_array_ndims(value_type) == 1)
+         {
+            hsize_t words;
+            H5Tget_array_dims2(value_type, &words);
+            _value_words = words;
+            memory_value_type = H5Tarray_create2(H5T_NATIVE_UINT64, 1, &words);
+         }
+         else
+         {
+            H5Tclose(value_type);
+            H5Tclose(file_type);
+            throw std::runtime_error("Unknown k-mer type in " + _file_name + "\n");
+         }
+         H5Tclose(value_type);
+         H5Tclose(file_type);
+
+         if (_value_words * kmer_word_bases < _kmer_length)
+         {
+            H5Tclose(memory_value_type);
+            throw std::runtime_error("k-mers in " + _file_name + " are shorter than dsk/kmer_size\n");
+         }
+
+         _record_size = (_value_words + 1) * sizeof(uint64_t);
+         _h5_type = H5Tcreate(H5T_COMPOUND, _record_size);
+         H5Tinsert(_h5_type, "value", 0, memory_value_type);
+         H5Tinsert(_h5_type, "abundance", _value_words * sizeof(uint64_t), H5T_NATIVE_UINT32);
+         H5Tclose(memory_value_type);
+      }
+   }
+
+   hsize_t start = _partition_pos;
+   hsize_t count = std::min((uint64_t)dsk_block_size, _partition_size - _partition_pos);
+   hid_t file_space = H5Dget_space(_h5_partition);
+   H5Sselect_hyperslab(file_space, H5S_SELECT_SET, &start, NULL, &count, NULL);
+   hid_t memory_space = H5Screate_simple(1, &count, NULL);
+
+   _block.resize(count * _record_size);
+   herr_t status = H5Dread(_h5_partition, _h5_type, memory_space, file_space, H5P_DEFAULT, _block.data());
+   H5Sclose(memory_space);
+   H5Sclose(file_space);
+   if (status < 0)
+   {
+      throw std::runtime_error("Could not read k-mers from " + _file_name + "\n");
+   }
+
+   _partition_pos += count;
+   _block_count = count;
+   _block_pos = 0;
+
+   return 1;
+}
+#endif
+
+/*
+ * KmerHashTable
+ */
+KmerHashTable::KmerHashTable()
+   :_length(0), _words(0), _capacity(0), _size(0), _num_postings(0)
+{
+}
+
+void KmerHashTable::add(const uint64_t* key, const size_t kmer_length, const uint32_t sample, const uint32_t abundance)
+{
+   if (_capacity == 0)
+   {
+      _length = kmer_length;
+      _words = kmerWords(kmer_length);
+      _capacity = hash_initial_capacity;
+      _keys.assign(_capacity * _words, 0);
+      _first.assign(_capacity, 0);
+      _last.assign(_capacity, 0);
+      _counts.assign(_capacity, 0);
+   }
+   else if (kmer_length != _length)
+   {
+      throw std::runtime_error("k-mers of different lengths (" + std::to_string(_length) + " and " + std::to_string(kmer_length) + ") can't be combined\n");
+   }
+
+   if (_size + 1 > _capacity * hash_max_load)
+   {
+      grow();
+   }
+
+   // New posting, at the end of the last chunk
+   if (_num_postings % posting_chunk_size == 0)
+   {
+      _postings.emplace_back(new kmerPosting[posting_chunk_size]);
+   }
+   kmerPosting& posting = _postings.back()[_num_postings % posting_chunk_size];
+   posting.sample = sample;
+   posting.abundance = abundance;
+   posting.next = 0;
+   _num_postings++;
+
+   size_t slot = find_slot(key);
+   if (_first[slot] == 0)
+   {
+      std::copy(key, key + _words, _keys.begin() + slot * _words);
+      _first[slot] = _num_postings;
+      _size++;
+   }
+   else
+   {
+      uint64_t last = _last[slot] - 1;
+      _postings[last / posting_chunk_size][last % posting_chunk_size].next = _num_postings;
+   }
+   _last[slot] = _num_postings;
+   _counts[slot]++;
+}
+
+// Empties the table, freeing its memory
+void KmerHashTable::clear()
+{
+   _capacity = 0;
+   _size = 0;
+   _num_postings = 0;
+
+   std::vector<uint64_t>().swap(_keys);
+   std::vector<uint64_t>().swap(_first);
+   std::vector<uint64_t>().swap(_last);
+   std::vector<uint32_t>().swap(_counts);
+   std::vector<std::unique_ptr<kmerPosting[]>>().swap(_postings);
+}
+
+void KmerHashTable::for_each(const size_t min_samples, const unionCallback& f) const
+{
+   std::vector<kmerPosting> postings;
+   for (size_t slot = 0; slot < _capacity; ++slot)
+   {
+      if (_first[slot] != 0 && _counts[slot] >= min_samples)
+      {
+         slot_postings(slot, postings);
+         f(unpackKmer(&_keys[slot * _words], _length), postings);
+      }
+   }
+}
+
+void KmerHashTable::write_run(std::ostream& os) const
+{
+   std::vector<size_t> slots;
+   slots.reserve(_size);
+   for (size_t slot = 0; slot < _capacity; ++slot)
+   {
+      if (_first[slot] != 0)
+      {
+         slots.push_back(slot);
+      }
+   }
+   std::sort(slots.begin(), slots.end(), [this](const size_t a, const size_t b)
+   {
+      return std::lexicographical_compare(&_keys[a * _words], &_keys[(a + 1) * _words], &_keys[b * _words], &_keys[(b + 1) * _words]);
+   });
+
+   uint64_t length = _length;
+   os.write((const char*)&length, sizeof(uint64_t));
+
+   std::vector<kmerPosting> postings;
+   for (auto it = slots.begin(); it != slots.end(); ++it)
+   {
+      slot_postings(*it, postings);
+
+      uint32_t count = postings.size();
+      os.write((const char*)&_keys[*it * _words], _words * sizeof(uint64_t));
+      os.write((const char*)&count, sizeof(uint32_t));
+      for (auto posting_it = postings.begin(); posting_it != postings.end(); ++posting_it)
+      {
+         os.write((const char*)&posting_it->sample, sizeof(uint32_t));
+         os.write((const char*)&posting_it->abundance, sizeof(uint32_t));
+      }
+   }
+}
+
+size_t KmerHashTable::memory() const
+{
+   return _capacity * (_words * sizeof(uint64_t) + 2 * sizeof(uint64_t) + sizeof(uint32_t))
+      + _postings.size() * posting_chunk_size * sizeof(kmerPosting);
+}
+
+// Slot holding key, or the empty slot it would go in. Probes linearly
+size_t KmerHashTable::find_slot(const uint64_t* key) const
+{
+   size_t slot = hashKmer(key, _words) & (_capacity - 1);
+   while (_first[slot] != 0 && memcmp(&_keys[slot * _words], key, _words * sizeof(uint64_t)) != 0)
+   {
+      slot = (slot + 1) & (_capacity - 1);
+   }
+
+   return slot;
+}
+
+// Doubles the capacity and reinserts every k-mer. Postings don't move
+void KmerHashTable::grow()
+{
+   std::vector<uint64_t> old_keys, old_first, old_last;
+   std::vector<uint32_t> old_counts;
+   old_keys.swap(_keys);
+   old_first.swap(_first);
+   old_last.swap(_last);
+   old_counts.swap(_counts);
+
+   size_t old_capacity = _capacity;
+   _capacity *= 2;
+   _keys.assign(_capacity * _words, 0);
+   _first.assign(_capacity, 0);
+   _last.assign(_capacity, 0);
+   _counts.assign(_capacity, 0);
+
+   for (size_t old_slot = 0; old_slot < old_capacity; ++old_slot)
+   {
+      if (old_first[old_slot] != 0)
+      {
+         const uint64_t* key = &old_keys[old_slot * _words];
+         size_t slot = find_slot(key);
+
+         std::copy(key, key + _words, _keys.begin() + slot * _words);
+         _first[slot] = old_first[old_slot];
+         _last[slot] = old_last[old_slot];
+         _counts[slot] = old_counts[old_slot];
+      }
+   }
+}
+
+// Postings of the k-mer in slot, sorted by sample
+void KmerHashTable::slot_postings(const size_t slot, std::vector<kmerPosting>& postings) const
+{
+   postings.clear();
+   for (uint64_t next = _first[slot]; next != 0; next = postings.back().next)
+   {
+      postings.push_back(_postings[(next - 1) / posting_chunk_size][(next - 1) % posting_chunk_size]);
+   }
+
+   if (!std::is_sorted(postings.begin(), postings.end(), postingOrder))
+   {
+      std::stable_sort(postings.begin(), postings.end(), postingOrder);
+   }
+}
+
+/*
+ * KmerPartition
+ */
+KmerPartition::KmerPartition(const std::string& run_prefix, const size_t max_memory)
+   :_run_prefix(run_prefix), _max_memory(max_memory)
+{
+}
+
+KmerPartition::~KmerPartition()
+{
+   for (auto it = _runs.begin(); it != _runs.end(); ++it)
+   {
+      std::remove(it->c_str());
+   }
+}
+
+void KmerPartition::add(const kmerBatch& batch)
+{
+   const size_t words = kmerWords(batch.kmer_length);
+   for (size_t i = 0; i < batch.samples.size(); ++i)
+   {
+      _table.add(&batch.keys[i * words], batch.kmer_length, batch.samples[i], batch.abundances[i]);
+   }
+
+   if (_max_memory > 0 && _table.memory() > _max_memory)
+   {
+      spill();
+   }
+}
+
+void KmerPartition::for_each(const size_t min_samples, const unionCallback& f)
+{
+   if (_runs.empty())
+   {
+      _table.for_each(min_samples, f);
+   }
+   else
+   {
+      if (_table.size() > 0)
+      {
+         spill();
+      }
+      mergeRuns(_runs, min_samples, f);
+   }
+}
+
+// Writes the table to a new run, and empties it
+void KmerPartition::spill()
+{
+   std::string run_file = _run_prefix + "." + std::to_string(_runs.size() + 1);
+   std::ofstream run(run_file.c_str(), std::ios::out | std::ios::binary);
+   _runs.push_back(run_file);
+
+   _table.write_run(run);
+   run.close();
+   if (!run)
+   {
+      throw std::runtime_error("Could not write k-mers to " + run_file + "\n");
+   }
+
+   _table.clear();
+}
+
+/*
+ * Functions
+ */
+bool postingOrder(const kmerPosting& a, const kmerPosting& b)
+{
+   return a.sample < b.sample;
+}
+
+size_t kmerWords(const size_t kmer_length)
+{
+   return (kmer_length + kmer_word_bases - 1) / kmer_word_bases;
+}
+
+// Packs kmer into key. Returns 0 if it has bases other than ACGT
+int packKmer(const std::string& kmer, std::vector<uint64_t>& key)
+{
+   key.assign(kmerWords(kmer.length()), 0);
+   for (size_t i = 0; i < kmer.length(); ++i)
+   {
+      uint64_t code;
+      switch (kmer[i])
+      {
+         case 'A':
+            code = 0;
+            break;
+         case 'C':
+            code = 1;
+            break;
+         case 'G':
+            code = 2;
+            break;
+         case 'T':
+            code = 3;
+            break;
+         default:
+            return 0;
+      }
+      key[i / kmer_word_bases] |= code << (2 * (kmer_word_bases - 1 - i % kmer_word_bases));
+   }
+
+   return 1;
+}
+
+std::string unpackKmer(const uint64_t* key, const size_t kmer_length)
+{
+   static const char bases[4] = {'A', 'C', 'G', 'T'};
+
+   std::string kmer(kmer_length, 'A');
+   for (size_t i = 0; i < kmer_length; ++i)
+   {
+      kmer[i] = bases[(key[i / kmer_word_bases] >> (2 * (kmer_word_bases - 1 - i % kmer_word_bases))) & 3];
+   }
+
+   return kmer;
+}
+
+// Packs a dsk k-mer, converting its bases from A=0 C=1 T=2 G=3
+void dskToKey(const uint64_t* value, const size_t value_words, const size_t kmer_length, std::vector<uint64_t>& key)
+{
+   // Swapping the codes of G and T is the low bit of each base xor its
+   // high bit
+   const uint64_t low_bits = 0x5555555555555555;
+   if (value_words == 1)
+   {
+      uint64_t bases = value[0] ^ ((value[0] >> 1) & low_bits);
+      key.assign(1, kmer_length < kmer_word_bases ? bases << (2 * (kmer_word_bases - kmer_length)) : bases);
+   }
+   else
+   {
+      key.assign(kmerWords(kmer_length), 0);
+      for (size_t i = 0; i < kmer_length; ++i)
+      {
+         size_t bit = 2 * (kmer_length - 1 - i);
+         uint64_t code = (value[bit / 64] >> (bit % 64)) & 3;
+         code ^= code >> 1;
+         key[i / kmer_word_bases] |= code << (2 * (kmer_word_bases - 1 - i % kmer_word_bases));
+      }
+   }
+}
+
+// Partition of a k-mer, from the top of its hash. Tables use the bottom
+unsigned int kmerPartition(const uint64_t* key, const size_t words, const unsigned int num_partitions)
+{
+   return (hashKmer(key, words) >> 32) % num_partitions;
+}
+
+// Mixes the words of a packed k-mer (splitmix64 finaliser)
+uint64_t hashKmer(const uint64_t* key, const size_t words)
+{
+   uint64_t hash = 0x9e3779b97f4a7c15;
+   for (size_t i = 0; i < words; ++i)
+   {
+      hash ^= key[i] + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+      hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+      hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+      hash ^= hash >> 31;
+   }
+
+   return hash;
+}
+
+// k-way merge of spilled runs, in order of k-mer. The postings of a k-mer
+// in several runs are combined
+void mergeRuns(const std::vector<std::string>& runs, const size_t min_samples, const unionCallback& f)
+{
+   const size_t num_runs = runs.size();
+   std::vector<std::ifstream> files(num_runs);
+   std::vector<std::vector<uint64_t>> current(num_runs);
+   std::vector<std::vector<kmerPosting>> postings(num_runs);
+   std::vector<int> more(num_runs, 0);
+
+   uint64_t kmer_length = 0;
+   size_t words = 0;
+   auto next = [&](const size_t run)
+   {
+      uint32_t count;
+      more[run] = (bool)files[run].read((char*)current[run].data(), words * sizeof(uint64_t))
+         && files[run].read((char*)&count, sizeof(uint32_t));
+      if (more[run])
+      {
+         postings[run].resize(count);
+         for (uint32_t i = 0; i < count; ++i)
+         {
+            files[run].read((char*)&postings[run][i].sample, sizeof(uint32_t));
+            files[run].read((char*)&postings[run][i].abundance, sizeof(uint32_t));
+            postings[run][i].next = 0;
+         }
+         if (!files[run])
+         {
+            throw std::runtime_error("Truncated k-mer run " + runs[run] + "\n");
+         }
+      }
+   };
+
+   for (size_t i = 0; i < num_runs; ++i)
+   {
+      files[i].open(runs[i].c_str(), std::ios::in | std::ios::binary);
+      uint64_t run_length;
+      if (!files[i].read((char*)&run_length, sizeof(uint64_t)))
+      {
+         throw std::runtime_error("Could not read k-mer run " + runs[i] + "\n");
+      }
+      else if (i > 0 && run_length != kmer_length)
+      {
+         throw std::runtime_error("k-mers of different lengths (" + std::to_string(kmer_length) + " and " + std::to_string(run_length) + ") can't be combined\n");
+      }
+      kmer_length = run_length;
+      words = kmerWords(kmer_length);
+   }
+
+   // Heap of the runs by their current k-mer
+   auto later = [&current](const size_t a, const size_t b)
+   {
+      return current[b] < current[a] || (current[a] == current[b] && a > b);
+   };
+   std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+   for (size_t i = 0; i < num_runs; ++i)
+   {
+      current[i].resize(words);
+      next(i);
+      if (more[i])
+      {
+         heap.push(i);
+      }
+   }
+
+   std::vector<uint64_t> key;
+   std::vector<kmerPosting> merged;
+   while (!heap.empty())
+   {
+      key = current[heap.top()];
+      merged.clear();
+
+      while (!heap.empty() && current[heap.top()] == key)
+      {
+         size_t run = heap.top();
+         heap.pop();
+         merged.insert(merged.end(), postings[run].begin(), postings[run].end());
+
+         next(run);
+         if (more[run])
+         {
+            heap.push(run);
+         }
+      }
+
+      if (merged.size() >= min_samples)
+      {
+         std::stable_sort(merged.begin(), merged.end(), postingOrder);
+         f(unpackKmer(key.data(), kmer_length), merged);
+      }
+   }
+}
+
+// k-way merge of count files sorted by k-mer, in order of k-mer. Files which
+// can't be opened are skipped. dsk output is in hash partitions, not k-mer
+// order, so can't be merged this way
+void mergeSortedCounts(const std::vector<std::string>& count_files, const size_t min_samples, const unionCallback& f)
+{
+   const size_t num_samples = count_files.size();
+   std::vector<KmerCountReader> readers(num_samples);
+   std::vector<std::vector<uint64_t>> current(num_samples);
+   std::vector<uint32_t> abundances(num_samples);
+   size_t kmer_length = 0;
+
+   // Heap of the samples by their current k-mer, then sample order
+   auto later = [&current](const uint32_t a, const uint32_t b)
+   {
+      return current[a] > current[b] || (current[a] == current[b] && a > b);
+   };
+   std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(later)> heap(later);
+
+   // All k-mers must be one length, so the packed keys compare as the
+   // sequences do
+   auto check_length = [&](const uint32_t sample)
+   {
+      if (kmer_length == 0)
+      {
+         kmer_length = readers[sample].kmer_length();
+      }
+      else if (readers[sample].kmer_length() != kmer_length)
+      {
+         throw std::runtime_error(count_files[sample] + " has k-mers of length " + std::to_string(readers[sample].kmer_length())
+               + ", not " + std::to_string(kmer_length) + "\n");
+      }
+   };
+
+   for (uint32_t i = 0; i < num_samples; ++i)
+   {
+      if (!readers[i].open(count_files[i]))
+      {
+         std::cerr << "Could not open " + count_files[i] << std::endl;
+         std::cerr << "Skipping..." << std::endl;
+      }
+      else if (readers[i].is_dsk())
+      {
+         throw std::runtime_error(count_files[i] + " is dsk output, which is not sorted by k-mer. Run without --sorted\n");
+      }
+      else if (readers[i].next(current[i], abundances[i]))
+      {
+         check_length(i);
+         heap.push(i);
+      }
+   }
+
+   std::vector<uint64_t> key, previous;
+   std::vector<kmerPosting> postings;
+   while (!heap.empty())
+   {
+      key = current[heap.top()];
+      postings.clear();
+
+      while (!heap.empty() && current[heap.top()] == key)
+      {
+         uint32_t sample = heap.top();
+         heap.pop();
+         postings.push_back(kmerPosting{sample, abundances[sample], 0});
+
+         previous.swap(current[sample]);
+         if (readers[sample].next(current[sample], abundances[sample]))
+         {
+            check_length(sample);
+            if (current[sample] < previous)
+            {
+               throw std::runtime_error(count_files[sample] + " is not sorted by k-mer ("
+                     + unpackKmer(current[sample].data(), kmer_length) + " after " + unpackKmer(previous.data(), kmer_length)
+                     + "). Sort it with LC_ALL=C sort\n");
+            }
+            heap.push(sample);
+         }
+      }
+
+      if (postings.size() >= min_samples)
+      {
+         f(unpackKmer(key.data(), kmer_length), postings);
+      }
+   }
+}
@@ -0,0 +1,204 @@
+/*
+ * kmerUnion.hpp
+ * Header file for the engines combineKmers takes the union of k-mer counts
+ * with
+ *
+ * k-mers are packed 2 bits per base (A=0 C=1 G=2 T=3) into uint64 words,
+ * first base in the highest bits of the first word, so comparing the words
+ * in order sorts k-mers of the same length as their sequences sort.
+ *
+ * KmerHashTable is an open addressing table of packed k-mers, each with a
+ * list of (sample, abundance) postings. Samples may be added in any order,
+ * so postings are sorted by sample when read out.
+ *
+ * KmerPartition is a table of the k-mers routed to one partition by their
+ * hash, with a memory budget. When the table goes over budget it is spilled
+ * to disk as a run sorted by k-mer, and emptied. The runs are merged at the
+ * end. A run is
+ *    kmer_length  uint64
+ * then for each k-mer, in order
+ *    key          kmerWords(kmer_length) uint64
+ *    count        uint32
+ *    postings     count x (uint32 sample, uint32 abundance)
+ *
+ * mergeSortedCounts instead streams count files which are each sorted by
+ * k-mer, as from LC_ALL=C sort, in a k-way merge. Only the current k-mer of
+ * each file is held, so memory use is proportional to the number of samples
+ *
+ */
+
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Constants
+const unsigned int kmer_word_bases = 32;
+const size_t hash_initial_capacity = 1 << 16; // slots, a power of two
+const double hash_max_load = 0.7;
+const size_t posting_chunk_size = 1 << 16; // postings allocated together
+const size_t count_batch_size = 1 << 16; // k-mers passed to a partition at once
+const size_t dsk_block_size = 1 << 16; // k-mers read from HDF5 at once
+const std::string hdf5_signature = "\211HDF\r\n\032\n";
+
+// Structs
+struct kmerPosting
+{
+   uint32_t sample;
+   uint32_t abundance;
+   uint64_t next; // index of the next posting of the k-mer, plus one. 0 at the end
+};
+
+// k-mers read from the count files, for one partition
+struct kmerBatch
+{
+   size_t kmer_length;
+   std::vector<uint64_t> keys; // kmerWords(kmer_length) per k-mer
+   std::vector<uint32_t> samples;
+   std::vector<uint32_t> abundances;
+};
+
+// Called with each k-mer of the union, and the samples it is in, in order
+typedef std::function<void(const std::string&, const std::vector<kmerPosting>&)> unionCallback;
+
+// Reads the k-mer counts of one sample, packed. Either text, one
+// 'kmer abundance' pair per line, or the HDF5 output of dsk, which is read
+// straight from its 2-bit k-mers (unless built with NO_HDF5). dsk keeps its
+// solid k-mers in datasets dsk/solid/0, 1... of (value, abundance), with the
+// bases of the k-mer in the low bits of value, first base highest, coded
+// A=0 C=1 T=2 G=3. value is a uint64 for k up to 32, otherwise an array of
+// them, least significant first. The group dsk has a kmer_size attribute
+class KmerCountReader
+{
+   public:
+      KmerCountReader();
+      ~KmerCountReader();
+
+      KmerCountReader(const KmerCountReader&) = delete;
+      KmerCountReader& operator=(const KmerCountReader&) = delete;
+
+      // Returns 0 if the file can't be opened
+      int open(const std::string& file_name);
+      void close();
+
+      // Moves to the next k-mer. Returns 0 at the end of the file
+      int next(std::vector<uint64_t>& key, uint32_t& abundance);
+
+      // nonmodifying operations
+      size_t kmer_length() const { return _kmer_length; } // of the last k-mer
+      int is_dsk() const { return _dsk; }
+
+   private:
+      int next_text(std::vector<uint64_t>& key, uint32_t& abundance);
+      int next_dsk(std::vector<uint64_t>& key, uint32_t& abundance);
+      void open_dsk();
+      int read_dsk_block();
+
+      std::string _file_name;
+      size_t _kmer_length;
+      int _dsk;
+
+      // Text
+      std::ifstream _file;
+      std::string _kmer;
+      std::string _abundance;
+
+      // dsk. HDF5 identifiers, or -1
+      int64_t _h5_file;
+      int64_t _h5_solid;
+      int64_t _h5_partition;
+      int64_t _h5_type; // of a record, in memory
+      uint64_t _num_partitions;
+      uint64_t _partition; // next to open
+      uint64_t _partition_size;
+      uint64_t _partition_pos;
+      size_t _value_words;
+      size_t _record_size;
+      std::vector<char> _block;
+      size_t _block_count;
+      size_t _block_pos;
+};
+
+class KmerHashTable
+{
+   public:
+      // Initialisation
+      KmerHashTable();
+
+      // Adds a posting to packed k-mer key, of the same length as all others
+      void add(const uint64_t* key, const size_t kmer_length, const uint32_t sample, const uint32_t abundance);
+      void clear();
+
+      // Calls f with each k-mer in at least min_samples samples, in no
+      // particular order. Postings are sorted by sample
+      void for_each(const size_t min_samples, const unionCallback& f) const;
+      // Every k-mer, in order, in the run format
+      void write_run(std::ostream& os) const;
+
+      // nonmodifying operations
+      size_t size() const { return _size; } // k-mers
+      size_t memory() const; // bytes
+
+   private:
+      size_t find_slot(const uint64_t* key) const;
+      void grow();
+      void slot_postings(const size_t slot, std::vector<kmerPosting>& postings) const;
+
+      size_t _length;
+      size_t _words;
+      size_t _capacity;
+      size_t _size;
+
+      std::vector<uint64_t> _keys; // _words per slot
+      std::vector<uint64_t> _first; // posting index plus one, 0 in empty slots
+      std::vector<uint64_t> _last;
+      std::vector<uint32_t> _counts;
+
+      std::vector<std::unique_ptr<kmerPosting[]>> _postings;
+      uint64_t _num_postings;
+};
+
+class KmerPartition
+{
+   public:
+      // Runs are written to run_prefix.1, .2 and so on. A max_memory of 0
+      // (bytes) never spills
+      KmerPartition(const std::string& run_prefix, const size_t max_memory);
+      ~KmerPartition(); // Removes the runs
+
+      KmerPartition(const KmerPartition&) = delete;
+      KmerPartition& operator=(const KmerPartition&) = delete;
+
+      void add(const kmerBatch& batch);
+
+      // Calls f with each k-mer in at least min_samples samples. In order of
+      // k-mer if any runs were spilled, otherwise in no particular order
+      void for_each(const size_t min_samples, const unionCallback& f);
+
+      // nonmodifying operations
+      size_t size() const { return _table.size(); } // k-mers in memory
+      size_t memory() const { return _table.memory(); }
+      size_t num_runs() const { return _runs.size(); }
+
+   private:
+      void spill();
+
+      KmerHashTable _table;
+      std::string _run_prefix;
+      size_t _max_memory;
+      std::vector<std::string> _runs;
+};
+
+// Functions
+bool postingOrder(const kmerPosting& a, const kmerPosting& b);
+size_t kmerWords(const size_t kmer_length);
+int packKmer(const std::string& kmer, std::vector<uint64_t>& key);
+std::string unpackKmer(const uint64_t* key, const size_t kmer_length);
+uint64_t hashKmer(const uint64_t* key, const size_t words);
+void dskToKey(const uint64_t* value, const size_t value_words, const size_t kmer_length, std::vector<uint64_t>& key);
+unsigned int kmerPartition(const uint64_t* key, const size_t words, const unsigned int num_partitions);
+void mergeRuns(const std::vector<std::string>& runs, const size_t min_samples, const unionCallback& f);
+void mergeSortedCounts(const std::vector<std::string>& count_files, const size_t min_samples, const unionCallback& f);
@@ -0,0 +1,307 @@
+/*
+ * File: libseer.cpp
+ *
+ * Tests batches of k-mers given in memory, for the seer library. Each batch
+ * goes through the same threads as seer: a reader applying the filters, and
+ * a pool of workers testing the k-mers which pass
+ *
+ */
+
+#include "seer.hpp"
+#include "libseer.hpp"
+
+#include <cstring>
+
+seerOptions::seerOptions()
+   :maf(maf_default), min_words(-1), max_length(max_length_default), chisq(stod(chisq_default)), pval(stod(pval_default)),
+   score(1), filter(1), threads(1)
+{
+}
+
+struct SeerModel::model
+{
+   void test(const size_t num_kmers, const std::function<void(const size_t, Kmer&)>& load, seerResult* results);
+
+   std::vector<Sample> samples;
+   std::vector<std::string> names;
+   cmdOptions parameters;
+   std::vector<phenotypeTest> phenotypes;
+
+   std::unique_ptr<RecyclePool<kmerTask>> recycled; // Kept between batches
+   std::mutex mtx; // One batch at a time
+};
+
+SeerModel::SeerModel(const std::string& pheno_file, const std::string& context_file, const std::string& kinship_file, const seerOptions& options)
+   :_model(new model)
+{
+   std::unordered_map<std::string,int> sample_map;
+   readPheno(pheno_file, _model->samples, sample_map);
+   const std::vector<Sample>& samples = _model->samples;
+   for (auto it = samples.begin(); it != samples.end(); ++it)
+   {
+      _model->names.push_back(it->iid());
+   }
+
+   // Null model, as seer
+   arma::vec y = constructVecY(samples);
+   int continuous = continuousPhenotype(samples);
+   if (context_file.empty())
+   {
+      _model->phenotypes.emplace_back(y, continuous, FixedCovariates(y, arma::mat(), continuous));
+   }
+   else
+   {
+      _model->phenotypes.emplace_back(y, continuous, FixedCovariates(y, context_file, samples, continuous));
+   }
+
+   if (!kinship_file.empty())
+   {
+      arma::mat kinship = readMDS(kinship_file, samples);
+      _model->phenotypes[0].lmm.reset(new MixedModel(_model->phenotypes[0].fixed, kinship));
+   }
+
+   // Options, as verifyCommandLine. Everything else is off
+   cmdOptions& parameters = _model->parameters;
+   parameters = cmdOptions();
+   parameters.filter = options.filter;
+   parameters.max_length = options.max_length;
+   parameters.chi_cutoff = options.chisq;
+   parameters.log_cutoff = options.pval;
+   parameters.score_test = options.score < 1;
+   parameters.score_cutoff = options.score;
+   parameters.num_threads = std::max(options.threads, 1U);
+   parameters.num_shards = 1;
+
+   if (options.min_words >= 0)
+   {
+      parameters.min_words = options.min_words;
+   }
+   else if (options.maf >= 0)
+   {
+      parameters.min_words = static_cast<unsigned int>(samples.size() * options.maf);
+   }
+   else
+   {
+      throw std::runtime_error("maf must be at least 0");
+   }
+   if (parameters.min_words > samples.size())
+   {
+      throw std::runtime_error("min_words/maf is more than the number of samples");
+   }
+   parameters.max_words = samples.size() - parameters.min_words;
+
+   _model->recycled.reset(new RecyclePool<kmerTask>((queue_depth + reorder_depth) * parameters.num_threads + stats_block_size));
+}
+
+SeerModel::~SeerModel()
+{
+}
+
+size_t SeerModel::num_samples() const
+{
+   return _model->samples.size();
+}
+
+const std::string& SeerModel::sample_name(const size_t i) const
+{
+   return _model->names.at(i);
+}
+
+size_t SeerModel::num_covars() const
+{
+   return _model->phenotypes[0].fixed.num_fixed() - 1;
+}
+
+size_t SeerModel::presence_words() const
+{
+   return (num_samples() + presence_word_bits - 1) / presence_word_bits;
+}
+
+void SeerModel::test(const std::vector<std::string>& sequences, const std::vector<uint64_t>& presence, std::vector<seerResult>& results)
+{
+   const size_t words = presence_words();
+   const size_t num_kmers = presence.size() / std::max(words, (size_t)1);
+   if (presence.size() != num_kmers * words || (!sequences.empty() && sequences.size() != num_kmers))
+   {
+      throw std::runtime_error("Need one sequence (or none) and " + std::to_string(words) + " presence words for each k-mer");
+   }
+
+   std::vector<const char*> sequence_ptrs;
+   for (auto it = sequences.begin(); it != sequences.end(); ++it)
+   {
+      sequence_ptrs.push_back(it->c_str());
+   }
+
+   results.resize(num_kmers);
+   test(num_kmers, sequences.empty() ? NULL : sequence_ptrs.data(), presence.data(), results.data());
+}
+
+void SeerModel::test(const std::vector<std::string>& sequences, const std::vector<std::vector<uint32_t>>& samples, std::vector<seerResult>& results)
+{
+   const size_t num_kmers = samples.size();
+   if (!sequences.empty() && sequences.size() != num_kmers)
+   {
+      throw std::runtime_error("Need one sequence (or none) for each k-mer");
+   }
+
+   const size_t n = num_samples();
+   for (size_t i = 0; i < num_kmers; ++i)
+   {
+      for (auto it = samples[i].begin(); it != samples[i].end(); ++it)
+      {
+         if (*it >= n)
+         {
+            throw std::runtime_error("Sample index " + std::to_string(*it) + " out of range in k-mer " + std::to_string(i));
+         }
+      }
+   }
+
+   results.resize(num_kmers);
+   _model->test(num_kmers, [&](const size_t i, Kmer& k)
+      {
+         if (sequences.empty())
+         {
+            k.reset("", 0, n);
+         }
+         else
+         {
+            k.reset(sequences[i].data(), sequences[i].length(), n);
+         }
+         for (auto it = samples[i].begin(); it != samples[i].end(); ++it)
+         {
+            k.add_sample(*it);
+         }
+         k.set_maf((double)k.num_occurrences() / n);
+      }, results.data());
+}
+
+void SeerModel::test(const size_t num_kmers, const char* const* sequences, const uint64_t* presence, seerResult* results)
+{
+   // Bits past the last sample must be clear
+   const size_t n = num_samples();
+   const size_t words = presence_words();
+   for (size_t i = 0; n % presence_word_bits && i < num_kmers; ++i)
+   {
+      if (presence[(i + 1) * words - 1] >> (n % presence_word_bits))
+      {
+         throw std::runtime_error("Sample index out of range in k-mer " + std::to_string(i));
+      }
+   }
+
+   _model->test(num_kmers, [&](const size_t i, Kmer& k)
+      {
+         const char* sequence = sequences == NULL ? "" : sequences[i];
+         k.reset(sequence, strlen(sequence), n);
+         for (size_t j = 0; j < words; ++j)
+         {
+            uint64_t word = presence[i * words + j];
+            while (word)
+            {
+               k.add_sample(j * presence_word_bits + __builtin_ctzll(word));
+               word &= word - 1;
+            }
+         }
+         k.set_maf((double)k.num_occurrences() / n);
+      }, results);
+}
+
+void SeerModel::test(const size_t num_kmers, const char* const* sequences, const uint32_t* samples, const size_t* num_present, seerResult* results)
+{
+   const size_t n = num_samples();
+   std::vector<size_t> starts(num_kmers + 1, 0);
+   for (size_t i = 0; i < num_kmers; ++i)
+   {
+      starts[i + 1] = starts[i] + num_present[i];
+   }
+   for (size_t i = 0; i < num_kmers; ++i)
+   {
+      for (size_t j = starts[i]; j < starts[i + 1]; ++j)
+      {
+         if (samples[j] >= n)
+         {
+            throw std::runtime_error("Sample index " + std::to_string(samples[j]) + " out of range in k-mer " + std::to_string(i));
+         }
+      }
+   }
+
+   _model->test(num_kmers, [&](const size_t i, Kmer& k)
+      {
+         const char* sequence = sequences == NULL ? "" : sequences[i];
+         k.reset(sequence, strlen(sequence), n);
+         for (size_t j = starts[i]; j < starts[i + 1]; ++j)
+         {
+            k.add_sample(samples[j]);
+         }
+         k.set_maf((double)k.num_occurrences() / n);
+      }, results);
+}
+
+// Starts a reader and workers for the batch, and fills in the results of
+// the k-mers tested as they come back. load is called by the reader, so the
+// input has been checked before
+void SeerModel::model::test(const size_t num_kmers, const std::function<void(const size_t, Kmer&)>& load, seerResult* results)
+{
+   std::lock_guard<std::mutex> lock(mtx);
+
+   for (size_t i = 0; i < num_kmers; ++i)
+   {
+      results[i].tested = 0;
+      results[i].significant = 0;
+      results[i].maf = kmer_maf_default;
+      results[i].chisq_p = kmer_chi_pvalue_default;
+      results[i].wald_p = kmer_pvalue_default;
+      results[i].lrt_p = kmer_pvalue_default;
+      results[i].beta = kmer_beta_default;
+      results[i].se = kmer_se_default;
+      results[i].covar_p.clear();
+      results[i].comments = 0;
+   }
+
+   // Every k-mer's maf is set by the reader, before it is queued
+   std::function<void(const size_t, Kmer&)> load_maf = [&load, results](const size_t i, Kmer& k)
+   {
+      load(i, k);
+      results[i].maf = k.maf();
+   };
+
+   BlockingQueue<kmerTask> work_queue(queue_depth * parameters.num_threads);
+   ReorderBuffer<kmerTask> tested(reorder_depth * parameters.num_threads, parameters.num_threads);
+
+   std::thread reader(loadKmers, std::cref(load_maf), num_kmers, std::ref(work_queue), std::ref(*recycled), std::cref(parameters),
+         std::cref(phenotypes));
+
+   std::vector<std::thread> workers;
+   workers.reserve(parameters.num_threads);
+   for (unsigned int i = 0; i < parameters.num_threads; ++i)
+   {
+      workers.push_back(std::thread(testKmers, std::ref(work_queue), std::ref(tested), std::cref(parameters),
+               std::cref(phenotypes)));
+   }
+
+   kmerTask task;
+   while (tested.pop(task))
+   {
+      if (task.passed[0])
+      {
+         const Kmer& k = task.k[0];
+         seerResult& result = results[task.input_line];
+
+         result.tested = 1;
+         result.significant = passAssocFilter(parameters, k);
+         result.chisq_p = k.unadj();
+         result.wald_p = k.p_val();
+         result.lrt_p = k.lrt_p_val();
+         result.beta = k.beta();
+         result.se = k.se();
+         result.covar_p = k.covar_p();
+         result.comments = k.comment_flags();
+      }
+      recycled->put(task);
+   }
+
+   reader.join();
+   for (auto it = workers.begin(); it != workers.end(); ++it)
+   {
+      it->join();
+   }
+}
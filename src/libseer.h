@@ -0,0 +1,70 @@
+/*
+ * libseer.h
+ * C interface to the seer library, for bindings. See libseer.hpp
+ *
+ * Functions returning int give 0 on success, and -1 on error with the
+ * message from seer_error
+ *
+ */
+
+#ifndef LIBSEER_H
+#define LIBSEER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct seer_model seer_model;
+
+typedef struct
+{
+   double maf;
+   long min_words; /* Overrides maf if >= 0 */
+   long max_length;
+   double chisq;
+   double pval;
+   double score; /* Score test pre-filter if < 1 */
+   int filter;
+   unsigned int threads;
+} seer_options;
+
+typedef struct
+{
+   int tested;
+   int significant;
+   double maf;
+   double chisq_p;
+   double wald_p;
+   double lrt_p;
+   double beta;
+   double se;
+   unsigned int comments;
+} seer_result;
+
+void seer_default_options(seer_options* options);
+
+/* context_file and kinship_file may be NULL. Returns NULL on error, with the
+ * message in error if it isn't NULL */
+seer_model* seer_open(const char* pheno_file, const char* context_file, const char* kinship_file, const seer_options* options, char* error, size_t error_size);
+void seer_close(seer_model* model);
+
+size_t seer_num_samples(const seer_model* model);
+const char* seer_sample_name(const seer_model* model, size_t i);
+size_t seer_num_covars(const seer_model* model);
+size_t seer_presence_words(const seer_model* model);
+
+/* results has num_kmers entries. covar_p may be NULL, otherwise it has
+ * seer_num_covars() p-values for each k-mer */
+int seer_test_bits(seer_model* model, size_t num_kmers, const char* const* sequences, const uint64_t* presence, seer_result* results, double* covar_p);
+int seer_test_samples(seer_model* model, size_t num_kmers, const char* const* sequences, const uint32_t* samples, const size_t* num_present, seer_result* results, double* covar_p);
+
+const char* seer_error(const seer_model* model); /* Of the last call */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
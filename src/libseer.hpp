@@ -0,0 +1,92 @@
+/*
+ * libseer.hpp
+ * Header file for the seer library
+ *
+ * Tests k-mers given in memory against a phenotype, with the same filters
+ * and association tests as seer, but without reading a dsm file or writing
+ * results. The samples, covariates and null model are loaded once, then any
+ * number of batches of k-mers can be tested, each on a pool of threads.
+ * Built with make libseer, as libseer.a and libseer.so. libseer.h is the
+ * same interface for C
+ *
+ */
+
+#ifndef LIBSEER_HPP
+#define LIBSEER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Filtering and threads, as the seer options of the same names. Defaults are
+// seer's
+struct seerOptions
+{
+   seerOptions();
+
+   double maf;
+   long int min_words; // Overrides maf if >= 0
+   long int max_length;
+   double chisq;
+   double pval;
+   double score; // Score test pre-filter if < 1
+   int filter; // 0 tests every k-mer, as --no_filtering
+   unsigned int threads;
+};
+
+// A k-mer's result. Only maf is set if it was filtered out before the
+// association test. comments are kmerComment flags, in the order of
+// kmer_comment_names
+struct seerResult
+{
+   int tested;
+   int significant; // Passed pval
+   double maf;
+   double chisq_p;
+   double wald_p;
+   double lrt_p;
+   double beta;
+   double se;
+   std::vector<double> covar_p;
+   unsigned int comments;
+};
+
+class SeerModel
+{
+   public:
+      // Initialisation. pheno_file as seer --pheno. context_file as --context,
+      // from seer --save_context, or empty for no covariates. kinship_file
+      // as --lmm, or empty
+      SeerModel(const std::string& pheno_file, const std::string& context_file = "", const std::string& kinship_file = "", const seerOptions& options = seerOptions());
+      ~SeerModel();
+
+      SeerModel(const SeerModel&) = delete;
+      SeerModel& operator=(const SeerModel&) = delete;
+
+      // nonmodifying operations
+      size_t num_samples() const;
+      const std::string& sample_name(const size_t i) const; // In the sorted order of the pheno file, which presence is given in
+      size_t num_covars() const; // p-values in each result's covar_p
+      size_t presence_words() const; // per k-mer in a bitset
+
+      // Tests a batch of k-mers, giving a result for each in the same order.
+      // Sequences are only used for the max_length filter, so may be empty.
+      // Presence is either a bitset of presence_words() words per k-mer, with
+      // sample i in bit i % 64 of word i / 64, or a list of sample indices.
+      // Batches are tested one at a time
+      void test(const std::vector<std::string>& sequences, const std::vector<uint64_t>& presence, std::vector<seerResult>& results);
+      void test(const std::vector<std::string>& sequences, const std::vector<std::vector<uint32_t>>& samples, std::vector<seerResult>& results);
+
+      // As above, from arrays for the C interface. sequences may be NULL.
+      // Index lists are concatenated, with num_present[i] for k-mer i
+      void test(const size_t num_kmers, const char* const* sequences, const uint64_t* presence, seerResult* results);
+      void test(const size_t num_kmers, const char* const* sequences, const uint32_t* samples, const size_t* num_present, seerResult* results);
+
+   private:
+      struct model;
+      std::unique_ptr<model> _model;
+};
+
+#endif
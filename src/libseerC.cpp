@@ -0,0 +1,158 @@
+/*
+ * File: libseerC.cpp
+ *
+ * C interface to the seer library. Exceptions are caught here and kept as
+ * the model's error
+ *
+ */
+
+#include "libseer.hpp"
+#include "libseer.h"
+
+#include <cstring>
+#include <exception>
+
+struct seer_model
+{
+   std::unique_ptr<SeerModel> model;
+   std::vector<seerResult> results; // Reused between batches
+   std::string error;
+};
+
+static seerOptions fromC(const seer_options* options)
+{
+   seerOptions converted;
+   if (options != NULL)
+   {
+      converted.maf = options->maf;
+      converted.min_words = options->min_words;
+      converted.max_length = options->max_length;
+      converted.chisq = options->chisq;
+      converted.pval = options->pval;
+      converted.score = options->score;
+      converted.filter = options->filter;
+      converted.threads = options->threads;
+   }
+   return converted;
+}
+
+static void toC(const std::vector<seerResult>& results, const size_t num_covars, seer_result* c_results, double* covar_p)
+{
+   for (size_t i = 0; i < results.size(); ++i)
+   {
+      c_results[i].tested = results[i].tested;
+      c_results[i].significant = results[i].significant;
+      c_results[i].maf = results[i].maf;
+      c_results[i].chisq_p = results[i].chisq_p;
+      c_results[i].wald_p = results[i].wald_p;
+      c_results[i].lrt_p = results[i].lrt_p;
+      c_results[i].beta = results[i].beta;
+      c_results[i].se = results[i].se;
+      c_results[i].comments = results[i].comments;
+
+      if (covar_p != NULL)
+      {
+         for (size_t j = 0; j < num_covars; ++j)
+         {
+            covar_p[i * num_covars + j] = j < results[i].covar_p.size() ? results[i].covar_p[j] : 1;
+         }
+      }
+   }
+}
+
+void seer_default_options(seer_options* options)
+{
+   seerOptions defaults;
+   options->maf = defaults.maf;
+   options->min_words = defaults.min_words;
+   options->max_length = defaults.max_length;
+   options->chisq = defaults.chisq;
+   options->pval = defaults.pval;
+   options->score = defaults.score;
+   options->filter = defaults.filter;
+   options->threads = defaults.threads;
+}
+
+seer_model* seer_open(const char* pheno_file, const char* context_file, const char* kinship_file, const seer_options* options, char* error, size_t error_size)
+{
+   try
+   {
+      std::unique_ptr<seer_model> opened(new seer_model);
+      opened->model.reset(new SeerModel(pheno_file, context_file == NULL ? "" : context_file,
+               kinship_file == NULL ? "" : kinship_file, fromC(options)));
+      return opened.release();
+   }
+   catch (std::exception& e)
+   {
+      if (error != NULL && error_size > 0)
+      {
+         strncpy(error, e.what(), error_size - 1);
+         error[error_size - 1] = '\0';
+      }
+      return NULL;
+   }
+}
+
+void seer_close(seer_model* model)
+{
+   delete model;
+}
+
+size_t seer_num_samples(const seer_model* model)
+{
+   return model->model->num_samples();
+}
+
+const char* seer_sample_name(const seer_model* model, size_t i)
+{
+   return i < model->model->num_samples() ? model->model->sample_name(i).c_str() : NULL;
+}
+
+size_t seer_num_covars(const seer_model* model)
+{
+   return model->model->num_covars();
+}
+
+size_t seer_presence_words(const seer_model* model)
+{
+   return model->model->presence_words();
+}
+
+int seer_test_bits(seer_model* model, size_t num_kmers, const char* const* sequences, const uint64_t* presence, seer_result* results, double* covar_p)
+{
+   try
+   {
+      model->error.clear();
+      model->results.resize(num_kmers);
+      model->model->test(num_kmers, sequences, presence, model->results.data());
+      toC(model->results, model->model->num_covars(), results, covar_p);
+      return 0;
+   }
+   catch (std::exception& e)
+   {
+      model->error = e.what();
+      return -1;
+   }
+}
+
+int seer_test_samples(seer_model* model, size_t num_kmers, const char* const* sequences, const uint32_t* samples, const size_t* num_present, seer_result* results, double* covar_p)
+{
+   try
+   {
+      model->error.clear();
+      model->results.resize(num_kmers);
+      model->model->test(num_kmers, sequences, samples, num_present, model->results.data());
+      toC(model->results, model->model->num_covars(), results, covar_p);
+      return 0;
+   }
+   catch (std::exception& e)
+   {
+      model->error = e.what();
+      return -1;
+   }
+}
+
+const char* seer_error(const seer_model* model)
+{
+   return model->error.c_str();
+}
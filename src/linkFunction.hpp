@@ -1,6 +1,6 @@
 /*
  * linkFunction.hpp
- * Header file for logitFunction and linearFunction class
+ * Header file for linearFunction class
 */
 
 #include "seercommon.hpp"
@@ -27,28 +27,6 @@ class LinkFunction
       double lambda;
 };
 
-class LogitLikelihood : public LinkFunction
-{
-   public:
-      LogitLikelihood(const arma::mat& _predictors, const arma::vec& _responses, const double _lambda = 0)
-         : LinkFunction(_predictors, _responses, _lambda)
-      {
-      }
-
-      double operator() (const column_vector& parameters_in) const;
-};
-
-class LogitLikelihoodGradient : public LinkFunction
-{
-   public:
-      LogitLikelihoodGradient(const arma::mat& _predictors, const arma::vec& _responses, const double _lambda = 0)
-         : LinkFunction(_predictors, _responses, _lambda)
-      {
-      }
-
-      column_vector operator() (const column_vector& parameters_in) const;
-};
-
 class LinearLikelihood : public LinkFunction
 {
    public:
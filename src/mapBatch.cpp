@@ -0,0 +1,213 @@
+/*
+ * File: mapBatch.cpp
+ *
+ * map_back --batch. All k-mers, in both orientations, are loaded into one
+ * automaton, then each reference is streamed through it once. k-mers with
+ * bases other than ACGT, which the automaton can't hold, are compared
+ * against each contig directly
+ *
+ */
+
+#include "map_back.hpp"
+
+// Output is the same as mapping each k-mer in turn: for each reference the
+// k-mer was found in, matches to the k-mer then to its reverse complement, in
+// order of contig and position. The references are read from the cache if
+// given, otherwise from their fasta files
+void mapBatch(SignificantKmerReader& kmer_file, const std::vector<std::pair<std::string, std::string>>& references, const ReferenceCache* cache, const size_t num_threads, std::ostream& os)
+{
+   std::vector<std::string> reference_names;
+   for (auto it = references.begin(); it != references.end(); ++it)
+   {
+      reference_names.push_back(it->first);
+   }
+
+   // Read all the k-mers
+   std::vector<Significant_kmer> kmers;
+   std::vector<std::vector<uint32_t>> searched; // references to report, for each k-mer
+   KmerAutomaton automaton;
+   batchPatterns others; // Not ACGT only
+
+   Significant_kmer sig_kmer(kmer_file.num_covars());
+   while (kmer_file.next(sig_kmer))
+   {
+      uint32_t kmer_id = kmers.size();
+      if (acgtOnly(sig_kmer.sequence()))
+      {
+         automaton.add(sig_kmer.sequence(), 2 * kmer_id);
+         automaton.add(sig_kmer.rev_comp(), 2 * kmer_id + 1);
+      }
+      else
+      {
+         others.emplace_back(2 * kmer_id, sig_kmer.sequence());
+         others.emplace_back(2 * kmer_id + 1, sig_kmer.rev_comp());
+      }
+
+      searched.push_back(searchedReferences(sig_kmer.samples_found(), reference_names));
+      kmers.push_back(sig_kmer);
+   }
+   automaton.build();
+
+   // Scan the references in parallel
+   std::cerr << "Scanning " << references.size() << " references for " << kmers.size() << " significant kmers...\n";
+   std::vector<batchReference> results(references.size());
+   std::atomic<size_t> next_reference(0);
+   std::vector<std::future<void>> scanners;
+   for (size_t i = 0; i < std::min(num_threads, references.size()); ++i)
+   {
+      scanners.push_back(std::async(std::launch::async, scanReferences, std::cref(automaton), std::cref(others), std::cref(searched),
+               std::cref(references), cache, std::ref(results), std::ref(next_reference)));
+   }
+   for (auto it = scanners.begin(); it != scanners.end(); ++it)
+   {
+      it->get(); // Rethrows any read errors
+   }
+
+   // Each reference's hits are sorted by k-mer, so can be printed by going
+   // through them all in step
+   std::vector<size_t> next_hit(references.size(), 0);
+   for (uint32_t kmer_id = 0; kmer_id < kmers.size(); ++kmer_id)
+   {
+      os << kmers[kmer_id].sequence();
+      for (auto ref_it = searched[kmer_id].begin(); ref_it != searched[kmer_id].end(); ++ref_it)
+      {
+         const batchReference& reference = results[*ref_it];
+         size_t& hit_idx = next_hit[*ref_it];
+         for (; hit_idx < reference.hits.size() && reference.hits[hit_idx].pattern / 2 == kmer_id; ++hit_idx)
+         {
+            const batchHit& hit = reference.hits[hit_idx];
+            os << "\t" << references[*ref_it].first << ":" << reference.contig_names[hit.contig] << ":"
+               << hit.position << "-" << hit.position + kmers[kmer_id].sequence().length() - 1;
+         }
+      }
+      os << "\n";
+   }
+}
+
+// Scanning thread for mapBatch. Takes the next reference from the list until
+// there are none left, keeping only hits to k-mers found in that reference.
+// If there are other patterns, each contig is kept whole for them
+void scanReferences(const KmerAutomaton& automaton, const batchPatterns& others, const std::vector<std::vector<uint32_t>>& searched, const std::vector<std::pair<std::string, std::string>>& references, const ReferenceCache* cache, std::vector<batchReference>& results, std::atomic<size_t>& next_reference)
+{
+   for (size_t i = next_reference++; i < references.size(); i = next_reference++)
+   {
+      batchReference& result = results[i];
+      int32_t state = automaton.root();
+      uint64_t position = 0;
+
+      if (cache != NULL)
+      {
+         result.contig_names = cache->contig_names(i);
+         for (uint32_t contig = 0; contig < result.contig_names.size(); ++contig)
+         {
+            state = automaton.root();
+            position = 0;
+            std::string bases = cache->contig(i, contig);
+            scanBases(automaton, searched, i, contig, bases, state, position, result.hits);
+            scanOthers(others, searched, i, contig, bases, result.hits);
+         }
+      }
+      else
+      {
+         const std::string& filename = references[i].second;
+         std::ifstream ist(filename.c_str());
+         if (!ist)
+         {
+            throw std::runtime_error("Could not open fasta file " + filename + "\n");
+         }
+
+         std::string line_in, contig_bases;
+         while (std::getline(ist, line_in))
+         {
+            // New contig. Matches can't span contigs
+            if (!line_in.empty() && line_in[0] == '>')
+            {
+               if (!result.contig_names.empty())
+               {
+                  scanOthers(others, searched, i, result.contig_names.size() - 1, contig_bases, result.hits);
+                  contig_bases.clear();
+               }
+
+               result.contig_names.push_back(line_in.substr(1));
+               state = automaton.root();
+               position = 0;
+            }
+            else if (result.contig_names.empty())
+            {
+               throw std::runtime_error("Error reading fasta file " + filename + "\n"
+                  "Header should start with '>', but has:\n" + line_in + "\n");
+            }
+            else
+            {
+               scanBases(automaton, searched, i, result.contig_names.size() - 1, line_in, state, position, result.hits);
+               if (!others.empty())
+               {
+                  contig_bases += line_in;
+               }
+            }
+         }
+
+         if (result.contig_names.empty())
+         {
+            throw std::runtime_error("Could not read fasta file " + filename + "\n");
+         }
+         scanOthers(others, searched, i, result.contig_names.size() - 1, contig_bases, result.hits);
+      }
+
+      // By k-mer, then forward before reverse complement. Hits of each are
+      // left in order of contig and position
+      std::stable_sort(result.hits.begin(), result.hits.end(), [](const batchHit& a, const batchHit& b)
+      {
+         return a.pattern < b.pattern;
+      });
+   }
+}
+
+// Runs bases of a contig through the automaton, continuing from state at
+// position
+void scanBases(const KmerAutomaton& automaton, const std::vector<std::vector<uint32_t>>& searched, const uint32_t reference_idx, const uint32_t contig, const std::string& bases, int32_t& state, uint64_t& position, std::vector<batchHit>& hits)
+{
+   for (auto it = bases.begin(); it != bases.end(); ++it)
+   {
+      state = automaton.next(state, *it);
+      ++position;
+
+      automaton.matches(state, [&](const uint32_t pattern)
+      {
+         const std::vector<uint32_t>& kmer_refs = searched[pattern / 2];
+         if (std::binary_search(kmer_refs.begin(), kmer_refs.end(), reference_idx))
+         {
+            hits.push_back(batchHit{pattern, contig, position - automaton.length(pattern)});
+         }
+      });
+   }
+}
+
+// Compares the patterns the automaton can't hold at every position of a
+// whole contig. As in the FM index, any base other than ACGT matches any
+// other
+void scanOthers(const batchPatterns& others, const std::vector<std::vector<uint32_t>>& searched, const uint32_t reference_idx, const uint32_t contig, const std::string& bases, std::vector<batchHit>& hits)
+{
+   for (auto it = others.begin(); it != others.end(); ++it)
+   {
+      const std::vector<uint32_t>& kmer_refs = searched[it->first / 2];
+      if (!std::binary_search(kmer_refs.begin(), kmer_refs.end(), reference_idx))
+      {
+         continue;
+      }
+
+      const std::string& pattern = it->second;
+      for (size_t start = 0; start + pattern.length() <= bases.length(); ++start)
+      {
+         size_t matched = 0;
+         while (matched < pattern.length() && fmSymbol(bases[start + matched]) == fmSymbol(pattern[matched]))
+         {
+            ++matched;
+         }
+         if (matched == pattern.length())
+         {
+            hits.push_back(batchHit{it->first, contig, start});
+         }
+      }
+   }
+}
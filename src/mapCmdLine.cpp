@@ -25,6 +25,8 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
    po::options_description other("Other options");
    other.add_options()
     ("threads", po::value<size_t>()->default_value(1), ("number of threads. Suggested: " + std::to_string(std::thread::hardware_concurrency())).c_str())
+    ("cache", po::value<std::string>(), "reference cache file. Built from the references if missing or out of date, then memory mapped on later runs. The default search uses only the cached FM-indexes; the cached sequences are only read with --batch")
+    ("batch", "match all kmers in one pass over each reference, rather than indexing the references. Faster when there are many kmers")
     ("version", "prints version and exits")
     ("help,h", "full help message");
 
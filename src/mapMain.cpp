@@ -33,102 +33,113 @@ int main (int argc, char *argv[])
       num_threads = 1;
    }
 
-   // Read all sequences into memory as Fasta objects
-   std::cerr << "Reading reference sequences into memory...\n";
-   std::vector<Fasta> sequence_cache = readSequences(vm["references"].as<std::string>());
+   std::vector<std::pair<std::string, std::string>> references = readReferenceList(vm["references"].as<std::string>());
 
-   // Loop through significant kmers
-   std::cerr << "Now mapping significant kmers...\n";
-   std::ifstream kmer_file(vm["kmers"].as<std::string>().c_str());
-   if (!kmer_file)
+   // Map the reference cache, building it first if it's missing or out of
+   // date
+   ReferenceCache reference_cache;
+   int cached = 0;
+   if (vm.count("cache"))
+   {
+      std::string cache_file = vm["cache"].as<std::string>();
+      if (!reference_cache.open(cache_file, references))
+      {
+         std::cerr << "Building reference cache " << cache_file << "...\n";
+         buildReferenceCache(cache_file, references, num_threads);
+
+         if (!reference_cache.open(cache_file, references))
+         {
+            throw std::runtime_error("Could not read reference cache " + cache_file + " after building it\n");
+         }
+      }
+      cached = 1;
+   }
+
+   // Significant k-mers, as text or binary results
+   SignificantKmerReader kmer_file;
+   if (!kmer_file.open(vm["kmers"].as<std::string>()))
    {
       throw std::runtime_error("Could not open kmer_file " + vm["kmers"].as<std::string>() + "\n");
    }
+   else if (vm.count("batch"))
+   {
+      // Find all the kmers in one pass over each reference
+      std::cerr << "Reading significant kmers...\n";
+      mapBatch(kmer_file, references, cached ? &reference_cache : NULL, num_threads, std::cout);
+
+      std::cerr << "Done.\n";
+   }
    else
    {
-      // Set up list of threads, and mutex lock on std out
-      std::mutex out_mtx;
-      std::list<std::future<void>> threads;
+      // Read all sequences into memory as indexed Fasta objects, or take
+      // them from the reference cache
+      std::vector<Fasta> sequence_cache;
+      if (cached)
+      {
+         for (size_t i = 0; i < reference_cache.size(); ++i)
+         {
+            sequence_cache.push_back(reference_cache.fasta(i));
+         }
+      }
+      else
+      {
+         std::cerr << "Reading reference sequences into memory...\n";
+         sequence_cache = readSequences(references, num_threads);
+      }
 
-      // Read the header
-      std::string header;
-      std::getline(kmer_file, header);
-      int num_covar_fields = parseHeader(header);
+      // Start a reader thread to queue a search of each reference for each
+      // kmer, and a pool of workers sharing the references to run them.
+      // Results come back in input order and are printed here
+      std::cerr << "Now mapping significant kmers...\n";
 
-      Significant_kmer sig_kmer(num_covar_fields);
-      while(kmer_file)
+      std::vector<std::string> reference_names;
+      for (auto it = references.begin(); it != references.end(); ++it)
       {
-         kmer_file >> sig_kmer;
+         reference_names.push_back(it->first);
+      }
+
+      BlockingQueue<mapTask> work_queue(queue_depth * num_threads);
+      ReorderBuffer<mapTask> results(reorder_depth * num_threads, num_threads);
 
-         // Check the read into sig_kmer hasn't reached end of file
-         if (!kmer_file.eof())
+      std::thread reader(queueSearches, std::ref(kmer_file), std::cref(reference_names), std::ref(work_queue));
+      std::vector<std::thread> workers;
+      workers.reserve(num_threads);
+      for (size_t i = 0; i < num_threads; ++i)
+      {
+         workers.push_back(std::thread(mapKmers, std::ref(work_queue), std::ref(results), std::cref(sequence_cache)));
+      }
+
+      // Tab between every sample, line break after every kmer
+      mapTask mapped;
+      while (results.pop(mapped))
+      {
+         if (mapped.first)
+         {
+            std::cout << mapped.sequence;
+         }
+         std::cout << mapped.output;
+         if (mapped.last)
          {
-            assert(num_threads >= 1);
-
-            std::cout << sig_kmer.sequence();
-
-            // sig_kmer samples and sample cache are sorted in the same order, so
-            // can go through linearly
-            std::vector<std::string> search_names = sig_kmer.samples_found();
-            std::vector<std::string>::iterator search_names_it = search_names.begin();
-
-            for (std::vector<Fasta>::iterator all_names_it = sequence_cache.begin(); all_names_it != sequence_cache.end(); ++all_names_it)
-            {
-               // For each sample we know the kmer is in, print all matches to
-               // the kmer
-               if (all_names_it->get_name() == *search_names_it)
-               {
-                  // Thread each search (i.e. per sample per kmer)
-                  if (num_threads > 1)
-                  {
-                     // Check if four searches are running. If so, wait for the
-                     // next one to finish. Wait (for a max of 100ms) so this
-                     // thread doesn't consume processing
-                     waitForThreads(threads, num_threads - 1);
-
-                     // Start a new thread asynchronously, at the back of the
-                     // queue
-                     threads.push_back(std::async(std::launch::async,
-                              &Fasta::printMappings, *all_names_it, std::ref(std::cout), sig_kmer.sequence(), std::ref(out_mtx)));
-
-                     // Search for reverse complement too
-                     waitForThreads(threads, num_threads - 1);
-                     threads.push_back(std::async(std::launch::async,
-                              &Fasta::printMappings, *all_names_it, std::ref(std::cout), sig_kmer.rev_comp(), std::ref(out_mtx)));
-                  }
-                  else
-                  {
-                     all_names_it->printMappings(std::cout, sig_kmer.sequence(), out_mtx);
-                     all_names_it->printMappings(std::cout, sig_kmer.rev_comp(), out_mtx);
-                  }
-
-                  ++search_names_it;
-                  if (search_names_it == search_names.end())
-                  {
-                     break;
-                  }
-               }
-            }
-
-            // Tab between every sample, line break after every kmer
-            if (num_threads > 1)
-            {
-               waitForThreads(threads, 0);
-            }
-
-            std::cout << std::endl;
+            std::cout << "\n";
          }
       }
+      std::cout.flush();
+
+      reader.join();
+      for (auto it = workers.begin(); it != workers.end(); ++it)
+      {
+         it->join();
+      }
 
       std::cerr << "Done.\n";
    }
 
 }
 
-// Stores all fasta sequences in a vector of Fasta objects
-std::vector<Fasta> readSequences(const std::string& reference_file)
+// Reads the names and fasta files of the references, sorted by name
+std::vector<std::pair<std::string, std::string>> readReferenceList(const std::string& reference_file)
 {
-   std::vector<Fasta> sequences;
+   std::vector<std::pair<std::string, std::string>> references;
 
    std::ifstream ifs(reference_file.c_str());
    if (!ifs)
@@ -138,31 +149,105 @@ std::vector<Fasta> readSequences(const std::string& reference_file)
    else
    {
       std::string name, fasta_file = "";
-      while(ifs)
+      while (ifs >> name >> fasta_file)
       {
-         ifs >> name >> fasta_file;
-         sequences.push_back(Fasta(name, fasta_file));
+         references.push_back(std::make_pair(name, fasta_file));
       }
    }
 
-   std::sort(sequences.begin(), sequences.end(), Fasta::compareFasta);
-   return sequences;
+   std::stable_sort(references.begin(), references.end(), [](const std::pair<std::string, std::string>& a, const std::pair<std::string, std::string>& b)
+   {
+      return a.first < b.first;
+   });
+   return references;
 }
 
-// Waits until there are #spaces threads left unfinished
-void waitForThreads(std::list<std::future<void>>& thread_list, const size_t leave_running)
+// References to search for a k-mer. The k-mer's samples and the references
+// are sorted in the same order, so can go through linearly
+std::vector<uint32_t> searchedReferences(const std::vector<std::string>& search_names, const std::vector<std::string>& reference_names)
 {
-   auto list_it = thread_list.begin();
-   while (thread_list.size() > leave_running)
+   std::vector<uint32_t> searched;
+
+   std::vector<std::string>::const_iterator search_names_it = search_names.begin();
+   for (size_t i = 0; i < reference_names.size() && search_names_it != search_names.end(); ++i)
    {
-      auto status = list_it->wait_for(std::chrono::milliseconds(thread_wait));
-      if (status == std::future_status::ready)
-      {
-         list_it = thread_list.erase(list_it);
-      }
-      else if (list_it++ == thread_list.end())
+      if (reference_names[i] == *search_names_it)
       {
-         list_it = thread_list.begin();
+         searched.push_back(i);
+         ++search_names_it;
       }
    }
+
+   return searched;
+}
+
+// Stores all fasta sequences in a vector of Fasta objects, in the same order
+// as the references. The assemblies are read and indexed in parallel
+std::vector<Fasta> readSequences(const std::vector<std::pair<std::string, std::string>>& references, const size_t num_threads)
+{
+   std::vector<std::unique_ptr<Fasta>> indexed(references.size());
+   std::atomic<size_t> next_reference(0);
+   std::vector<std::future<void>> readers;
+   for (size_t i = 0; i < std::min(num_threads, references.size()); ++i)
+   {
+      readers.push_back(std::async(std::launch::async, readReferences, std::cref(references), std::ref(indexed), std::ref(next_reference)));
+   }
+   for (auto it = readers.begin(); it != readers.end(); ++it)
+   {
+      it->get(); // Rethrows any read errors
+   }
+
+   std::vector<Fasta> sequences;
+   sequences.reserve(indexed.size());
+   for (auto it = indexed.begin(); it != indexed.end(); ++it)
+   {
+      sequences.push_back(std::move(**it));
+   }
+
+   return sequences;
+}
+
+// Reader thread for readSequences. Takes the next reference from the list
+// until there are none left
+void readReferences(const std::vector<std::pair<std::string, std::string>>& references, std::vector<std::unique_ptr<Fasta>>& indexed, std::atomic<size_t>& next_reference)
+{
+   for (size_t i = next_reference++; i < references.size(); i = next_reference++)
+   {
+      indexed[i].reset(new Fasta(references[i].first, references[i].second));
+   }
+}
+
+// Reads and indexes the references in parallel, as readSequences does, but
+// writes each to the cache rather than keeping it
+void buildReferenceCache(const std::string& cache_file, const std::vector<std::pair<std::string, std::string>>& references, const size_t num_threads)
+{
+   ReferenceCacheWriter writer;
+   writer.open(cache_file, references);
+
+   std::atomic<size_t> next_reference(0);
+   std::vector<std::future<void>> readers;
+   for (size_t i = 0; i < std::min(num_threads, references.size()); ++i)
+   {
+      readers.push_back(std::async(std::launch::async, cacheReferences, std::cref(references), std::ref(writer), std::ref(next_reference)));
+   }
+   for (auto it = readers.begin(); it != readers.end(); ++it)
+   {
+      it->get(); // Rethrows any read errors
+   }
+
+   writer.close();
+}
+
+// Reader thread for buildReferenceCache
+void cacheReferences(const std::vector<std::pair<std::string, std::string>>& references, ReferenceCacheWriter& writer, std::atomic<size_t>& next_reference)
+{
+   std::vector<std::string> names;
+   std::vector<uint64_t> starts;
+   std::vector<uint8_t> text;
+   for (size_t i = next_reference++; i < references.size(); i = next_reference++)
+   {
+      readFasta(references[i].second, names, starts, text);
+      Fasta indexed(references[i].first, names, starts, std::make_shared<const FmIndex>(text));
+      writer.write(i, indexed, text);
+   }
 }
@@ -0,0 +1,74 @@
+/*
+ * File: mapThreads.cpp
+ *
+ * Reader and worker threads for map_back's default mode. The reader queues a
+ * search for each reference each k-mer was found in, a pool of workers runs
+ * them against the shared references, and results are handed back in input
+ * order to be printed
+ *
+ */
+
+#include "map_back.hpp"
+
+// Reads the significant k-mers, queueing a task to search each reference
+// listed for a k-mer. The first and last tasks of a k-mer are marked, so the
+// line can be started and finished; a k-mer with nothing to search gets one
+// empty task. The queue is closed at the end of the file
+void queueSearches(SignificantKmerReader& kmer_file, const std::vector<std::string>& reference_names, BlockingQueue<mapTask>& work_queue)
+{
+   long int order = 0;
+
+   Significant_kmer sig_kmer(kmer_file.num_covars());
+   while (kmer_file.next(sig_kmer))
+   {
+      mapTask task;
+      task.sequence = sig_kmer.sequence();
+      task.rev_comp = sig_kmer.rev_comp();
+      task.search = 1;
+
+      std::vector<uint32_t> searched = searchedReferences(sig_kmer.samples_found(), reference_names);
+      if (searched.empty())
+      {
+         task.search = 0;
+         searched.push_back(0);
+      }
+
+      for (auto it = searched.begin(); it != searched.end(); ++it)
+      {
+         task.order = order++;
+         task.reference = *it;
+         task.first = it == searched.begin();
+         task.last = it + 1 == searched.end();
+         work_queue.push(task);
+      }
+   }
+
+   work_queue.close();
+}
+
+// Worker thread. Searches a reference for the k-mer then its reverse
+// complement, into the task's own output, until the queue is closed and
+// empty
+void mapKmers(BlockingQueue<mapTask>& work_queue, ReorderBuffer<mapTask>& results, const std::vector<Fasta>& sequence_cache)
+{
+   std::ostringstream output;
+
+   mapTask task;
+   while (work_queue.pop(task))
+   {
+      if (task.search)
+      {
+         const Fasta& reference = sequence_cache[task.reference];
+
+         output.str("");
+         reference.printMappings(output, task.sequence);
+         reference.printMappings(output, task.rev_comp);
+         task.output = output.str();
+      }
+
+      results.push(task.order, std::move(task));
+   }
+
+   results.done();
+}
+
@@ -16,8 +16,10 @@
 #include <stdexcept>
 #include <future>
 #include <thread>
-#include <chrono>
-#include <list>
+#include <sstream>
+#include <atomic>
+#include <memory>
+#include <utility>
 #include <assert.h>
 
 // Boost headers
@@ -25,18 +27,67 @@
 
 // Classes
 #include "fasta.hpp"
+#include "referenceCache.hpp"
 #include "significant_kmer.hpp"
+#include "kmerAutomaton.hpp"
+#include "blockingQueue.hpp"
 
 // Constants
 const std::string VERSION = "1.2";
-const int thread_wait = 100; //time to wait for each thread in ms
+const unsigned int queue_depth = 16; // searches waiting for a worker
+const unsigned int reorder_depth = 256; // searches done ahead of the next one to print
 
 // Structs
+// A search of one reference for a k-mer and its reverse complement, in the
+// default mode. Output is the matches, to be printed after those of the
+// previous task
+struct mapTask
+{
+   long int order;
+   std::string sequence;
+   std::string rev_comp;
+   uint32_t reference;
+   int search; // 0 if the k-mer is in none of the references
+   int first; // first and last search of the k-mer
+   int last;
+   std::string output;
+};
+
+// A match in --batch mode. pattern is twice the k-mer's index, plus one for
+// its reverse complement
+struct batchHit
+{
+   uint32_t pattern;
+   uint32_t contig;
+   uint64_t position;
+};
+
+struct batchReference
+{
+   std::vector<std::string> contig_names;
+   std::vector<batchHit> hits;
+};
+
+typedef std::vector<std::pair<uint32_t, std::string>> batchPatterns; // pattern id, sequence
 
 // Function headers
 // mapMain.cpp
-std::vector<Fasta> readSequences(const std::string& reference_file);
-void waitForThreads(std::list<std::future<void>>& thread_list, const size_t leave_running);
+std::vector<std::pair<std::string, std::string>> readReferenceList(const std::string& reference_file);
+std::vector<uint32_t> searchedReferences(const std::vector<std::string>& search_names, const std::vector<std::string>& reference_names);
+std::vector<Fasta> readSequences(const std::vector<std::pair<std::string, std::string>>& references, const size_t num_threads);
+void readReferences(const std::vector<std::pair<std::string, std::string>>& references, std::vector<std::unique_ptr<Fasta>>& indexed, std::atomic<size_t>& next_reference);
+void buildReferenceCache(const std::string& cache_file, const std::vector<std::pair<std::string, std::string>>& references, const size_t num_threads);
+void cacheReferences(const std::vector<std::pair<std::string, std::string>>& references, ReferenceCacheWriter& writer, std::atomic<size_t>& next_reference);
+
+// mapThreads.cpp
+void queueSearches(SignificantKmerReader& kmer_file, const std::vector<std::string>& reference_names, BlockingQueue<mapTask>& work_queue);
+void mapKmers(BlockingQueue<mapTask>& work_queue, ReorderBuffer<mapTask>& results, const std::vector<Fasta>& sequence_cache);
+
+// mapBatch.cpp
+void mapBatch(SignificantKmerReader& kmer_file, const std::vector<std::pair<std::string, std::string>>& references, const ReferenceCache* cache, const size_t num_threads, std::ostream& os);
+void scanReferences(const KmerAutomaton& automaton, const batchPatterns& others, const std::vector<std::vector<uint32_t>>& searched, const std::vector<std::pair<std::string, std::string>>& references, const ReferenceCache* cache, std::vector<batchReference>& results, std::atomic<size_t>& next_reference);
+void scanBases(const KmerAutomaton& automaton, const std::vector<std::vector<uint32_t>>& searched, const uint32_t reference_idx, const uint32_t contig, const std::string& bases, int32_t& state, uint64_t& position, std::vector<batchHit>& hits);
+void scanOthers(const batchPatterns& others, const std::vector<std::vector<uint32_t>>& searched, const uint32_t reference_idx, const uint32_t contig, const std::string& bases, std::vector<batchHit>& hits);
 
 // mapCmdLine.cpp
 int parseCommandLine (int argc, char *argv[], boost::program_options::variables_map& vm);
@@ -0,0 +1,82 @@
+/*
+ * mergeCmdLine.cpp
+ * Parses cmd line options for merge_seer
+ *
+ */
+
+#include "merge_seer.hpp"
+
+namespace po = boost::program_options; // Save some typing
+
+// Parse command line options using boost program options
+int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
+{
+   int failed = 0;
+
+   //Required options
+   po::options_description required("Required options");
+   required.add_options()
+    ("shards", po::value<std::vector<std::string>>()->multitoken()->required(), "output of each seer --shard run");
+
+   po::options_description other("Other options");
+   other.add_options()
+    ("version", "prints version and exits")
+    ("help,h", "full help message");
+
+   po::options_description all;
+   all.add(required).add(other);
+
+   // Shard files can also be given without --shards
+   po::positional_options_description positional;
+   positional.add("shards", -1);
+
+   try
+   {
+      po::store(po::command_line_parser(argc, argv).options(all).positional(positional).run(), vm);
+
+      if (vm.count("help"))
+      {
+         printHelp(all);
+         failed = 1;
+      }
+      else if (vm.count("version"))
+      {
+         std::cout << VERSION << std::endl;
+         failed = 1;
+      }
+      else
+      {
+         po::notify(vm);
+         failed = 0;
+      }
+
+   }
+   catch (po::error& e)
+   {
+      // Report errors from boost library
+      std::cerr << "Error in command line input: " << e.what() << "\n";
+      std::cerr << "Run 'merge_seer --help' for full option listing\n\n";
+      std::cerr << required << "\n" << other << "\n";
+
+      failed = 1;
+   }
+
+   return failed;
+}
+
+// Makes sure command line options are valid. Casts into correct variables
+cmdOptions processCmdLine(po::variables_map& vm)
+{
+   cmdOptions processed_options;
+
+   processed_options.shard_files = vm["shards"].as<std::vector<std::string>>();
+
+   return processed_options;
+}
+
+// Print long help message
+void printHelp(po::options_description& help)
+{
+   std::cerr << help << "\n";
+}
+
@@ -0,0 +1,183 @@
+/*
+ * merge_seer.cpp
+ * Merges the output of seer runs with --shard into the output of a single
+ * run: rows in input order, and the counts of k-mers summed
+ *
+ */
+
+#include "merge_seer.hpp"
+
+int main (int argc, char *argv[])
+{
+   // Program description
+   std::cerr << "merge_seer: merge sharded seer output\n";
+
+   // Do parsing and checking of command line params
+   // If no input options, give quick usage rather than full help
+   boost::program_options::variables_map vm;
+   if (argc == 1)
+   {
+      std::cerr << "Usage: merge_seer shard_1.txt shard_2.txt ... > significant_kmers.txt\n\n"
+         << "For full option details run 'merge_seer -h'\n";
+      return 0;
+   }
+   else if (parseCommandLine(argc, argv, vm))
+   {
+      return 1;
+   }
+
+   cmdOptions options = processCmdLine(vm);
+
+   try
+   {
+      // Check every shard is present, once, and they were all split the
+      // same way
+      std::vector<ShardInfo> shards;
+      for (auto it = options.shard_files.begin(); it != options.shard_files.end(); ++it)
+      {
+         shards.push_back(readShardTrailer(*it));
+      }
+
+      const unsigned int num_shards = shards[0].num_shards;
+      const int by_range = shards[0].split == "range";
+      std::vector<int> shard_found(num_shards, 0);
+      for (size_t i = 0; i < shards.size(); ++i)
+      {
+         if (shards[i].num_shards != num_shards || shards[i].split != shards[0].split)
+         {
+            throw std::runtime_error(options.shard_files[i] + " is from a different set of shards to " + options.shard_files[0]);
+         }
+         else if (shard_found[shards[i].shard - 1]++)
+         {
+            throw std::runtime_error("Shard " + std::to_string(shards[i].shard) + " was given more than once");
+         }
+      }
+      if (shards.size() != num_shards)
+      {
+         throw std::runtime_error("Only " + std::to_string(shards.size()) + " of " + std::to_string(num_shards) + " shards were given");
+      }
+
+      // Headers must match. Write without the line number column
+      std::vector<std::ifstream> shard_in(shards.size());
+      std::string header;
+      for (size_t i = 0; i < shards.size(); ++i)
+      {
+         shard_in[i].open(options.shard_files[i].c_str());
+
+         std::string shard_header;
+         std::getline(shard_in[i], shard_header);
+         if (i == 0)
+         {
+            header = shard_header;
+         }
+         else if (shard_header != header)
+         {
+            throw std::runtime_error("Columns in " + options.shard_files[i] + " do not match " + options.shard_files[0]);
+         }
+      }
+      std::cout << header.substr(header.find('\t') + 1) << '\n';
+
+      // Each shard's rows are in input order, so merge them by taking the
+      // earliest next row
+      std::vector<std::string> rows(shards.size());
+      std::priority_queue<ShardRow, std::vector<ShardRow>, std::greater<ShardRow>> next_rows;
+      for (size_t i = 0; i < shards.size(); ++i)
+      {
+         ShardRow next;
+         if (nextShardRow(shard_in[i], rows[i], next.line))
+         {
+            next.shard_order = by_range ? shards[i].shard : 0;
+            next.file_idx = i;
+            next_rows.push(next);
+         }
+      }
+
+      while (!next_rows.empty())
+      {
+         ShardRow next = next_rows.top();
+         next_rows.pop();
+
+         std::cout << rows[next.file_idx] << '\n';
+
+         if (nextShardRow(shard_in[next.file_idx], rows[next.file_idx], next.line))
+         {
+            next_rows.push(next);
+         }
+      }
+      std::cout.flush();
+
+      long int input_line = 0, tested_kmers = 0, significant_kmers = 0;
+      for (auto it = shards.begin(); it != shards.end(); ++it)
+      {
+         input_line += it->read;
+         tested_kmers += it->tested;
+         significant_kmers += it->printed;
+      }
+
+      std::cerr << "Read " << input_line << " total k-mers. Of these:\n";
+      std::cerr << "\tPre-filtered " << input_line - tested_kmers << " k-mers\n";
+      std::cerr << "\tTested " << tested_kmers << " k-mers\n";
+      std::cerr << "\tPrinted " << significant_kmers << " k-mers\n";
+      std::cerr << "Done.\n";
+   }
+   catch (std::exception& e)
+   {
+      std::cerr << "Error: " << e.what() << std::endl;
+      return 1;
+   }
+
+   return(0);
+}
+
+// The trailer is the last line, and is only written once seer has finished
+ShardInfo readShardTrailer(const std::string& file_name)
+{
+   std::ifstream shard_in(file_name.c_str());
+   if (!shard_in)
+   {
+      throw std::runtime_error("Could not open input file " + file_name);
+   }
+
+   std::string line, trailer;
+   while (std::getline(shard_in, line))
+   {
+      if (line.compare(0, shard_trailer.length(), shard_trailer) == 0)
+      {
+         trailer = line;
+      }
+   }
+   if (trailer.empty())
+   {
+      throw std::runtime_error(file_name + " has no shard trailer. Was it written by seer --shard, and did the run finish?");
+   }
+
+   // #shard=i/N split= read= tested= printed=
+   ShardInfo info;
+   char split[16];
+   if (sscanf(trailer.c_str(), "#shard=%u/%u\tsplit=%15s\tread=%ld\ttested=%ld\tprinted=%ld",
+            &info.shard, &info.num_shards, split, &info.read, &info.tested, &info.printed) != 6
+         || info.shard < 1 || info.shard > info.num_shards)
+   {
+      throw std::runtime_error("Could not parse shard trailer in " + file_name);
+   }
+   info.split = split;
+
+   return info;
+}
+
+// Next row of a shard's output, without its line number. Returns 0 at the
+// trailer
+int nextShardRow(std::ifstream& shard_in, std::string& row, long int& line)
+{
+   std::string shard_row;
+   if (!std::getline(shard_in, shard_row) || shard_row.compare(0, shard_trailer.length(), shard_trailer) == 0)
+   {
+      return 0;
+   }
+
+   size_t line_end = shard_row.find('\t');
+   line = std::stol(shard_row.substr(0, line_end));
+   row = shard_row.substr(line_end + 1);
+
+   return 1;
+}
@@ -0,0 +1,62 @@
+/*
+ * Header file for merge_seer.cpp
+ * Merges the output of seer runs with --shard
+ *
+ */
+
+// C++ stl includes
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <stdexcept>
+#include <cstdio>
+
+// Library includes
+#include <boost/program_options.hpp>
+
+// Constants
+const std::string VERSION = "1.1.4";
+const std::string shard_trailer = "#shard="; // As written by seer
+
+// Structures
+struct cmdOptions
+{
+   std::vector<std::string> shard_files;
+};
+
+// Read from the trailer of a shard's output
+struct ShardInfo
+{
+   unsigned int shard; // From 1
+   unsigned int num_shards;
+   std::string split;
+   long int read;
+   long int tested;
+   long int printed;
+};
+
+// Position of a shard's next row in the merged output. Shards split by line
+// have line numbers in the whole input; shards split by range have line
+// numbers in the shard, so are output one shard after another
+struct ShardRow
+{
+   unsigned int shard_order;
+   long int line;
+   size_t file_idx;
+
+   bool operator>(const ShardRow& other) const
+   {
+      return shard_order > other.shard_order || (shard_order == other.shard_order && line > other.line);
+   }
+};
+
+// Function prototypes
+int parseCommandLine (int argc, char *argv[], boost::program_options::variables_map& vm);
+cmdOptions processCmdLine(boost::program_options::variables_map& vm);
+void printHelp(boost::program_options::options_description& help);
+
+ShardInfo readShardTrailer(const std::string& file_name);
+int nextShardRow(std::ifstream& shard_in, std::string& row, long int& line);
@@ -0,0 +1,213 @@
+/*
+ * File: mixedModel.cpp
+ *
+ * Linear mixed model association test, with the kinship matrix
+ * eigendecomposed once by kmds
+ *
+ */
+
+#include "seer.hpp"
+
+MixedModel::MixedModel(const FixedCovariates& fixed, const arma::mat& kinship)
+   :_fixed(fixed), _num_samples(fixed.num_samples())
+{
+   if (kinship.n_rows != _num_samples)
+   {
+      throw std::runtime_error("Number of rows in kinship matrix does not match number of samples");
+   }
+
+   // The columns of G are orthogonal, so are the eigenvectors scaled by the
+   // square roots of the eigenvalues
+   _eigval = arma::sum(arma::square(kinship), 0).t();
+   _u_t = kinship.t();
+   for (size_t j = 0; j < _eigval.n_elem; ++j)
+   {
+      _u_t.row(j) /= sqrt(_eigval(j));
+   }
+   _full_rank = _eigval.n_elem >= _num_samples;
+
+   const arma::mat& x_t = fixed.x_t();
+   _x_rot = _u_t * x_t.t();
+   _y_rot = _u_t * fixed.y();
+   _xtx = x_t * x_t.t();
+   _xty = x_t * fixed.y();
+   _yty = dot(fixed.y(), fixed.y());
+
+   // Maximise the null likelihood over log10(d), on a grid then by golden
+   // section search around the best point
+   auto null_ll = [this](const double log_delta)
+   {
+      arma::vec weights, xtvy, b;
+      arma::mat xtvx_inv;
+      double rss;
+      return nullFit(pow(10, log_delta), weights, xtvx_inv, xtvy, b, rss);
+   };
+
+   double best_log_delta = lmm_log_delta_min;
+   double best_ll = -std::numeric_limits<double>::infinity();
+   for (double log_delta = lmm_log_delta_min; log_delta <= lmm_log_delta_max + lmm_log_delta_step / 2; log_delta += lmm_log_delta_step)
+   {
+      double ll = null_ll(log_delta);
+      if (ll > best_ll)
+      {
+         best_ll = ll;
+         best_log_delta = log_delta;
+      }
+   }
+
+   const double ratio = (sqrt(5.0) - 1) / 2;
+   double lower = best_log_delta - lmm_log_delta_step, upper = best_log_delta + lmm_log_delta_step;
+   double left = upper - ratio * (upper - lower), right = lower + ratio * (upper - lower);
+   double left_ll = null_ll(left), right_ll = null_ll(right);
+   while (upper - lower > lmm_delta_tolerance)
+   {
+      if (left_ll > right_ll)
+      {
+         upper = right;
+         right = left;
+         right_ll = left_ll;
+         left = upper - ratio * (upper - lower);
+         left_ll = null_ll(left);
+      }
+      else
+      {
+         lower = left;
+         left = right;
+         left_ll = right_ll;
+         right = lower + ratio * (upper - lower);
+         right_ll = null_ll(right);
+      }
+   }
+
+   _delta = pow(10, (lower + upper) / 2);
+   nullFit(_delta, _weights, _xtvx_inv, _xtvy, _null_b, _null_rss);
+   _log_det = logDet(_delta);
+}
+
+// GLS fit of the fixed covariates alone, with V = K + dI. Returns its
+// log-likelihood
+double MixedModel::nullFit(const double delta, arma::vec& weights, arma::mat& xtvx_inv, arma::vec& xtvy, arma::vec& b, double& rss) const
+{
+   weights = 1 / (_eigval + delta);
+
+   arma::mat wx = _x_rot;
+   for (size_t j = 0; j < wx.n_cols; ++j)
+   {
+      wx.col(j) %= weights;
+   }
+   arma::mat xtvx = _x_rot.t() * wx;
+   xtvy = wx.t() * _y_rot;
+   double ytvy = dot(_y_rot, weights % _y_rot);
+   if (!_full_rank)
+   {
+      xtvx += (_xtx - _x_rot.t() * _x_rot) / delta;
+      xtvy += (_xty - _x_rot.t() * _y_rot) / delta;
+      ytvy += (_yty - dot(_y_rot, _y_rot)) / delta;
+   }
+
+   xtvx_inv = inv_covar(xtvx);
+   if (xtvx_inv.n_elem == 0)
+   {
+      throw std::runtime_error("Could not fit the null mixed model");
+   }
+   b = xtvx_inv * xtvy;
+   rss = ytvy - dot(xtvy, b);
+
+   return logLikelihood(rss, logDet(delta));
+}
+
+// Maximum likelihood over the variance, at fixed d
+double MixedModel::logLikelihood(const double rss, const double log_det) const
+{
+   return -0.5 * (_num_samples * log(2 * M_PI * rss / _num_samples) + log_det + _num_samples);
+}
+
+// log|K + dI|
+double MixedModel::logDet(const double delta) const
+{
+   double log_det = arma::accu(arma::log(_eigval + delta));
+   if (!_full_rank)
+   {
+      log_det += (_num_samples - _eigval.n_elem) * log(delta);
+   }
+
+   return log_det;
+}
+
+// Adds the k-mer column z to the null fit by a block update, as in
+// linearTest, with all products through V^-1
+void MixedModel::test(Kmer& k) const
+{
+   const Presence& x = k.presence();
+
+   // U'z
+   arma::vec z_rot = arma::zeros(_eigval.n_elem);
+   const std::vector<uint64_t>& words = x.words();
+   for (size_t i = 0; i < words.size(); ++i)
+   {
+      uint64_t word = words[i];
+      while (word)
+      {
+         z_rot += _u_t.col(i * presence_word_bits + __builtin_ctzll(word));
+         word &= word - 1;
+      }
+   }
+
+   arma::vec wz = _weights % z_rot;
+   arma::vec xtvz = _x_rot.t() * wz;
+   double ztvz = dot(z_rot, wz);
+   double ztvy = dot(_y_rot, wz);
+   if (!_full_rank)
+   {
+      double zy, zy_sq;
+      presenceSums(x, _fixed.y(), zy, zy_sq);
+
+      xtvz += (_fixed.cross_product(x) - _x_rot.t() * z_rot) / _delta;
+      ztvz += (x.count() - dot(z_rot, z_rot)) / _delta;
+      ztvy += (zy - dot(z_rot, _y_rot)) / _delta;
+   }
+
+   arma::vec a = _xtvx_inv * xtvz;
+   double s = ztvz - dot(xtvz, a);
+
+   // k-mer is (nearly) collinear with the covariates
+   if (s <= collinear_limit * x.count())
+   {
+      k.add_comment(comment_collinear);
+      return;
+   }
+
+   double b = (ztvy - dot(a, _xtvy)) / s;
+   double rss = _null_rss - b * b * s;
+   double sigma_sq = rss / (_num_samples - _xtvx_inv.n_rows - 1);
+
+   k.log_likelihood(logLikelihood(rss, _log_det));
+   k.beta(b);
+
+   // Wald test. The k-mer's entry of (X'V^-1X)^-1 is 1/s
+   double se = pow(sigma_sq / s, 0.5);
+   k.standard_error(se);
+
+   double W = std::abs(b) / se; // null hypothesis b_1 = 0
+   k.p_val(normalPval(W));
+
+#ifdef SEER_DEBUG
+   std::cerr << "Wald statistic: " << W << "\n";
+   std::cerr << "p-value: " << k.p_val() << "\n";
+#endif
+
+   // Add in covariate p-values
+   for (unsigned int i = 1; i < _null_b.n_elem; ++i)
+   {
+      double b_i = _null_b(i) - a(i) * b;
+      se = pow((_xtvx_inv(i,i) + a(i) * a(i) / s) * sigma_sq, 0.5);
+      W = std::abs(b_i) / se;
+
+      k.add_covar_p(normalPval(W));
+   }
+
+   // Likelihood ratio test, at the null model's d. The statistic is
+   // chi-squared with one degree of freedom
+   double lrt = _num_samples * log(_null_rss / rss);
+   k.lrt_p_val(lrt > 0 ? normalPval(pow(lrt, 0.5)) : 1);
+}
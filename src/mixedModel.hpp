@@ -0,0 +1,65 @@
+/*
+ * mixedModel.hpp
+ * Header file for the linear mixed model association test
+ *
+ * y = Xb + zb_z + g + e, with g ~ N(0, s_g K) for the kinship matrix K from
+ * kmds --kinship, and e ~ N(0, s_e I). K = USU' is eigendecomposed once, by
+ * kmds, and the ratio d = s_e/s_g is fitted once to the null model by
+ * maximum likelihood. Each k-mer is then a generalised least squares fit with
+ * V = K + dI, in which every product a'V^-1 b is a weighted sum over U'a and
+ * U'b, plus (a'b - (U'a)'(U'b))/d when U has fewer columns than samples.
+ * The k-mer column is added to the null fit as in linearTest, so its only
+ * cost is U'z, which is a sum of the rows of U for the samples it is in.
+ * Binary phenotypes are fitted as 0/1 values, as in FaST-LMM and GEMMA
+ *
+ */
+
+// Constants
+const double lmm_log_delta_min = -5; // log10 of the range of d searched
+const double lmm_log_delta_max = 5;
+const double lmm_log_delta_step = 0.1;
+const double lmm_delta_tolerance = 1e-4; // of log10(d), in the line search
+
+class MixedModel
+{
+   public:
+      // Initialisation. kinship is the factor G of K = GG' from kmds, with
+      // the samples in the same order as fixed, which must outlive this
+      MixedModel(const FixedCovariates& fixed, const arma::mat& kinship);
+
+      // nonmodifying operations
+      double delta() const { return _delta; }
+      double heritability() const { return 1 / (1 + _delta); } // s_g / (s_g + s_e)
+      size_t rank() const { return _eigval.n_elem; }
+
+      void test(Kmer& k) const;
+
+   private:
+      double nullFit(const double delta, arma::vec& weights, arma::mat& xtvx_inv, arma::vec& xtvy, arma::vec& b, double& rss) const;
+      double logLikelihood(const double rss, const double log_det) const;
+      double logDet(const double delta) const;
+
+      const FixedCovariates& _fixed;
+      size_t _num_samples;
+      int _full_rank;
+
+      arma::vec _eigval; // S
+      arma::mat _u_t; // U', one column per sample
+
+      // Rotated fixed covariates and phenotype, U'X and U'y, and their
+      // unrotated products
+      arma::mat _x_rot;
+      arma::vec _y_rot;
+      arma::mat _xtx;
+      arma::vec _xty;
+      double _yty;
+
+      // Null model at the fitted d
+      double _delta;
+      arma::vec _weights; // 1/(S + dI)
+      arma::mat _xtvx_inv; // (X'V^-1X)^-1
+      arma::vec _xtvy; // X'V^-1y
+      arma::vec _null_b;
+      double _null_rss; // (y - Xb)'V^-1(y - Xb)
+      double _log_det; // log|V|
+};
@@ -0,0 +1,63 @@
+/*
+ * File: patternCache.cpp
+ *
+ * Caches association test results by presence pattern, shared between the
+ * worker threads
+ *
+ */
+
+#include "seer.hpp"
+
+size_t presenceHash::operator()(const std::vector<uint64_t>& words) const
+{
+   uint64_t hash = 0xcbf29ce484222325;
+   for (auto it = words.begin(); it != words.end(); ++it)
+   {
+      hash ^= *it;
+      hash *= 0x100000001b3;
+      hash ^= hash >> 29;
+   }
+
+   return hash;
+}
+
+PatternCache::PatternCache()
+   :_shards(pattern_cache_shards)
+{
+}
+
+// High bits pick the shard, so the maps' buckets in each aren't correlated
+PatternCache::cacheShard& PatternCache::shard(const std::vector<uint64_t>& words)
+{
+   return _shards[(_hasher(words) >> 32) % _shards.size()];
+}
+
+int PatternCache::find(Kmer& k)
+{
+   const std::vector<uint64_t>& words = k.presence().words();
+   cacheShard& cache = shard(words);
+
+   std::lock_guard<std::mutex> lock(cache.mtx);
+   auto it = cache.results.find(words);
+   if (it == cache.results.end())
+   {
+      return 0;
+   }
+
+   k.set_result(it->second);
+   return 1;
+}
+
+void PatternCache::insert(const Kmer& k)
+{
+   const std::vector<uint64_t>& words = k.presence().words();
+   cacheShard& cache = shard(words);
+
+   std::lock_guard<std::mutex> lock(cache.mtx);
+   if (cache.results.size() >= pattern_cache_shard_size)
+   {
+      cache.results.clear();
+   }
+   cache.results[words] = k.result();
+}
+
@@ -0,0 +1,50 @@
+/*
+ * patternCache.hpp
+ * Header file for the cache of association test results by presence pattern
+ *
+ * k-mers with exactly the same presence pattern, such as overlapping k-mers
+ * along a gene, get the same test result. Each phenotype keeps the results
+ * of the patterns its worker threads have tested, so repeats only need their
+ * sequence and MAF. The cache is split into shards, each with its own lock,
+ * and a shard is emptied once full so recent patterns are kept
+ *
+ */
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// Constants
+const size_t pattern_cache_shards = 64;
+const size_t pattern_cache_shard_size = 4096; // patterns per shard
+
+// Hash of a packed presence vector
+struct presenceHash
+{
+   size_t operator()(const std::vector<uint64_t>& words) const;
+};
+
+class PatternCache
+{
+   public:
+      PatternCache();
+
+      // Copies a cached result onto k. Returns 0 if its pattern hasn't been
+      // tested
+      int find(Kmer& k);
+      // Stores the result of testing k
+      void insert(const Kmer& k);
+
+   private:
+      struct cacheShard
+      {
+         std::mutex mtx;
+         std::unordered_map<std::vector<uint64_t>, kmerResult, presenceHash> results;
+      };
+
+      cacheShard& shard(const std::vector<uint64_t>& words);
+
+      std::vector<cacheShard> _shards;
+      presenceHash _hasher;
+};
+
@@ -0,0 +1,100 @@
+/*
+ * File: permutation.cpp
+ *
+ * Family-wise significance thresholds from phenotype permutations
+ *
+ */
+
+#include "seer.hpp"
+
+#include <random>
+
+PermutationTest::PermutationTest(const FixedCovariates& fixed, const unsigned int num_permutations)
+   :_fixed(fixed), _residuals_t(num_permutations, fixed.num_samples()), _max_stats(num_permutations, arma::fill::zeros)
+{
+   std::mt19937 generator(permutation_seed);
+   std::vector<size_t> order(fixed.num_samples());
+   for (size_t i = 0; i < order.size(); ++i)
+   {
+      order[i] = i;
+   }
+
+   const arma::vec& residuals = fixed.null_residuals();
+   for (unsigned int p = 0; p < num_permutations; ++p)
+   {
+      std::shuffle(order.begin(), order.end(), generator);
+      for (size_t i = 0; i < order.size(); ++i)
+      {
+         _residuals_t(p, i) = residuals[order[i]];
+      }
+   }
+
+   _projection_t = _residuals_t * (fixed.xtwx_inv() * fixed.x_t()).t();
+}
+
+// Score statistics U^2/V of the k-mer in x against each permutation, raising
+// max_stats where they are larger. scores is storage for the calling thread
+void PermutationTest::add(const Presence& x, arma::vec& max_stats, arma::vec& scores) const
+{
+   // Variance, as in scoreTest
+   double V, V_sq;
+   presenceSums(x, _fixed.null_weights(), V, V_sq);
+
+   arma::vec xwz = _fixed.weighted_cross_product(x);
+   double z_w_z = V;
+   V -= dot(xwz, _fixed.xtwx_inv() * xwz);
+   if (V <= collinear_limit * z_w_z)
+   {
+      return;
+   }
+   V *= _fixed.dispersion();
+
+   // Scores of every permutation, in one walk of the set bits
+   const size_t num_permutations = _residuals_t.n_rows;
+   scores.zeros(num_permutations);
+   const std::vector<uint64_t>& words = x.words();
+   for (size_t i = 0; i < words.size(); ++i)
+   {
+      uint64_t word = words[i];
+      while (word)
+      {
+         const double* r_i = _residuals_t.colptr(i * presence_word_bits + __builtin_ctzll(word));
+         for (size_t p = 0; p < num_permutations; ++p)
+         {
+            scores[p] += r_i[p];
+         }
+
+         word &= word - 1;
+      }
+   }
+
+   // Take out the part explained by the covariates
+   scores -= _projection_t * xwz;
+
+   if (max_stats.n_elem != num_permutations)
+   {
+      max_stats.zeros(num_permutations);
+   }
+   for (size_t p = 0; p < num_permutations; ++p)
+   {
+      max_stats[p] = std::max(max_stats[p], scores[p] * scores[p] / V);
+   }
+}
+
+void PermutationTest::merge(const arma::vec& max_stats)
+{
+   std::lock_guard<std::mutex> lock(_mtx);
+   for (size_t p = 0; p < max_stats.n_elem && p < _max_stats.n_elem; ++p)
+   {
+      _max_stats[p] = std::max(_max_stats[p], max_stats[p]);
+   }
+}
+
+double PermutationTest::threshold(const double alpha) const
+{
+   // Largest statistic is smallest p-value
+   arma::vec max_stats = arma::sort(_max_stats, "descend");
+   size_t quantile = std::min((size_t)(alpha * max_stats.n_elem), (size_t)max_stats.n_elem - 1);
+
+   return max_stats[quantile] > 0 ? normalPval(pow(max_stats[quantile], 0.5)) : 1;
+}
@@ -0,0 +1,50 @@
+/*
+ * permutation.hpp
+ * Header file for permutation thresholds
+ *
+ * With --permutations N, every k-mer passing the basic filters is also
+ * tested against N permutations of the phenotype, and the smallest p-value
+ * of each permutation kept. The alpha quantile of these is the p-value
+ * threshold with family-wise error alpha, which allows for the correlation
+ * between k-mers.
+ *
+ * The test is the score test against the null model (see scoreTest), with the
+ * null residuals permuted between samples. Its variance doesn't depend on the
+ * permutation, so for each k-mer the N scores are one sum over the samples it
+ * is in, of a column of permuted residuals. Permuted residuals are no longer
+ * orthogonal to the covariates, so each score is then adjusted for them as
+ * the efficient score, z'r - (X'Wz)'(X'WX)^-1 X'r. (X'WX)^-1 X'r is the same
+ * for every k-mer, so is computed once for each permutation
+ *
+ */
+
+#include <mutex>
+
+// Constants
+const double permutation_alpha = 0.05;
+const unsigned int permutation_seed = 1;
+
+class PermutationTest
+{
+   public:
+      // Initialisation. fixed must outlive this
+      PermutationTest(const FixedCovariates& fixed, const unsigned int num_permutations);
+
+      // nonmodifying operations
+      size_t num_permutations() const { return _residuals_t.n_rows; }
+
+      // Largest score statistic of each permutation so far, kept by each
+      // worker thread, then merged
+      void add(const Presence& x, arma::vec& max_stats, arma::vec& scores) const;
+      void merge(const arma::vec& max_stats);
+
+      double threshold(const double alpha) const; // Smallest p-value of permutations at the alpha quantile
+
+   private:
+      const FixedCovariates& _fixed;
+      arma::mat _residuals_t; // Permutations x samples
+      arma::mat _projection_t; // Permutations x fixed, (X'WX)^-1 X'r of each
+
+      std::mutex _mtx;
+      arma::vec _max_stats;
+};
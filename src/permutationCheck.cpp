@@ -0,0 +1,137 @@
+/*
+ * File: permutationCheck.cpp
+ *
+ * Checks the permutation threshold with covariates against a brute force
+ * run: each permutation of the null residuals has the covariates projected
+ * out of it in full, and every k-mer is scored against it directly. Run by
+ * make test
+ *
+ */
+
+#include "seer.hpp"
+
+#include <random>
+
+// Constants
+const size_t check_samples = 300;
+const size_t check_covariates = 3;
+const size_t check_kmers = 200;
+const unsigned int check_permutations = 200;
+const double check_tolerance = 1e-8;
+const unsigned int check_seed = 1;
+
+// Threshold from the smallest p-value of each permutation, as
+// PermutationTest::threshold, with the same permutations
+double bruteForceThreshold(const FixedCovariates& fixed, const std::vector<arma::vec>& kmers)
+{
+   const size_t n = fixed.num_samples();
+   const arma::mat x = fixed.x_t().t();
+   const arma::vec& w = fixed.null_weights();
+
+   std::mt19937 generator(permutation_seed);
+   std::vector<size_t> order(n);
+   for (size_t i = 0; i < n; ++i)
+   {
+      order[i] = i;
+   }
+
+   arma::vec max_stats(check_permutations, arma::fill::zeros);
+   arma::vec r(n);
+   for (unsigned int p = 0; p < check_permutations; ++p)
+   {
+      std::shuffle(order.begin(), order.end(), generator);
+      for (size_t i = 0; i < n; ++i)
+      {
+         r[i] = fixed.null_residuals()[order[i]];
+      }
+      arma::vec r_adj = r - w % (x * (fixed.xtwx_inv() * (x.t() * r)));
+
+      for (auto it = kmers.begin(); it != kmers.end(); ++it)
+      {
+         const arma::vec& z = *it;
+         arma::vec xwz = x.t() * (w % z);
+         double z_w_z = dot(z, w);
+         double V = z_w_z - dot(xwz, fixed.xtwx_inv() * xwz);
+         if (V <= collinear_limit * z_w_z)
+         {
+            continue;
+         }
+         V *= fixed.dispersion();
+
+         double U = dot(z, r_adj);
+         max_stats[p] = std::max(max_stats[p], U * U / V);
+      }
+   }
+
+   max_stats = arma::sort(max_stats, "descend");
+   size_t quantile = std::min((size_t)(permutation_alpha * max_stats.n_elem), (size_t)max_stats.n_elem - 1);
+   return max_stats[quantile] > 0 ? normalPval(pow(max_stats[quantile], 0.5)) : 1;
+}
+
+// k-mers and phenotype both follow the first covariate, so the permuted
+// scores are confounded by it unless it is projected out
+int checkThreshold(const int continuous)
+{
+   std::mt19937 generator(check_seed);
+   std::normal_distribution<double> normal(0, 1);
+   std::uniform_real_distribution<double> uniform(0, 1);
+
+   arma::mat covariates(check_samples, check_covariates);
+   arma::vec y(check_samples);
+   for (size_t i = 0; i < check_samples; ++i)
+   {
+      double eta = -0.5;
+      for (size_t j = 0; j < check_covariates; ++j)
+      {
+         covariates(i, j) = normal(generator);
+         eta += 0.5 * covariates(i, j);
+      }
+      y[i] = continuous ? eta + normal(generator) : uniform(generator) < 1 / (1 + exp(-eta));
+   }
+   FixedCovariates fixed(y, covariates, continuous);
+
+   PermutationTest permutations(fixed, check_permutations);
+   std::vector<arma::vec> kmers;
+   arma::vec max_stats, scores;
+   Kmer k;
+   const std::string sequence = "ACGTACGTACGTACGTACGTACGTACGTA";
+   for (size_t i = 0; i < check_kmers; ++i)
+   {
+      k.reset(sequence.data(), sequence.length(), check_samples);
+      arma::vec z(check_samples, arma::fill::zeros);
+      for (size_t j = 0; j < check_samples; ++j)
+      {
+         if (uniform(generator) < 1 / (1 + exp(-2 * covariates(j, 0))))
+         {
+            k.add_sample(j);
+            z[j] = 1;
+         }
+      }
+      kmers.push_back(z);
+
+      permutations.add(k.presence(), max_stats, scores);
+   }
+   permutations.merge(max_stats);
+
+   double threshold = permutations.threshold(permutation_alpha);
+   double expected = bruteForceThreshold(fixed, kmers);
+
+   const std::string name = continuous ? "continuous" : "binary";
+   if (std::abs(threshold - expected) > check_tolerance * expected)
+   {
+      std::cerr << "FAILED permutation threshold, " << name << " phenotype with covariates: "
+                << threshold << " but brute force gives " << expected << "\n";
+      return 1;
+   }
+
+   std::cerr << "PASSED permutation threshold, " << name << " phenotype with covariates\n";
+   return 0;
+}
+
+int main()
+{
+   int fail = checkThreshold(0);
+   fail = checkThreshold(1) || fail;
+
+   return fail;
+}
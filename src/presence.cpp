@@ -0,0 +1,48 @@
+/*
+ * File: presence.cpp
+ *
+ * Helper functions for the presence class
+ *
+ */
+
+#include "presence.hpp"
+
+Presence::Presence()
+   :_num_samples(0), _count(0)
+{
+}
+
+Presence::Presence(const size_t num_samples)
+   :_bits((num_samples + presence_word_bits - 1) / presence_word_bits, 0), _num_samples(num_samples), _count(0)
+{
+}
+
+void Presence::set(const size_t i)
+{
+   uint64_t bit = (uint64_t)1 << (i % presence_word_bits);
+   uint64_t& word = _bits[i / presence_word_bits];
+
+   if (!(word & bit))
+   {
+      word |= bit;
+      _count++;
+   }
+}
+
+void Presence::clear(const size_t num_samples)
+{
+   _bits.assign((num_samples + presence_word_bits - 1) / presence_word_bits, 0);
+   _num_samples = num_samples;
+   _count = 0;
+}
+
+size_t Presence::count_and(const Presence& mask) const
+{
+   size_t both = 0;
+   for (size_t i = 0; i < _bits.size() && i < mask._bits.size(); ++i)
+   {
+      both += __builtin_popcountll(_bits[i] & mask._bits[i]);
+   }
+
+   return both;
+}
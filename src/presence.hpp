@@ -0,0 +1,37 @@
+/*
+ * presence.hpp
+ * Header file for presence class
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+const size_t presence_word_bits = 64;
+
+// Which samples a k-mer is found in, as a packed bitset with one bit per
+// sample (in the sorted order given by the pheno file)
+class Presence
+{
+   public:
+      // Initialisation
+      Presence();
+      Presence(const size_t num_samples); // All absent
+
+      // nonmodifying operations
+      size_t size() const { return _num_samples; }
+      size_t count() const { return _count; }
+      int test(const size_t i) const { return (_bits[i / presence_word_bits] >> (i % presence_word_bits)) & 1; }
+      size_t count_and(const Presence& mask) const; // Number of samples present in both
+      const std::vector<uint64_t>& words() const { return _bits; }
+
+      // Modifying operations
+      void set(const size_t i);
+      void clear(const size_t num_samples); // All absent, keeping the storage
+
+   private:
+      std::vector<uint64_t> _bits;
+      size_t _num_samples;
+      size_t _count;
+};
+
@@ -0,0 +1,180 @@
+/*
+ * File: profile.cpp
+ *
+ * Per-thread, per-stage timings for --profile, and the JSON summary
+ *
+ */
+
+#include "profile.hpp"
+
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+const char* profile_stage_names[profile_num_stages] = {"parse", "basic_filter", "stats_filter",
+   "score_filter", "permutations", "cache_hit", "logistic_fit", "linear_fit", "lmm_fit", "firth", "bfgs_fail", "nr_fail",
+   "large_se", "inv_fail", "firth_fail", "output"};
+
+// Threads' totals are kept until the summary is written
+struct programProfile
+{
+   std::string program;
+   std::chrono::steady_clock::time_point start;
+   std::mutex mtx;
+   std::vector<std::unique_ptr<threadProfile>> threads;
+};
+
+static std::unique_ptr<programProfile> program_profile;
+static thread_local threadProfile* current_profile = NULL;
+
+double threadCpuTime()
+{
+   timespec cpu_time;
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_time);
+   return cpu_time.tv_sec + cpu_time.tv_nsec * 1e-9;
+}
+
+double processCpuTime()
+{
+   timespec cpu_time;
+   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_time);
+   return cpu_time.tv_sec + cpu_time.tv_nsec * 1e-9;
+}
+
+double secondsSince(const std::chrono::steady_clock::time_point& start)
+{
+   return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void startProfile(const std::string& program)
+{
+   program_profile.reset(new programProfile);
+   program_profile->program = program;
+   program_profile->start = std::chrono::steady_clock::now();
+}
+
+/*
+ * ProfileThread
+ */
+ProfileThread::ProfileThread(const std::string& name)
+   :_profile(NULL), _start_cpu(0)
+{
+   if (program_profile)
+   {
+      std::lock_guard<std::mutex> lock(program_profile->mtx);
+      program_profile->threads.emplace_back(new threadProfile);
+
+      _profile = program_profile->threads.back().get();
+      _profile->name = name;
+      _profile->stages.assign(profile_num_stages, stageTime{0, 0, 0, 0});
+      _profile->wall = 0;
+      _profile->cpu = 0;
+
+      current_profile = _profile;
+      _start = std::chrono::steady_clock::now();
+      _start_cpu = threadCpuTime();
+   }
+}
+
+ProfileThread::~ProfileThread()
+{
+   if (_profile != NULL)
+   {
+      _profile->wall = secondsSince(_start);
+      _profile->cpu = threadCpuTime() - _start_cpu;
+      current_profile = NULL;
+   }
+}
+
+/*
+ * ProfileTimer
+ */
+ProfileTimer::ProfileTimer(const profileStage stage, const uint64_t items)
+   :_stage(NULL), _start_cpu(0)
+{
+   if (current_profile != NULL)
+   {
+      _stage = &current_profile->stages[stage];
+      _stage->calls++;
+      _stage->items += items;
+
+      _start = std::chrono::steady_clock::now();
+      _start_cpu = threadCpuTime();
+   }
+}
+
+ProfileTimer::~ProfileTimer()
+{
+   if (_stage != NULL)
+   {
+      _stage->wall += secondsSince(_start);
+      _stage->cpu += threadCpuTime() - _start_cpu;
+   }
+}
+
+/*
+ * Functions
+ */
+void profileCount(const profileStage stage, const uint64_t items)
+{
+   if (current_profile != NULL)
+   {
+      current_profile->stages[stage].calls++;
+      current_profile->stages[stage].items += items;
+   }
+}
+
+// Call once all registered threads have finished
+void writeProfile(const std::string& file_name)
+{
+   if (!program_profile)
+   {
+      return;
+   }
+
+   std::ofstream json(file_name.c_str());
+   if (!json)
+   {
+      throw std::runtime_error("Could not open " + file_name + " for writing");
+   }
+
+   std::lock_guard<std::mutex> lock(program_profile->mtx);
+   const std::vector<std::unique_ptr<threadProfile>>& threads = program_profile->threads;
+
+   json << std::fixed << std::setprecision(6);
+   json << "{\n  \"program\": \"" << program_profile->program << "\",\n"
+        << "  \"wall_seconds\": " << secondsSince(program_profile->start) << ",\n"
+        << "  \"cpu_seconds\": " << processCpuTime() << ",\n";
+
+   // Each stage, summed over the threads
+   json << "  \"stages\": {";
+   for (int stage = 0; stage < profile_num_stages; ++stage)
+   {
+      stageTime total = {0, 0, 0, 0};
+      for (auto it = threads.begin(); it != threads.end(); ++it)
+      {
+         const stageTime& thread_stage = (*it)->stages[stage];
+         total.calls += thread_stage.calls;
+         total.items += thread_stage.items;
+         total.wall += thread_stage.wall;
+         total.cpu += thread_stage.cpu;
+      }
+
+      json << (stage ? ",\n" : "\n") << "    \"" << profile_stage_names[stage] << "\": {"
+           << "\"calls\": " << total.calls << ", \"items\": " << total.items
+           << ", \"wall_seconds\": " << total.wall << ", \"cpu_seconds\": " << total.cpu
+           << ", \"items_per_second\": " << (total.wall > 0 ? total.items / total.wall : 0) << "}";
+   }
+   json << "\n  },\n";
+
+   json << "  \"threads\": [";
+   for (auto it = threads.begin(); it != threads.end(); ++it)
+   {
+      json << (it == threads.begin() ? "\n" : ",\n") << "    {\"name\": \"" << (*it)->name << "\""
+           << ", \"wall_seconds\": " << (*it)->wall << ", \"cpu_seconds\": " << (*it)->cpu
+           << ", \"utilisation\": " << ((*it)->wall > 0 ? (*it)->cpu / (*it)->wall : 0) << "}";
+   }
+   json << "\n  ]\n}\n";
+}
+
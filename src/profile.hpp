@@ -0,0 +1,100 @@
+/*
+ * profile.hpp
+ * Header file for seer's --profile timings
+ *
+ * Each thread registers itself with a ProfileThread, then sections of code
+ * are timed with a ProfileTimer, which adds their wall and CPU time to the
+ * thread's totals for that stage. Counts without a time use profileCount.
+ * Timed stages may nest: the fallback fits are also counted in the fit that
+ * called them. Without --profile no thread is registered, and timers and
+ * counts do nothing
+ *
+ * The summary is written as JSON:
+ *    {"program": , "wall_seconds": , "cpu_seconds": ,
+ *     "stages": {"<stage>": {"calls": , "items": , "wall_seconds": ,
+ *        "cpu_seconds": , "items_per_second": }, ...},
+ *     "threads": [{"name": , "wall_seconds": , "cpu_seconds": ,
+ *        "utilisation": }, ...]}
+ * with stages summed over threads, and utilisation the fraction of the
+ * thread's lifetime spent on a CPU
+ *
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum profileStage
+{
+   profile_parse,        // reading and parsing k-mers, including presence
+   profile_basic_filter,
+   profile_stats_filter, // chi-squared or Welch pre-filter, per block
+   profile_score_filter, // score test pre-filter, per block
+   profile_permutations, // scores against permuted phenotypes
+   profile_cache_hit,    // results reused from the pattern cache
+   profile_logistic_fit,
+   profile_linear_fit,
+   profile_lmm_fit,
+   profile_firth,        // bad-chisq k-mers fitted with Firth from the start
+   profile_bfgs_fail,    // N-R after IRLS, or QR after BFGS, failed
+   profile_nr_fail,      // Firth after N-R failed
+   profile_large_se,     // Firth after a large standard error
+   profile_inv_fail,
+   profile_firth_fail,
+   profile_output,
+   profile_num_stages
+};
+
+// Accumulated time in one stage, by one thread
+struct stageTime
+{
+   uint64_t calls;
+   uint64_t items;
+   double wall;
+   double cpu;
+};
+
+struct threadProfile
+{
+   std::string name;
+   std::vector<stageTime> stages;
+   double wall;
+   double cpu;
+};
+
+// Registers the current thread for profiling, if --profile is on, for the
+// lifetime of this object
+class ProfileThread
+{
+   public:
+      ProfileThread(const std::string& name);
+      ~ProfileThread();
+
+   private:
+      threadProfile* _profile;
+      std::chrono::steady_clock::time_point _start;
+      double _start_cpu;
+};
+
+// Times a stage, from construction to destruction, on a registered thread
+class ProfileTimer
+{
+   public:
+      ProfileTimer(const profileStage stage, const uint64_t items = 1);
+      ~ProfileTimer();
+
+   private:
+      stageTime* _stage;
+      std::chrono::steady_clock::time_point _start;
+      double _start_cpu;
+};
+
+// Functions
+void startProfile(const std::string& program);
+void profileCount(const profileStage stage, const uint64_t items = 1);
+void writeProfile(const std::string& file_name);
+double threadCpuTime();
+
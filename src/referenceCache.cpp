@@ -0,0 +1,464 @@
+/*
+ * File: referenceCache.cpp
+ *
+ * Reads and writes map_back's reference cache
+ *
+ */
+
+#include "fasta.hpp"
+#include "referenceCache.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const size_t cache_header_size = 24; // magic, num_references, directory
+const size_t cache_entry_header_size = 32; // num_contigs, num_bases, num_masked, index_length
+const char cache_bases[4] = {'A', 'C', 'G', 'T'};
+
+size_t cachePadding(const size_t length)
+{
+   return (sizeof(uint64_t) - length % sizeof(uint64_t)) % sizeof(uint64_t);
+}
+
+/*
+ * ReferenceCache
+ */
+ReferenceCache::ReferenceCache()
+   :_fd(-1), _map(NULL), _map_length(0)
+{
+}
+
+ReferenceCache::~ReferenceCache()
+{
+   close();
+}
+
+int ReferenceCache::open(const std::string& file_name, const std::vector<std::pair<std::string, std::string>>& references)
+{
+   close();
+   _file_name = file_name;
+
+   _fd = ::open(file_name.c_str(), O_RDONLY);
+   if (_fd < 0)
+   {
+      if (errno == ENOENT)
+      {
+         return 0;
+      }
+      throw std::runtime_error("Could not open reference cache " + file_name + "\n");
+   }
+
+   struct stat file_info;
+   if (fstat(_fd, &file_info) != 0)
+   {
+      throw std::runtime_error("Could not open reference cache " + file_name + "\n");
+   }
+   _map_length = file_info.st_size;
+   if (_map_length < cache_header_size)
+   {
+      throw std::runtime_error(file_name + " is not a reference cache\n");
+   }
+
+   void* map = mmap(NULL, _map_length, PROT_READ, MAP_SHARED, _fd, 0);
+   if (map == MAP_FAILED)
+   {
+      throw std::runtime_error("Could not map reference cache " + file_name + "\n");
+   }
+   _map = (const char*)map;
+
+   if (memcmp(_map, cache_magic.data(), cache_magic.length() - 1) != 0)
+   {
+      throw std::runtime_error(file_name + " is not a reference cache\n");
+   }
+   else if (_map[cache_magic.length() - 1] != cache_magic.back())
+   {
+      // An earlier version of the format
+      close();
+      return 0;
+   }
+
+   uint64_t num_references, directory;
+   memcpy(&num_references, _map + 8, sizeof(uint64_t));
+   memcpy(&directory, _map + 16, sizeof(uint64_t));
+   if (num_references != references.size())
+   {
+      close();
+      return 0;
+   }
+
+   // Check the cache is of these references, in their current state, before
+   // reading any entries
+   std::vector<uint64_t> offsets;
+   size_t pos = directory;
+   auto read_string = [this, &pos]()
+   {
+      uint32_t length;
+      if (pos + sizeof(uint32_t) > _map_length)
+      {
+         throw std::runtime_error("Truncated reference cache " + _file_name + "\n");
+      }
+      memcpy(&length, _map + pos, sizeof(uint32_t));
+      pos += sizeof(uint32_t);
+
+      if (pos + length > _map_length)
+      {
+         throw std::runtime_error("Truncated reference cache " + _file_name + "\n");
+      }
+      std::string read(_map + pos, length);
+      pos += length;
+      return read;
+   };
+
+   for (auto it = references.begin(); it != references.end(); ++it)
+   {
+      std::string name = read_string();
+      std::string fasta_file = read_string();
+
+      uint64_t cached_stamp[3]; // size, modified, offset
+      if (pos + sizeof(cached_stamp) > _map_length)
+      {
+         throw std::runtime_error("Truncated reference cache " + _file_name + "\n");
+      }
+      memcpy(cached_stamp, _map + pos, sizeof(cached_stamp));
+      pos += sizeof(cached_stamp);
+
+      uint64_t size;
+      int64_t modified;
+      if (name != it->first || fasta_file != it->second || !fastaStamp(fasta_file, size, modified)
+            || size != cached_stamp[0] || modified != (int64_t)cached_stamp[1])
+      {
+         close();
+         return 0;
+      }
+      offsets.push_back(cached_stamp[2]);
+   }
+
+   _names = references;
+   _references.reserve(references.size());
+   for (size_t i = 0; i < references.size(); ++i)
+   {
+      read_entry(references[i].first, offsets[i]);
+   }
+
+   return 1;
+}
+
+void ReferenceCache::close()
+{
+   _names.clear();
+   _references.clear();
+
+   if (_map != NULL)
+   {
+      munmap((void*)_map, _map_length);
+      _map = NULL;
+   }
+   if (_fd >= 0)
+   {
+      ::close(_fd);
+      _fd = -1;
+   }
+}
+
+Fasta ReferenceCache::fasta(const size_t i) const
+{
+   const cachedReference& reference = _references[i];
+
+   // Contigs start after the previous one and its separator
+   std::vector<uint64_t> starts;
+   uint64_t start = 0;
+   for (auto it = reference.contig_lengths.begin(); it != reference.contig_lengths.end(); ++it)
+   {
+      starts.push_back(start);
+      start += *it + 1;
+   }
+
+   return Fasta(_names[i].first, reference.contig_names, starts, reference.index);
+}
+
+std::string ReferenceCache::contig(const size_t i, const size_t contig_idx) const
+{
+   const cachedReference& reference = _references[i];
+   const uint64_t start = reference.contig_offsets[contig_idx];
+   const uint64_t end = start + reference.contig_lengths[contig_idx];
+
+   std::string bases(end - start, 'A');
+   for (uint64_t pos = start; pos < end; ++pos)
+   {
+      bases[pos - start] = cache_bases[(reference.sequence[pos / 4] >> (2 * (pos % 4))) & 3];
+   }
+
+   // Runs are in order, so start from the first one that ends in the contig
+   uint64_t lo = 0, hi = reference.num_masked;
+   while (lo < hi)
+   {
+      uint64_t mid = (lo + hi) / 2;
+      if (reference.masked[2 * mid] + reference.masked[2 * mid + 1] <= start)
+      {
+         lo = mid + 1;
+      }
+      else
+      {
+         hi = mid;
+      }
+   }
+   for (uint64_t run = lo; run < reference.num_masked && reference.masked[2 * run] < end; ++run)
+   {
+      uint64_t run_start = std::max(reference.masked[2 * run], start);
+      uint64_t run_end = std::min(reference.masked[2 * run] + reference.masked[2 * run + 1], end);
+      std::fill(bases.begin() + (run_start - start), bases.begin() + (run_end - start), 'N');
+   }
+
+   return bases;
+}
+
+void ReferenceCache::read_entry(const std::string& reference_name, const uint64_t offset)
+{
+   uint64_t header[4]; // num_contigs, num_bases, num_masked, index_length
+   if (offset % sizeof(uint64_t) != 0 || offset + cache_entry_header_size > _map_length)
+   {
+      throw std::runtime_error("Bad entry for " + reference_name + " in reference cache " + _file_name + "\n");
+   }
+   memcpy(header, _map + offset, sizeof(header));
+
+   const uint64_t num_contigs = header[0], num_bases = header[1];
+   const uint64_t sequence_bytes = (num_bases + 3) / 4;
+   size_t pos = offset + cache_entry_header_size;
+   size_t names_start = pos + (num_contigs + 2 * header[2]) * sizeof(uint64_t) + header[3] + sequence_bytes + cachePadding(sequence_bytes);
+   if (names_start > _map_length || names_start < pos)
+   {
+      throw std::runtime_error("Truncated entry for " + reference_name + " in reference cache " + _file_name + "\n");
+   }
+
+   cachedReference reference;
+   const uint64_t* lengths = (const uint64_t*)(_map + pos);
+   reference.contig_lengths.assign(lengths, lengths + num_contigs);
+   pos += num_contigs * sizeof(uint64_t);
+
+   uint64_t contig_offset = 0;
+   for (auto it = reference.contig_lengths.begin(); it != reference.contig_lengths.end(); ++it)
+   {
+      reference.contig_offsets.push_back(contig_offset);
+      contig_offset += *it;
+   }
+   if (contig_offset != num_bases)
+   {
+      throw std::runtime_error("Bad entry for " + reference_name + " in reference cache " + _file_name + "\n");
+   }
+
+   reference.masked = (const uint64_t*)(_map + pos);
+   reference.num_masked = header[2];
+   pos += 2 * header[2] * sizeof(uint64_t);
+
+   reference.index = std::make_shared<const FmIndex>(_map + pos, header[3]);
+   if (reference.index->size() != num_bases + num_contigs + 1)
+   {
+      throw std::runtime_error("Bad entry for " + reference_name + " in reference cache " + _file_name + "\n");
+   }
+   pos += header[3];
+
+   reference.sequence = (const uint8_t*)(_map + pos);
+   pos = names_start;
+
+   for (uint64_t i = 0; i < num_contigs; ++i)
+   {
+      uint32_t name_length;
+      if (pos + sizeof(uint32_t) > _map_length)
+      {
+         throw std::runtime_error("Truncated entry for " + reference_name + " in reference cache " + _file_name + "\n");
+      }
+      memcpy(&name_length, _map + pos, sizeof(uint32_t));
+      pos += sizeof(uint32_t);
+
+      if (pos + name_length > _map_length)
+      {
+         throw std::runtime_error("Truncated entry for " + reference_name + " in reference cache " + _file_name + "\n");
+      }
+      reference.contig_names.emplace_back(_map + pos, name_length);
+      pos += name_length;
+   }
+
+   _references.push_back(std::move(reference));
+}
+
+/*
+ * ReferenceCacheWriter
+ */
+ReferenceCacheWriter::ReferenceCacheWriter()
+   :_file(NULL), _pos(0), _num_written(0)
+{
+}
+
+ReferenceCacheWriter::~ReferenceCacheWriter()
+{
+   close();
+}
+
+void ReferenceCacheWriter::open(const std::string& file_name, const std::vector<std::pair<std::string, std::string>>& references)
+{
+   _file_name = file_name;
+   _temp_name = file_name + ".tmp";
+   _file = fopen(_temp_name.c_str(), "wb");
+   if (_file == NULL)
+   {
+      throw std::runtime_error("Could not open " + _temp_name + " for writing\n");
+   }
+
+   _references = references;
+   _offsets.assign(references.size(), 0);
+   _num_written = 0;
+
+   uint64_t header[2] = {references.size(), 0}; // Directory filled in on close
+   fwrite(cache_magic.data(), 1, cache_magic.length(), _file);
+   fwrite(header, sizeof(uint64_t), 2, _file);
+   _pos = cache_header_size;
+}
+
+// Writes the directory and moves the cache into place, unless some of the
+// references weren't written, when it is removed
+void ReferenceCacheWriter::close()
+{
+   if (_file == NULL)
+   {
+      return;
+   }
+
+   int complete = _num_written == _references.size();
+   if (complete)
+   {
+      uint64_t directory = _pos;
+      for (size_t i = 0; i < _references.size(); ++i)
+      {
+         uint64_t stamp[3] = {0, 0, _offsets[i]};
+         int64_t modified = 0;
+         fastaStamp(_references[i].second, stamp[0], modified);
+         stamp[1] = modified;
+
+         const std::string* fields[2] = {&_references[i].first, &_references[i].second};
+         for (int j = 0; j < 2; ++j)
+         {
+            uint32_t length = fields[j]->length();
+            fwrite(&length, sizeof(uint32_t), 1, _file);
+            fwrite(fields[j]->data(), 1, length, _file);
+         }
+         fwrite(stamp, sizeof(uint64_t), 3, _file);
+      }
+
+      fseek(_file, cache_magic.length() + sizeof(uint64_t), SEEK_SET);
+      fwrite(&directory, sizeof(uint64_t), 1, _file);
+   }
+
+   complete = fclose(_file) == 0 && complete;
+   _file = NULL;
+
+   if (!complete)
+   {
+      std::remove(_temp_name.c_str());
+   }
+   else if (std::rename(_temp_name.c_str(), _file_name.c_str()) != 0)
+   {
+      std::remove(_temp_name.c_str());
+      throw std::runtime_error("Could not write reference cache " + _file_name + "\n");
+   }
+}
+
+void ReferenceCacheWriter::write(const size_t i, const Fasta& indexed, const std::vector<uint8_t>& text)
+{
+   const std::vector<std::string>& contig_names = indexed.get_sequence_names();
+   const FmIndex& index = indexed.get_index();
+
+   // Pack the bases, leaving out the separators, and find the masked runs
+   std::vector<uint64_t> contig_lengths(contig_names.size(), 0);
+   std::vector<uint64_t> masked;
+   std::vector<uint8_t> sequence;
+   sequence.reserve(text.size() / 4 + 1);
+
+   uint64_t num_bases = 0;
+   size_t contig = 0;
+   for (auto it = text.begin(); it != text.end(); ++it)
+   {
+      if (*it == fm_separator)
+      {
+         contig++;
+         continue;
+      }
+
+      uint8_t code = 0;
+      if (*it == fm_other)
+      {
+         if (!masked.empty() && masked[masked.size() - 2] + masked.back() == num_bases)
+         {
+            masked.back()++;
+         }
+         else
+         {
+            masked.push_back(num_bases);
+            masked.push_back(1);
+         }
+      }
+      else
+      {
+         code = *it - fmSymbol('A');
+      }
+
+      if (num_bases % 4 == 0)
+      {
+         sequence.push_back(0);
+      }
+      sequence.back() |= code << (2 * (num_bases % 4));
+      contig_lengths[contig]++;
+      num_bases++;
+   }
+   sequence.resize(sequence.size() + cachePadding(sequence.size()), 0);
+
+   uint64_t header[4] = {contig_names.size(), num_bases, masked.size() / 2, index.data_length()};
+   std::vector<char> names;
+   for (auto it = contig_names.begin(); it != contig_names.end(); ++it)
+   {
+      uint32_t length = it->length();
+      names.insert(names.end(), (const char*)&length, (const char*)&length + sizeof(uint32_t));
+      names.insert(names.end(), it->begin(), it->end());
+   }
+   names.resize(names.size() + cachePadding(names.size()), 0);
+
+   std::lock_guard<std::mutex> lock(_mtx);
+   _offsets[i] = _pos;
+   fwrite(header, sizeof(uint64_t), 4, _file);
+   fwrite(contig_lengths.data(), sizeof(uint64_t), contig_lengths.size(), _file);
+   fwrite(masked.data(), sizeof(uint64_t), masked.size(), _file);
+   fwrite(index.data(), 1, index.data_length(), _file);
+   fwrite(sequence.data(), 1, sequence.size(), _file);
+   fwrite(names.data(), 1, names.size(), _file);
+   _pos += sizeof(header) + (contig_lengths.size() + masked.size()) * sizeof(uint64_t)
+      + index.data_length() + sequence.size() + names.size();
+
+   if (ferror(_file))
+   {
+      throw std::runtime_error("Could not write reference cache " + _temp_name + "\n");
+   }
+   _num_written++;
+}
+
+/*
+ * Functions
+ */
+// Size and modification time of a fasta file, which the cache is of. Returns
+// 0 if it doesn't exist
+int fastaStamp(const std::string& file_name, uint64_t& size, int64_t& modified)
+{
+   struct stat file_info;
+   if (stat(file_name.c_str(), &file_info) != 0)
+   {
+      return 0;
+   }
+
+   size = file_info.st_size;
+   modified = file_info.st_mtime;
+   return 1;
+}
@@ -0,0 +1,118 @@
+/*
+ * referenceCache.hpp
+ * Header file for map_back's reference cache
+ *
+ * map_back --cache reads and indexes the references once and writes them to
+ * a cache file, which later runs memory map rather than reading the fasta
+ * files again. Each assembly is stored 2 bits per base, with runs of other
+ * bases (N, IUPAC codes, lower case) masked, along with its FM-index. Only
+ * --batch reads the sequence; the default search only needs the index,
+ * which doesn't keep the text. The cache is of one reference list: it is rebuilt if the number of
+ * references, any of their names or fasta files, or the size or
+ * modification time of a fasta file change. Integers are in host (little
+ * endian) byte order, and entries are 8 byte aligned
+ *
+ * Header
+ *    magic            8 bytes, "SEERREF2". Caches of other versions are
+ *                     rebuilt
+ *    num_references   uint64
+ *    directory        uint64, offset of the directory
+ * Then one entry per reference, in any order
+ *    num_contigs      uint64
+ *    num_bases        uint64, in all the contigs
+ *    num_masked       uint64, runs of bases other than ACGT
+ *    index_length     uint64, bytes
+ *    contig lengths   num_contigs uint64
+ *    masked runs      num_masked x (uint64 start, uint64 length), positions
+ *                     in the contigs concatenated
+ *    index            index_length bytes, the FM-index (see fmIndex.hpp)
+ *    sequence         (num_bases + 3) / 4 bytes, 2 bits per base
+ *                     (A=0 C=1 G=2 T=3), first base in the lowest bits.
+ *                     Masked bases are stored as A. Padded to 8
+ *    contig names     num_contigs x (uint32 length, name), padded to 8
+ * Then the directory, in the order of the reference list
+ *    per reference    uint32 length, name, uint32 length, fasta file,
+ *                     uint64 file size, int64 modification time,
+ *                     uint64 offset of its entry
+ *
+ */
+
+// Constants
+const std::string cache_magic = "SEERREF2";
+
+// A reference in the cache. The sequence, masked runs and index point into
+// the memory map
+struct cachedReference
+{
+   std::vector<std::string> contig_names;
+   std::vector<uint64_t> contig_lengths;
+   std::vector<uint64_t> contig_offsets; // first base of each contig in sequence
+   const uint64_t* masked;
+   uint64_t num_masked;
+   const uint8_t* sequence;
+   std::shared_ptr<const FmIndex> index;
+};
+
+// Reads a cache through a read-only memory map. Anything taken from it is
+// valid until it is closed
+class ReferenceCache
+{
+   public:
+      ReferenceCache();
+      ~ReferenceCache();
+
+      // Returns 0 if the cache doesn't exist, or is of a different reference
+      // list, and needs building
+      int open(const std::string& file_name, const std::vector<std::pair<std::string, std::string>>& references);
+      void close();
+
+      // Reference i, as if read from its fasta file
+      Fasta fasta(const size_t i) const;
+      // The sequence of a contig of reference i, with masked bases as N
+      std::string contig(const size_t i, const size_t contig_idx) const;
+
+      // nonmodifying operations
+      size_t size() const { return _references.size(); }
+      const std::vector<std::string>& contig_names(const size_t i) const { return _references[i].contig_names; }
+
+   private:
+      void read_entry(const std::string& reference_name, const uint64_t offset);
+
+      int _fd;
+      const char* _map;
+      size_t _map_length;
+      std::string _file_name;
+
+      std::vector<std::pair<std::string, std::string>> _names; // reference names, fasta files
+      std::vector<cachedReference> _references;
+};
+
+// Writes a cache to a temporary file, which is moved into place once every
+// reference has been written
+class ReferenceCacheWriter
+{
+   public:
+      ReferenceCacheWriter();
+      ~ReferenceCacheWriter();
+
+      void open(const std::string& file_name, const std::vector<std::pair<std::string, std::string>>& references);
+      void close();
+
+      // Reference i of the list, as read by readFasta, and its index. Can be
+      // called from many threads
+      void write(const size_t i, const Fasta& indexed, const std::vector<uint8_t>& text);
+
+   private:
+      std::FILE* _file;
+      std::string _file_name;
+      std::string _temp_name;
+      uint64_t _pos;
+
+      std::vector<std::pair<std::string, std::string>> _references;
+      std::vector<uint64_t> _offsets; // 0 until written
+      size_t _num_written;
+      std::mutex _mtx;
+};
+
+// Functions
+int fastaStamp(const std::string& file_name, uint64_t& size, int64_t& modified);
@@ -0,0 +1,246 @@
+/*
+ * File: resultWriter.cpp
+ *
+ * Buffered output of significant k-mers for seer, with a writer thread
+ *
+ */
+
+#include "seer.hpp"
+
+ResultWriter::ResultWriter(const std::string& file_name, const resultFormat format, const unsigned int num_covars, const SampleDictionary& dictionary, const int print_samples, const int sharded, const uint64_t resume_offset)
+   :_format(format), _dictionary(dictionary), _print_samples(print_samples), _sharded(sharded), _file_name(file_name), _os(&std::cout),
+   _queue(result_queue_depth), _failed(0), _closed(0), _written(resume_offset), _syncs_requested(0), _syncs_done(0)
+{
+   if (resume_offset > 0 && (file_name.empty() || format == gzip_results || format == bgzf_results))
+   {
+      throw std::runtime_error("Only text or binary results written to a file can be resumed");
+   }
+
+   if (file_name.empty())
+   {
+      if (format == gzip_results || format == bgzf_results)
+      {
+         throw std::runtime_error("Compressed results must be written to a file, with --output");
+      }
+   }
+   else
+   {
+      switch (format)
+      {
+         case gzip_results:
+            _gz_file.open(file_name.c_str());
+            _os = &_gz_file;
+            break;
+         case bgzf_results:
+            _bgzf_file.open(file_name, 1);
+            _os = &_bgzf_file;
+            break;
+         default:
+            if (resume_offset > 0)
+            {
+               truncateFile(file_name, resume_offset);
+               _file.open(file_name.c_str(), std::ios::out | std::ios::binary | std::ios::app);
+            }
+            else
+            {
+               _file.open(file_name.c_str(), std::ios::out | std::ios::binary);
+            }
+            _os = &_file;
+      }
+      if (!*_os)
+      {
+         throw std::runtime_error("Could not open " + file_name + " for writing");
+      }
+   }
+
+   _buffer.reserve(result_buffer_size);
+   if (format == binary_results && resume_offset == 0)
+   {
+      appendBinaryHeader(_buffer, num_covars, print_samples);
+   }
+
+   _writer = std::thread(&ResultWriter::write_buffers, this);
+}
+
+ResultWriter::~ResultWriter()
+{
+   if (!_closed)
+   {
+      try
+      {
+         close();
+      }
+      catch (std::exception& e)
+      {
+         std::cerr << e.what() << std::endl;
+      }
+   }
+}
+
+void ResultWriter::write_line(const std::string& line)
+{
+   if (_format != binary_results)
+   {
+      _buffer.append(line);
+      _buffer.push_back('\n');
+   }
+}
+
+// As Kmer's operator<<, with the line number before for shards, and the
+// samples after with --print_samples
+void ResultWriter::write(const Kmer& k)
+{
+   if (_format == binary_results)
+   {
+      appendBinaryStats(_buffer, k);
+
+      _comments.clear();
+      k.append_comments(_comments);
+      appendBinaryString(_buffer, _comments);
+
+      if (_print_samples)
+      {
+         const std::vector<uint32_t>& sample_ids = k.sample_ids();
+         uint32_t count = sample_ids.size();
+         _buffer.append((const char*)&count, sizeof(uint32_t));
+         for (auto it = sample_ids.begin(); it != sample_ids.end(); ++it)
+         {
+            appendBinaryString(_buffer, _dictionary.name(*it));
+         }
+      }
+   }
+   else
+   {
+      char field[64];
+      if (_sharded)
+      {
+         _buffer.append(field, snprintf(field, sizeof(field), "%ld\t", k.line_number()));
+      }
+
+      _buffer.append(k.sequence());
+      _buffer.append(field, snprintf(field, sizeof(field), "\t%.3f\t%.3e\t%.3e\t%.3e\t%.3e\t%.3e",
+               k.maf(), k.unadj(), k.p_val(), k.lrt_p_val(), k.beta(), k.se()));
+
+      const std::vector<double>& covariates = k.covar_p();
+      for (auto it = covariates.begin(); it != covariates.end(); ++it)
+      {
+         _buffer.append(field, snprintf(field, sizeof(field), "\t%.3e", *it));
+      }
+      _buffer.push_back('\t');
+      k.append_comments(_buffer);
+
+      if (_print_samples)
+      {
+         const std::vector<uint32_t>& sample_ids = k.sample_ids();
+         _buffer.push_back('\t');
+         for (auto it = sample_ids.begin(); it != sample_ids.end(); ++it)
+         {
+            if (it != sample_ids.begin())
+            {
+               _buffer.push_back('\t');
+            }
+            _buffer.append(_dictionary.name(*it));
+         }
+      }
+      _buffer.push_back('\n');
+   }
+
+   if (_buffer.size() >= result_buffer_size)
+   {
+      flush_buffer();
+   }
+}
+
+uint64_t ResultWriter::sync()
+{
+   flush_buffer();
+
+   std::unique_lock<std::mutex> lock(_mtx);
+   long int sync_nr = ++_syncs_requested;
+   lock.unlock();
+   _queue.push(std::string());
+
+   lock.lock();
+   _synced.wait(lock, [this, sync_nr]{ return _syncs_done >= sync_nr; });
+   if (_failed)
+   {
+      throw std::runtime_error("Could not write results to " + (_file_name.empty() ? "stdout" : _file_name));
+   }
+
+   return _written;
+}
+
+void ResultWriter::close()
+{
+   _closed = 1;
+   flush_buffer();
+   _queue.close();
+   _writer.join();
+
+   _os->flush();
+   _failed |= _os->fail();
+   if (!_file_name.empty())
+   {
+      switch (_format)
+      {
+         case gzip_results:
+            _gz_file.close();
+            break;
+         case bgzf_results:
+            _bgzf_file.close();
+            break;
+         default:
+            _file.close();
+      }
+      _failed |= _os->fail();
+   }
+
+   if (_failed)
+   {
+      throw std::runtime_error("Could not write results to " + (_file_name.empty() ? "stdout" : _file_name));
+   }
+}
+
+void ResultWriter::flush_buffer()
+{
+   if (!_buffer.empty())
+   {
+      std::string full;
+      full.reserve(result_buffer_size);
+      full.swap(_buffer);
+      _queue.push(std::move(full));
+   }
+}
+
+// Writer thread
+void ResultWriter::write_buffers()
+{
+   std::string buffer;
+   while (_queue.pop(buffer))
+   {
+      if (buffer.empty())
+      {
+         // Sync request
+         if (!_failed)
+         {
+            _os->flush();
+            _failed = !*_os;
+            if (!_failed && !_file_name.empty())
+            {
+               syncFile(_file_name);
+            }
+         }
+
+         std::lock_guard<std::mutex> lock(_mtx);
+         ++_syncs_done;
+         _synced.notify_all();
+      }
+      else if (!_failed)
+      {
+         _os->write(buffer.data(), buffer.size());
+         _failed = !*_os;
+         _written += buffer.size();
+      }
+   }
+}
+
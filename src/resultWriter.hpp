@@ -0,0 +1,88 @@
+/*
+ * resultWriter.hpp
+ * Header file for seer's output of significant k-mers
+ *
+ * Results are formatted into a large buffer on the calling thread. Full
+ * buffers are passed to a writer thread, which writes them to stdout or a
+ * file, as text, gzipped or BGZF text, or binary results (see
+ * significant_kmer.hpp). Nothing is flushed until the writer is closed
+ *
+ */
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+// Constants
+const size_t result_buffer_size = 1 << 20; // bytes formatted before they are written
+const size_t result_queue_depth = 4; // buffers waiting for the writer thread
+const std::string binary_results_suffix = ".bin";
+const std::string compressed_suffix = ".gz";
+
+enum resultFormat
+{
+   text_results,
+   gzip_results,
+   bgzf_results, // with a .gzi index
+   binary_results
+};
+
+class ResultWriter
+{
+   public:
+      // An empty file_name writes to stdout, which only text and binary
+      // results can be. Sample ids are written as their names in dictionary.
+      // A resume_offset cuts a text or binary results file back to that
+      // length, from a checkpoint, and writes after it
+      ResultWriter(const std::string& file_name, const resultFormat format, const unsigned int num_covars, const SampleDictionary& dictionary, const int print_samples, const int sharded, const uint64_t resume_offset = 0);
+      ~ResultWriter();
+
+      ResultWriter(const ResultWriter&) = delete;
+      ResultWriter& operator=(const ResultWriter&) = delete;
+
+      // The header and shard trailer are lines of text, which binary results
+      // don't have
+      void write_line(const std::string& line);
+      void write(const Kmer& k);
+
+      // Waits until everything so far is written and on disk, for a
+      // checkpoint. Returns the length of the file
+      uint64_t sync();
+
+      // Writes what is left and waits for the writer thread. Throws if any
+      // write failed
+      void close();
+
+   private:
+      void flush_buffer();
+      void write_buffers();
+
+      resultFormat _format;
+      const SampleDictionary& _dictionary;
+      int _print_samples;
+      int _sharded;
+      std::string _file_name;
+
+      std::ofstream _file;
+      ogzstream _gz_file;
+      BgzfOutStream _bgzf_file;
+      std::ostream* _os;
+
+      std::string _buffer;
+      std::string _comments; // of the k-mer being written, for binary results
+      BlockingQueue<std::string> _queue;
+      std::thread _writer;
+      int _failed;
+      int _closed;
+
+      // Written by the writer thread. An empty buffer in the queue asks it
+      // to sync
+      std::mutex _mtx;
+      std::condition_variable _synced;
+      uint64_t _written;
+      long int _syncs_requested;
+      long int _syncs_done;
+};
+
@@ -0,0 +1,120 @@
+/*
+ * File: sampleDictionary.cpp
+ *
+ * Interns sample names to integer ids
+ *
+ */
+
+#include "seercommon.hpp"
+
+#include <cstring>
+
+// FNV-1a
+const uint64_t fnv_offset = 14695981039346656037ULL;
+const uint64_t fnv_prime = 1099511628211ULL;
+
+SampleDictionary::SampleDictionary(const std::vector<Sample>& samples)
+   :_num_pheno(samples.size())
+{
+   // Table is at least twice the number of samples, and a power of two
+   size_t table_size = 2;
+   while (table_size < 2 * samples.size())
+   {
+      table_size *= 2;
+   }
+   _table.assign(table_size, -1);
+   _table_mask = table_size - 1;
+
+   _pheno_names.reserve(samples.size());
+   for (unsigned int i = 0; i < samples.size(); ++i)
+   {
+      _pheno_names.push_back(samples[i].iid());
+      insert(i);
+   }
+}
+
+uint64_t SampleDictionary::hash(const char* name, const size_t length) const
+{
+   uint64_t h = fnv_offset;
+   for (size_t i = 0; i < length; ++i)
+   {
+      h ^= (unsigned char)name[i];
+      h *= fnv_prime;
+   }
+
+   return h;
+}
+
+// The reader thread is the only one adding names, so doesn't need the lock
+// to read them
+const std::string& SampleDictionary::entry(const uint32_t id) const
+{
+   return id < _num_pheno ? _pheno_names[id] : _other_names[id - _num_pheno];
+}
+
+const std::string& SampleDictionary::name(const uint32_t id) const
+{
+   if (id < _num_pheno)
+   {
+      return _pheno_names[id];
+   }
+   else
+   {
+      std::lock_guard<std::mutex> lock(_mtx);
+      return _other_names[id - _num_pheno];
+   }
+}
+
+void SampleDictionary::insert(const uint32_t id)
+{
+   const std::string& name = entry(id);
+   uint64_t slot = hash(name.data(), name.length()) & _table_mask;
+   while (_table[slot] != -1)
+   {
+      slot = (slot + 1) & _table_mask;
+   }
+   _table[slot] = id;
+}
+
+long int SampleDictionary::find(const char* name, const size_t length) const
+{
+   uint64_t slot = hash(name, length) & _table_mask;
+   while (_table[slot] != -1)
+   {
+      const std::string& candidate = entry(_table[slot]);
+      if (candidate.length() == length && memcmp(candidate.data(), name, length) == 0)
+      {
+         return _table[slot];
+      }
+      slot = (slot + 1) & _table_mask;
+   }
+
+   return -1;
+}
+
+uint32_t SampleDictionary::intern(const char* name, const size_t length)
+{
+   long int id = find(name, length);
+   if (id < 0)
+   {
+      {
+         std::lock_guard<std::mutex> lock(_mtx);
+         _other_names.emplace_back(name, length);
+      }
+      id = _num_pheno + _other_names.size() - 1;
+
+      // Keep the table at most half full
+      if (2 * (id + 1) > (long int)_table.size())
+      {
+         _table.assign(2 * _table.size(), -1);
+         _table_mask = _table.size() - 1;
+         for (long int i = 0; i < id; ++i)
+         {
+            insert(i);
+         }
+      }
+      insert(id);
+   }
+
+   return id;
+}
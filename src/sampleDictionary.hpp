@@ -0,0 +1,49 @@
+/*
+ * sampleDictionary.hpp
+ * Header file for the run-wide sample dictionary
+ */
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Interns sample names to integer ids, so k-mers can store the samples they
+// are found in without copying names. The samples in the pheno file have
+// ids 0 to num_pheno()-1, in their (sorted) order, which are also their
+// indices in a Presence. Other names found in the k-mer file are added
+// after them as they are first seen.
+// Names are looked up and added by the reader thread only. Any thread can
+// resolve an id to its name
+class SampleDictionary
+{
+   public:
+      // Initialisation
+      SampleDictionary(const std::vector<Sample>& samples);
+
+      SampleDictionary(const SampleDictionary&) = delete;
+      SampleDictionary& operator=(const SampleDictionary&) = delete;
+
+      // nonmodifying operations
+      size_t num_pheno() const { return _num_pheno; }
+      long int find(const char* name, const size_t length) const; // -1 if not seen
+      const std::string& name(const uint32_t id) const;
+
+      // Modifying operations
+      uint32_t intern(const char* name, const size_t length); // Adds the name if it is new
+
+   private:
+      uint64_t hash(const char* name, const size_t length) const;
+      void insert(const uint32_t id);
+
+      const std::string& entry(const uint32_t id) const; // Reader thread only
+
+      size_t _num_pheno;
+      std::vector<std::string> _pheno_names;
+      std::deque<std::string> _other_names; // Grows without moving names already added
+      std::vector<long int> _table; // open addressing, -1 is empty
+      uint64_t _table_mask;
+
+      mutable std::mutex _mtx; // For _other_names
+};
@@ -12,43 +12,213 @@
 // dlib headers
 #include <dlib/optimization.h>
 
+// Queues between reader, worker and writer threads
+#include "blockingQueue.hpp"
+
+// --profile timings
+#include "profile.hpp"
+
+// Output of the results
+#include "resultWriter.hpp"
+
 // Constants
 //    Default options
 const std::string pval_default = "10e-8";
 const double convergence_limit = 10e-8;
 const unsigned int max_nr_iterations = 1000;
+const unsigned int max_irls_iterations = 25; // before falling back to N-R
+const unsigned int max_step_halvings = 10;
 const double se_limit = 3;
+const double collinear_limit = 10e-8; // Of the k-mer column's length, after projecting out the covariates
 
 // Starting value for beta vectors (except intercept)
 // Should be >0. This value is based on RMS in example study
 const double bfgs_start_beta = 1;
 
+//    Pipeline sizes, per worker thread
+const unsigned int queue_depth = 32; // k-mers read and waiting to be tested
+const unsigned int reorder_depth = 64; // k-mers tested ahead of the next one to print
+const unsigned int stats_block_size = 256; // k-mers pre-filtered together by the reader
+const unsigned int worker_batch_size = 16; // k-mers taken from the queue at once by a worker
+const unsigned int logit_batch_lanes = 16; // k-mers in a batched logistic fit at once
+
+// State of a lane of a batched logistic fit, after each evaluation
+const int lane_running = 0;
+const int lane_converged = 1;
+const int lane_failed = 2;
+
+//    Sharded output. Each row starts with the k-mer's line number in the
+//    input (in the shard, when split by range), and the output ends with
+//    #shard=i/N  split=lines|range  read=  tested=  printed=
+//    separated by tabs, for merge_seer
+const std::string shard_trailer = "#shard=";
+
+//    Output for each phenotype, when testing more than one
+const std::string multi_pheno_suffix = ".seer.txt";
+
+// Null model and covariates shared by every k-mer's regression
+#include "fixedCovariates.hpp"
+
+// Linear mixed model, with --lmm
+#include "mixedModel.hpp"
+
+// Thresholds from phenotype permutations, with --permutations
+#include "permutation.hpp"
+
+// Test results by presence pattern
+#include "patternCache.hpp"
+
+// A continuous phenotype centred on its mean, which keeps the sums of squares
+// of the Welch test accurate, with its totals. Made once per phenotype
+struct centredPhenotype
+{
+   centredPhenotype(const arma::vec& y_in)
+      :y(y_in - mean(y_in)), sum(accu(y)), sum_sq(accu(square(y)))
+   {
+   }
+
+   arma::vec y;
+   double sum;
+   double sum_sq;
+};
+
+// A phenotype to test the k-mers against, one per --pheno file. All have the
+// same samples, so they share each k-mer's presence vector and the
+// covariates. Each has its own cache of results, written by the workers.
+// With --lmm every k-mer is tested with a mixed model instead of a logistic
+// or linear fit. With --permutations every k-mer passing the basic filters
+// is also scored against the permuted phenotypes
+struct phenotypeTest
+{
+   phenotypeTest(const arma::vec& y_in, const int continuous_in, FixedCovariates&& fixed_in)
+      :y(y_in), cases(constructCases(y_in)), centred(y_in), continuous(continuous_in), fixed(std::move(fixed_in)), patterns(new PatternCache)
+   {
+   }
+
+   arma::vec y;
+   Presence cases;
+   centredPhenotype centred;
+   int continuous;
+   FixedCovariates fixed;
+   std::unique_ptr<PatternCache> patterns;
+   std::unique_ptr<MixedModel> lmm;
+   std::unique_ptr<PermutationTest> permutations;
+};
+
+// Storage for the IRLS logistic fit, reused between fits by each worker
+// thread. Sized on first use
+struct logitWorkspace
+{
+   arma::mat x_design;
+   arma::vec b;
+   arma::vec step;
+   arma::vec x_i; // current row of x_design
+   arma::vec score;
+   arma::mat information;
+   arma::mat var_covar;
+   double log_likelihood;
+};
+
+// One k-mer being fitted in a lane of the batch, and how far it has got
+struct logitLane
+{
+   Kmer* k;
+   unsigned int iterations; // Newton steps taken. 0 until its first evaluation
+   unsigned int halvings; // of the current step
+   double previous_ll; // before the current step
+};
+
+// Storage for IRLS fits of a batch of k-mers in lockstep, reused between
+// batches by each worker thread. The k-mers share the fixed covariates, so
+// only their own column is stored. Matrices are lanes x columns, so the
+// values for all lanes are contiguous for each column of the design
+struct logitBatchWorkspace
+{
+   arma::mat z; // lanes x samples, the k-mer columns
+   arma::mat b;
+   arma::mat step;
+   arma::mat x_i; // current row of each lane's design
+   arma::mat score;
+   arma::mat information; // lanes x upper triangle, by column
+   arma::vec log_likelihood;
+   arma::vec sigmoid;
+   arma::vec residual;
+   arma::vec weight;
+   std::vector<logitLane> lanes;
+   logitWorkspace single; // one lane's information and step, and fallbacks
+};
+
+// A k-mer passed between threads. order is its position among the tested
+// k-mers, so output can be written in input order. There is a copy of the
+// k-mer for the results of each phenotype, which is only tested if it passed
+// the filters for that phenotype
+struct kmerTask
+{
+   long int order;
+   std::vector<Kmer> k;
+   std::vector<int> passed;
+
+   // Where the k-mer was read, for checkpoints. For libseer, input_line is
+   // its index in the batch
+   long int input_line;
+   uint64_t block_offset;
+   long int block_line;
+};
+
 // seerCmdLine headers
 int parseCommandLine (int argc, char *argv[], boost::program_options::variables_map& vm);
 void printHelp(boost::program_options::options_description& help);
 
 // seerStats headers
-double chiTest(Kmer& k, const arma::vec& y);
-double welchTwoSamplet(const Kmer& k, const arma::vec& y);
+double chiTest(Kmer& k, const Presence& cases);
+double chiTest(Kmer& k, const size_t present_cases, const size_t present, const size_t num_cases, const size_t num_samples);
+double welchTwoSamplet(const Kmer& k, const centredPhenotype& y);
+double welchTwoSamplet(const size_t n_present, const double sum_present, const double sum_sq_present, const size_t n_total, const double sum_total, const double sum_sq_total);
+void presenceSums(const Presence& x, const arma::vec& y, double& sum, double& sum_sq);
+void presenceSums(const Presence& x, const arma::mat& y_t, arma::vec& sum, arma::vec& sum_sq);
 double nullLogLikelihood(const arma::mat& x, const arma::vec& y, const int continuous);
 double likelihoodRatioTest(Kmer& k, const double null_ll, const int continuous = 0);
 double normalPval(double testStatistic);
 
-int passStatsFilters(const cmdOptions& filterOptions, Kmer& k, const arma::vec& y, const int continuous_phenotype);
+int passStatsFilters(const cmdOptions& filterOptions, Kmer& k, const centredPhenotype& y, const Presence& cases, const int continuous_phenotype);
+void passStatsFilters(const cmdOptions& filterOptions, std::vector<kmerTask>& block, const std::vector<phenotypeTest>& phenotypes);
+double scoreTest(const Kmer& k, const FixedCovariates& fixed);
+void passScoreFilter(const cmdOptions& filterOptions, std::vector<kmerTask>& block, const std::vector<phenotypeTest>& phenotypes);
+int passAssocFilter(const cmdOptions& filterOptions, const Kmer& k);
 
 // seerBinaryAssoc headers
-void logisticTest(Kmer& k, const arma::vec& y, const double null_ll);
-void logisticTest(Kmer& k, const arma::vec& y_train, const double null_ll, const arma::mat& mds);
+void logisticTest(Kmer& k, const FixedCovariates& fixed, logitWorkspace& workspace);
 
 void doLogit(Kmer& k, const arma::vec& y_train, const arma::mat& x_design);
+void doLogit(Kmer& k, const arma::vec& y_train, const arma::mat& x_design, const arma::vec& null_b, logitWorkspace& workspace);
+void logitWald(Kmer& k, const arma::vec& b, const double log_likelihood, const arma::mat& information);
+void logitFallback(Kmer& k, const arma::vec& y_train, const arma::mat& x_design, const std::exception& e);
+void irls(const arma::vec& y_train, const arma::mat& x_design, logitWorkspace& workspace);
+double logitEvaluate(const arma::vec& y_train, const arma::mat& x_design, const arma::vec& b, logitWorkspace& workspace);
+double logitLogLikelihood(const arma::vec& y_train, const arma::mat& x_design, const arma::vec& b);
 void newtonRaphson(Kmer& k, const arma::vec& y_train, const arma::mat& x_design, const bool firth = 0);
 
 arma::mat varCovarMat(const arma::mat& x, const arma::mat& b);
 arma::vec predictLogitProbs(const arma::mat& x, const arma::vec& b);
 
+// seerBatchAssoc headers
+void logisticTest(const std::vector<Kmer*>& kmers, const FixedCovariates& fixed, logitBatchWorkspace& workspace);
+void loadLane(Kmer& k, const size_t lane, const FixedCovariates& fixed, logitBatchWorkspace& workspace);
+void moveLane(const size_t from, const size_t to, logitBatchWorkspace& workspace);
+void laneInformation(const size_t lane, logitBatchWorkspace& workspace);
+int laneStep(const size_t lane, logitBatchWorkspace& workspace);
+void finishLane(const size_t lane, const int error, const FixedCovariates& fixed, logitBatchWorkspace& workspace);
+void logitBatchEvaluate(const FixedCovariates& fixed, logitBatchWorkspace& workspace, const size_t num_lanes);
+
 // seerContinuousAssoc headers
-void linearTest(Kmer& k, const arma::vec& y_train, const double null_ll);
-void linearTest(Kmer& k, const arma::vec& y_train, const double null_ll, const arma::mat& mds);
+void linearTest(Kmer& k, const FixedCovariates& fixed);
 
 void doLinear(Kmer& k, const arma::vec& y_train, const arma::mat& x_design);
 
+// seerThreads headers
+void readKmers(DsmReader& dsm_reader, BlockingQueue<kmerTask>& work_queue, RecyclePool<kmerTask>& recycled, const cmdOptions& parameters, const std::vector<phenotypeTest>& phenotypes, long int line_nr, long int& input_line, long int& queued_kmers);
+void loadKmers(const std::function<void(const size_t, Kmer&)>& load, const size_t num_kmers, BlockingQueue<kmerTask>& work_queue, RecyclePool<kmerTask>& recycled, const cmdOptions& parameters, const std::vector<phenotypeTest>& phenotypes);
+void queueTask(kmerTask& task, std::vector<kmerTask>& block, BlockingQueue<kmerTask>& work_queue, const cmdOptions& parameters, long int& queued_kmers);
+void queueBlock(std::vector<kmerTask>& block, BlockingQueue<kmerTask>& work_queue, RecyclePool<kmerTask>& recycled, const cmdOptions& parameters, const std::vector<phenotypeTest>& phenotypes, long int& queued_kmers);
+void newTask(kmerTask& task, Kmer& k, const size_t num_phenotypes, RecyclePool<kmerTask>& recycled);
+void testKmers(BlockingQueue<kmerTask>& work_queue, ReorderBuffer<kmerTask>& results, const cmdOptions& parameters, const std::vector<phenotypeTest>& phenotypes);
@@ -0,0 +1,326 @@
+/*
+ * File: seerBatchAssoc.cpp
+ *
+ * Logistic regression of a batch of k-mers at once. Every k-mer's design is
+ * the same fixed covariates plus its own column, so IRLS iterations for up to
+ * logit_batch_lanes k-mers are run in lockstep, with one pass over the
+ * samples evaluating all of them. The saving is that the fixed covariates
+ * and phenotype are read once per sample for the whole batch. The loops are
+ * across lanes, but exp and log are scalar libm calls, as in the single
+ * k-mer IRLS, so these loops aren't vectorised; only the multiply-adds can
+ * be. Each lane stops when its own fit converges or fails, and is refilled
+ * with the next k-mer of the batch. Failed fits drop out to the single k-mer
+ * N-R and Firth fallbacks
+ *
+ */
+
+#include "seer.hpp"
+
+// Tests each of kmers, as logisticTest would. workspace belongs to the calling
+// thread. k-mers which are to be fitted with Firth regression from the start
+// are fitted singly
+void logisticTest(const std::vector<Kmer*>& kmers, const FixedCovariates& fixed, logitBatchWorkspace& workspace)
+{
+   const size_t num_cols = fixed.num_fixed() + 1;
+   workspace.z.set_size(logit_batch_lanes, fixed.num_samples());
+   workspace.b.set_size(logit_batch_lanes, num_cols);
+   workspace.step.set_size(logit_batch_lanes, num_cols);
+   workspace.x_i.set_size(logit_batch_lanes, num_cols);
+   workspace.score.set_size(logit_batch_lanes, num_cols);
+   workspace.information.set_size(logit_batch_lanes, num_cols * (num_cols + 1) / 2);
+   workspace.log_likelihood.set_size(logit_batch_lanes);
+   workspace.sigmoid.set_size(logit_batch_lanes);
+   workspace.residual.set_size(logit_batch_lanes);
+   workspace.weight.set_size(logit_batch_lanes);
+   workspace.lanes.resize(logit_batch_lanes);
+
+   // Puts the next k-mer to be batched into lane. Returns false if there are
+   // none left
+   size_t next = 0;
+   auto load_next = [&](const size_t lane)
+   {
+      for (; next < kmers.size(); ++next)
+      {
+         Kmer& k = *kmers[next];
+         if (k.firth())
+         {
+            logisticTest(k, fixed, workspace.single);
+         }
+         else
+         {
+            loadLane(k, lane, fixed, workspace);
+            ++next;
+            return true;
+         }
+      }
+      return false;
+   };
+
+   size_t active = 0;
+   while (active < logit_batch_lanes && load_next(active))
+   {
+      ++active;
+   }
+
+   while (active > 0)
+   {
+      logitBatchEvaluate(fixed, workspace, active);
+
+      size_t lane = 0;
+      while (lane < active)
+      {
+         const int status = laneStep(lane, workspace);
+         if (status == lane_running)
+         {
+            ++lane;
+            continue;
+         }
+
+         finishLane(lane, status == lane_converged, fixed, workspace);
+         if (load_next(lane))
+         {
+            ++lane; // Not evaluated yet
+         }
+         else
+         {
+            // Close the gap with the last lane, which still needs its step
+            --active;
+            if (lane < active)
+            {
+               moveLane(active, lane, workspace);
+            }
+         }
+      }
+   }
+}
+
+// Starts a fit of k in lane, from the null model's betas
+void loadLane(Kmer& k, const size_t lane, const FixedCovariates& fixed, logitBatchWorkspace& workspace)
+{
+   workspace.z.row(lane).zeros();
+   const std::vector<uint64_t>& words = k.presence().words();
+   for (size_t i = 0; i < words.size(); ++i)
+   {
+      uint64_t word = words[i];
+      while (word)
+      {
+         workspace.z(lane, i * presence_word_bits + __builtin_ctzll(word)) = 1;
+         word &= word - 1;
+      }
+   }
+
+   const arma::vec& null_b = fixed.null_b();
+   workspace.b(lane, 0) = null_b(0);
+   workspace.b(lane, 1) = 0;
+   for (size_t i = 1; i < null_b.n_elem; ++i)
+   {
+      workspace.b(lane, i + 1) = null_b(i);
+   }
+   workspace.step.row(lane).zeros();
+
+   workspace.lanes[lane] = logitLane{&k, 0, 0, 0};
+}
+
+// Moves a running fit, with its last evaluation, to another lane
+void moveLane(const size_t from, const size_t to, logitBatchWorkspace& workspace)
+{
+   workspace.z.row(to) = workspace.z.row(from);
+   workspace.b.row(to) = workspace.b.row(from);
+   workspace.step.row(to) = workspace.step.row(from);
+   workspace.score.row(to) = workspace.score.row(from);
+   workspace.information.row(to) = workspace.information.row(from);
+   workspace.log_likelihood(to) = workspace.log_likelihood(from);
+   workspace.lanes[to] = workspace.lanes[from];
+}
+
+// Copies a lane's score and (symmetric) information matrix into the single
+// fit workspace
+void laneInformation(const size_t lane, logitBatchWorkspace& workspace)
+{
+   const size_t num_cols = workspace.b.n_cols;
+   arma::vec& score = workspace.single.score;
+   arma::mat& information = workspace.single.information;
+
+   score = workspace.score.row(lane).t();
+   information.set_size(num_cols, num_cols);
+   size_t pair = 0;
+   for (size_t j = 0; j < num_cols; ++j)
+   {
+      for (size_t l = j; l < num_cols; ++l)
+      {
+         information(j, l) = workspace.information(lane, pair++);
+         information(l, j) = information(j, l);
+      }
+   }
+}
+
+// One lane's part of an IRLS iteration (see irls), after the batch has been
+// evaluated at its current betas. Either halves a step which lowered the
+// likelihood, or takes the next Newton step
+int laneStep(const size_t lane, logitBatchWorkspace& workspace)
+{
+   logitLane& state = workspace.lanes[lane];
+   const double log_likelihood = workspace.log_likelihood(lane);
+
+   if (state.iterations > 0)
+   {
+      if (log_likelihood < state.previous_ll - convergence_limit)
+      {
+         if (state.halvings == max_step_halvings)
+         {
+            return lane_failed;
+         }
+         workspace.step.row(lane) *= 0.5;
+         workspace.b.row(lane) -= workspace.step.row(lane);
+         ++state.halvings;
+
+         return lane_running;
+      }
+
+      if (arma::abs(workspace.step.row(lane)).max() < convergence_limit)
+      {
+         return lane_converged;
+      }
+      else if (state.iterations == max_irls_iterations)
+      {
+         return lane_failed;
+      }
+   }
+
+   laneInformation(lane, workspace);
+   if (!invSympd(workspace.single.var_covar, workspace.single.information))
+   {
+      return lane_failed;
+   }
+   workspace.single.step = workspace.single.var_covar * workspace.single.score;
+
+   workspace.step.row(lane) = workspace.single.step.t();
+   workspace.b.row(lane) += workspace.step.row(lane);
+   state.previous_ll = log_likelihood;
+   state.halvings = 0;
+   ++state.iterations;
+
+   return lane_running;
+}
+
+// Sets the results of a lane's fit on its k-mer. If the fit did not converge,
+// or the SE is too large, the k-mer is refitted on its own
+void finishLane(const size_t lane, const int converged, const FixedCovariates& fixed, logitBatchWorkspace& workspace)
+{
+   Kmer& k = *workspace.lanes[lane].k;
+   try
+   {
+      if (!converged)
+      {
+         throw std::runtime_error("irls did not converge");
+      }
+      laneInformation(lane, workspace);
+      workspace.single.b = workspace.b.row(lane).t();
+      logitWald(k, workspace.single.b, workspace.log_likelihood(lane), workspace.single.information);
+   }
+   catch (std::exception& e)
+   {
+      fixed.design(k.presence(), workspace.single.x_design);
+      logitFallback(k, fixed.y(), workspace.single.x_design, e);
+   }
+
+   // Likelihood ratio test
+   k.lrt_p_val(likelihoodRatioTest(k, fixed.null_ll()));
+}
+
+// logitEvaluate for the first num_lanes lanes at once: the log-likelihood,
+// score and upper triangle of the information at each lane's betas
+void logitBatchEvaluate(const FixedCovariates& fixed, logitBatchWorkspace& workspace, const size_t num_lanes)
+{
+   const arma::mat& x_t = fixed.x_t();
+   const arma::vec& y = fixed.y();
+   const size_t num_cols = workspace.b.n_cols;
+
+   workspace.score.zeros();
+   workspace.information.zeros();
+   workspace.log_likelihood.zeros();
+
+   double* sigmoid = workspace.sigmoid.memptr();
+   double* residual = workspace.residual.memptr();
+   double* weight = workspace.weight.memptr();
+   double* log_likelihood = workspace.log_likelihood.memptr();
+
+   for (size_t i = 0; i < y.n_elem; ++i)
+   {
+      // This sample's row of each lane's design. Only the k-mer column
+      // differs between lanes
+      const double* x_fixed = x_t.colptr(i);
+      const double* z_i = workspace.z.colptr(i);
+      for (size_t j = 0; j < num_cols; ++j)
+      {
+         double* x_j = workspace.x_i.colptr(j);
+         if (j == 1)
+         {
+            std::copy(z_i, z_i + num_lanes, x_j);
+         }
+         else
+         {
+            std::fill(x_j, x_j + num_lanes, x_fixed[j == 0 ? 0 : j - 1]);
+         }
+      }
+
+      for (size_t l = 0; l < num_lanes; ++l)
+      {
+         sigmoid[l] = 0;
+      }
+      for (size_t j = 0; j < num_cols; ++j)
+      {
+         const double* x_j = workspace.x_i.colptr(j);
+         const double* b_j = workspace.b.colptr(j);
+         for (size_t l = 0; l < num_lanes; ++l)
+         {
+            sigmoid[l] += x_j[l] * b_j[l];
+         }
+      }
+      for (size_t l = 0; l < num_lanes; ++l)
+      {
+         sigmoid[l] = 1.0 / (1.0 + exp(-sigmoid[l]));
+      }
+
+      if (y[i] == 1)
+      {
+         for (size_t l = 0; l < num_lanes; ++l)
+         {
+            log_likelihood[l] += log(sigmoid[l]);
+         }
+      }
+      else
+      {
+         for (size_t l = 0; l < num_lanes; ++l)
+         {
+            log_likelihood[l] += log(1.0 - sigmoid[l]);
+         }
+      }
+
+      for (size_t l = 0; l < num_lanes; ++l)
+      {
+         residual[l] = y[i] - sigmoid[l];
+         weight[l] = sigmoid[l] * (1 - sigmoid[l]);
+      }
+
+      size_t pair = 0;
+      for (size_t j = 0; j < num_cols; ++j)
+      {
+         const double* x_j = workspace.x_i.colptr(j);
+         double* score_j = workspace.score.colptr(j);
+         for (size_t l = 0; l < num_lanes; ++l)
+         {
+            score_j[l] += x_j[l] * residual[l];
+         }
+         for (size_t m = j; m < num_cols; ++m)
+         {
+            const double* x_m = workspace.x_i.colptr(m);
+            double* information_jm = workspace.information.colptr(pair++);
+            for (size_t l = 0; l < num_lanes; ++l)
+            {
+               information_jm[l] += weight[l] * x_j[l] * x_m[l];
+            }
+         }
+      }
+   }
+}
@@ -0,0 +1,210 @@
+/*
+ * File: seerBench.cpp
+ *
+ * Benchmarks of seer's association tests and pre-filters, on a synthetic
+ * k-mer and phenotype at each sample size and number of covariates
+ *
+ */
+
+#include "seer.hpp"
+#include "bench.hpp"
+
+#include <memory>
+#include <random>
+
+// A k-mer in about 30% of samples, with the phenotype more common where it is
+// present, and normally distributed covariates
+struct seerBenchData
+{
+   seerBenchData(const size_t num_samples, const size_t num_covariates, const int continuous);
+
+   Kmer k;
+   arma::vec y;
+   Presence cases;
+   arma::mat covariates;
+   arma::mat x_design; // [1, k-mer, covariates]
+   arma::vec b; // The betas used to simulate y
+   std::unique_ptr<FixedCovariates> fixed;
+   logitWorkspace workspace;
+};
+
+seerBenchData::seerBenchData(const size_t num_samples, const size_t num_covariates, const int continuous)
+   :y(num_samples), covariates(num_samples, num_covariates), x_design(num_samples, num_covariates + 2), b(num_covariates + 2)
+{
+   b.fill(0.2);
+   b(0) = -0.5;
+   b(1) = 1;
+
+   std::mt19937 generator(bench_seed);
+   std::bernoulli_distribution present(0.3);
+   std::normal_distribution<double> normal(0, 1);
+   std::uniform_real_distribution<double> uniform(0, 1);
+
+   const std::string sequence = "ACGTACGTACGTACGTACGTACGTACGTA";
+   k.reset(sequence.data(), sequence.length(), num_samples);
+   for (size_t i = 0; i < num_samples; ++i)
+   {
+      double x = present(generator);
+      if (x)
+      {
+         k.add_sample(i);
+      }
+
+      double eta = b(0) + b(1) * x;
+      x_design(i, 0) = 1;
+      x_design(i, 1) = x;
+      for (size_t j = 0; j < num_covariates; ++j)
+      {
+         covariates(i, j) = normal(generator);
+         x_design(i, j + 2) = covariates(i, j);
+         eta += b(j + 2) * covariates(i, j);
+      }
+
+      if (continuous)
+      {
+         y(i) = eta + normal(generator);
+      }
+      else
+      {
+         y(i) = uniform(generator) < 1 / (1 + exp(-eta));
+      }
+   }
+
+   cases = constructCases(y);
+   fixed.reset(new FixedCovariates(y, covariates, continuous));
+}
+
+std::string benchName(const std::string& function, const size_t num_samples)
+{
+   return function + "/n:" + std::to_string(num_samples);
+}
+
+std::string benchName(const std::string& function, const size_t num_samples, const size_t num_covariates)
+{
+   return benchName(function, num_samples) + "/covars:" + std::to_string(num_covariates);
+}
+
+// The fits add comments and covariate p-values to the k-mer, so each
+// iteration starts from a fresh copy. This is a copy of the presence bits,
+// which is small next to a fit
+void seerBenchmarks(std::vector<benchCase>& benchmarks)
+{
+   // Pre-filters, which don't use the covariates
+   for (auto n_it = bench_sample_sizes.begin(); n_it != bench_sample_sizes.end(); ++n_it)
+   {
+      const size_t n = *n_it;
+      benchmarks.push_back(benchCase{benchName("chiTest", n), [n]()
+      {
+         std::shared_ptr<seerBenchData> data(new seerBenchData(n, 0, 0));
+         return std::function<void()>([data]() { keepResult(chiTest(data->k, data->cases)); });
+      }});
+      benchmarks.push_back(benchCase{benchName("welchTwoSamplet", n), [n]()
+      {
+         std::shared_ptr<seerBenchData> data(new seerBenchData(n, 0, 1));
+         std::shared_ptr<centredPhenotype> y(new centredPhenotype(data->y));
+         return std::function<void()>([data, y]() { keepResult(welchTwoSamplet(data->k, *y)); });
+      }});
+   }
+
+   // Fits
+   for (auto n_it = bench_sample_sizes.begin(); n_it != bench_sample_sizes.end(); ++n_it)
+   {
+      for (auto w_it = bench_covariate_widths.begin(); w_it != bench_covariate_widths.end(); ++w_it)
+      {
+         const size_t n = *n_it, w = *w_it;
+         benchmarks.push_back(benchCase{benchName("scoreTest", n, w), [n, w]()
+         {
+            std::shared_ptr<seerBenchData> data(new seerBenchData(n, w, 0));
+            return std::function<void()>([data]() { keepResult(scoreTest(data->k, *data->fixed)); });
+         }});
+         benchmarks.push_back(benchCase{benchName("logisticTest", n, w), [n, w]()
+         {
+            std::shared_ptr<seerBenchData> data(new seerBenchData(n, w, 0));
+            return std::function<void()>([data]()
+            {
+               Kmer k = data->k;
+               logisticTest(k, *data->fixed, data->workspace);
+               keepResult(k);
+            });
+         }});
+         // A full batch of copies of the k-mer, fitted together
+         benchmarks.push_back(benchCase{benchName("logisticTest_batch", n, w), [n, w]()
+         {
+            std::shared_ptr<seerBenchData> data(new seerBenchData(n, w, 0));
+            std::shared_ptr<logitBatchWorkspace> workspace(new logitBatchWorkspace);
+            return std::function<void()>([data, workspace]()
+            {
+               std::vector<Kmer> batch(logit_batch_lanes, data->k);
+               std::vector<Kmer*> fits;
+               for (auto it = batch.begin(); it != batch.end(); ++it)
+               {
+                  fits.push_back(&(*it));
+               }
+               logisticTest(fits, *data->fixed, *workspace);
+               keepResult(batch[0]);
+            });
+         }});
+         benchmarks.push_back(benchCase{benchName("doLogit", n, w), [n, w]()
+         {
+            std::shared_ptr<seerBenchData> data(new seerBenchData(n, w, 0));
+            return std::function<void()>([data]()
+            {
+               Kmer k = data->k;
+               doLogit(k, data->y, data->x_design);
+               keepResult(k);
+            });
+         }});
+         benchmarks.push_back(benchCase{benchName("newtonRaphson", n, w), [n, w]()
+         {
+            std::shared_ptr<seerBenchData> data(new seerBenchData(n, w, 0));
+            return std::function<void()>([data]()
+            {
+               Kmer k = data->k;
+               newtonRaphson(k, data->y, data->x_design);
+               keepResult(k);
+            });
+         }});
+         benchmarks.push_back(benchCase{benchName("newtonRaphson_firth", n, w), [n, w]()
+         {
+            std::shared_ptr<seerBenchData> data(new seerBenchData(n, w, 0));
+            return std::function<void()>([data]()
+            {
+               Kmer k = data->k;
+               k.firth(1);
+               newtonRaphson(k, data->y, data->x_design, 1);
+               keepResult(k);
+            });
+         }});
+         benchmarks.push_back(benchCase{benchName("varCovarMat", n, w), [n, w]()
+         {
+            std::shared_ptr<seerBenchData> data(new seerBenchData(n, w, 0));
+            return std::function<void()>([data]()
+            {
+               arma::mat var_covar = varCovarMat(data->x_design, data->b);
+               keepResult(var_covar);
+            });
+         }});
+         benchmarks.push_back(benchCase{benchName("linearTest", n, w), [n, w]()
+         {
+            std::shared_ptr<seerBenchData> data(new seerBenchData(n, w, 1));
+            return std::function<void()>([data]()
+            {
+               Kmer k = data->k;
+               linearTest(k, *data->fixed);
+               keepResult(k);
+            });
+         }});
+         benchmarks.push_back(benchCase{benchName("doLinear", n, w), [n, w]()
+         {
+            std::shared_ptr<seerBenchData> data(new seerBenchData(n, w, 1));
+            return std::function<void()>([data]()
+            {
+               Kmer k = data->k;
+               doLinear(k, data->y, data->x_design);
+               keepResult(k);
+            });
+         }});
+      }
+   }
+}
+
@@ -7,122 +7,260 @@
 
 #include "seer.hpp"
 
-// Logistic fit without covariates
-void logisticTest(Kmer& k, const arma::vec& y_train, const double null_ll)
+// Logistic fit, starting from the null model's betas. workspace belongs to
+// the calling thread, and is only used with this fixed
+void logisticTest(Kmer& k, const FixedCovariates& fixed, logitWorkspace& workspace)
 {
    // Train classifier
-   arma::mat x_train = arma::join_rows(arma::mat(y_train.n_rows,1,arma::fill::ones), k.get_x());
-   doLogit(k, y_train, x_train);
+   fixed.design(k.presence(), workspace.x_design);
+   doLogit(k, fixed.y(), workspace.x_design, fixed.null_b(), workspace);
 
    // Likelihood ratio test
-   k.lrt_p_val(likelihoodRatioTest(k, null_ll));
+   k.lrt_p_val(likelihoodRatioTest(k, fixed.null_ll()));
 }
 
-// Logistic fit with covariates
-void logisticTest(Kmer& k, const arma::vec& y_train, const double null_ll, const arma::mat& mds)
+void doLogit(Kmer& k, const arma::vec& y_train, const arma::mat& x_design)
 {
-   // Train classifier
-   arma::mat x_train = arma::join_rows(arma::mat(y_train.n_rows,1,arma::fill::ones), k.get_x());
-   x_train = arma::join_rows(x_train, mds);
-   doLogit(k, y_train, x_train);
-
-   // Likelihood ratio test
-   k.lrt_p_val(likelihoodRatioTest(k, null_ll));
+   logitWorkspace workspace;
+   doLogit(k, y_train, x_design, arma::vec(), workspace);
 }
 
-// This uses BFGS optimisation by default. Invokes NR or Firth on error
-void doLogit(Kmer& k, const arma::vec& y_train, const arma::mat& x_design)
+// This uses IRLS by default. Invokes NR or Firth on error
+// null_b, if given, are the betas of the model without the k-mer (column 1)
+// which are used as the starting point
+void doLogit(Kmer& k, const arma::vec& y_train, const arma::mat& x_design, const arma::vec& null_b, logitWorkspace& workspace)
 {
-   column_vector starting_point(x_design.n_cols);
-
    if (k.firth())
    {
+      ProfileTimer timer(profile_firth);
       newtonRaphson(k, y_train, x_design, 1);
    }
    else
    {
-      starting_point(0) = log(mean(y_train)/(1 - mean(y_train)));
-      for (size_t i = 1; i < x_design.n_cols; ++i)
+      arma::vec& b = workspace.b;
+      b.zeros(x_design.n_cols);
+      if (null_b.n_elem + 1 == x_design.n_cols)
       {
-         starting_point(i) = bfgs_start_beta;
+         b(0) = null_b(0);
+         for (size_t i = 1; i < null_b.n_elem; ++i)
+         {
+            b(i + 1) = null_b(i);
+         }
+      }
+      else
+      {
+         b(0) = log(mean(y_train)/(1 - mean(y_train)));
       }
 
       try
       {
-         // Use BFGS optimiser in dlib to maximise likelihood function by chaging the
-         // b vector, which will end in starting_point
-         LogitLikelihood likelihood_fit(x_design, y_train); // store this, as it is used for computing the LRT
-
-         dlib::find_max(dlib::bfgs_search_strategy(),
-                     dlib::objective_delta_stop_strategy(convergence_limit),
-                     likelihood_fit, LogitLikelihoodGradient(x_design, y_train),
-                     starting_point, -1);
-
-         // Extract beta and likelihood
-         arma::vec b_vector = dlib_to_arma(starting_point);
-         k.beta(b_vector(1));
-
-         k.log_likelihood(likelihood_fit(starting_point));
-
-         // Extract p-value
-         //
-         //
-         // W = B_1 / SE(B_1) ~ N(0,1)
-         //
-         // In the special case of a logistic regression, abs can be taken rather
-         // than ^2 as responses are 0 or 1
-         //
-         arma::mat var_covar_mat = varCovarMat(x_design, b_vector);
-         double se = pow(var_covar_mat(1,1), 0.5);
-
-         // Zeros will result in bad regression with large SE - firth regression helps
-         if (se > se_limit)
-         {
-            throw std::runtime_error("se>limit");
-         }
-         else
-         {
-            k.standard_error(se);
+         // Fit, leaving b at the maximum and the likelihood, score and
+         // information there in the workspace
+         irls(y_train, x_design, workspace);
+         logitWald(k, b, workspace.log_likelihood, workspace.information);
+      }
+      // Sometimes won't converge, use N-R instead
+      catch (std::exception& e)
+      {
+         logitFallback(k, y_train, x_design, e);
+      }
+   }
+}
 
-            double W = std::abs(b_vector(1)) / se; // null hypothesis b_1 = 0
-            k.p_val(normalPval(W));
+// Sets beta, likelihood and the Wald test p-values of a converged fit.
+// Throws if the k-mer's SE is too large
+void logitWald(Kmer& k, const arma::vec& b, const double log_likelihood, const arma::mat& information)
+{
+   // Extract beta and likelihood
+   k.beta(b(1));
+   k.log_likelihood(log_likelihood);
+
+   // Extract p-value
+   //
+   //
+   // W = B_1 / SE(B_1) ~ N(0,1)
+   //
+   // In the special case of a logistic regression, abs can be taken rather
+   // than ^2 as responses are 0 or 1
+   //
+   // The var-covar matrix is the inverse of the Fisher information
+   // matrix (see varCovarMat)
+   arma::mat var_covar_mat = inv_covar(information);
+   double se = pow(var_covar_mat(1,1), 0.5);
+
+   // Zeros will result in bad regression with large SE - firth regression helps
+   if (se > se_limit)
+   {
+      throw std::runtime_error("se>limit");
+   }
+   else
+   {
+      k.standard_error(se);
+
+      double W = std::abs(b(1)) / se; // null hypothesis b_1 = 0
+      k.p_val(normalPval(W));
 
 #ifdef SEER_DEBUG
-            std::cerr << "Wald statistic: " << W << "\n";
-            std::cerr << "p-value: " << k.p_val() << "\n";
+      std::cerr << "Wald statistic: " << W << "\n";
+      std::cerr << "p-value: " << k.p_val() << "\n";
 #endif
-            // Add in covariate p-values
-            for (unsigned int i = 2; i < var_covar_mat.n_rows; ++i)
-            {
-               se = pow(var_covar_mat(i,i), 0.5);
-               W = std::abs(b_vector(i)) / se;
-
-               k.add_covar_p(normalPval(W));
-            }
-         }
+      // Add in covariate p-values
+      for (unsigned int i = 2; i < var_covar_mat.n_rows; ++i)
+      {
+         se = pow(var_covar_mat(i,i), 0.5);
+         W = std::abs(b(i)) / se;
+
+         k.add_covar_p(normalPval(W));
       }
-      // Sometimes won't converge, use N-R instead
-      catch (std::exception& e)
+   }
+}
+
+// Refits a k-mer whose IRLS fit failed with error e, with N-R or Firth
+void logitFallback(Kmer& k, const arma::vec& y_train, const arma::mat& x_design, const std::exception& e)
+{
+#ifdef SEER_DEBUG
+   std::cerr << "Caught error " << e.what() << std::endl;
+#endif
+
+   // SE is greater than specified limit - run Firth regression
+   if (strcmp(e.what(), "se>limit") == 0)
+   {
+      k.add_comment(comment_large_se);
+      ProfileTimer timer(profile_large_se);
+      newtonRaphson(k, y_train, x_design, 1);
+   }
+   // Optimiser did not converge - use NR iterations w/o Firth first
+   // Could also be matrix inversion failing
+   // (comment is still bfgs-fail, as output is filtered on it)
+   else
+   {
+      k.add_comment(comment_bfgs_fail);
+      ProfileTimer timer(profile_bfgs_fail);
+      newtonRaphson(k, y_train, x_design);
+   }
+}
+
+// Iteratively reweighted least squares (Newton's method) from the betas in
+// workspace.b. Each iteration is a single pass over the samples, in
+// logitEvaluate, and a solve, all in the workspace's storage. Steps which
+// lower the likelihood are halved. Throws if the information matrix can't
+// be inverted, or there is no convergence
+void irls(const arma::vec& y_train, const arma::mat& x_design, logitWorkspace& workspace)
+{
+   arma::vec& b = workspace.b;
+   arma::vec& step = workspace.step;
+
+   workspace.log_likelihood = logitEvaluate(y_train, x_design, b, workspace);
+   for (unsigned int i = 0; i < max_irls_iterations; ++i)
+   {
+      if (!invSympd(workspace.var_covar, workspace.information))
+      {
+         throw std::runtime_error("irls inversion failed");
+      }
+      step = workspace.var_covar * workspace.score;
+
+      double previous_ll = workspace.log_likelihood;
+      b += step;
+      workspace.log_likelihood = logitEvaluate(y_train, x_design, b, workspace);
+      for (unsigned int j = 0; j < max_step_halvings && workspace.log_likelihood < previous_ll - convergence_limit; ++j)
+      {
+         step *= 0.5;
+         b -= step;
+         workspace.log_likelihood = logitEvaluate(y_train, x_design, b, workspace);
+      }
+      if (workspace.log_likelihood < previous_ll - convergence_limit)
+      {
+         throw std::runtime_error("irls step failed");
+      }
+
+      if (arma::abs(step).max() < convergence_limit)
       {
 #ifdef SEER_DEBUG
-         std::cerr << "Caught error " << e.what() << std::endl;
+         std::cerr << "Number of IRLS iterations: " << i + 1 << "\n";
 #endif
+         return;
+      }
+   }
 
-         // SE is greater than specified limit - run Firth regression
-         if (strcmp(e.what(), "se>limit") == 0)
-         {
-            k.add_comment("large-se");
-            newtonRaphson(k, y_train, x_design, 1);
-         }
-         // BFGS optimiser did not converge - use NR iterations w/o Firth first
-         // Could also be matrix inversion failing
-         else
+   throw std::runtime_error("irls did not converge");
+}
+
+// Log-likelihood of the logistic model at b, with its gradient (the score)
+// and the Fisher information X'WX, in one pass over the samples
+double logitEvaluate(const arma::vec& y_train, const arma::mat& x_design, const arma::vec& b, logitWorkspace& workspace)
+{
+   const size_t num_cols = x_design.n_cols;
+   arma::vec& score = workspace.score;
+   arma::mat& information = workspace.information;
+   arma::vec& x_i = workspace.x_i;
+
+   score.zeros(num_cols);
+   information.zeros(num_cols, num_cols);
+   x_i.set_size(num_cols);
+
+   double log_likelihood = 0;
+   for (size_t i = 0; i < x_design.n_rows; ++i)
+   {
+      double exponent = 0;
+      for (size_t j = 0; j < num_cols; ++j)
+      {
+         x_i(j) = x_design(i, j);
+         exponent += x_i(j) * b(j);
+      }
+
+      const double sigmoid = 1.0 / (1.0 + exp(-exponent));
+      if (y_train[i] == 1)
+      {
+         log_likelihood += log(sigmoid);
+      }
+      else
+      {
+         log_likelihood += log(1.0 - sigmoid);
+      }
+
+      const double residual = y_train[i] - sigmoid;
+      const double weight = sigmoid * (1 - sigmoid);
+      for (size_t j = 0; j < num_cols; ++j)
+      {
+         score(j) += x_i(j) * residual;
+         for (size_t l = j; l < num_cols; ++l)
          {
-            k.add_comment("bfgs-fail");
-            newtonRaphson(k, y_train, x_design);
+            information(j, l) += weight * x_i(j) * x_i(l);
          }
       }
    }
+
+   // Only the upper triangle was filled
+   for (size_t j = 0; j < num_cols; ++j)
+   {
+      for (size_t l = j + 1; l < num_cols; ++l)
+      {
+         information(l, j) = information(j, l);
+      }
+   }
+
+   return log_likelihood;
+}
+
+// Log-likelihood of the logistic model at b
+double logitLogLikelihood(const arma::vec& y_train, const arma::mat& x_design, const arma::vec& b)
+{
+   const arma::vec y_pred = predictLogitProbs(x_design, b);
+
+   double result = 0.0;
+   for (size_t i = 0; i < y_train.n_elem; ++i)
+   {
+      if (y_train[i] == 1)
+      {
+         result += log(y_pred[i]);
+      }
+      else
+      {
+         result += log(1.0 - y_pred[i]);
+      }
+   }
+
+   return result;
 }
 
 void newtonRaphson(Kmer& k, const arma::vec& y_train, const arma::mat& x_design, const bool firth)
@@ -149,13 +287,16 @@ void newtonRaphson(Kmer& k, const arma::vec& y_train, const arma::mat& x_design,
       arma::vec y_pred = predictLogitProbs(x_design, b0);
 
       arma::mat U(x_design.n_cols, 1);
-      arma::mat W = repmat(y_pred % (arma::ones(y_pred.n_rows) - y_pred), 1, x_design.n_cols);
+      arma::vec w = y_pred % (arma::ones(y_pred.n_rows) - y_pred);
 
-      // Perform inversion, which may fail
-      var_covar_mat = inv_covar(x_design.t() * (W % x_design));
+      // Perform inversion of X'WX, which may fail
+      arma::mat information;
+      weightedCrossProduct(x_design, w, information);
+      var_covar_mat = inv_covar(information);
       if (var_covar_mat.n_cols == 0 || var_covar_mat.n_rows == 0)
       {
-         k.add_comment("inv-fail");
+         k.add_comment(comment_inv_fail);
+         profileCount(profile_inv_fail);
          k.p_val(0);
          std::cerr << "Inversion at input line " << k.line_number() << " failed" << std::endl;
          failed = 1;
@@ -166,15 +307,17 @@ void newtonRaphson(Kmer& k, const arma::vec& y_train, const arma::mat& x_design,
       {
          // Firth logistic regression
          // See: DOI: 10.1002/sim.1047
-         // Hat matrix
+         // Diagonal of the hat matrix H = W^1/2 X (X'WX)^-1 X' W^1/2
+         // which is h_i = w_i * x_i' (X'WX)^-1 x_i for row x_i of X. This
+         // avoids forming the n x n matrix H
          // Note: W is diagonal so X.t() * W * X is still sympd
-         arma::mat H = (sqrt(W) % x_design) * var_covar_mat * (x_design.t() % sqrt(W).t());
+         arma::vec h = w % sum((x_design * var_covar_mat) % x_design, 1);
 
          arma::vec correction(y_train.n_rows);
          correction.fill(0.5);
 
          // Penalised score
-         U = x_design.t() * (y_train - y_pred + diagvec(H) % (correction - y_pred));
+         U = x_design.t() * (y_train - y_pred + h % (correction - y_pred));
       }
       else
       {
@@ -198,27 +341,28 @@ void newtonRaphson(Kmer& k, const arma::vec& y_train, const arma::mat& x_design,
    {
       if (!firth)
       {
-         k.add_comment("nr-fail");
+         k.add_comment(comment_nr_fail);
+         ProfileTimer timer(profile_nr_fail);
          newtonRaphson(k, y_train, x_design, 1);
       }
       else
       {
-         k.add_comment("firth-fail");
+         k.add_comment(comment_firth_fail);
+         profileCount(profile_firth_fail);
       }
    }
    else if (!failed)
    {
       // Add beta and log-likelihood
-      column_vector converged_beta = arma_to_dlib(parameter_iterations.back());
+      const arma::vec& converged_beta = parameter_iterations.back();
 
-      LogitLikelihood likelihood_fit(x_design, y_train);
       if (k.firth())
       {
-         k.log_likelihood(likelihood_fit(converged_beta) + 0.5*log(det(inv_covar(var_covar_mat))));
+         k.log_likelihood(logitLogLikelihood(y_train, x_design, converged_beta) + 0.5*log(det(inv_covar(var_covar_mat))));
       }
       else
       {
-         k.log_likelihood(likelihood_fit(converged_beta));
+         k.log_likelihood(logitLogLikelihood(y_train, x_design, converged_beta));
       }
 
       k.beta(converged_beta(1));
@@ -231,11 +375,12 @@ void newtonRaphson(Kmer& k, const arma::vec& y_train, const arma::mat& x_design,
       {
          if (!firth)
          {
+            ProfileTimer timer(profile_large_se);
             newtonRaphson(k, y_train, x_design, 1);
          }
          else
          {
-            k.add_comment("large-se");
+            k.add_comment(comment_large_se);
          }
       }
 
@@ -271,20 +416,9 @@ arma::mat varCovarMat(const arma::mat& x, const arma::mat& b)
    arma::vec y_pred = predictLogitProbs(x, b);
    arma::vec y_trans = y_pred % (1 - y_pred);
 
-   // Fill elements of I, which are sums of element by element vector multiples
-   arma::mat I(b.n_elem, b.n_elem);
-   unsigned int j_max = I.n_rows;
-   for (unsigned int i = 0; i<I.n_cols; ++i)
-   {
-      for (unsigned int j = i; j < j_max; j++)
-      {
-         I(i,j) = accu(y_trans % x.col(i) % x.col(j));
-         if (i != j)
-         {
-            I(j,i) = I(i,j); // I is symmetric - only need to calculate upper triangle
-         }
-      }
-   }
+   // I = X'WX with W = diag(p(1-p)), in one pass over the rows of x
+   arma::mat I;
+   weightedCrossProduct(x, y_trans, I);
 
    return inv_covar(I);
 }
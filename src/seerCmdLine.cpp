@@ -20,20 +20,27 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
    po::options_description required("Required options");
    required.add_options()
     ("kmers,k", po::value<std::string>()->required(), "dsm kmer output file")
-    ("pheno,p", po::value<std::string>()->required(), ".pheno metadata");
+    ("pheno,p", po::value<std::vector<std::string>>()->multitoken()->required(), ".pheno metadata. Give more than one to test each in the same pass over the kmers");
 
    // kmds options
    po::options_description covar("Covariate options");
    covar.add_options()
     ("struct", po::value<std::string>(), "mds values from kmds")
     ("covar_file", po::value<std::string>(), "file containing covariates")
-    ("covar_list", po::value<std::string>(), "list of columns covariates to use. Format is 1,2q,3 (use q for quantitative)");
+    ("covar_list", po::value<std::string>(), "list of columns covariates to use. Format is 1,2q,3 (use q for quantitative)")
+    ("lmm", po::value<std::string>(), "kinship from kmds --kinship. Tests with a linear mixed model, for binary phenotypes too")
+    ("save_context", po::value<std::string>(), "save the samples, covariates and null model to this file, for later runs")
+    ("context", po::value<std::string>(), "samples, covariates and null model saved with --save_context. Replaces --struct and --covar_file");
 
    //Optional filtering parameters
    //NB pval cutoffs are strings for display, and are converted to floats later
    po::options_description performance("Performance options");
    performance.add_options()
-    ("threads", po::value<int>()->default_value(1), ("number of threads. Suggested: " + std::to_string(std::thread::hardware_concurrency())).c_str());
+    ("threads", po::value<int>()->default_value(1), ("number of threads. Suggested: " + std::to_string(std::thread::hardware_concurrency())).c_str())
+    ("shard", po::value<std::string>(), "only test shard i of N of the input, given as i/N. Combine shard outputs with merge_seer")
+    ("checkpoint", po::value<std::string>(), "save progress to this file, and resume from it if it exists. Removed when the run finishes. Needs --output")
+    ("checkpoint_interval", po::value<int>(), ("seconds between checkpoints. Default: " + std::to_string(checkpoint_interval_default)).c_str())
+    ("profile", po::value<std::string>(), "write the time spent in each stage, and thread utilisation, to this file as JSON");
 
    //Optional filtering parameters
    //NB pval cutoffs are strings for display, and are converted to floats later
@@ -44,11 +51,17 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
     ("maf", po::value<double>()->default_value(maf_default), "minimum kmer frequency")
     ("min_words", po::value<int>(), "minimum kmer occurences. Overrides --maf")
     ("chisq", po::value<std::string>()->default_value(chisq_default), "p-value threshold for initial chi squared test. Set to 1 to show all")
-    ("pval", po::value<std::string>()->default_value(pval_default), "p-value threshold for final logistic test. Set to 1 to show all");
+    ("pval", po::value<std::string>()->default_value(pval_default), "p-value threshold for final logistic test. Set to 1 to show all")
+    ("score", po::value<std::string>(), "p-value threshold for a score test against the null model. Only k-mers passing are given the full fit")
+    ("permutations", po::value<int>(), "also score k-mers against this many permutations of the phenotype, and report the p-value threshold for a 5% family-wise error rate");
 
    po::options_description other("Other options");
    other.add_options()
     ("print_samples", "print lists of samples significant kmers were found in")
+    ("output,o", po::value<std::string>(), "write results to this file rather than stdout")
+    ("gzip", "gzip the results. Needs --output")
+    ("bgzf", "write the results as BGZF (blocked gzip), with a .gzi index. Needs --output")
+    ("binary_results", "write binary results, which filter_seer and map_back read without parsing text")
     ("version", "prints version and exits")
     ("help,h", "full help message");
 
@@ -75,7 +88,8 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
          failed = 0;
 
          // Check input files exist, and can stat
-         if (!fileStat(vm["kmers"].as<std::string>()) || !fileStat(vm["pheno"].as<std::string>()))
+         const std::vector<std::string>& pheno_files = vm["pheno"].as<std::vector<std::string>>();
+         if (!fileStat(vm["kmers"].as<std::string>()) || std::find_if_not(pheno_files.begin(), pheno_files.end(), fileStat) != pheno_files.end())
          {
             failed = 1;
          }
@@ -83,6 +97,19 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
          {
             failed = 1;
          }
+         else if (vm.count("context") && !fileStat(vm["context"].as<std::string>()))
+         {
+            failed = 1;
+         }
+         else if (vm.count("lmm") && !fileStat(vm["lmm"].as<std::string>()))
+         {
+            failed = 1;
+         }
+         else if (vm.count("context") && (vm.count("struct") || vm.count("covar_file")))
+         {
+            std::cerr << "Covariates are taken from --context, so --struct and --covar_file cannot also be used\n";
+            failed = 1;
+         }
       }
 
    }
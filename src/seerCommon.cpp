@@ -35,8 +35,16 @@ cmdOptions verifyCommandLine(boost::program_options::variables_map& vm, const st
       verified.log_cutoff = stod(vm["pval"].as<std::string>());
    }
 
+   verified.score_test = 0;
+   verified.score_cutoff = 1;
+   if (vm.count("score"))
+   {
+      verified.score_test = 1;
+      verified.score_cutoff = stod(vm["score"].as<std::string>());
+   }
+
    // Verify MDS options in a separate function
-   // This is pc, size and number of threads
+   // This is pc, size, sample fraction and number of threads
    verifyMDSOptions(verified, vm);
 
    verified.filter = 1;
@@ -80,6 +88,60 @@ cmdOptions verifyCommandLine(boost::program_options::variables_map& vm, const st
       verified.max_words = samples.size() - verified.min_words;
    }
 
+   // Shards are numbered from 1 on the command line. BGZF files are split
+   // into ranges of blocks, so each shard only reads its own part
+   verified.shard = 0;
+   verified.num_shards = 1;
+   verified.shard_by_range = 0;
+   if (vm.count("shard"))
+   {
+      std::smatch shard_match;
+      const std::string shard_in = vm["shard"].as<std::string>();
+      if (std::regex_match(shard_in, shard_match, std::regex("^(\\d+)/(\\d+)$"))
+            && stoul(shard_match[1]) >= 1 && stoul(shard_match[1]) <= stoul(shard_match[2]))
+      {
+         verified.shard = stoul(shard_match[1]) - 1;
+         verified.num_shards = stoul(shard_match[2]);
+         verified.shard_by_range = !isKmerMatrix(verified.kmers) && isBgzf(verified.kmers);
+      }
+      else
+      {
+         badCommand("shard", shard_in);
+      }
+   }
+
+   verified.permutations = 0;
+   if (vm.count("permutations"))
+   {
+      if (vm["permutations"].as<int>() > 0)
+      {
+         verified.permutations = vm["permutations"].as<int>();
+      }
+      else
+      {
+         badCommand("permutations", std::to_string(vm["permutations"].as<int>()));
+      }
+   }
+
+   // Progress is saved every checkpoint_interval seconds, and resumed from
+   // if the file exists
+   verified.checkpoint_interval = checkpoint_interval_default;
+   if (vm.count("checkpoint"))
+   {
+      verified.checkpoint = vm["checkpoint"].as<std::string>();
+      if (vm.count("checkpoint_interval"))
+      {
+         if (vm["checkpoint_interval"].as<int>() > 0)
+         {
+            verified.checkpoint_interval = vm["checkpoint_interval"].as<int>();
+         }
+         else
+         {
+            badCommand("checkpoint_interval", std::to_string(vm["checkpoint_interval"].as<int>()));
+         }
+      }
+   }
+
    verified.print_samples = 0;
    if (vm.count("print_samples"))
    {
@@ -127,6 +189,19 @@ void verifyMDSOptions(cmdOptions& verified, boost::program_options::variables_ma
       }
    }
 
+   verified.sample_fraction = 0;
+   if (vm.count("sample_fraction"))
+   {
+      if (vm["sample_fraction"].as<double>() > 0 && vm["sample_fraction"].as<double>() <= 1)
+      {
+         verified.sample_fraction = vm["sample_fraction"].as<double>();
+      }
+      else
+      {
+         badCommand("sample_fraction", std::to_string(vm["sample_fraction"].as<double>()));
+      }
+   }
+
    if (vm.count("write_distances"))
    {
       verified.write_distances = 1;
@@ -135,6 +210,24 @@ void verifyMDSOptions(cmdOptions& verified, boost::program_options::variables_ma
    {
       verified.write_distances = 0;
    }
+
+   verified.kinship = 0;
+   verified.kinship_rank = 0;
+   if (vm.count("kinship"))
+   {
+      verified.kinship = 1;
+   }
+   if (vm.count("kinship_rank"))
+   {
+      if (vm["kinship_rank"].as<int>() > 0)
+      {
+         verified.kinship_rank = vm["kinship_rank"].as<int>();
+      }
+      else
+      {
+         badCommand("kinship_rank", std::to_string(vm["kinship_rank"].as<int>()));
+      }
+   }
 }
 
 // Check for continuous phenotype. If even one sample has neither 0 or 1 as
@@ -220,9 +313,10 @@ void normaliseMatCols(arma::mat& matrix_in)
 arma::mat inv_covar(arma::mat A)
 {
    // Try the default. Internally this uses Cholesky decomposition and back
-   // solves. For large condition numbers it fails.
+   // solves, with a fixed size kernel for small matrices. For large
+   // condition numbers it fails.
    arma::mat B;
-   if (!inv_sympd(B, A))
+   if (!invSympd(B, A))
    {
       // If the Cholesky decomposition fails, try pseudo-inverse
       // This uses SVD:
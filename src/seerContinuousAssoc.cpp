@@ -7,24 +7,58 @@
 
 #include "seer.hpp"
 
-// Linear fit without covariates
-void linearTest(Kmer& k, const arma::vec& y_train, const double null_ll)
+// Linear fit. The k-mer column z is added to the null OLS fit with a block
+// (Schur complement) update rather than refitting: with a = (X'X)^-1 X'z and
+// s = z'z - z'Xa, the k-mer's beta is z'r/s for null residuals r, and the
+// other betas move by -a*beta
+void linearTest(Kmer& k, const FixedCovariates& fixed)
 {
-   // Train classifier
-   arma::mat x_train = join_rows(arma::mat(y_train.n_rows,1,arma::fill::ones), k.get_x());
-   doLinear(k, y_train, x_train);
+   const Presence& x = k.presence();
 
-   // Likelihood ratio test
-   k.lrt_p_val(k.p_val());
-}
+   arma::vec xz = fixed.cross_product(x);
+   arma::vec a = fixed.xtx_inv() * xz;
+   double s = x.count() - dot(xz, a);
 
-// Linear fit with covariates
-void linearTest(Kmer& k, const arma::vec& y_train, const double null_ll, const arma::mat& mds)
-{
-   // Train classifier
-   arma::mat x_train = join_rows(arma::mat(y_train.n_rows,1,arma::fill::ones), k.get_x());
-   x_train = join_rows(x_train, mds);
-   doLinear(k, y_train, x_train);
+   // k-mer is (nearly) collinear with the covariates, so fit the full model
+   if (s <= collinear_limit * x.count())
+   {
+      doLinear(k, fixed.y(), fixed.design(x));
+   }
+   else
+   {
+      double zr, zr_sq;
+      presenceSums(x, fixed.null_residuals(), zr, zr_sq);
+
+      double b = zr / s;
+      double SSE = fixed.null_sse() - b * b * s;
+      double MSE = SSE / (fixed.num_samples() - 2);
+
+      // For LRT test
+      k.log_likelihood(SSE);
+      k.beta(b);
+
+      // Wald test, as in doLinear. The k-mer's entry of (X'X)^-1 is 1/s
+      double se = pow(MSE / s, 0.5);
+      k.standard_error(se);
+
+      double W = std::abs(b) / (se); // null hypothesis b_1 = 0
+      k.p_val(normalPval(W));
+
+#ifdef SEER_DEBUG
+      std::cerr << "Wald statistic: " << W << "\n";
+      std::cerr << "p-value: " << k.p_val() << "\n";
+#endif
+
+      // Add in covariate p-values
+      for (unsigned int i = 1; i < fixed.num_fixed(); ++i)
+      {
+         double b_i = fixed.null_b()(i) - a(i) * b;
+         se = pow(((fixed.xtx_inv()(i,i) + a(i) * a(i) / s) * MSE), 0.5);
+         W = std::abs(b_i) / (se);
+
+         k.add_covar_p(normalPval(W));
+      }
+   }
 
    // Likelihood ratio test
    k.lrt_p_val(k.p_val());
@@ -64,7 +98,8 @@ void doLinear(Kmer& k, const arma::vec& y_train, const arma::mat& x_design)
 #ifdef SEER_DEBUG
       std::cerr << "bfgs failed with " << e.what() << std::endl;
 #endif
-      k.add_comment("bfgs-fail");
+      k.add_comment(comment_bfgs_fail);
+      ProfileTimer timer(profile_bfgs_fail);
 
       // Calculate (X'X)^-1. Use QR decomposition to solve.
       // Might be slower than Cholesky, but numerically is more stable
@@ -92,7 +127,9 @@ void doLinear(Kmer& k, const arma::vec& y_train, const arma::mat& x_design)
    // SE(B_1) = MSE * (X'X)^-1
    // MSE = sum(Y_i-Y'_i)^2 / n-2
    //
-   arma::mat var_covar_mat = inv_covar(x_design.t()*x_design);
+   arma::mat xtx;
+   crossProduct(x_design, xtx);
+   arma::mat var_covar_mat = inv_covar(xtx);
    double se = pow((var_covar_mat(1,1) * MSE), 0.5);
    k.standard_error(se);
 
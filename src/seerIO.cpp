@@ -47,8 +47,9 @@ void readPheno(const std::string& filename, std::vector<Sample>& samples, std::u
    }
 }
 
-// Open dsm files, which are possibly zipped
-void openDsmFile(igzstream& dsm_stream, const std::string& file_name)
+// Open dsm files, which are possibly zipped. BGZF files are decompressed
+// with threads
+void openDsmFile(DsmStream& dsm_stream, const std::string& file_name, const unsigned int threads, const uint64_t start_offset, const uint64_t end_offset)
 {
    // Check for a .gz extension
    if (!std::regex_match(file_name, gzipped))
@@ -58,7 +59,7 @@ void openDsmFile(igzstream& dsm_stream, const std::string& file_name)
          + " is not gzip compressed, which is recommended\n";
    }
 
-   dsm_stream.open(file_name.c_str()); // Push binary file into buffer
+   dsm_stream.open(file_name, threads, start_offset, end_offset); // Push binary file into buffer
 
    // Set stream buffer of istream to the one just opened, and check ok
    if (!dsm_stream.good())
@@ -81,6 +82,22 @@ arma::vec constructVecY(const std::vector<Sample>& samples)
    return y;
 }
 
+// Affected samples (y == 1), for contingency tables
+Presence constructCases(const arma::vec& y)
+{
+   Presence cases(y.n_elem);
+
+   for (unsigned int i = 0; i < y.n_elem; ++i)
+   {
+      if (y[i] == 1)
+      {
+         cases.set(i);
+      }
+   }
+
+   return cases;
+}
+
 // Also saves sample information
 void writeMDS(const std::string& file_name, const std::vector<Sample>& sample_names, const arma::mat& MDS)
 {
@@ -92,27 +109,93 @@ void writeMDS(const std::string& file_name, const std::vector<Sample>& sample_na
       MDS.save(file_name, arma::hdf5_binary);
 #endif
 
-      std::string sample_file_name = file_name + sample_suffix;
-      std::ofstream sample_names_file(sample_file_name.c_str());
+      writeSampleNames(file_name, sample_names);
+   }
+   else
+   {
+      throw std::logic_error("When writing matrix to " + file_name + " the number samples in the .pheno file did not match the number of columns or rows");
+   }
+
+}
+
+// Writes the sample name order used in a matrix file
+void writeSampleNames(const std::string& file_name, const std::vector<Sample>& sample_names)
+{
+   std::string sample_file_name = file_name + sample_suffix;
+   std::ofstream sample_names_file(sample_file_name.c_str());
 
-      // Write out the sample name order
-      if (!sample_names_file)
+   if (!sample_names_file)
+   {
+      std::cerr << "Could not write used sample names to " << sample_file_name << std::endl;
+   }
+   else
+   {
+      for (auto sample_it = sample_names.begin(); sample_it != sample_names.end(); ++sample_it)
       {
-         std::cerr << "Could not write used sample names to " << sample_file_name << std::endl;
+         sample_names_file << sample_it->iid() << std::endl;
       }
-      else
+   }
+}
+
+// A partial distance matrix is the Hamming distances between samples summed
+// over some k-mers, so partial matrices from shards of the k-mers can be
+// added. It is saved as samples + 1 rows: the last row holds the number of
+// k-mers summed over
+void writePartialDistances(const std::string& file_name, const std::vector<Sample>& sample_names, const arma::mat& counts, const long int num_kmers)
+{
+   if (counts.n_rows == sample_names.size() && counts.n_cols == sample_names.size())
+   {
+      arma::mat partial = counts;
+      partial.insert_rows(counts.n_rows, 1);
+      for (unsigned int j = 0; j < partial.n_cols; ++j)
       {
-         for (auto sample_it = sample_names.begin(); sample_it != sample_names.end(); ++sample_it)
+         partial(counts.n_rows, j) = num_kmers;
+      }
+
+#ifdef NO_HDF5
+      partial.save(file_name, arma::arma_ascii);
+#else
+      partial.save(file_name, arma::hdf5_binary);
+#endif
+
+      writeSampleNames(file_name, sample_names);
+   }
+   else
+   {
+      throw std::logic_error("When writing partial distances to " + file_name + " the number samples in the .pheno file did not match the number of columns or rows");
+   }
+}
+
+arma::mat readPartialDistances(const std::string& file_name, const std::vector<Sample>& sample_names, long int& num_kmers)
+{
+   arma::mat partial = readHDF5(file_name);
+   if (partial.n_cols != sample_names.size() || partial.n_rows != sample_names.size() + 1)
+   {
+      throw std::runtime_error("Partial distances in " + file_name + " do not have the same number of samples as the .pheno file");
+   }
+
+   // Shards must be run with the same .pheno file, so samples are in the same
+   // order
+   std::string sample_name_file = file_name + sample_suffix;
+   std::ifstream samples_in(sample_name_file.c_str());
+   if (samples_in)
+   {
+      for (auto it = sample_names.begin(); it != sample_names.end(); ++it)
+      {
+         std::string sample_name;
+         if (!(samples_in >> sample_name) || sample_name != it->iid())
          {
-            sample_names_file << sample_it->iid() << std::endl;
+            throw std::runtime_error("Samples in " + sample_name_file + " do not match the .pheno file");
          }
       }
    }
    else
    {
-      throw std::logic_error("When writing matrix to " + file_name + " the number samples in the .pheno file did not match the number of columns or rows");
+      std::cerr << "WARNING: Could not open sample file " + sample_name_file + ". Ensure kmds -p inputs were identical" << std::endl;
    }
 
+   num_kmers = (long int)partial(sample_names.size(), 0);
+   return partial.rows(0, sample_names.size() - 1);
 }
 
 void writeDistances(const std::string& file_name, const arma::mat& distances)
@@ -228,6 +311,35 @@ arma::mat readMDSList(const std::string& filename)
    return combined_matrix;
 }
 
+// Sums a list of partial distance matrices, and the number of k-mers in each
+arma::mat readPartialList(const std::string& filename, const std::vector<Sample>& sample_names, long int& num_kmers)
+{
+   std::ifstream ist(filename.c_str());
+   if (!ist)
+   {
+      throw std::runtime_error("Could not open partial distances list file " + filename + "\n");
+   }
+   else
+   {
+      std::cerr << "Reading partial distances from " + filename + "\n";
+   }
+
+   std::string matrix_file;
+   arma::mat combined_counts = arma::zeros<arma::mat>(sample_names.size(), sample_names.size());
+   num_kmers = 0;
+   int i = 0;
+   while (ist >> matrix_file)
+   {
+      long int partial_kmers;
+      combined_counts += readPartialDistances(matrix_file, sample_names, partial_kmers);
+      num_kmers += partial_kmers;
+
+      std::cerr << "Added partial distances " << ++i << "\n";
+   }
+
+   return combined_counts;
+}
+
 // Opens a text file containing covariates, and reads the specified columns
 // into a matrix. Categorical covariates use dummy coding
 arma::mat parseCovars(const std::string& file, const std::string& columns)
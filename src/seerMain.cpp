@@ -7,6 +7,9 @@
 
 #include "seer.hpp"
 
+#include <iomanip>
+#include <sstream>
+
 int main (int argc, char *argv[])
 {
    // Program description
@@ -26,22 +29,46 @@ int main (int argc, char *argv[])
       return 1;
    }
 
-   // Open .pheno file, parse into vector of samples
+   // Open .pheno files, parse into vectors of samples. Every phenotype is
+   // tested in the same pass over the k-mers, so must have the same samples
    std::vector<Sample> samples;
    std::unordered_map<std::string,int> sample_map;
+   std::vector<std::string> pheno_files;
+   std::vector<arma::vec> pheno_y;
+   std::vector<int> pheno_continuous;
 
    if (vm.count("pheno"))
    {
-      readPheno(vm["pheno"].as<std::string>(), samples, sample_map);
+      pheno_files = vm["pheno"].as<std::vector<std::string>>();
+      readPheno(pheno_files[0], samples, sample_map);
+      pheno_y.push_back(constructVecY(samples));
+      pheno_continuous.push_back(continuousPhenotype(samples));
+
+      for (auto it = pheno_files.begin() + 1; it != pheno_files.end(); ++it)
+      {
+         std::vector<Sample> pheno_samples;
+         std::unordered_map<std::string,int> pheno_sample_map;
+         readPheno(*it, pheno_samples, pheno_sample_map);
+
+         int same_samples = pheno_samples.size() == samples.size();
+         for (size_t i = 0; same_samples && i < samples.size(); ++i)
+         {
+            same_samples = pheno_samples[i].iid() == samples[i].iid();
+         }
+         if (!same_samples)
+         {
+            throw std::runtime_error("Samples in " + *it + " do not match " + pheno_files[0] + ". All --pheno files must have the same samples");
+         }
+
+         pheno_y.push_back(constructVecY(pheno_samples));
+         pheno_continuous.push_back(continuousPhenotype(pheno_samples));
+      }
    }
    else
    {
       throw std::runtime_error("--pheno option is compulsory");
    }
 
-   arma::vec y = constructVecY(samples);
-   int continuous_phenotype = continuousPhenotype(samples);
-
    // Get mds values
    arma::mat mds;
    int use_mds = 0;
@@ -87,167 +114,340 @@ int main (int argc, char *argv[])
       }
    }
 
-   // Disambiguate overloaded logistic functions by the type of parameter they
-   // take
-   void (*mdsLogitFunc)(Kmer&, const arma::vec&, const double, const arma::mat&) = &logisticTest;
-   void (*logitFunc)(Kmer&, const arma::vec&, const double) = &logisticTest;
-
-   void (*mdsLinearFunc)(Kmer&, const arma::vec&, const double, const arma::mat&) = &linearTest;
-   void (*linearFunc)(Kmer&, const arma::vec&, const double) = &linearTest;
-
    // Error check command line options
    cmdOptions parameters = verifyCommandLine(vm, samples);
 
-   // calculate the null log-likelihood
-   Kmer null_kmer;
-   arma::mat x(y.n_rows, 1, arma::fill::ones);
-   if (use_mds)
+   // Fit the null model for each phenotype, which each k-mer's fit starts
+   // from, or load it with the covariates from a saved context
+   std::vector<phenotypeTest> phenotypes;
+   phenotypes.reserve(pheno_files.size());
+   for (size_t i = 0; i < pheno_files.size(); ++i)
    {
-      x = join_rows(x, mds);
+      if (vm.count("context"))
+      {
+         phenotypes.emplace_back(pheno_y[i], pheno_continuous[i], FixedCovariates(pheno_y[i], vm["context"].as<std::string>(), samples, pheno_continuous[i]));
+      }
+      else
+      {
+         phenotypes.emplace_back(pheno_y[i], pheno_continuous[i], FixedCovariates(pheno_y[i], mds, pheno_continuous[i]));
+      }
    }
+   const size_t num_fixed = phenotypes[0].fixed.num_fixed();
+   use_mds = num_fixed > 1;
 
-   double null_ll = nullLogLikelihood(x, y, continuous_phenotype);
-
-   // Open the dsm kmer ifstream, and read through the whole thing
-   igzstream kmer_file;
-   openDsmFile(kmer_file, parameters.kmers);
-
-   // Write a header
-   std::string header = "sequence\tmaf\tchisq_p_val\twald_p_val\tlrt_p_val\tbeta\tse";
-   if (use_mds)
+   // Mixed model, sharing the eigendecomposition of the kinship between
+   // phenotypes
+   if (vm.count("lmm"))
    {
-      std::cout << header;
-      for (unsigned int i = 1; i <= mds.n_cols; ++i)
+      arma::mat kinship = readMDS(vm["lmm"].as<std::string>(), samples);
+      for (size_t i = 0; i < phenotypes.size(); ++i)
       {
-         std::cout << "\tcovar" << i << "_p";
+         phenotypes[i].lmm.reset(new MixedModel(phenotypes[i].fixed, kinship));
+         if (phenotypes.size() > 1)
+         {
+            std::cerr << "For " << pheno_files[i] << ": ";
+         }
+         std::cerr << "Mixed model with kinship rank " << phenotypes[i].lmm->rank()
+            << ", heritability " << phenotypes[i].lmm->heritability() << "\n";
       }
-      std::cout << "\tcomments";
    }
-   else
+
+   if (parameters.permutations)
    {
-      std::cout << header << "\tcomments";
+      for (auto it = phenotypes.begin(); it != phenotypes.end(); ++it)
+      {
+         it->permutations.reset(new PermutationTest(it->fixed, parameters.permutations));
+      }
    }
-   if (parameters.print_samples)
+
+   if (vm.count("save_context"))
    {
-      std::cout << "\tsamples_present";
+      phenotypes[0].fixed.save(vm["save_context"].as<std::string>(), samples, phenotypes[0].continuous);
    }
-   std::cout << std::endl;
 
-   long int input_line = 0;
-   long int tested_kmers = 0;
-   long int significant_kmers = 0;
-   while (kmer_file)
+   // Resume from the checkpoint, if there is one. Permutation scores are
+   // spread over the workers, so aren't saved
+   Checkpoint checkpoint;
+   int resuming = 0;
+   if (!parameters.checkpoint.empty())
    {
-      // Parse a set of dsm lines
-      std::vector<Kmer> kmer_lines;
-      kmer_lines.reserve(parameters.num_threads);
+      if (parameters.permutations)
+      {
+         badCommand("checkpoint", "can't be used with --permutations");
+      }
 
-      Kmer k;
-      while(kmer_lines.size() < parameters.num_threads && kmer_file)
+      // Options which change the results, which a resumed run must share
+      std::ostringstream settings;
+      settings << std::setprecision(17);
+      for (auto it = pheno_files.begin(); it != pheno_files.end(); ++it)
+      {
+         settings << "pheno=" << *it << "\n";
+      }
+      const std::vector<std::string> covariate_options = {"struct", "covar_file", "covar_list", "context", "lmm"};
+      for (auto it = covariate_options.begin(); it != covariate_options.end(); ++it)
       {
-         kmer_file >> k;
-         k.set_line_nr(++input_line);
+         settings << *it << "=" << (vm.count(*it) ? vm[*it].as<std::string>() : "") << "\n";
+      }
+      settings << "filter=" << parameters.filter << "\n"
+               << "min_words=" << parameters.min_words << "\n"
+               << "max_words=" << parameters.max_words << "\n"
+               << "max_length=" << parameters.max_length << "\n"
+               << "chisq=" << parameters.chi_cutoff << "\n"
+               << "pval=" << parameters.log_cutoff << "\n"
+               << "score=" << (parameters.score_test ? parameters.score_cutoff : 1) << "\n"
+               << "print_samples=" << parameters.print_samples << "\n"
+               << "binary_results=" << vm.count("binary_results") << "\n";
 
-         if (kmer_file)
+      resuming = checkpoint.load(parameters.checkpoint);
+      if (resuming)
+      {
+         checkpoint.check("seer", parameters.kmers, parameters.shard, parameters.num_shards, settings.str());
+         if (checkpoint.counters.size() != 1 + 2 * phenotypes.size())
          {
-            k.add_x(sample_map, samples.size());
-
-            // apply filters here
-            if (!parameters.filter)
-            {
-               kmer_lines.push_back(k);
-               tested_kmers++;
-            }
-            else if (passBasicFilters(parameters, k) && passStatsFilters(parameters, k, y, continuous_phenotype))
-            {
-#ifdef SEER_DEBUG
-               std::cerr << "kmer " + k.sequence() + " seems significant\n";
-#endif
-               kmer_lines.push_back(k);
-               tested_kmers++;
-            }
+            throw std::runtime_error("Checkpoint " + parameters.checkpoint + " is for a different number of phenotypes");
          }
+         std::cerr << "Resuming from " << parameters.checkpoint << " after " << checkpoint.counters[0] << " k-mers\n";
       }
+      checkpoint.program = "seer";
+      checkpoint.kmers = parameters.kmers;
+      checkpoint.shard = parameters.shard;
+      checkpoint.num_shards = parameters.num_shards;
+      checkpoint.settings = settings.str();
+   }
 
-      // Thread from here...
-      std::vector<std::thread> threads;
-      threads.reserve(kmer_lines.size());
+   // Open the dsm or .kmx kmer file, and read through the whole thing (from
+   // the checkpoint, if resuming)
+   DsmReader dsm_reader(samples, parameters.print_samples);
+   uint64_t start_offset = 0, end_offset = UINT64_MAX;
+   if (parameters.shard_by_range)
+   {
+      bgzfRange(parameters.kmers, parameters.shard, parameters.num_shards, start_offset, end_offset);
+   }
+   dsm_reader.resume(parameters.kmers, checkpoint, parameters.num_threads, start_offset, end_offset);
 
-      for (unsigned int i = 0; i<kmer_lines.size(); ++i)
+   // Results for a single phenotype go to stdout, or --output. With more
+   // than one, each is written to <pheno file>.seer.txt
+   const int sharded = parameters.num_shards > 1;
+   resultFormat format = text_results;
+   if (vm.count("binary_results"))
+   {
+      format = binary_results;
+   }
+   else if (vm.count("bgzf"))
+   {
+      format = bgzf_results;
+   }
+   else if (vm.count("gzip"))
+   {
+      format = gzip_results;
+   }
+   if (sharded && format != text_results)
+   {
+      badCommand("shard", "merge_seer reads text shards, so can't be used with compressed or binary results");
+   }
+   if (!parameters.checkpoint.empty() && (format == gzip_results || format == bgzf_results))
+   {
+      badCommand("checkpoint", "compressed results can't be resumed");
+   }
+
+   std::vector<std::string> out_files;
+   if (phenotypes.size() == 1)
+   {
+      out_files.push_back(parameters.output);
+   }
+   else
+   {
+      for (auto it = pheno_files.begin(); it != pheno_files.end(); ++it)
       {
-         // Association test
-         // Note threads must be passed values as they are copied
-         // std::reference_wrapper allows references to be passed
-         if (use_mds)
+         if (format == binary_results)
+         {
+            out_files.push_back(*it + multi_pheno_suffix + binary_results_suffix);
+         }
+         else if (format == gzip_results || format == bgzf_results)
          {
-            if (continuous_phenotype)
-            {
-               threads.push_back(std::thread(mdsLinearFunc, std::ref(kmer_lines[i]), std::cref(y), null_ll, std::cref(mds)));
-            }
-            else
-            {
-               threads.push_back(std::thread(mdsLogitFunc, std::ref(kmer_lines[i]), std::cref(y), null_ll, std::cref(mds)));
-            }
+            out_files.push_back(*it + multi_pheno_suffix + compressed_suffix);
          }
          else
          {
-            if (continuous_phenotype)
-            {
-               threads.push_back(std::thread(linearFunc, std::ref(kmer_lines[i]), std::cref(y), null_ll));
-            }
-            else
-            {
-               threads.push_back(std::thread(logitFunc, std::ref(kmer_lines[i]), std::cref(y), null_ll));
-            }
+            out_files.push_back(*it + multi_pheno_suffix);
+         }
+      }
+   }
+
+   if (!parameters.checkpoint.empty() && out_files[0].empty())
+   {
+      badCommand("checkpoint", "needs --output");
+   }
+
+   // Resuming, each file is cut back to its length at the checkpoint
+   std::vector<std::unique_ptr<ResultWriter>> out;
+   for (size_t p = 0; p < out_files.size(); ++p)
+   {
+      uint64_t resume_offset = resuming ? checkpoint.output_offsets.at(p) : 0;
+      out.emplace_back(new ResultWriter(out_files[p], format, use_mds ? num_fixed - 1 : 0, dsm_reader.dictionary(), parameters.print_samples, sharded, resume_offset));
+   }
+
+   // Write a header. Shard output also has the line number of each k-mer
+   std::string header = "sequence\tmaf\tchisq_p_val\twald_p_val\tlrt_p_val\tbeta\tse";
+   if (sharded)
+   {
+      header = "line\t" + header;
+   }
+   if (use_mds)
+   {
+      for (unsigned int i = 1; i < num_fixed; ++i)
+      {
+         header += "\tcovar" + std::to_string(i) + "_p";
+      }
+   }
+   header += "\tcomments";
+   if (parameters.print_samples)
+   {
+      header += "\tsamples_present";
+   }
+   for (auto out_it = out.begin(); !resuming && out_it != out.end(); ++out_it)
+   {
+      (*out_it)->write_line(header);
+   }
+
+   // Timings for --profile include this thread's output
+   std::unique_ptr<ProfileThread> main_profile;
+   if (vm.count("profile"))
+   {
+      startProfile("seer");
+      main_profile.reset(new ProfileThread("main"));
+   }
+
+   // Start a reader thread to parse and filter k-mers, and a pool of workers
+   // to test them. Results come back in input order and are printed here
+   long int input_line = 0;
+   long int queued_kmers = 0;
+   std::vector<long int> tested_kmers(phenotypes.size(), 0);
+   std::vector<long int> significant_kmers(phenotypes.size(), 0);
+   if (resuming)
+   {
+      input_line = checkpoint.counters[0];
+      std::copy(checkpoint.counters.begin() + 1, checkpoint.counters.begin() + 1 + phenotypes.size(), tested_kmers.begin());
+      std::copy(checkpoint.counters.begin() + 1 + phenotypes.size(), checkpoint.counters.end(), significant_kmers.begin());
+   }
+
+   BlockingQueue<kmerTask> work_queue(queue_depth * parameters.num_threads);
+   ReorderBuffer<kmerTask> results(reorder_depth * parameters.num_threads, parameters.num_threads);
+   RecyclePool<kmerTask> recycled((queue_depth + reorder_depth) * parameters.num_threads + stats_block_size);
+
+   // Note threads must be passed values as they are copied
+   // std::reference_wrapper allows references to be passed
+   std::thread reader(readKmers, std::ref(dsm_reader), std::ref(work_queue), std::ref(recycled), std::cref(parameters),
+         std::cref(phenotypes), checkpoint.line_nr, std::ref(input_line), std::ref(queued_kmers));
+
+   std::vector<std::thread> workers;
+   workers.reserve(parameters.num_threads);
+   for (unsigned int i = 0; i < parameters.num_threads; ++i)
+   {
+      workers.push_back(std::thread(testKmers, std::ref(work_queue), std::ref(results), std::cref(parameters),
+               std::cref(phenotypes)));
+   }
+
+   // Checkpoints are taken between tasks, once the results so far are on
+   // disk. Lines after the task which were filtered out are read again on
+   // resuming
+   auto last_checkpoint = std::chrono::steady_clock::now();
+   const auto checkpoint_interval = std::chrono::seconds(parameters.checkpoint_interval);
+
+   kmerTask tested;
+   while (results.pop(tested))
+   {
+      for (size_t p = 0; p < phenotypes.size(); ++p)
+      {
+         if (!tested.passed[p])
+         {
+            continue;
+         }
+         tested_kmers[p]++;
+
+         const Kmer& k = tested.k[p];
+         if (passAssocFilter(parameters, k))
+         {
+            significant_kmers[p]++;
+            ProfileTimer timer(profile_output);
+
+            out[p]->write(k);
          }
       }
 
-      for (unsigned int i = 0; i<threads.size(); ++i)
+      if (!parameters.checkpoint.empty() && std::chrono::steady_clock::now() - last_checkpoint >= checkpoint_interval)
       {
-         // Rejoin in order
-         threads[i].join();
+         checkpoint.line_nr = tested.k[0].line_number();
+         checkpoint.block_offset = tested.block_offset;
+         checkpoint.block_line = tested.block_line;
+
+         checkpoint.counters.assign(1, tested.input_line);
+         checkpoint.counters.insert(checkpoint.counters.end(), tested_kmers.begin(), tested_kmers.end());
+         checkpoint.counters.insert(checkpoint.counters.end(), significant_kmers.begin(), significant_kmers.end());
 
-         // Print in order when all threads complete
-         if (!parameters.filter || kmer_lines[i].p_val() < parameters.log_cutoff || kmer_lines[i].lrt_p_val() < parameters.log_cutoff)
+         checkpoint.output_offsets.clear();
+         for (auto out_it = out.begin(); out_it != out.end(); ++out_it)
          {
-            significant_kmers++;
-            // Caclculate chisq value if not already done so in filtering
-            if (kmer_lines[i].unadj() == kmer_chi_pvalue_default)
-            {
-               if (continuous_phenotype)
-               {
-                  kmer_lines[i].unadj_p_val(welchTwoSamplet(kmer_lines[i], y));
-               }
-               else
-               {
-                  kmer_lines[i].unadj_p_val(chiTest(kmer_lines[i], y));
-               }
-            }
-
-            std::cout << kmer_lines[i];
-            if (parameters.print_samples)
-            {
-               std::vector<std::string> samples_found = kmer_lines[i].occurrence_vector();
-               std::cout << "\t";
-               // Doing this for all samples leaves trailing whitespace, so
-               // write the last sample separately
-               if (samples_found.size() > 1)
-               {
-                  std::copy(samples_found.begin(), samples_found.end() - 1, std::ostream_iterator<std::string>(std::cout, "\t"));
-               }
-               std::cout << samples_found.back();
-            }
-            std::cout << std::endl;
+            checkpoint.output_offsets.push_back((*out_it)->sync());
+         }
+         checkpoint.save(parameters.checkpoint);
+         last_checkpoint = std::chrono::steady_clock::now();
+      }
+      recycled.put(tested);
+   }
+
+   reader.join();
+   for (auto it = workers.begin(); it != workers.end(); ++it)
+   {
+      it->join();
+   }
 
+   for (size_t p = 0; p < phenotypes.size(); ++p)
+   {
+      if (sharded)
+      {
+         out[p]->write_line(shard_trailer + std::to_string(parameters.shard + 1) + "/" + std::to_string(parameters.num_shards)
+            + "\tsplit=" + (parameters.shard_by_range ? "range" : "lines")
+            + "\tread=" + std::to_string(input_line) + "\ttested=" + std::to_string(tested_kmers[p])
+            + "\tprinted=" + std::to_string(significant_kmers[p]));
+      }
+      out[p]->close();
+   }
+
+   // A finished run starts again from the beginning
+   if (!parameters.checkpoint.empty())
+   {
+      std::remove(parameters.checkpoint.c_str());
+   }
+
+   std::cerr << "Read " << input_line << " total k-mers. Of these:\n";
+   for (size_t p = 0; p < phenotypes.size(); ++p)
+   {
+      if (phenotypes.size() > 1)
+      {
+         std::cerr << "For " << pheno_files[p] << ", written to " << out_files[p] << ":\n";
+      }
+      std::cerr << "\tPre-filtered " << input_line - tested_kmers[p] << " k-mers\n";
+      std::cerr << "\tTested " << tested_kmers[p] << " k-mers\n";
+      std::cerr << "\tPrinted " << significant_kmers[p] << " k-mers\n";
+      if (phenotypes[p].permutations)
+      {
+         std::cerr << "\tp-value threshold for a " << 100 * permutation_alpha << "% family-wise error rate, from "
+            << phenotypes[p].permutations->num_permutations() << " permutations: " << phenotypes[p].permutations->threshold(permutation_alpha);
+         if (sharded)
+         {
+            std::cerr << " (this shard's k-mers only)";
          }
+         std::cerr << "\n";
       }
-      // ...to here
+   }
+   if (main_profile)
+   {
+      main_profile.reset();
+      writeProfile(vm["profile"].as<std::string>());
+      std::cerr << "Timings written to " << vm["profile"].as<std::string>() << "\n";
    }
 
-   std::cerr << "Read " << input_line - 1 << " total k-mers. Of these:\n";
-   std::cerr << "\tPre-filtered " << input_line - tested_kmers - 1 << " k-mers\n";
-   std::cerr << "\tTested " << tested_kmers << " k-mers\n";
-   std::cerr << "\tPrinted " << significant_kmers << " k-mers\n";
    std::cerr << "Done.\n";
 }
 
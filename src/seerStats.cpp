@@ -10,10 +10,17 @@
 const double normalArea = pow(2*M_PI, -0.5);
 
 // Basic chi^2 test, using contingency table
-double chiTest(Kmer& k, const arma::vec& y)
+// cases has the affected samples set
+double chiTest(Kmer& k, const Presence& cases)
 {
-   arma::mat x = k.get_x();
+   const Presence& x = k.presence();
+   return chiTest(k, x.count_and(cases), x.count(), cases.count(), x.size());
+}
 
+// chi^2 test from counts: the number of samples with the k-mer that are
+// affected, with the k-mer, affected, and in total
+double chiTest(Kmer& k, const size_t present_cases, const size_t present, const size_t num_cases, const size_t num_samples)
+{
    double chisq = 0;
 
    // Contigency table
@@ -21,35 +28,18 @@ double chiTest(Kmer& k, const arma::vec& y)
    // present a          b
    // absent  c          d
    //
-   // Use doubles for compatibility with det function in arma::mat
-   double a = 0, b = 0, c = 0, d = 0;
+   // Stored column major, as a 2x2 matrix would be
+   double b = present_cases;
+   double a = present - b;
+   double d = num_cases - b;
+   double c = num_samples - a - b - d;
 
-   arma::vec::const_iterator j = y.begin();
-   for (arma::vec::const_iterator i = x.begin(); i!=x.end(); ++i)
-   {
-      if (*j == 0) {
-         if (*i == 0){
-            c++;
-         } else {
-            a++;
-         }
-      } else {
-         if (*i == 0){
-            d++;
-         } else {
-            b++;
-         }
-      }
-      j++;
-   }
-
-   arma::mat::fixed<2, 2> table = {a, b, c, d};
+   const double table[4] = {a, b, c, d};
 #ifdef SEER_DEBUG
-   arma::Mat<int>::fixed<2, 2> tab_out = {int (a), int (b), int (c), int(d)};
-   std::cerr << tab_out << "\n";
+   std::cerr << int (a) << " " << int (c) << "\n" << int (b) << " " << int (d) << "\n";
 #endif
 
-   int N = accu(table);
+   int N = a + b + c + d;
 
    if (N == 0)
    {
@@ -59,22 +49,20 @@ double chiTest(Kmer& k, const arma::vec& y)
    // Treat as invalid if any entry is 0 or 1, or if more than one entry < 5
    // Mark as needing to use Firth regression
    int low_obs = 0;
-   for (auto obs = table.begin(); obs != table.end(); ++obs)
+   for (int i = 0; i < 4; ++i)
    {
-      if (*obs <= 1 || (*obs <= 5 && ++low_obs > 2))
+      if (table[i] <= 1 || (table[i] <= 5 && ++low_obs > 2))
       {
-         k.add_comment("bad-chisq");
+         k.add_comment(comment_bad_chisq);
          k.firth(1);
          break;
       }
    }
 
    // Without Yates' continuity correction
-   chisq = N * pow(det(table), 2);
-   for (int i = 0; i < 2; ++i)
-   {
-      chisq /= accu(table.row(i)) * accu(table.col(i));
-   }
+   chisq = N * pow(a*d - c*b, 2);
+   chisq /= (a + c) * (a + b);
+   chisq /= (b + d) * (c + d);
 
    // For df = 1, as here, chi^2 == N(0,1)^2 (standard normal dist.)
    double p_value = normalPval(pow(chisq, 0.5));
@@ -86,26 +74,36 @@ double chiTest(Kmer& k, const arma::vec& y)
 }
 
 // Welch two sample t-test, for continuous phenotypes
-double welchTwoSamplet(const Kmer& k, const arma::vec& y)
+double welchTwoSamplet(const Kmer& k, const centredPhenotype& y)
 {
-   arma::mat x = k.get_x();
+   double sum, sum_sq;
+   presenceSums(k.presence(), y.y, sum, sum_sq);
+
+   return welchTwoSamplet(k.num_occurrences(), sum, sum_sq, y.y.n_elem, y.sum, y.sum_sq);
+}
 
-   // Subset into present and absent groups
-   arma::vec group1 = y.elem(find(x==0));
-   arma::vec group2 = y.elem(find(x==1));
+// Welch test from the sum and sum of squares of (centred) phenotype values
+// for the n_present samples with the k-mer, and over all samples
+double welchTwoSamplet(const size_t n_present, const double sum_present, const double sum_sq_present, const size_t n_total, const double sum_total, const double sum_sq_total)
+{
+   // Group means, then variances, of absent (1) and present (2) groups
+   size_t n1 = n_total - n_present, n2 = n_present;
 
-   // Calculate group means and variances
    double p_val = 0;
-   if (group1.n_elem >= 3 && group2.n_elem >= 3) // need >2 to get var
+   if (n1 >= 3 && n2 >= 3) // need >2 to get var
    {
-      double x1 = mean(group1);
-      double x2 = mean(group2);
-      double v1 = var(group1);
-      double v2 = var(group2);
+      double sum1 = sum_total - sum_present;
+      double sum2 = sum_present;
+
+      double x1 = sum1 / n1;
+      double x2 = sum2 / n2;
+
+      double v1 = (sum_sq_total - sum_sq_present - sum1 * x1) / (n1 - 1);
+      double v2 = (sum_sq_present - sum2 * x2) / (n2 - 1);
 
       // t and degrees freedom for test
-      double t = (x1 - x2)*pow((v1/group1.n_rows + v2/group2.n_rows), -0.5);
-      double df = pow((v1/group1.n_rows + v2/group2.n_rows), 2) / (pow(v1/group1.n_rows,2)/(group1.n_rows-1) + pow(v2/group2.n_rows,2)/(group2.n_rows-1));
+      double t = (x1 - x2)*pow((v1/n1 + v2/n2), -0.5);
+      double df = pow((v1/n1 + v2/n2), 2) / (pow(v1/n1,2)/(n1-1) + pow(v2/n2,2)/(n2-1));
 
       // Calculate p-value from t distribution
       boost::math::students_t t_dist(df);
@@ -126,6 +124,83 @@ double welchTwoSamplet(const Kmer& k, const arma::vec& y)
    return p_val;
 }
 
+// Sum and sum of squares of y over the samples present. Walks the set bits
+// a word at a time, so the cost is in the number of samples present
+void presenceSums(const Presence& x, const arma::vec& y, double& sum, double& sum_sq)
+{
+   sum = 0;
+   sum_sq = 0;
+
+   const std::vector<uint64_t>& words = x.words();
+   for (size_t i = 0; i < words.size(); ++i)
+   {
+      uint64_t word = words[i];
+      while (word)
+      {
+         double y_i = y[i * presence_word_bits + __builtin_ctzll(word)];
+         sum += y_i;
+         sum_sq += y_i * y_i;
+
+         word &= word - 1;
+      }
+   }
+}
+
+// As above, for several phenotypes at once. Rows of y_t are the phenotypes,
+// so each sample's values are contiguous
+void presenceSums(const Presence& x, const arma::mat& y_t, arma::vec& sum, arma::vec& sum_sq)
+{
+   sum.zeros(y_t.n_rows);
+   sum_sq.zeros(y_t.n_rows);
+
+   const std::vector<uint64_t>& words = x.words();
+   for (size_t i = 0; i < words.size(); ++i)
+   {
+      uint64_t word = words[i];
+      while (word)
+      {
+         const double* y_i = y_t.colptr(i * presence_word_bits + __builtin_ctzll(word));
+         for (size_t p = 0; p < y_t.n_rows; ++p)
+         {
+            sum[p] += y_i[p];
+            sum_sq[p] += y_i[p] * y_i[p];
+         }
+
+         word &= word - 1;
+      }
+   }
+}
+
+// Score (Rao) test for adding the k-mer column z to the null model, so needs
+// no fit of its own. The score is U = z'(y - mu) with variance
+// V = phi * (z'Wz - z'WX (X'WX)^-1 X'Wz), and U^2/V ~ chi^2 with df = 1
+double scoreTest(const Kmer& k, const FixedCovariates& fixed)
+{
+   const Presence& x = k.presence();
+
+   double U, V, U_sq, V_sq;
+   presenceSums(x, fixed.null_residuals(), U, U_sq);
+   presenceSums(x, fixed.null_weights(), V, V_sq);
+
+   arma::vec xwz = fixed.weighted_cross_product(x);
+   double z_w_z = V;
+   V -= dot(xwz, fixed.xtwx_inv() * xwz);
+
+   // k-mer is (nearly) collinear with the covariates. Leave it to the full fit
+   if (V <= collinear_limit * z_w_z)
+   {
+      return 0;
+   }
+   V *= fixed.dispersion();
+
+   double p_value = normalPval(std::abs(U) / pow(V, 0.5));
+#ifdef SEER_DEBUG
+   std::cerr << "score:" << U << " var:" << V << "\n";
+   std::cerr << "score p: " << p_value << "\n";
+#endif
+   return p_value;
+}
+
 // Fit null models for null log-likelihoods
 double nullLogLikelihood(const arma::mat& x, const arma::vec& y, const int continuous)
 {
@@ -145,19 +220,18 @@ double nullLogLikelihood(const arma::mat& x, const arma::vec& y, const int conti
    }
    else
    {
-      dlib::matrix<double,1,1> intercept;
-
       if (continuous)
       {
+         dlib::matrix<double,1,1> intercept;
          intercept(0) = mean(y);
          LinearLikelihood likelihood_fit(x, y);
          null_ll = 2*likelihood_fit(intercept);
       }
       else
       {
+         arma::vec intercept(1);
          intercept(0) = log(mean(y)/(1-mean(y))); // null is: intercept = log-odds of success
-         LogitLikelihood likelihood_fit(x, y);
-         null_ll = likelihood_fit(intercept);
+         null_ll = logitLogLikelihood(y, x, intercept);
       }
    }
    return null_ll;
@@ -170,7 +244,7 @@ double likelihoodRatioTest(Kmer& k, const double null_ll, const int continuous)
    double lrt_p = 1;
    if (log_likelihood == 0 || null_ll == 0)
    {
-      k.add_comment("zero-ll");
+      k.add_comment(comment_zero_ll);
    }
    else
    {
@@ -189,7 +263,7 @@ double likelihoodRatioTest(Kmer& k, const double null_ll, const int continuous)
          // 10.2478/v10048-009-0003-9
          // Exact Likelihood Ratio Test for the Parameters of the Linear
          // Regression Model with Normal Errors
-         lrt = k.get_x().n_rows * (1-log_likelihood/null_ll);
+         lrt = k.presence().size() * (1-log_likelihood/null_ll);
       }
       else
       {
@@ -232,7 +306,7 @@ double normalPval(double testStatistic)
    return p_val;
 }
 
-int passStatsFilters(const cmdOptions& filterOptions, Kmer& k, const arma::vec& y, const int continuous_phenotype)
+int passStatsFilters(const cmdOptions& filterOptions, Kmer& k, const centredPhenotype& y, const Presence& cases, const int continuous_phenotype)
 {
    int passed = 1;
 
@@ -242,7 +316,7 @@ int passStatsFilters(const cmdOptions& filterOptions, Kmer& k, const arma::vec&
    }
    else
    {
-      k.unadj_p_val(chiTest(k, y));
+      k.unadj_p_val(chiTest(k, cases));
    }
 
    if (k.unadj() > filterOptions.chi_cutoff)
@@ -253,3 +327,91 @@ int passStatsFilters(const cmdOptions& filterOptions, Kmer& k, const arma::vec&
    return passed;
 }
 
+// Stats filter on a block of k-mers against every phenotype, setting
+// block[i].passed[p] to 0 for those failing. Continuous phenotypes are summed
+// over together, in one walk of each k-mer's set bits
+void passStatsFilters(const cmdOptions& filterOptions, std::vector<kmerTask>& block, const std::vector<phenotypeTest>& phenotypes)
+{
+   // Rows of y_t are the centred continuous phenotypes
+   std::vector<size_t> continuous_idx;
+   for (size_t p = 0; p < phenotypes.size(); ++p)
+   {
+      if (phenotypes[p].continuous)
+      {
+         continuous_idx.push_back(p);
+      }
+   }
+
+   const size_t num_samples = phenotypes[0].y.n_elem;
+   arma::mat y_t(continuous_idx.size(), num_samples);
+   arma::vec sum_total(continuous_idx.size()), sum_sq_total(continuous_idx.size());
+   for (size_t c = 0; c < continuous_idx.size(); ++c)
+   {
+      const centredPhenotype& centred = phenotypes[continuous_idx[c]].centred;
+      y_t.row(c) = centred.y.t();
+      sum_total[c] = centred.sum;
+      sum_sq_total[c] = centred.sum_sq;
+   }
+
+   arma::vec sums, sums_sq;
+   for (size_t i = 0; i < block.size(); ++i)
+   {
+      std::vector<Kmer>& k = block[i].k;
+      block[i].passed.assign(phenotypes.size(), 1);
+
+      if (continuous_idx.size() > 0)
+      {
+         presenceSums(k[0].presence(), y_t, sums, sums_sq);
+         for (size_t c = 0; c < continuous_idx.size(); ++c)
+         {
+            Kmer& pheno_k = k[continuous_idx[c]];
+            pheno_k.unadj_p_val(welchTwoSamplet(pheno_k.num_occurrences(), sums[c], sums_sq[c], num_samples, sum_total[c], sum_sq_total[c]));
+         }
+      }
+
+      for (size_t p = 0; p < phenotypes.size(); ++p)
+      {
+         if (!phenotypes[p].continuous)
+         {
+            const Presence& cases = phenotypes[p].cases;
+            k[p].unadj_p_val(chiTest(k[p], k[p].presence().count_and(cases), k[p].num_occurrences(), cases.count(), num_samples));
+         }
+
+         if (k[p].unadj() > filterOptions.chi_cutoff)
+         {
+            block[i].passed[p] = 0;
+         }
+      }
+   }
+}
+
+// Score test filter on a block of k-mers, clearing passed[p] for those with
+// a score test p-value above the cutoff
+void passScoreFilter(const cmdOptions& filterOptions, std::vector<kmerTask>& block, const std::vector<phenotypeTest>& phenotypes)
+{
+   for (size_t i = 0; i < block.size(); ++i)
+   {
+      for (size_t p = 0; p < phenotypes.size(); ++p)
+      {
+         if (block[i].passed[p] && scoreTest(block[i].k[p], phenotypes[p].fixed) > filterOptions.score_cutoff)
+         {
+            block[i].passed[p] = 0;
+         }
+      }
+   }
+}
+
+// Whether a tested k-mer is significant enough to be printed. A cutoff of 1
+// prints every k-mer tested, including those with p = 1 exactly
+int passAssocFilter(const cmdOptions& filterOptions, const Kmer& k)
+{
+   int passed = 1;
+
+   if (filterOptions.filter && filterOptions.log_cutoff < 1
+         && k.p_val() >= filterOptions.log_cutoff && k.lrt_p_val() >= filterOptions.log_cutoff)
+   {
+      passed = 0;
+   }
+
+   return passed;
+}
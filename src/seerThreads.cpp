@@ -0,0 +1,290 @@
+/*
+ * File: seerThreads.cpp
+ *
+ * Reader and worker threads for seer's main loop. The reader parses and
+ * filters k-mers into a bounded queue, a pool of workers runs the association
+ * tests, and results are handed back in input order to be printed
+ *
+ */
+
+#include "seer.hpp"
+
+#include <algorithm>
+
+// Reads the dsm or .kmx file, applying the pre-filters. k-mers passing the
+// basic filters are collected into blocks for the stats filter, then the
+// score test if requested, against each phenotype. k-mers to be tested
+// against any phenotype are numbered in order and queued for the workers; the
+// queue is closed at the end of the file. With --permutations all k-mers
+// passing the basic filters are queued, to be scored against the
+// permutations. When sharding by line, only every num_shards'th k-mer is
+// read; input_line counts the k-mers read. Resuming from a checkpoint,
+// line_nr and input_line start from their saved values. Tasks which have
+// been written are taken back from recycled, and every line is read into the
+// same k-mer, so the reader doesn't allocate once it is running
+void readKmers(DsmReader& dsm_reader, BlockingQueue<kmerTask>& work_queue, RecyclePool<kmerTask>& recycled, const cmdOptions& parameters, const std::vector<phenotypeTest>& phenotypes, long int line_nr, long int& input_line, long int& queued_kmers)
+{
+   ProfileThread profile_thread("reader");
+
+   std::vector<kmerTask> block;
+   block.reserve(stats_block_size);
+
+   const int shard_by_line = parameters.num_shards > 1 && !parameters.shard_by_range;
+
+   Kmer k;
+   kmerTask task;
+   int more_kmers = 1;
+   while (more_kmers)
+   {
+      {
+         ProfileTimer timer(profile_parse);
+         more_kmers = dsm_reader.next(k);
+      }
+      if (more_kmers)
+      {
+         if (shard_by_line && line_nr % parameters.num_shards != parameters.shard)
+         {
+            ++line_nr;
+            continue; // In another shard
+         }
+         k.set_line_nr(++line_nr);
+         ++input_line;
+
+         // apply filters here
+         int passed = 1;
+         if (parameters.filter)
+         {
+            ProfileTimer timer(profile_basic_filter);
+            passed = passBasicFilters(parameters, k);
+         }
+         if (passed)
+         {
+            newTask(task, k, phenotypes.size(), recycled);
+            task.input_line = input_line;
+            task.block_offset = dsm_reader.block_offset();
+            task.block_line = dsm_reader.block_line();
+            queueTask(task, block, work_queue, parameters, queued_kmers);
+         }
+      }
+
+      if (block.size() == stats_block_size || (!more_kmers && !block.empty()))
+      {
+         queueBlock(block, work_queue, recycled, parameters, phenotypes, queued_kmers);
+      }
+   }
+
+   work_queue.close();
+}
+
+// Reader thread for libseer. As readKmers, for num_kmers k-mers given in
+// memory, which load reads into k. The tasks' input_line is the k-mer's index
+void loadKmers(const std::function<void(const size_t, Kmer&)>& load, const size_t num_kmers, BlockingQueue<kmerTask>& work_queue, RecyclePool<kmerTask>& recycled, const cmdOptions& parameters, const std::vector<phenotypeTest>& phenotypes)
+{
+   std::vector<kmerTask> block;
+   block.reserve(stats_block_size);
+   long int queued_kmers = 0;
+
+   Kmer k;
+   kmerTask task;
+   for (size_t i = 0; i < num_kmers; ++i)
+   {
+      load(i, k);
+      if (!parameters.filter || passBasicFilters(parameters, k))
+      {
+         newTask(task, k, phenotypes.size(), recycled);
+         task.input_line = i;
+         queueTask(task, block, work_queue, parameters, queued_kmers);
+      }
+
+      if (block.size() == stats_block_size || (i == num_kmers - 1 && !block.empty()))
+      {
+         queueBlock(block, work_queue, recycled, parameters, phenotypes, queued_kmers);
+      }
+   }
+
+   work_queue.close();
+}
+
+// Without filtering, tasks go straight to the workers. Otherwise they are
+// collected into a block for the stats filter
+void queueTask(kmerTask& task, std::vector<kmerTask>& block, BlockingQueue<kmerTask>& work_queue, const cmdOptions& parameters, long int& queued_kmers)
+{
+   if (!parameters.filter)
+   {
+      task.order = queued_kmers++;
+      work_queue.push(std::move(task));
+   }
+   else
+   {
+      block.push_back(std::move(task));
+   }
+}
+
+// Applies the stats filter, and the score test if requested, to a block of
+// k-mers which passed the basic filters. Those to be tested against any
+// phenotype are numbered and queued, and the rest recycled
+void queueBlock(std::vector<kmerTask>& block, BlockingQueue<kmerTask>& work_queue, RecyclePool<kmerTask>& recycled, const cmdOptions& parameters, const std::vector<phenotypeTest>& phenotypes, long int& queued_kmers)
+{
+   {
+      ProfileTimer timer(profile_stats_filter, block.size());
+      passStatsFilters(parameters, block, phenotypes);
+   }
+   if (parameters.score_test)
+   {
+      ProfileTimer timer(profile_score_filter, block.size());
+      passScoreFilter(parameters, block, phenotypes);
+   }
+   for (size_t i = 0; i < block.size(); ++i)
+   {
+      if (parameters.permutations || std::find(block[i].passed.begin(), block[i].passed.end(), 1) != block[i].passed.end())
+      {
+#ifdef SEER_DEBUG
+         std::cerr << "kmer " + block[i].k[0].sequence() + " seems significant\n";
+#endif
+         block[i].order = queued_kmers++;
+         work_queue.push(std::move(block[i]));
+      }
+      else
+      {
+         recycled.put(block[i]);
+      }
+   }
+   block.clear();
+}
+
+// A task with k for each phenotype, to be tested against all of them. A
+// recycled task is used if there is one. k is swapped in as the last
+// phenotype's k-mer, leaving k with recycled storage to read the next k-mer
+// into, so with one phenotype nothing is copied. Any other phenotypes get
+// copies, into the storage of the recycled k-mers
+void newTask(kmerTask& task, Kmer& k, const size_t num_phenotypes, RecyclePool<kmerTask>& recycled)
+{
+   recycled.get(task);
+   task.k.resize(num_phenotypes);
+   for (size_t p = 0; p + 1 < num_phenotypes; ++p)
+   {
+      task.k[p] = k;
+   }
+   std::swap(task.k[num_phenotypes - 1], k);
+   task.passed.assign(num_phenotypes, 1);
+}
+
+// Worker thread. Takes up to worker_batch_size k-mers at a time from the
+// queue until it is closed and empty, and tests them against each phenotype
+// they passed the filters for, then passes them on to be printed. k-mers with
+// a presence pattern that has already been tested take the cached result
+// instead. Logistic fits of the batch are run together. Permutation scores
+// are kept for this thread, and merged at the end
+void testKmers(BlockingQueue<kmerTask>& work_queue, ReorderBuffer<kmerTask>& results, const cmdOptions& parameters, const std::vector<phenotypeTest>& phenotypes)
+{
+   ProfileThread profile_thread("worker");
+   logitBatchWorkspace workspace;
+   std::vector<arma::vec> max_stats(phenotypes.size());
+   arma::vec scores;
+
+   std::vector<kmerTask> tasks(worker_batch_size);
+   std::vector<Kmer*> fits;
+   fits.reserve(worker_batch_size);
+   while (work_queue.pop(tasks[0]))
+   {
+      // Only wait for the first of the batch
+      size_t num_tasks = 1;
+      while (num_tasks < worker_batch_size && work_queue.try_pop(tasks[num_tasks]))
+      {
+         ++num_tasks;
+      }
+
+      for (size_t p = 0; p < phenotypes.size(); ++p)
+      {
+         const phenotypeTest& phenotype = phenotypes[p];
+         if (phenotype.permutations)
+         {
+            ProfileTimer timer(profile_permutations, num_tasks);
+            for (size_t i = 0; i < num_tasks; ++i)
+            {
+               phenotype.permutations->add(tasks[i].k[p].presence(), max_stats[p], scores);
+            }
+         }
+
+         fits.clear();
+         for (size_t i = 0; i < num_tasks; ++i)
+         {
+            if (!tasks[i].passed[p])
+            {
+               continue;
+            }
+            Kmer& k = tasks[i].k[p];
+            if (phenotype.patterns->find(k))
+            {
+               profileCount(profile_cache_hit);
+            }
+            else
+            {
+               fits.push_back(&k);
+            }
+         }
+         if (fits.empty())
+         {
+            continue;
+         }
+
+         // Association test
+         if (phenotype.lmm)
+         {
+            ProfileTimer timer(profile_lmm_fit, fits.size());
+            for (auto it = fits.begin(); it != fits.end(); ++it)
+            {
+               phenotype.lmm->test(**it);
+            }
+         }
+         else if (phenotype.continuous)
+         {
+            ProfileTimer timer(profile_linear_fit, fits.size());
+            for (auto it = fits.begin(); it != fits.end(); ++it)
+            {
+               linearTest(**it, phenotype.fixed);
+            }
+         }
+         else
+         {
+            ProfileTimer timer(profile_logistic_fit, fits.size());
+            logisticTest(fits, phenotype.fixed, workspace);
+         }
+
+         for (auto it = fits.begin(); it != fits.end(); ++it)
+         {
+            Kmer& k = **it;
+
+            // Caclculate chisq value if not already done so in filtering
+            if (passAssocFilter(parameters, k) && k.unadj() == kmer_chi_pvalue_default)
+            {
+               if (phenotype.continuous)
+               {
+                  k.unadj_p_val(welchTwoSamplet(k, phenotype.centred));
+               }
+               else
+               {
+                  k.unadj_p_val(chiTest(k, phenotype.cases));
+               }
+            }
+
+            phenotype.patterns->insert(k);
+         }
+      }
+
+      for (size_t i = 0; i < num_tasks; ++i)
+      {
+         results.push(tasks[i].order, std::move(tasks[i]));
+      }
+   }
+
+   for (size_t p = 0; p < phenotypes.size(); ++p)
+   {
+      if (phenotypes[p].permutations)
+      {
+         phenotypes[p].permutations->merge(max_stats[p]);
+      }
+   }
+
+   results.done();
+}
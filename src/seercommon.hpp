@@ -24,6 +24,7 @@
 
 // gzstream headers
 #include <gzstream.h>
+#include "bgzf.hpp"
 
 // Boost headers
 #include <boost/program_options.hpp>
@@ -35,10 +36,17 @@
 #include <armadillo>
 #include <dlib/matrix.h>
 
+// Small regression kernels
+#include "fixedKernels.hpp"
+
 // Classes
 #include "kmer.hpp"
 #include "sample.hpp"
+#include "sampleDictionary.hpp"
 #include "covar.hpp"
+#include "kmerMatrix.hpp"
+#include "checkpoint.hpp"
+#include "dsmReader.hpp"
 
 // Constants
 const std::string VERSION = "1.1.4";
@@ -56,20 +64,31 @@ struct cmdOptions
 {
    double log_cutoff;
    double chi_cutoff;
+   double score_cutoff;
+   double sample_fraction;
 
    long int max_length;
    long int size;
    int filter;
+   int score_test;
    int pc;
    int print_samples;
    int write_distances;
+   int kinship;
+   unsigned int kinship_rank; // 0 for full rank
    unsigned int num_threads;
+   unsigned int shard; // From 0
+   unsigned int num_shards;
+   int shard_by_range; // Shard BGZF input by blocks, rather than every num_shards'th k-mer
+   unsigned int permutations;
+   unsigned int checkpoint_interval; // seconds
    size_t min_words;
    size_t max_words;
 
    std::string pheno;
    std::string kmers;
    std::string output;
+   std::string checkpoint; // Empty for no checkpoints
 };
 
 // Function headers
@@ -91,17 +110,22 @@ void badCommand(const std::string& command, const std::string& value);
 
 // seerIO headers
 void readPheno(const std::string& filename, std::vector<Sample>& samples, std::unordered_map<std::string,int>& sample_map);
-void openDsmFile(igzstream& dsm_file, const std::string& file_name);
+void openDsmFile(DsmStream& dsm_file, const std::string& file_name, const unsigned int threads = 1, const uint64_t start_offset = 0, const uint64_t end_offset = UINT64_MAX);
 
 arma::vec constructVecY(const std::vector<Sample>& samples);
+Presence constructCases(const arma::vec& y);
 arma::vec constructVecX(const Kmer& k, const std::vector<Sample>& samples);
 
 arma::mat readHDF5(const std::string& file_name);
 
 void writeMDS(const std::string& file_name, const std::vector<Sample>& sample_names, const arma::mat& MDS);
+void writeSampleNames(const std::string& file_name, const std::vector<Sample>& sample_names);
+void writePartialDistances(const std::string& file_name, const std::vector<Sample>& sample_names, const arma::mat& counts, const long int num_kmers);
+arma::mat readPartialDistances(const std::string& file_name, const std::vector<Sample>& sample_names, long int& num_kmers);
 void writeDistances(const std::string& file_name, const arma::mat& distances);
 arma::mat readMDS(const std::string& file_name, const std::vector<Sample>& sample_names);
 arma::mat readMDSList(const std::string& filename);
+arma::mat readPartialList(const std::string& filename, const std::vector<Sample>& sample_names, long int& num_kmers);
 
 arma::mat parseCovars(const std::string& file, const std::string& columns);
 std::vector<std::tuple<int,bool>> parseCovarColumns(const std::string& columns);
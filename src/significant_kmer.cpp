@@ -8,6 +8,10 @@
 
 #include "significant_kmer.hpp"
 
+#include <cstdlib>
+#include <cctype>
+#include <limits>
+
 Significant_kmer::Significant_kmer()
    :_line_nr(0), _num_covars(default_covars)
 {
@@ -18,8 +22,8 @@ Significant_kmer::Significant_kmer(const int num_covars)
 {
 }
 
-Significant_kmer::Significant_kmer(const std::string& word, const std::vector<std::string>& samples, const double maf, const double unadj_p, const double adj_p, const double lrt_p, const double beta, const double se, const std::string& comments)
-   :_line_nr(0), _word(word), _samples(samples), _maf(maf), _unadj_p(unadj_p), _adj_p(adj_p), _adj_lrt_p(lrt_p), _beta(beta), _se(se), _comment(comments), _num_covars(default_covars)
+Significant_kmer::Significant_kmer(const std::string& word, const std::vector<std::string>& samples, const double maf, const double unadj_p, const double adj_p, const double lrt_p, const double beta, const double se, const std::string& comments, const int num_covars)
+   :_line_nr(0), _word(word), _samples(samples), _maf(maf), _unadj_p(unadj_p), _adj_p(adj_p), _adj_lrt_p(lrt_p), _beta(beta), _se(se), _comment(comments), _num_covars(num_covars)
 {
 }
 
@@ -27,38 +31,46 @@ Significant_kmer::Significant_kmer(const std::string& word, const std::vector<st
 // Sample vector is returned sorted
 std::istream& operator>>(std::istream &is, Significant_kmer& sk)
 {
-   double maf, unadj_p, adj_p, lrt_p, beta, se;
-   std::string sequence, sample, line_in, comments = "";
+   double stats[6] = {0, 0, 0, 0, 0, 0}; // maf, unadj_p, adj_p, lrt_p, beta, se
+   std::string sequence, comments = "";
    std::vector<std::string> sample_list;
 
-   // Read the line convert to stringstream, extract sequence and stats fields
+   // Read the line, then split it in place into sequence, stats, covariates
+   // (ignored), comments and samples
+   std::string line_in;
    std::getline(is, line_in);
-   std::stringstream line_stream(line_in);
 
-   line_stream >> sequence;
+   size_t pos = 0, start, length;
+   if (nextField(line_in, pos, start, length))
+   {
+      sequence.assign(line_in, start, length);
+   }
 
-   line_stream >> maf;
-   line_stream >> unadj_p;
-   line_stream >> adj_p;
-   line_stream >> lrt_p;
-   line_stream >> beta;
-   line_stream >> se;
+   for (unsigned int i = 0; i < 6 && nextField(line_in, pos, start, length); ++i)
+   {
+      stats[i] = strtod(line_in.c_str() + start, NULL);
+   }
 
    // Ignore the covariate fields
-   for (unsigned int i = 0; i < sk.num_covars(); ++i)
+   for (unsigned int i = 0; i < sk.num_covars() && nextField(line_in, pos, start, length); ++i)
    {
-      line_stream.ignore(std::numeric_limits<std::streamsize>::max(), '\t');
    }
 
-   line_stream >> comments;
+   if (nextField(line_in, pos, start, length))
+   {
+      comments.assign(line_in, start, length);
+   }
 
-   // Read remainder of line, which is sample names, in the same way they were
-   // written
-   std::copy(std::istream_iterator<std::string>(line_stream), std::istream_iterator<std::string>(), std::back_inserter(sample_list));
+   // Remainder of line is sample names, in the same way they were written
+   while (nextField(line_in, pos, start, length))
+   {
+      sample_list.emplace_back(line_in, start, length);
+   }
 
-   // Ensure vector remains sorted on sample name
+   // Ensure vector remains sorted on sample name. The number of covariate
+   // fields is kept for the next line
    std::sort(sample_list.begin(), sample_list.end());
-   sk = Significant_kmer(sequence, sample_list, maf, unadj_p, adj_p, lrt_p, beta, se, comments);
+   sk = Significant_kmer(sequence, sample_list, stats[0], stats[1], stats[2], stats[3], stats[4], stats[5], comments, sk.num_covars());
 
    return is;
 }
@@ -70,7 +82,7 @@ std::ostream& operator<<(std::ostream &os, const Significant_kmer& k)
       << "\t" << std::scientific << k.unadj() << "\t" << k.p_val() << "\t" << k.lrt_p_val()
       << "\t" << k.beta() << "\t" << k.se();
 
-   std::vector<std::string> samples_found = k.samples_found();
+   const std::vector<std::string>& samples_found = k.samples_found();
    if (samples_found.size() > 0)
    {
       os << "\t";
@@ -115,7 +127,7 @@ std::string Significant_kmer::rev_comp() const
         case 'T':
             return 'A';
         default:
-            throw std::runtime_error("Invalid nucleotide");
+            return c; // N and other ambiguous bases are left as they are
         }
     };
 
@@ -125,6 +137,151 @@ std::string Significant_kmer::rev_comp() const
 }
 
 
+/*
+ * SignificantKmerReader
+ */
+SignificantKmerReader::SignificantKmerReader()
+   :_binary(0), _num_covars(default_covars), _has_samples(0)
+{
+}
+
+int SignificantKmerReader::open(const std::string& file_name)
+{
+   _file_name = file_name;
+   _file.open(file_name.c_str(), std::ios::in | std::ios::binary);
+   if (!_file)
+   {
+      return 0;
+   }
+
+   std::string magic(binary_results_magic.length(), '\0');
+   _file.read(&magic[0], magic.length());
+   _binary = _file.gcount() == (std::streamsize)magic.length() && magic == binary_results_magic;
+   if (_binary)
+   {
+      uint32_t fields[2];
+      if (!_file.read((char*)fields, sizeof(fields)))
+      {
+         throw std::runtime_error("Could not read the header of " + file_name);
+      }
+      _num_covars = fields[0];
+      _has_samples = fields[1];
+   }
+   else
+   {
+      _file.clear();
+      _file.seekg(0);
+
+      std::string header;
+      std::getline(_file, header);
+      _num_covars = parseHeader(header);
+   }
+
+   return 1;
+}
+
+int SignificantKmerReader::next(Significant_kmer& sk)
+{
+   if (!_binary)
+   {
+      Significant_kmer read_kmer(_num_covars);
+      if (_file >> read_kmer)
+      {
+         sk = std::move(read_kmer);
+         return 1;
+      }
+      return 0;
+   }
+
+   auto read_string = [this](std::string& field)
+   {
+      uint32_t length;
+      _file.read((char*)&length, sizeof(uint32_t));
+      field.resize(length);
+      if (length)
+      {
+         _file.read(&field[0], length);
+      }
+   };
+
+   read_string(_sequence);
+   if (_file.gcount() == 0 && _file.eof())
+   {
+      return 0;
+   }
+
+   double stats[6];
+   uint32_t count = 0;
+   _file.read((char*)stats, sizeof(stats));
+   _file.read((char*)&count, sizeof(uint32_t));
+   _file.ignore(count * sizeof(double)); // Covariates aren't kept, as with text
+   read_string(_comments);
+
+   _samples.clear();
+   if (_has_samples)
+   {
+      _file.read((char*)&count, sizeof(uint32_t));
+      _samples.resize(_file ? count : 0);
+      for (auto it = _samples.begin(); it != _samples.end(); ++it)
+      {
+         read_string(*it);
+      }
+      std::sort(_samples.begin(), _samples.end());
+   }
+
+   if (!_file)
+   {
+      throw std::runtime_error("Truncated binary results in " + _file_name);
+   }
+
+   sk = Significant_kmer(_sequence, _samples, stats[0], stats[1], stats[2], stats[3], stats[4], stats[5], _comments, _num_covars);
+   return 1;
+}
+
+void appendBinaryHeader(std::string& buffer, const unsigned int num_covars, const int with_samples)
+{
+   uint32_t fields[2] = {num_covars, with_samples ? 1u : 0u};
+   buffer.append(binary_results_magic);
+   buffer.append((const char*)fields, sizeof(fields));
+}
+
+void appendBinaryResult(std::string& buffer, const Significant_kmer& k, const int with_samples)
+{
+   appendBinaryStats(buffer, k);
+   appendBinaryString(buffer, k.comments());
+
+   if (with_samples)
+   {
+      const std::vector<std::string>& samples = k.samples_found();
+      uint32_t count = samples.size();
+      buffer.append((const char*)&count, sizeof(uint32_t));
+      for (auto it = samples.begin(); it != samples.end(); ++it)
+      {
+         appendBinaryString(buffer, *it);
+      }
+   }
+}
+
+void appendBinaryStats(std::string& buffer, const Significant_kmer& k)
+{
+   appendBinaryString(buffer, k.sequence());
+
+   double stats[6] = {k.maf(), k.unadj(), k.p_val(), k.lrt_p_val(), k.beta(), k.se()};
+   buffer.append((const char*)stats, sizeof(stats));
+
+   const std::vector<double>& covariates = k.covar_p();
+   uint32_t count = covariates.size();
+   buffer.append((const char*)&count, sizeof(uint32_t));
+   buffer.append((const char*)covariates.data(), count * sizeof(double));
+}
+
+void appendBinaryString(std::string& buffer, const std::string& field)
+{
+   uint32_t length = field.length();
+   buffer.append((const char*)&length, sizeof(uint32_t));
+   buffer.append(field);
+}
+
 // Returns number of excess columns (i.e. number of covariate fields)
 int parseHeader(const std::string& header_line)
 {
@@ -194,27 +351,49 @@ void sortSigKmer::addSortField(const std::string& sort_field)
 
 bool sortSigKmer::operator() (const Significant_kmer& sk1, const Significant_kmer& sk2) const
 {
-   bool compare;
+   return value(sk1) < value(sk2);
+}
+
+double sortSigKmer::value(const Significant_kmer& sk) const
+{
+   double sort_value;
    switch (_sort_field)
    {
       case 1:
-         compare = sk1.maf() < sk2.maf();
+         sort_value = sk.maf();
          break;
       case 2:
-         compare = sk1.unadj() < sk2.unadj();
+         sort_value = sk.unadj();
          break;
       case 3:
-         compare = sk1.p_val() < sk2.p_val();
+         sort_value = sk.p_val();
          break;
       case 4:
-         compare = sk1.beta() < sk2.beta();
+         sort_value = sk.beta();
          break;
       case 5:
-         compare = sk1.sequence().length() < sk2.sequence().length();
+         sort_value = sk.sequence().length();
          break;
       default:
-         compare = sk1.p_val() < sk2.p_val();
+         sort_value = sk.p_val();
+   }
+   return sort_value;
+}
+
+int nextField(const std::string& line, size_t& pos, size_t& start, size_t& length)
+{
+   while (pos < line.length() && isspace(line[pos]))
+   {
+      pos++;
    }
-   return compare;
+   start = pos;
+
+   while (pos < line.length() && !isspace(line[pos]))
+   {
+      pos++;
+   }
+   length = pos - start;
+
+   return (length > 0);
 }
 
@@ -4,7 +4,9 @@
  *
  */
 
+#include <cstdint>
 #include <iostream>
+#include <fstream>
 #include <iomanip>
 #include <sstream>
 #include <string>
@@ -16,6 +18,20 @@
 const int default_covars = 0;
 const int standard_cols = 8;
 
+// Binary results, as written by seer --binary_results. Integers and doubles
+// are in host (little endian) byte order
+//    magic         8 bytes, "SEERRES1"
+//    num_covars    uint32, covariate p-value columns
+//    has_samples   uint32, 1 if written with --print_samples
+// Then for each k-mer
+//    sequence      uint32 length, then the bases
+//    stats         6 doubles: maf, chisq_p_val, wald_p_val, lrt_p_val, beta, se
+//    covariates    uint32 count, then that many doubles
+//    comments      uint32 length, then the text
+//    samples       if has_samples, uint32 count, then each as uint32 length and
+//                  the name
+const std::string binary_results_magic = "SEERRES1";
+
 // kmers have a sequence, and a list of samples they appear in
 class Significant_kmer
 {
@@ -23,20 +39,20 @@ class Significant_kmer
       // Initialisation
       Significant_kmer();
       Significant_kmer(const int num_covars);
-      Significant_kmer(const std::string& word, const std::vector<std::string>& samples, const double maf, const double unadj_p, const double adj_p, const double lrt_p, const double beta, const double se, const std::string& comments);
+      Significant_kmer(const std::string& word, const std::vector<std::string>& samples, const double maf, const double unadj_p, const double adj_p, const double lrt_p, const double beta, const double se, const std::string& comments, const int num_covars = default_covars);
 
       // nonmodifying operations
       long int line_number() const { return _line_nr; }
-      std::vector<std::string> samples_found() const { return _samples; }
-      std::string sequence() const { return _word; }
+      const std::vector<std::string>& samples_found() const { return _samples; }
+      const std::string& sequence() const { return _word; }
       double maf() const { return _maf; }
       double unadj() const { return _unadj_p; }
       double p_val() const { return _adj_p; }
       double lrt_p_val() const { return _adj_lrt_p; }
       double beta() const { return _beta; }
       double se() const { return _se; }
-      std::string comments() const { return _comment; }
-      std::vector<double> covar_p() const { return _covar_p; }
+      const std::string& comments() const { return _comment; }
+      const std::vector<double>& covar_p() const { return _covar_p; }
       unsigned int num_covars() const; // Defined in significant_kmer.cpp
       std::string rev_comp() const; // Defined in significant_kmer.cpp
 
@@ -80,12 +96,43 @@ class sortSigKmer
 
       // Overload for sort
       bool operator() (const Significant_kmer& sk1, const Significant_kmer& sk2) const;
+      double value(const Significant_kmer& sk) const; // of the sort field
       explicit operator bool() const { return (_sort_field > 0); };
 
    private:
       int _sort_field;
 };
 
+// Reads seer output, either text or binary results, detected from the
+// start of the file
+class SignificantKmerReader
+{
+   public:
+      SignificantKmerReader();
+
+      // Reads the header. Returns 0 if the file can't be opened
+      int open(const std::string& file_name);
+      void close() { _file.close(); }
+
+      // Returns 0 at the end of the file
+      int next(Significant_kmer& sk);
+
+      // nonmodifying operations
+      int num_covars() const { return _num_covars; }
+      int is_binary() const { return _binary; }
+
+   private:
+      std::ifstream _file;
+      std::string _file_name;
+      int _binary;
+      int _num_covars;
+      int _has_samples;
+
+      std::vector<std::string> _samples;
+      std::string _sequence;
+      std::string _comments;
+};
+
 // Overload input and output operators
 std::istream& operator>>(std::istream &is, Significant_kmer& sk);
 
@@ -94,3 +141,16 @@ std::ostream& operator<<(std::ostream &os, const Significant_kmer& k);
 // Function for reading header to find number of covariate fields
 int parseHeader(const std::string& header_line);
 
+// Appends k's binary results record to buffer. A record can also be built
+// from its parts: the fields up to the covariates, then strings for the
+// comments and each sample
+void appendBinaryResult(std::string& buffer, const Significant_kmer& k, const int with_samples);
+void appendBinaryStats(std::string& buffer, const Significant_kmer& k);
+void appendBinaryString(std::string& buffer, const std::string& field);
+void appendBinaryHeader(std::string& buffer, const unsigned int num_covars, const int with_samples);
+
+// Splits lines on whitespace in place. Sets start and length of the next field
+// from pos onwards, and moves pos past it. Returns 0 if there are no more
+// fields
+int nextField(const std::string& line, size_t& pos, size_t& start, size_t& length);
+
@@ -0,0 +1,154 @@
+#!/usr/bin/perl -w
+
+use strict;
+use warnings;
+
+use File::Temp qw/ tempdir /;
+use Getopt::Long;
+use Time::HiRes qw/ time /;
+
+# End to end benchmarks of kmds and seer on a generated dsm file. Prints the
+# wall time of each run, and its ratio to a baseline written by a previous
+# --out. Micro benchmarks of the kernels are in ../src/seer_bench
+
+my $seer_location = "../src/";
+my $samples = 2000;
+my $kmers = 100000;
+my $threads = 1;
+my $repeats = 3;
+my $seed = 1;
+my ($out_file, $baseline_file, $help);
+
+GetOptions("samples=i" => \$samples,
+           "kmers=i" => \$kmers,
+           "threads=i" => \$threads,
+           "repeats=i" => \$repeats,
+           "out=s" => \$out_file,
+           "baseline=s" => \$baseline_file,
+           "help|h" => \$help) || die("Error in command line arguments\n");
+
+if ($help)
+{
+   print STDERR "Usage: run_bench.pl [--samples $samples] [--kmers $kmers] [--threads $threads] [--repeats $repeats] [--out results.txt] [--baseline results.txt]\n";
+   exit(0);
+}
+
+# Writes a binary phenotype and a dsm file with k-mers at a range of
+# frequencies. Runs of k-mers share a presence pattern, as overlapping k-mers
+# do, and the phenotype is associated with some of them
+sub generate_input($$$$)
+{
+   my ($pheno_file, $dsm_file, $num_samples, $num_kmers) = @_;
+
+   srand($seed);
+
+   my (@names, @pheno);
+   open(PHENO, ">$pheno_file") || die("Could not write $pheno_file\n");
+   for (my $i = 0; $i < $num_samples; $i++)
+   {
+      push(@names, "sample_$i");
+      push(@pheno, rand() < 0.5 ? 1 : 0);
+      print PHENO join("\t", $names[$i], $names[$i], $pheno[$i]) . "\n";
+   }
+   close PHENO;
+
+   my @bases = ("A", "C", "G", "T");
+   open(DSM, "| gzip -c > $dsm_file") || die("Could not write $dsm_file\n");
+   my @present;
+   for (my $kmer_idx = 0; $kmer_idx < $num_kmers; $kmer_idx++)
+   {
+      if ($kmer_idx % 4 == 0)
+      {
+         my $freq = 0.05 + 0.9 * rand();
+         my $assoc = rand() < 0.1 ? 0.3 : 0;
+
+         @present = ();
+         for (my $i = 0; $i < $num_samples; $i++)
+         {
+            my $p = $freq + ($pheno[$i] ? $assoc : -$assoc) * $freq * (1 - $freq);
+            if (rand() < $p)
+            {
+               push(@present, "$names[$i]:1");
+            }
+         }
+      }
+
+      my $sequence = join("", map { $bases[int(rand(4))] } (1 .. 31));
+      print DSM join(" ", $sequence, "5.033430 0.161246 100 0 100 0.151841 100 |", @present) . "\n";
+   }
+   close DSM;
+}
+
+# Wall time of the fastest of the repeats
+sub time_command($)
+{
+   my ($command) = @_;
+
+   my $best;
+   for (my $i = 0; $i < $repeats; $i++)
+   {
+      my $start = time();
+      system("$command > /dev/null 2>&1") == 0 || die("Failed to run: $command\n");
+      my $elapsed = time() - $start;
+
+      if (!defined($best) || $elapsed < $best)
+      {
+         $best = $elapsed;
+      }
+   }
+
+   return($best);
+}
+
+my %baseline;
+if (defined($baseline_file))
+{
+   open(BASELINE, $baseline_file) || die("Could not open $baseline_file\n");
+   while (my $line = <BASELINE>)
+   {
+      chomp $line;
+      next if ($line =~ /^#/);
+
+      my ($name, $seconds) = split("\t", $line);
+      $baseline{$name} = $seconds;
+   }
+   close BASELINE;
+}
+
+my $dir = tempdir(CLEANUP => 1);
+my $pheno = "$dir/bench.pheno";
+my $dsm = "$dir/bench_kmers.gz";
+generate_input($pheno, $dsm, $samples, $kmers);
+
+my $size = "n:$samples/kmers:$kmers/threads:$threads";
+my @benchmarks = (
+   ["kmds/$size", "$seer_location/kmds -k $dsm -p $pheno -o $dir/bench --size $kmers --pc 3 --threads $threads --no_filtering"],
+   ["seer/$size", "$seer_location/seer -k $dsm -p $pheno --threads $threads"],
+   ["seer_struct/$size", "$seer_location/seer -k $dsm -p $pheno --struct $dir/bench.dsm --threads $threads"],
+   ["seer_all/$size", "$seer_location/seer -k $dsm -p $pheno --struct $dir/bench.dsm --threads $threads --pval 1 --chisq 1"]);
+
+my @results;
+printf("%-48s %12s %10s\n", "benchmark", "seconds", "vs_base");
+foreach my $benchmark (@benchmarks)
+{
+   my ($name, $command) = @$benchmark;
+   my $seconds = time_command($command);
+   push(@results, [$name, $seconds]);
+
+   my $ratio = exists($baseline{$name}) ? sprintf("%.3f", $seconds / $baseline{$name}) : (%baseline ? "new" : "");
+   printf("%-48s %12.3f %10s\n", $name, $seconds, $ratio);
+}
+
+if (defined($out_file))
+{
+   open(OUT, ">$out_file") || die("Could not write $out_file\n");
+   print OUT "#name\tseconds\n";
+   foreach my $result (@results)
+   {
+      print OUT join("\t", @$result) . "\n";
+   }
+   close OUT;
+}
+
+exit(0);
+
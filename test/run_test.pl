@@ -3,7 +3,7 @@
 use strict;
 use warnings;
 
-use File::Temp qw/ :POSIX /;
+use File::Temp qw/ :POSIX tempdir /;
 
 my $exit_status = 0;
 my $seer_location = "../src/";
@@ -37,6 +37,80 @@ sub do_test($$$$)
    return($fail);
 }
 
+# Runs two commands which should give the same output, such as a mode of a
+# program and its default run. Fails if they differ, or give nothing
+sub do_compare($$$$)
+{
+   my ($command, $reference, $num, $name) = @_;
+
+   my $fail = 0;
+
+   my $outfile = tmpnam();
+   my $reffile = tmpnam();
+   system("($command) > $outfile 2> /dev/null");
+   system("($reference) > $reffile 2> /dev/null");
+
+   my $outdiff = `diff -q $outfile $reffile`;
+   if ($outdiff ne "" || -z $reffile)
+   {
+      print STDERR "FAILED test $num, $name\n";
+      print STDERR $outdiff . "\n";
+      $fail = 1;
+   }
+   else
+   {
+      print STDERR "PASSED test $num, $name\n";
+   }
+
+   unlink($outfile, $reffile);
+
+   return($fail);
+}
+
+# Writes k-mer counts for combineKmers to a temporary directory: the 31-mers
+# of the start of 6259_5_16.fa, each sample missing a different fifth of
+# them. Returns the directory, which has the sample list in samples.txt
+sub write_counts()
+{
+   my $count_dir = tempdir(CLEANUP => 1);
+
+   my $sequence = "";
+   open(FASTA, "6259_5_16.fa") || die("Could not open 6259_5_16.fa\n");
+   while (my $fasta_line = <FASTA>)
+   {
+      next if ($fasta_line =~ /^>/);
+      chomp $fasta_line;
+      $sequence .= $fasta_line;
+      last if (length($sequence) >= 20000);
+   }
+   close FASTA;
+
+   open(SAMPLES, ">$count_dir/samples.txt") || die("Could not write $count_dir/samples.txt\n");
+   for (my $sample = 1; $sample <= 6; $sample++)
+   {
+      my %counts;
+      for (my $pos = 0; $pos + 31 <= length($sequence); $pos++)
+      {
+         my $kmer = substr($sequence, $pos, 31);
+         next if ($kmer =~ /[^ACGT]/ || ($pos * 7 + $sample * 13) % 5 == 0);
+         $counts{$kmer} += 1 + ($pos + $sample) % 3;
+      }
+
+      # Sorted by k-mer, as --sorted needs
+      open(COUNTS, ">$count_dir/sample$sample.txt") || die("Could not write $count_dir/sample$sample.txt\n");
+      foreach my $kmer (sort keys %counts)
+      {
+         print COUNTS "$kmer\t$counts{$kmer}\n";
+      }
+      close COUNTS;
+
+      print SAMPLES "sample$sample\t$count_dir/sample$sample.txt\n";
+   }
+   close SAMPLES;
+
+   return($count_dir);
+}
+
 $exit_status = do_test("$seer_location/seer -k example_kmers.gz -p subset.pheno", "test1", 1, "basic filters");
 $exit_status= $exit_status || do_test("$seer_location/seer -k example_kmers.gz -p subset.pheno --pval 1 --chisq 1", "test2", 2, "binary phenotype assocation");
 $exit_status = $exit_status || do_test("$seer_location/seer -k example_kmers.gz -p subset.pheno --pval 1 --chisq 1 --maf 0.1 --print_samples", "test3", 3, "print output");
@@ -45,6 +119,46 @@ $exit_status = $exit_status || do_test("$seer_location/seer -k example_kmers.gz
 $exit_status = $exit_status || do_test("$seer_location/seer -k example_kmers.gz -p subset.pheno --covar_file covariates.txt --covar_list 2q,3 --pval 1 --chisq 1", "test6", 6, "assocation with covariates");
 $exit_status = $exit_status || do_test("$seer_location/filter_seer -k filter_in.txt --pos_beta", "test7", 7, "filter output");
 $exit_status = $exit_status || do_test("$seer_location/map_back -k map_in.txt -r assembly_locations.txt --threads 1", "test8", 8, "map k-mers");
+$exit_status = $exit_status || do_test("$seer_location/filter_seer -k filter_in.txt --substr", "test9", 9, "remove substring k-mers");
+
+# combineKmers modes, each against the default union. Lines are sorted, as
+# the default prints k-mers in hash order
+my $counts = write_counts();
+my $combine = "$seer_location/combineKmers -r $counts/samples.txt";
+my $combine_default = "$combine -o $counts/default && zcat $counts/default.gz | sort";
+$exit_status = $exit_status || do_compare("$combine -o $counts/sorted --sorted && zcat $counts/sorted.gz | sort", $combine_default, 10, "combine sorted k-mer counts");
+$exit_status = $exit_status || do_compare("$combine -o $counts/spilled --max_memory 1 --partitions 2 --threads 2 && zcat $counts/spilled.gz | sort", $combine_default, 11, "combine k-mer counts over the memory budget");
+$exit_status = $exit_status || do_compare("$combine -o $counts/shard --shards --partitions 3 --threads 2 && zcat $counts/shard.*.gz | sort", $combine_default, 12, "combine k-mer counts into shards");
+$exit_status = $exit_status || do_compare("$combine -o $counts/bgzf --bgzf && zcat $counts/bgzf.gz | sort", $combine_default, 13, "combine k-mer counts as BGZF");
+
+# filter_seer sorting, against a stable sort of its unsorted output by
+# p-value. The external sort needs more than 1 MB, so is given filter_in.txt
+# many times over
+my $filter = "$seer_location/filter_seer";
+$exit_status = $exit_status || do_compare("$filter -k filter_in.txt --top 20", "$filter -k filter_in.txt | sort -s -g -k4,4 | head -n 20", 14, "top k-mers by p-value");
+my $filter_repeated = tmpnam();
+system("head -n 1 filter_in.txt > $filter_repeated && for i in \$(seq 150); do tail -n +2 filter_in.txt; done >> $filter_repeated");
+$exit_status = $exit_status || do_compare("$filter -k $filter_repeated --sort pval --max_memory 1", "$filter -k $filter_repeated | sort -s -g -k4,4", 15, "sort k-mers on disk");
+unlink($filter_repeated);
+
+# Two seer shards merged, against the unsharded run
+my $shard_1 = tmpnam();
+my $shard_2 = tmpnam();
+my $seer_shard = "$seer_location/seer -k example_kmers.gz -p subset.pheno --pval 1 --chisq 1";
+$exit_status = $exit_status || do_compare("$seer_shard --shard 1/2 -o $shard_1 && $seer_shard --shard 2/2 -o $shard_2 && $seer_location/merge_seer $shard_1 $shard_2",
+   $seer_shard, 16, "merge seer shards");
+unlink($shard_1, $shard_2);
+
+# map_back --batch, against the default search
+my $map = "$seer_location/map_back -k map_in.txt -r assembly_locations.txt --threads 1";
+$exit_status = $exit_status || do_compare("$map --batch", $map, 17, "map k-mers in one pass");
+
+# map_back --cache, building the cache then reading it, with each search
+my $map_cache = tmpnam();
+$exit_status = $exit_status || do_compare("$map --cache $map_cache", $map, 18, "map k-mers, building the cache");
+$exit_status = $exit_status || do_compare("$map --cache $map_cache", $map, 19, "map k-mers from the cache");
+$exit_status = $exit_status || do_compare("$map --cache $map_cache --batch", $map, 20, "map k-mers in one pass from the cache");
+unlink($map_cache);
 
 exit($exit_status);
 